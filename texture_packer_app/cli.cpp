@@ -3,8 +3,243 @@
 #include <cxxopts.hpp>
 #include <texture_packer/texture_packer.hpp>
 
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace TexturePackerApp
 {
+namespace
+{
+TexturePacker::CompositeMode parse_composite_mode(const std::string& value)
+{
+  if (value == "copy")
+  {
+    return TexturePacker::CompositeMode::Copy;
+  }
+  if (value == "blend")
+  {
+    return TexturePacker::CompositeMode::Blend;
+  }
+  throw std::invalid_argument("unknown composite_mode: " + value);
+}
+
+TexturePacker::ResampleFilter parse_scale_filter(const std::string& value)
+{
+  if (value == "box")
+  {
+    return TexturePacker::ResampleFilter::Box;
+  }
+  if (value == "bilinear")
+  {
+    return TexturePacker::ResampleFilter::Bilinear;
+  }
+  if (value == "mitchell")
+  {
+    return TexturePacker::ResampleFilter::Mitchell;
+  }
+  if (value == "lanczos")
+  {
+    return TexturePacker::ResampleFilter::Lanczos;
+  }
+  throw std::invalid_argument("unknown scale_filter: " + value);
+}
+
+TexturePacker::MipmapFilter parse_mipmap_filter(const std::string& value)
+{
+  if (value == "box")
+  {
+    return TexturePacker::MipmapFilter::Box;
+  }
+  if (value == "kaiser")
+  {
+    return TexturePacker::MipmapFilter::Kaiser;
+  }
+  throw std::invalid_argument("unknown mipmap_filter: " + value);
+}
+
+TexturePacker::TextureCompression parse_texture_compression(const std::string& value)
+{
+  if (value == "none")
+  {
+    return TexturePacker::TextureCompression::None;
+  }
+  if (value == "bc1")
+  {
+    return TexturePacker::TextureCompression::BC1;
+  }
+  if (value == "bc3")
+  {
+    return TexturePacker::TextureCompression::BC3;
+  }
+  if (value == "bc7")
+  {
+    return TexturePacker::TextureCompression::BC7;
+  }
+  if (value == "etc2_rgba")
+  {
+    return TexturePacker::TextureCompression::ETC2_RGBA;
+  }
+  if (value == "astc_4x4")
+  {
+    return TexturePacker::TextureCompression::ASTC_4x4;
+  }
+  if (value == "astc_5x4")
+  {
+    return TexturePacker::TextureCompression::ASTC_5x4;
+  }
+  if (value == "astc_5x5")
+  {
+    return TexturePacker::TextureCompression::ASTC_5x5;
+  }
+  if (value == "astc_6x5")
+  {
+    return TexturePacker::TextureCompression::ASTC_6x5;
+  }
+  if (value == "astc_6x6")
+  {
+    return TexturePacker::TextureCompression::ASTC_6x6;
+  }
+  if (value == "astc_8x5")
+  {
+    return TexturePacker::TextureCompression::ASTC_8x5;
+  }
+  if (value == "astc_8x6")
+  {
+    return TexturePacker::TextureCompression::ASTC_8x6;
+  }
+  if (value == "astc_8x8")
+  {
+    return TexturePacker::TextureCompression::ASTC_8x8;
+  }
+  throw std::invalid_argument("unknown texture_compression: " + value);
+}
+
+TexturePacker::CompressionQuality parse_compression_quality(const std::string& value)
+{
+  if (value == "fast")
+  {
+    return TexturePacker::CompressionQuality::Fast;
+  }
+  if (value == "normal")
+  {
+    return TexturePacker::CompressionQuality::Normal;
+  }
+  if (value == "thorough")
+  {
+    return TexturePacker::CompressionQuality::Thorough;
+  }
+  throw std::invalid_argument("unknown compression_quality: " + value);
+}
+
+TexturePacker::CPngOptions parse_png_preset(const std::string& value)
+{
+  if (value == "default")
+  {
+    return {};
+  }
+  if (value == "fastest")
+  {
+    return TexturePacker::CPngOptions::Fastest();
+  }
+  if (value == "smallest")
+  {
+    return TexturePacker::CPngOptions::Smallest();
+  }
+  throw std::invalid_argument("unknown png_preset: " + value);
+}
+
+TexturePacker::PngStrategy parse_png_strategy(const std::string& value)
+{
+  if (value == "default")
+  {
+    return TexturePacker::PngStrategy::Default;
+  }
+  if (value == "filtered")
+  {
+    return TexturePacker::PngStrategy::Filtered;
+  }
+  if (value == "huffman_only")
+  {
+    return TexturePacker::PngStrategy::HuffmanOnly;
+  }
+  if (value == "rle")
+  {
+    return TexturePacker::PngStrategy::Rle;
+  }
+  if (value == "best")
+  {
+    return TexturePacker::PngStrategy::Best;
+  }
+  throw std::invalid_argument("unknown png_strategy: " + value);
+}
+
+TexturePacker::PngFilter parse_png_filter(const std::string& value)
+{
+  if (value == "none")
+  {
+    return TexturePacker::PngFilter::None;
+  }
+  if (value == "sub")
+  {
+    return TexturePacker::PngFilter::Sub;
+  }
+  if (value == "up")
+  {
+    return TexturePacker::PngFilter::Up;
+  }
+  if (value == "average")
+  {
+    return TexturePacker::PngFilter::Average;
+  }
+  if (value == "paeth")
+  {
+    return TexturePacker::PngFilter::Paeth;
+  }
+  if (value == "adaptive")
+  {
+    return TexturePacker::PngFilter::Adaptive;
+  }
+  throw std::invalid_argument("unknown png_filter: " + value);
+}
+
+// "none", "auto" for the block size of texture_compression, or WxH.
+std::pair<int, int> parse_block_alignment(const std::string& value)
+{
+  if (value == "none")
+  {
+    return {1, 1};
+  }
+  if (value == "auto")
+  {
+    return {0, 0};
+  }
+  const auto separator = value.find('x');
+  if (separator == std::string::npos || separator == 0 || separator + 1 == value.size())
+  {
+    throw std::invalid_argument("block_alignment must be none, auto or WxH, got: " + value);
+  }
+  return {std::stoi(value.substr(0, separator)), std::stoi(value.substr(separator + 1))};
+}
+
+// "scale:pattern", e.g. "2:atlas@2x_%d"
+std::vector<TexturePacker::CScaleVariant> parse_variants(const std::vector<std::string>& values)
+{
+  std::vector<TexturePacker::CScaleVariant> variants;
+  for (const auto& value : values)
+  {
+    const auto separator = value.find(':');
+    if (separator == std::string::npos || separator + 1 == value.size())
+    {
+      throw std::invalid_argument("variant must be scale:pattern, got: " + value);
+    }
+    variants.push_back({std::stod(value.substr(0, separator)), value.substr(separator + 1)});
+  }
+  return variants;
+}
+} // namespace
+
 int run_cli(int argc, char** argv)
 {
   cxxopts::Options options("Texture Packer CLI", "A CLI interface to my texture packer");
@@ -14,7 +249,7 @@ int run_cli(int argc, char** argv)
         ("input_dir", "input dir", cxxopts::value<std::string>())
         ("output_dir", "output folder", cxxopts::value<std::string>()->default_value("./"))
         ("output_name", "output atlas name (with placeholder '%d')", cxxopts::value<std::string>())
-        ("image_format", "output image format {png, jpg}", cxxopts::value<std::string>()->default_value("png"))
+        ("image_format", "output image format {png, jpg, dds, pkm, astc, ktx2, qoi, rawz}", cxxopts::value<std::string>()->default_value("png"))
         ("max_width", "max atlas Width", cxxopts::value<int>()->default_value("4096"))
         ("max_height", "max atlas Height", cxxopts::value<int>()->default_value("4096"))
         ("force_square", "force square", cxxopts::value<bool>()->default_value("false"))
@@ -25,6 +260,34 @@ int run_cli(int argc, char** argv)
         ("trim_mode", "Trim pixel alpha less than input value", cxxopts::value<int>()->default_value("0"))
         ("extrude", "extrude", cxxopts::value<int>()->default_value("0"))
         ("scale", "scale", cxxopts::value<double>()->default_value("1.0"))
+        ("scale_filter", "resampling filter for scale {box, bilinear, mitchell, lanczos}", cxxopts::value<std::string>()->default_value("mitchell"))
+        ("deferred_decode", "read only image headers up front, decode sprites while composing each atlas", cxxopts::value<bool>()->default_value("false"))
+        ("threads", "worker threads, 0 uses all hardware threads", cxxopts::value<int>()->default_value("0"))
+        ("max_pages_in_flight", "atlas pages composed and encoded at once, 0 uses one per thread", cxxopts::value<int>()->default_value("0"))
+        ("composite_mode", "how sprites are written into the atlas {copy, blend}", cxxopts::value<std::string>()->default_value("copy"))
+        ("premultiply_alpha", "write color multiplied by alpha", cxxopts::value<bool>()->default_value("false"))
+        ("auto_pixel_format", "write each uncompressed png or ktx2 page in the smallest pixel format that holds it exactly", cxxopts::value<bool>()->default_value("false"))
+        ("reduce_pixel_depth", "let auto_pixel_format reduce pages to RGB565 and RGBA4444", cxxopts::value<bool>()->default_value("false"))
+        ("dither", "ordered dither pages reduced to RGB565 and RGBA4444", cxxopts::value<bool>()->default_value("false"))
+        ("palette_colors", "write png pages as palette images of at most this many colors (2..256), 0 keeps true color", cxxopts::value<int>()->default_value("0"))
+        ("palette_dither", "diffuse the error of palette quantization", cxxopts::value<bool>()->default_value("false"))
+        ("png_preset", "png deflate preset {default, fastest, smallest}, png_level, png_strategy and png_filter override its parts", cxxopts::value<std::string>()->default_value("default"))
+        ("png_level", "png deflate level (0..9)", cxxopts::value<int>())
+        ("png_strategy", "png deflate strategy {default, filtered, huffman_only, rle, best}", cxxopts::value<std::string>())
+        ("png_filter", "png row filter {none, sub, up, average, paeth, adaptive}", cxxopts::value<std::string>())
+        ("channel_pack", "pack gray and white-with-alpha sprites into the R, G, B and A planes of their own pages", cxxopts::value<bool>()->default_value("false"))
+        ("sprite_cache_dir", "folder of the processed sprite cache, empty disables the cache", cxxopts::value<std::string>()->default_value(""))
+        ("compress_sprite_cache", "zstd compress sprite cache entries when available", cxxopts::value<bool>()->default_value("false"))
+        ("variant", "output atlases at scale:pattern, repeatable; replaces scale and output_name", cxxopts::value<std::vector<std::string>>())
+        ("share_variant_layout", "place sprites at the same normalized position in every variant", cxxopts::value<bool>()->default_value("false"))
+        ("generate_mipmaps", "write the mip chain of every atlas page as <atlas>_mip<N> images, or inside ktx2 pages", cxxopts::value<bool>()->default_value("false"))
+        ("mipmap_levels", "mip levels below each page, 0 continues down to 1x1", cxxopts::value<int>()->default_value("0"))
+        ("mipmap_filter", "mip downsampling filter {box, kaiser}", cxxopts::value<std::string>()->default_value("box"))
+        ("align_to_mipmaps", "place sprites on multiples of 2^mipmap_levels", cxxopts::value<bool>()->default_value("false"))
+        ("texture_compression", "GPU block compression {none, bc1, bc3, bc7, etc2_rgba, astc_4x4, astc_5x4, astc_5x5, astc_6x5, astc_6x6, astc_8x5, astc_8x6, astc_8x8}", cxxopts::value<std::string>()->default_value("none"))
+        ("compression_quality", "block encoder effort {fast, normal, thorough}", cxxopts::value<std::string>()->default_value("normal"))
+        ("block_alignment", "place sprites on a block grid {none, auto, WxH}, auto follows texture_compression", cxxopts::value<std::string>()->default_value("none"))
+        ("ktx2_zstd_level", "zstd supercompression level of ktx2 pages (1..22), 0 disables it", cxxopts::value<int>()->default_value("0"))
         ;
   // clang-format on
   auto result = options.parse(argc, argv);
@@ -43,7 +306,51 @@ int run_cli(int argc, char** argv)
       .WithReduceBorderArtifacts(result["reduce_border_artifacts"].as<bool>())
       .WithTrimMode(result["trim_mode"].as<int>())
       .WithExtrude(result["extrude"].as<int>())
-      .WithScale(result["scale"].as<double>());
+      .WithScale(result["scale"].as<double>())
+      .WithScaleFilter(parse_scale_filter(result["scale_filter"].as<std::string>()))
+      .WithDeferredDecode(result["deferred_decode"].as<bool>())
+      .WithThreads(result["threads"].as<int>())
+      .WithMaxPagesInFlight(result["max_pages_in_flight"].as<int>())
+      .WithCompositeMode(parse_composite_mode(result["composite_mode"].as<std::string>()))
+      .WithPremultiplyAlpha(result["premultiply_alpha"].as<bool>())
+      .WithChannelPack(result["channel_pack"].as<bool>())
+      .WithAutoPixelFormat(result["auto_pixel_format"].as<bool>())
+      .WithReducePixelDepth(result["reduce_pixel_depth"].as<bool>(), result["dither"].as<bool>())
+      .WithPalette(result["palette_colors"].as<int>(), result["palette_dither"].as<bool>())
+      .WithSpriteCacheDir(result["sprite_cache_dir"].as<std::string>())
+      .WithCompressSpriteCache(result["compress_sprite_cache"].as<bool>())
+      .WithShareVariantLayout(result["share_variant_layout"].as<bool>())
+      .WithGenerateMipmaps(result["generate_mipmaps"].as<bool>())
+      .WithMipmapLevels(result["mipmap_levels"].as<int>())
+      .WithMipmapFilter(parse_mipmap_filter(result["mipmap_filter"].as<std::string>()))
+      .WithAlignToMipmaps(result["align_to_mipmaps"].as<bool>())
+      .WithTextureCompression(
+          parse_texture_compression(result["texture_compression"].as<std::string>()))
+      .WithCompressionQuality(
+          parse_compression_quality(result["compression_quality"].as<std::string>()))
+      .WithKtx2ZstdLevel(result["ktx2_zstd_level"].as<int>());
+  const auto [block_width, block_height] =
+      parse_block_alignment(result["block_alignment"].as<std::string>());
+  settings_builder.WithBlockAlignment(block_width, block_height);
+  auto png_options = parse_png_preset(result["png_preset"].as<std::string>());
+  if (result.count("png_level") > 0)
+  {
+    png_options.level = result["png_level"].as<int>();
+  }
+  if (result.count("png_strategy") > 0)
+  {
+    png_options.strategy = parse_png_strategy(result["png_strategy"].as<std::string>());
+  }
+  if (result.count("png_filter") > 0)
+  {
+    png_options.filter = parse_png_filter(result["png_filter"].as<std::string>());
+  }
+  settings_builder.WithPngOptions(png_options);
+  if (result.count("variant") > 0)
+  {
+    settings_builder.WithVariants(
+        parse_variants(result["variant"].as<std::vector<std::string>>()));
+  }
   TexturePacker::CTexturePacker packer;
   packer.Pack(settings_builder.Build());
 
@@ -33,14 +33,21 @@ public:
   [[nodiscard]]
   virtual int Channels() const = 0;
 
+  [[nodiscard]]
+  virtual int Pitch() const = 0;
+
+  [[nodiscard]]
+  virtual const Channel* Pixels() const = 0;
+
+  [[nodiscard]]
+  virtual Channel* Pixels() = 0;
+
   virtual void SaveAsJPEG(const std::string& path) const = 0;
 
   virtual void SaveAsPNG(const std::string& path) const = 0;
 
   virtual void Crop(int left, int top, int right, int bottom) = 0;
 
-  virtual void Scale(double scale) = 0;
-
   virtual void Composite(const CAbstractImage& src, int xOffset, int yOffset) = 0;
 
   [[nodiscard]]
@@ -3,6 +3,7 @@
 #include <texture_packer/image_rect.hpp>
 
 #include <tuple>
+#include <utility>
 #include <vector>
 
 namespace TexturePacker
@@ -33,7 +34,8 @@ public:
   CAtlas(int _max_width = DEFAULT_ATLAS_MAX_WIDTH, int _max_height = DEFAULT_ATLAS_MAX_HEIGHT,
          bool _force_square = false, bool _force_pot = false, int _border_padding = 0,
          int _shape_padding = 0, ExpandStrategy _expand_strategy = ExpandStrategy::ExpandShortSide,
-         RankStrategy _rank_strategy = RankStrategy::RankBAF);
+         RankStrategy _rank_strategy = RankStrategy::RankBAF, int _alignment_x = 1,
+         int _alignment_y = 1);
 
   [[nodiscard]]
   const std::vector<CImageRect>& GetPlacedImageRect() const;
@@ -66,12 +68,26 @@ public:
 
   void Shrink();
 
+  // Copy of a finished layout with every size and position multiplied by factor. The copy has
+  // no free rects left, nothing more can be placed into it.
+  [[nodiscard]]
+  CAtlas Scaled(int factor) const;
+
 private:
   [[nodiscard]]
   bool IsInMaxSize(int new_width, int new_height) const;
 
   void PruneFreeRects();
 
+  // Top left corner of an image placed into free_rect, after shape padding and alignment.
+  [[nodiscard]]
+  std::pair<int, int> GetPlacement(const CRect& free_rect) const;
+
+  // Area an image placed at x, y takes from free_rect: its size rounded up to the alignment
+  // grid, so the next image starts on a grid line instead of sharing a cell with it.
+  [[nodiscard]]
+  CRect GetFootprint(const CRect& free_rect, int x, int y, const CRect& image_rect) const;
+
 private:
   int                     m_width;
   int                     m_height;
@@ -79,6 +95,8 @@ private:
   int                     m_max_height;
   int                     m_border_padding;
   int                     m_shape_padding;
+  int                     m_alignment_x;
+  int                     m_alignment_y;
   bool                    m_force_square;
   bool                    m_force_pot;
   ExpandStrategy          m_expand_strategy;
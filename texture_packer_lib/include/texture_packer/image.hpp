@@ -2,6 +2,7 @@
 
 #include <texture_packer/abstract_image.hpp>
 #include <texture_packer/rect.hpp>
+#include <texture_packer/resample_filter.hpp>
 
 #include <memory>
 
@@ -11,9 +12,10 @@ namespace TexturePacker
 class CImage
 {
 public:
+  // Decoded in the native layout of the file: gray (1 channel), RGB24 (3) or RGBA32 (4).
   CImage(const std::string& path);
 
-  CImage(int w, int h);
+  CImage(int w, int h, int channels = 4);
 
   CImage(const CImage& other);
 
@@ -34,13 +36,29 @@ public:
   [[nodiscard]]
   int Channels() const;
 
+  // Only RGBA32 images have alpha; gray and RGB24 images are opaque.
+  [[nodiscard]]
+  bool HasAlpha() const;
+
+  // Row stride of Pixels() in bytes.
+  [[nodiscard]]
+  int Pitch() const;
+
+  [[nodiscard]]
+  const Channel* Pixels() const;
+
+  // Unshares the pixel buffer before handing out write access.
+  [[nodiscard]]
+  Channel* MutablePixels();
+
   void SaveAsJPEG(const std::string& path) const;
 
   void SaveAsPNG(const std::string& path) const;
 
   void Crop(int left, int top, int right, int bottom);
 
-  void Scale(double scale);
+  // Resamples to round(size * scale), at least 1x1. Rows are filtered on `threads` workers.
+  void Scale(double scale, ResampleFilter filter = ResampleFilter::Mitchell, int threads = 1);
 
   void Composite(const CImage& src, int xOffset, int yOffset);
 
@@ -56,6 +74,11 @@ public:
 
   void CleanPixelAlphaBelow(const Channel alpha);
 
+  // Whether one channel carries all of the image: it is gray and opaque, or white wherever it is
+  // not fully transparent (glyphs, masks). That channel is red premultiplied by alpha.
+  [[nodiscard]]
+  bool IsSingleChannel() const;
+
   [[nodiscard]]
   bool IsBorderPixel(int x, int y) const;
 
@@ -65,6 +88,10 @@ public:
   SDL_Texture* GetTexture(SDL_Renderer* renderer);
 
 private:
-  std::unique_ptr<CAbstractImage> m_impl;
+  // Copies share the pixel buffer; it is cloned on the first mutation of a shared image.
+  void Detach();
+
+private:
+  std::shared_ptr<CAbstractImage> m_impl;
 };
 } // namespace TexturePacker
@@ -3,6 +3,7 @@
 #include <texture_packer/image.hpp>
 #include <texture_packer/image_rect.hpp>
 
+#include <optional>
 #include <string>
 
 namespace TexturePacker
@@ -12,11 +13,17 @@ class CImageInfo
 public:
   CImageInfo(CImage _image, std::string _image_path);
 
-  CImageInfo(const CImageInfo& image_info);
+  // Deferred image info: only the size is known up front, pixels are decoded from
+  // _image_path by GetImage(). Scale, Trim and Extrude are recorded and replayed on decode.
+  CImageInfo(std::string _image_path, Size _image_size);
+
+  // Image info of an already scaled, trimmed and extruded image, e.g. restored from a cache.
+  CImageInfo(CImage _image, std::string _image_path, CRect _source_rect, CRect _source_bbox,
+             Size _source_size, bool _trimmed, int _extruded);
 
   void Trim(unsigned char alpha_threshold);
 
-  void Scale(double scale);
+  void Scale(double scale, ResampleFilter filter = ResampleFilter::Mitchell);
 
   [[nodiscard]]
   bool IsTrimmed() const;
@@ -30,10 +37,15 @@ public:
   CImageRect GetImageRect() const;
 
   [[nodiscard]]
-  const CImage& GetImage() const;
+  bool IsDeferred() const;
+
+  // Decodes a deferred info with its recorded steps and keeps the pixels resident.
+  void Decode();
 
+  // Returns the processed image. A deferred info decodes it on every call, so the caller
+  // owns the only copy of the pixels and releases them when the result goes out of scope.
   [[nodiscard]]
-  std::uint32_t GetExKey() const;
+  CImage GetImage() const;
 
   [[nodiscard]]
   CRect GetSourceRect() const;
@@ -48,14 +60,21 @@ public:
   Size GetSourceSize() const;
 
 private:
-  CImage        m_image;
-  std::string   m_image_path;
-  CRect         m_source_rect;
-  CRect         m_source_bbox;
-  Size          m_source_size{};
-  bool          m_trimmed{false};
-  int           m_extruded{0};
-  std::uint32_t m_ex_key{0};
+  [[nodiscard]]
+  CImage DecodeScaledImage() const;
+
+private:
+  std::optional<CImage> m_image;
+  std::string           m_image_path;
+  Size                  m_image_size{};
+  CRect                 m_source_rect;
+  CRect                 m_source_bbox;
+  Size                  m_source_size{};
+  double                m_scale{1.0};
+  ResampleFilter        m_scale_filter{ResampleFilter::Mitchell};
+  unsigned char         m_trim_alpha_threshold{0};
+  bool                  m_trimmed{false};
+  int                   m_extruded{0};
 };
 
 }; // namespace TexturePacker
@@ -11,6 +11,7 @@ struct CImageRect : public CRect
   {
   }
 
+  // Pack-local index of the sprite in the image info vector the rect was built from.
   unsigned int m_ex_key{0};
 };
 
@@ -1,27 +1,167 @@
 #pragma once
 
+#include <texture_packer/resample_filter.hpp>
+
 #include <string>
+#include <vector>
 
 namespace TexturePacker
 {
+// How sprites are written into their atlas slots. Slots are disjoint and the page starts out
+// transparent, so Copy stores the sprite pixels unchanged. Blend alpha-blends them like an SDL
+// blit, which premultiplies semi-transparent colors.
+enum class CompositeMode
+{
+  Copy,
+  Blend,
+};
+
+// Downsampling filter of the mip chain. Kaiser is a windowed sinc, sharper than Box at the cost
+// of six taps per axis instead of two.
+enum class MipmapFilter
+{
+  Box,
+  Kaiser,
+};
+
+// GPU block compression of the written pages. Anything but None needs a container that can hold
+// the blocks: "dds" for the BC formats, "pkm" for ETC2, "astc" for ASTC, or "ktx2" for any.
+enum class TextureCompression
+{
+  None,
+  BC1,
+  BC3,
+  BC7,
+  ETC2_RGBA,
+  ASTC_4x4,
+  ASTC_5x4,
+  ASTC_5x5,
+  ASTC_6x5,
+  ASTC_6x6,
+  ASTC_8x5,
+  ASTC_8x6,
+  ASTC_8x8,
+};
+
+// Texel layout of an uncompressed page. L8 and LA8 hold gray in their first channel, A8 holds
+// alpha only with white color. RGBA4444 and RGB565 keep 4 and 5/6/5 bits of each channel.
+enum class PixelFormat
+{
+  RGBA8,
+  RGB8,
+  LA8,
+  L8,
+  A8,
+  RGBA4444,
+  RGB565,
+};
+
+// Effort of the block encoders: Fast for iteration builds, Thorough for release builds.
+enum class CompressionQuality
+{
+  Fast,
+  Normal,
+  Thorough,
+};
+
+// Row filter of png pages. Adaptive picks for each row the filter whose output has the smallest
+// sum of absolute values, like libpng does by default.
+enum class PngFilter
+{
+  None,
+  Sub,
+  Up,
+  Average,
+  Paeth,
+  Adaptive,
+};
+
+// zlib strategy png pages are deflated with. Rle only looks for runs, which is fast and often
+// smaller on filtered artwork but much larger on repeating patterns; HuffmanOnly does not look
+// for matches at all. Best deflates every part of a page with Default, Filtered and Rle and keeps
+// the smallest output, at the cost of all three.
+enum class PngStrategy
+{
+  Default,
+  Filtered,
+  HuffmanOnly,
+  Rle,
+  Best,
+};
+
+// Deflate level (0..9), strategy and row filter of png pages. The defaults are zlib's and
+// libpng's; Fastest suits iteration and CI builds, Smallest release builds.
+struct CPngOptions
+{
+  int         level{6};
+  PngStrategy strategy{PngStrategy::Default};
+  PngFilter   filter{PngFilter::Adaptive};
+
+  static CPngOptions Fastest()
+  {
+    return {1, PngStrategy::Default, PngFilter::Up};
+  }
+
+  static CPngOptions Smallest()
+  {
+    return {9, PngStrategy::Best, PngFilter::Adaptive};
+  }
+};
+
+// One resolution of a multi-resolution pack, written with its own atlas name pattern.
+struct CScaleVariant
+{
+  double      scale{1.0};
+  std::string atlases_pattern_name;
+};
+
 struct CPackSettings
 {
   constexpr static int kDefaultAtlasSize{4096};
 
-  bool        reduce_border_artifacts{false};
-  bool        force_square{false};
-  bool        force_pot{false};
-  int         trim_mode{0};
-  int         extrude{0};
-  int         max_width{kDefaultAtlasSize};
-  int         max_height{kDefaultAtlasSize};
-  int         border_padding{0};
-  int         shape_padding{2};
-  double      scale{1.0};
-  std::string images_input_dir;
-  std::string atlases_output_dir;
-  std::string atlases_pattern_name{"atlas_%02d"};
-  std::string atlases_output_format{"png"};
+  bool               reduce_border_artifacts{false};
+  bool               force_square{false};
+  bool               force_pot{false};
+  bool               deferred_decode{false};
+  bool               compress_sprite_cache{false};
+  bool               share_variant_layout{false};
+  bool               generate_mipmaps{false};
+  bool               align_to_mipmaps{false};
+  bool               premultiply_alpha{false};
+  bool               channel_pack{false};
+  bool               auto_pixel_format{false};
+  bool               reduce_pixel_depth{false};
+  bool               dither{false};
+  bool               palette_dither{false};
+  int                trim_mode{0};
+  int                extrude{0};
+  int                max_width{kDefaultAtlasSize};
+  int                max_height{kDefaultAtlasSize};
+  int                border_padding{0};
+  int                shape_padding{2};
+  double             scale{1.0};
+  ResampleFilter     scale_filter{ResampleFilter::Mitchell};
+  int                threads{0};
+  int                max_pages_in_flight{0};
+  CompositeMode      composite_mode{CompositeMode::Copy};
+  int                mipmap_levels{0};
+  int                block_alignment_width{1};
+  int                block_alignment_height{1};
+  MipmapFilter       mipmap_filter{MipmapFilter::Box};
+  TextureCompression texture_compression{TextureCompression::None};
+  CompressionQuality compression_quality{CompressionQuality::Normal};
+  int                ktx2_zstd_level{0};
+  int                palette_colors{0};
+  CPngOptions        png_options;
+  std::string        images_input_dir;
+  std::string        atlases_output_dir;
+  std::string        atlases_pattern_name{"atlas_%02d"};
+  std::string        atlases_output_format{"png"};
+  std::string        sprite_cache_dir;
+
+  // When not empty, replaces scale and atlases_pattern_name: every source is decoded once and
+  // packed at each of these scales.
+  std::vector<CScaleVariant> variants;
 };
 
 class CPackSettingsBuilder
@@ -45,6 +185,27 @@ public:
     return *this;
   }
 
+  CPackSettingsBuilder& WithDeferredDecode(bool deferred_decode)
+  {
+    m_settings.deferred_decode = deferred_decode;
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithCompressSpriteCache(bool compress_sprite_cache)
+  {
+    m_settings.compress_sprite_cache = compress_sprite_cache;
+    return *this;
+  }
+
+  // Lays out the smallest variant once and multiplies the layout, extrusion included, for the
+  // others, so sprites have the same relative UVs in every variant. Every variant scale needs to
+  // be an integer multiple of the smallest one.
+  CPackSettingsBuilder& WithShareVariantLayout(bool share_variant_layout)
+  {
+    m_settings.share_variant_layout = share_variant_layout;
+    return *this;
+  }
+
   CPackSettingsBuilder& WithTrimMode(int trim_mode)
   {
     m_settings.trim_mode = trim_mode;
@@ -87,6 +248,137 @@ public:
     return *this;
   }
 
+  CPackSettingsBuilder& WithScaleFilter(ResampleFilter scale_filter)
+  {
+    m_settings.scale_filter = scale_filter;
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithThreads(int threads)
+  {
+    m_settings.threads = threads;
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithMaxPagesInFlight(int max_pages_in_flight)
+  {
+    m_settings.max_pages_in_flight = max_pages_in_flight;
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithCompositeMode(CompositeMode composite_mode)
+  {
+    m_settings.composite_mode = composite_mode;
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithTextureCompression(TextureCompression texture_compression)
+  {
+    m_settings.texture_compression = texture_compression;
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithCompressionQuality(CompressionQuality compression_quality)
+  {
+    m_settings.compression_quality = compression_quality;
+    return *this;
+  }
+
+  // zstd level (1..22) that supercompresses "ktx2" pages, 0 stores them as is.
+  CPackSettingsBuilder& WithKtx2ZstdLevel(int ktx2_zstd_level)
+  {
+    m_settings.ktx2_zstd_level = ktx2_zstd_level;
+    return *this;
+  }
+
+  // Writes color multiplied by alpha; border artifact reduction is skipped, it has no effect then.
+  CPackSettingsBuilder& WithPremultiplyAlpha(bool premultiply_alpha)
+  {
+    m_settings.premultiply_alpha = premultiply_alpha;
+    return *this;
+  }
+
+  // Packs single channel sprites (gray and opaque, or white with alpha) into the R, G, B and A
+  // planes of their own pages, four to a texel. Not available together with variants.
+  CPackSettingsBuilder& WithChannelPack(bool channel_pack)
+  {
+    m_settings.channel_pack = channel_pack;
+    return *this;
+  }
+
+  // Writes each uncompressed png or ktx2 page in the smallest pixel format that still holds its
+  // sprites exactly, and moves opaque and transparent sprites to separate pages when that takes
+  // less memory. The format is recorded in the page metadata.
+  CPackSettingsBuilder& WithAutoPixelFormat(bool auto_pixel_format)
+  {
+    m_settings.auto_pixel_format = auto_pixel_format;
+    return *this;
+  }
+
+  // Lets auto_pixel_format quantize pages to RGB565 and RGBA4444, ordered dithered when dither
+  // is set.
+  CPackSettingsBuilder& WithReducePixelDepth(bool reduce_pixel_depth, bool dither = false)
+  {
+    m_settings.reduce_pixel_depth = reduce_pixel_depth;
+    m_settings.dither = dither;
+    return *this;
+  }
+
+  // Writes png pages as 8 bit palette images of at most `colors` (2..256) colors, 0 keeps them
+  // true color. Pages with that few distinct colors keep them exactly, others are quantized,
+  // with error diffusion when dither is set.
+  CPackSettingsBuilder& WithPalette(int colors, bool dither = false)
+  {
+    m_settings.palette_colors = colors;
+    m_settings.palette_dither = dither;
+    return *this;
+  }
+
+  // Deflate level, strategy and row filter of png pages, palette ones included; those keep their
+  // rows unfiltered under PngFilter::Adaptive.
+  CPackSettingsBuilder& WithPngOptions(CPngOptions png_options)
+  {
+    m_settings.png_options = png_options;
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithGenerateMipmaps(bool generate_mipmaps)
+  {
+    m_settings.generate_mipmaps = generate_mipmaps;
+    return *this;
+  }
+
+  // Levels below the page, 0 continues down to 1x1.
+  CPackSettingsBuilder& WithMipmapLevels(int mipmap_levels)
+  {
+    m_settings.mipmap_levels = mipmap_levels;
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithMipmapFilter(MipmapFilter mipmap_filter)
+  {
+    m_settings.mipmap_filter = mipmap_filter;
+    return *this;
+  }
+
+  // Places sprites on multiples of 2^mipmap_levels, so no two sprites share a texel of any
+  // generated level.
+  CPackSettingsBuilder& WithAlignToMipmaps(bool align_to_mipmaps)
+  {
+    m_settings.align_to_mipmaps = align_to_mipmaps;
+    return *this;
+  }
+
+  // Places sprites on a width x height grid and keeps the cells they end in to themselves, so no
+  // compressed block holds texels of two sprites. 0 x 0 takes the block size of
+  // texture_compression.
+  CPackSettingsBuilder& WithBlockAlignment(int width, int height)
+  {
+    m_settings.block_alignment_width = width;
+    m_settings.block_alignment_height = height;
+    return *this;
+  }
+
   CPackSettingsBuilder& WithImagesInputDir(std::string images_input_dir)
   {
     m_settings.images_input_dir = std::move(images_input_dir);
@@ -111,6 +403,18 @@ public:
     return *this;
   }
 
+  CPackSettingsBuilder& WithSpriteCacheDir(std::string sprite_cache_dir)
+  {
+    m_settings.sprite_cache_dir = std::move(sprite_cache_dir);
+    return *this;
+  }
+
+  CPackSettingsBuilder& WithVariants(std::vector<CScaleVariant> variants)
+  {
+    m_settings.variants = std::move(variants);
+    return *this;
+  }
+
   CPackSettings Build()
   {
     return m_settings;
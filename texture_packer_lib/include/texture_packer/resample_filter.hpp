@@ -0,0 +1,13 @@
+#pragma once
+
+namespace TexturePacker
+{
+// Reconstruction filters for CImage::Scale, from fastest and softest to slowest and sharpest.
+enum class ResampleFilter
+{
+  Box,
+  Bilinear,
+  Mitchell,
+  Lanczos,
+};
+} // namespace TexturePacker
@@ -11,20 +11,46 @@ namespace TexturePacker
 class CTexturePacker
 {
 public:
-  void Pack(const std::vector<CImageInfo>& image_infos, const CPackSettings& settings);
+  // Pack keeps all of its state local to the call, so concurrent packs are safe.
+  void Pack(const std::vector<CImageInfo>& image_infos, const CPackSettings& settings) const;
 
   /*
   void Pack(const std::vector<std::string>& image_paths, const std::string& output_dir,
             const std::string& output_name, const std::string& image_format = "png");
   */
 
-  void Pack(const CPackSettings& settings);
+  void Pack(const CPackSettings& settings) const;
 
 private:
-  void AddImageRect(CImageRect image_rect, const CPackSettings& settings);
-
-  void AddImageRects(std::vector<CImageRect> image_rects, const CPackSettings& settings);
-
-  std::vector<CAtlas> m_atlases;
+  // Lays out already scaled, trimmed and extruded sprites and writes the atlases.
+  static void PackPreparedImageInfos(const std::vector<CImageInfo>& image_infos,
+                                     const CPackSettings&           settings);
+
+  // Lays out color sprites. With auto_pixel_format, opaque and translucent sprites go to pages of
+  // their own when those take less memory in the pixel formats they select.
+  [[nodiscard]]
+  static std::vector<CAtlas> LayoutColorImageInfos(const std::vector<CImageInfo>&  image_infos,
+                                                   const std::vector<std::size_t>& indices,
+                                                   const CPackSettings&            settings);
+
+  // Decodes every source once and packs it at each of settings.variants.
+  static void PackVariants(const std::vector<CImageInfo>& image_infos,
+                           const CPackSettings&           settings);
+
+  [[nodiscard]]
+  static std::vector<CAtlas> LayoutImageInfos(const std::vector<CImageInfo>& image_infos,
+                                              const CPackSettings&           settings);
+
+  // Lays out only the image infos at indices; rect keys still index all of image_infos.
+  [[nodiscard]]
+  static std::vector<CAtlas> LayoutImageInfos(const std::vector<CImageInfo>& image_infos,
+                                              const std::vector<std::size_t>& indices,
+                                              const CPackSettings&            settings);
+
+  static void AddImageRect(std::vector<CAtlas>& atlases, CImageRect image_rect,
+                           const CPackSettings& settings);
+
+  static void AddImageRects(std::vector<CAtlas>& atlases, std::vector<CImageRect> image_rects,
+                            const CPackSettings& settings);
 };
 } // namespace TexturePacker
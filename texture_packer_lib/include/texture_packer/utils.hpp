@@ -3,33 +3,121 @@
 #include <texture_packer/atlas.hpp>
 #include <texture_packer/image.hpp>
 #include <texture_packer/image_info.hpp>
+#include <texture_packer/pack_settings.hpp>
 
+#include <optional>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace TexturePacker
 {
 
-using ImageInfoMap = std::unordered_map<unsigned int, CImageInfo>;
-
 CImage read_image_from_file(const std::string& file_path);
 
-void save_image_to_file(const std::string& file_path, const CImage& image);
+// Same as read_image_from_file followed by CImage::Scale, but a downscale shrinks PNG and JPEG
+// files while decoding, so the full size pixels are never held in memory.
+CImage read_image_from_file(const std::string& file_path, double scale, ResampleFilter filter);
+
+// PNG output is deflated in parallel chunks on `threads` workers (0 = hardware concurrency).
+// A .dds file holds the image BC compressed, or RGBA8 when compression is None; .pkm and .astc
+// files hold it ETC2 and ASTC compressed, and .ktx2 files any compression. A compression the
+// file format can not hold throws a std::runtime_error. The ETC2 and ASTC encoders only fit the
+// pixels inside `regions`, when there are any. Uncompressed .png and .ktx2 files store the
+// channels of pixel_format; RGBA4444 and RGB565 expect pixels already reduced to their depth.
+// .png files are deflated as png_options say. .qoi files and .rawz files, raw rows in a zstd
+// level 1 frame, are quick to write for iteration builds and are read back by
+// read_image_from_file.
+void save_image_to_file(const std::string& file_path, const CImage& image, int threads = 1,
+                        TextureCompression compression = TextureCompression::None,
+                        CompressionQuality quality = CompressionQuality::Normal,
+                        const std::vector<CRect>& regions = {},
+                        PixelFormat               pixel_format = PixelFormat::RGBA8,
+                        const CPngOptions&        png_options = {});
+
+// Writes the image and its mip levels, each half the size of the previous one, into one KTX2
+// file, encoded as in save_image_to_file; `regions` are halved along with the levels. A
+// zstd_level above 0 zstd supercompresses each level, `premultiplied` is recorded in the data
+// format descriptor.
+void save_ktx2_to_file(const std::string& file_path, const CImage& image,
+                       const std::vector<CImage>& mipmaps, int threads = 1,
+                       TextureCompression compression = TextureCompression::None,
+                       CompressionQuality quality = CompressionQuality::Normal, int zstd_level = 0,
+                       bool premultiplied = false, std::vector<CRect> regions = {},
+                       PixelFormat pixel_format = PixelFormat::RGBA8);
+
+// Writes an RGBA32 image as an 8 bit palette PNG of at most max_colors (2..256) colors. Images
+// with that few distinct colors keep them exactly, others are quantized, with error diffusion
+// when `dither` is set.
+void save_palette_png_to_file(const std::string& file_path, const CImage& image, int max_colors,
+                              bool dither = false, int threads = 1,
+                              const CPngOptions& png_options = {});
 
 CImageInfo read_image_info_from_file(const std::string& file_path);
 
-std::vector<CImageInfo> load_image_infos_from_paths(const std::vector<std::string>& file_paths);
+// Deferred info of the file, see probe_image_infos_from_paths.
+CImageInfo probe_image_info_from_file(const std::string& file_path);
+
+struct CLoadError
+{
+  std::string file_path;
+  std::string message;
+};
+
+// Decodes the files on `threads` workers (0 = hardware concurrency). The result keeps the
+// order of file_paths; files that fail to load are skipped and reported in errors.
+std::vector<CImageInfo> load_image_infos_from_paths(const std::vector<std::string>& file_paths,
+                                                    int threads, std::vector<CLoadError>& errors);
+
+// Same as above, but throws a std::runtime_error listing every file that failed to load.
+std::vector<CImageInfo> load_image_infos_from_paths(const std::vector<std::string>& file_paths,
+                                                    int                             threads = 0);
 
-std::vector<CImageInfo> load_image_infos_from_dir(const std::string& dir_path);
+// Reads only the image headers, the returned infos are deferred and decode their pixels in
+// CImageInfo::GetImage(). Formats without a known header layout are decoded once for the size.
+std::vector<CImageInfo> probe_image_infos_from_paths(const std::vector<std::string>& file_paths,
+                                                     int                             threads,
+                                                     std::vector<CLoadError>&        errors);
 
+std::vector<CImageInfo> probe_image_infos_from_paths(const std::vector<std::string>& file_paths,
+                                                     int                             threads = 0);
+
+// Image dimensions from the PNG IHDR, JPEG SOF, WebP or BMP header, without decoding pixels.
+std::optional<Size> read_image_size_from_file(const std::string& file_path);
+
+std::vector<std::string> list_image_files_in_dir(const std::string& dir_path);
+
+std::vector<CImageInfo> load_image_infos_from_dir(const std::string& dir_path, int threads = 0);
+
+// A pixel_format is recorded in the metadata as "pixelFormat", by name ("RGBA8", "L8", ...).
 void dump_atlas_to_json(const std::string& file_path, const CAtlas& atlas,
-                        ImageInfoMap& image_info_map, const std::string& texture_file_name);
+                        const std::vector<CImageInfo>& image_infos,
+                        const std::string&             texture_file_name,
+                        bool                           premultiply_alpha = false,
+                        std::optional<PixelFormat>     pixel_format = std::nullopt);
 
-void draw_image_in_image(CImage& main_image, const CImage& sub_image, int start_x, int start_y);
+// Size of a page that stacks single channel layouts, channel_atlases[c] being the one stored
+// in channel c (R, G, B, A) or null when the channel is unused.
+Size get_channel_page_size(const std::vector<const CAtlas*>& channel_atlases);
+
+// Same as dump_atlas_to_json for a channel page; every frame records its "channel" index.
+void dump_channel_atlases_to_json(const std::string&                 file_path,
+                                  const std::vector<const CAtlas*>& channel_atlases,
+                                  const std::vector<CImageInfo>&     image_infos,
+                                  const std::string&                 texture_file_name);
 
-CImage dump_atlas_to_image(const CAtlas& atlas, const ImageInfoMap& image_info_map);
+// Composes a channel page: each channel holds the single channel sprites (see
+// CImage::IsSingleChannel) of its layout, unused channels and page area stay 0.
+CImage dump_channel_atlases_to_image(const std::vector<const CAtlas*>& channel_atlases,
+                                     const std::vector<CImageInfo>&     image_infos,
+                                     int                                threads = 1);
+
+void draw_image_in_image(CImage& main_image, const CImage& sub_image, int start_x, int start_y);
 
-ImageInfoMap make_image_info_map(const std::vector<CImageInfo>& image_infos);
+// Composes the page in horizontal bands on `threads` workers (0 = hardware concurrency). Sprites
+// are fetched one per worker at a time, so deferred infos hold at most that many decoded. With
+// `premultiply_alpha` sprites are premultiplied as they are copied in.
+CImage dump_atlas_to_image(const CAtlas& atlas, const std::vector<CImageInfo>& image_infos,
+                           int threads = 1, CompositeMode composite_mode = CompositeMode::Copy,
+                           bool premultiply_alpha = false);
 
 } // namespace TexturePacker
@@ -0,0 +1,1450 @@
+#include "astc_encoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr int   kMaxTexels = 64;
+constexpr float kInfinity = std::numeric_limits<float>::max();
+
+// Ranges of the integer sequence encoding, by increasing number of levels: (3 or 5) << bits
+// levels for trits and quints, 1 << bits otherwise.
+struct IseRange
+{
+  int trits;
+  int quints;
+  int bits;
+};
+
+constexpr IseRange kRanges[] = {
+    {0, 0, 1}, {1, 0, 0}, {0, 0, 2}, {0, 1, 0}, {1, 0, 1}, {0, 0, 3}, {0, 1, 1},
+    {1, 0, 2}, {0, 0, 4}, {0, 1, 2}, {1, 0, 3}, {0, 0, 5}, {0, 1, 3}, {1, 0, 4},
+    {0, 0, 6}, {0, 1, 4}, {1, 0, 5}, {0, 0, 7}, {0, 1, 5}, {1, 0, 6}, {0, 0, 8},
+};
+constexpr int kRangeCount = static_cast<int>(std::size(kRanges));
+// Weights use the first 12 ranges, endpoints anything from 6 levels up.
+constexpr int kWeightRangeCount = 12;
+constexpr int kMinColorRange = 4;
+
+// LDR color endpoint modes with direct RGB and RGBA endpoints.
+constexpr int kEndpointModeRgb = 8;
+constexpr int kEndpointModeRgba = 12;
+
+// Expected error, relative to the squared endpoint distance, of every texel a weight grid
+// smaller than the block leaves without a weight of its own.
+constexpr float kGridPenalty = 0.05f;
+
+// Squared error per visible texel above which a block tries two partitions.
+constexpr float kPartitionThreshold = 16.0f;
+
+struct SearchEffort
+{
+  int modes;
+  int passes;
+  int partitionings;
+  int partition_modes;
+};
+
+// How many of the best ranked block modes are tried, how often weights and endpoints are
+// refined against each other for each, and how many two partition splits, with how many modes,
+// blocks that one partition fits poorly try.
+SearchEffort GetSearchEffort(CompressionQuality quality)
+{
+  switch (quality)
+  {
+  case CompressionQuality::Fast:
+    return {2, 1, 0, 0};
+  case CompressionQuality::Normal:
+    return {6, 2, 2, 3};
+  case CompressionQuality::Thorough:
+    return {16, 3, 8, 6};
+  }
+  return {2, 1, 0, 0};
+}
+
+int RangeLevels(int range)
+{
+  const auto& r = kRanges[range];
+  return (r.trits != 0 ? 3 : r.quints != 0 ? 5 : 1) << r.bits;
+}
+
+int IseBitCount(int range, int count)
+{
+  const auto& r = kRanges[range];
+  return count * r.bits + (r.trits != 0 ? (8 * count + 4) / 5 : 0) +
+         (r.quints != 0 ? (7 * count + 2) / 3 : 0);
+}
+
+std::array<int, 5> DecodeTrits(int code)
+{
+  int c;
+  int t3;
+  int t4;
+  if ((code >> 2 & 7) == 7)
+  {
+    c = (code >> 5 & 7) << 2 | (code & 3);
+    t4 = 2;
+    t3 = 2;
+  }
+  else
+  {
+    c = code & 0x1F;
+    if ((code >> 5 & 3) == 3)
+    {
+      t4 = 2;
+      t3 = code >> 7 & 1;
+    }
+    else
+    {
+      t4 = code >> 7 & 1;
+      t3 = code >> 5 & 3;
+    }
+  }
+
+  int t0;
+  int t1;
+  int t2;
+  if ((c & 3) == 3)
+  {
+    t2 = 2;
+    t1 = c >> 4 & 1;
+    t0 = (c >> 3 & 1) << 1 | (c >> 2 & 1 & ~(c >> 3) & 1);
+  }
+  else if ((c >> 2 & 3) == 3)
+  {
+    t2 = 2;
+    t1 = 2;
+    t0 = c & 3;
+  }
+  else
+  {
+    t2 = c >> 4 & 1;
+    t1 = c >> 2 & 3;
+    t0 = (c >> 1 & 1) << 1 | (c & 1 & ~(c >> 1) & 1);
+  }
+  return {t0, t1, t2, t3, t4};
+}
+
+std::array<int, 3> DecodeQuints(int code)
+{
+  if ((code >> 1 & 3) == 3 && (code >> 5 & 3) == 0)
+  {
+    const int q2 = (code & 1) << 2 | (code >> 4 & 1 & ~code & 1) << 1 | (code >> 3 & 1 & ~code & 1);
+    return {4, 4, q2};
+  }
+
+  int c;
+  int q2;
+  if ((code >> 1 & 3) == 3)
+  {
+    q2 = 4;
+    c = (code >> 3 & 3) << 3 | (~(code >> 5) & 3) << 1 | (code & 1);
+  }
+  else
+  {
+    q2 = code >> 5 & 3;
+    c = code & 0x1F;
+  }
+  if ((c & 7) == 5)
+  {
+    return {c >> 3 & 3, 4, q2};
+  }
+  return {c & 7, c >> 3 & 3, q2};
+}
+
+int ReplicateBits(int value, int bits, int target_bits)
+{
+  int result = 0;
+  int filled = 0;
+  while (filled < target_bits)
+  {
+    result = result << bits | value;
+    filled += bits;
+  }
+  return result >> (filled - target_bits);
+}
+
+// Endpoint value 0..255 of an encoded symbol.
+int UnquantizeColor(int range, int symbol)
+{
+  const auto& r = kRanges[range];
+  if (r.trits == 0 && r.quints == 0)
+  {
+    return ReplicateBits(symbol, r.bits, 8);
+  }
+
+  const int low = symbol & ((1 << r.bits) - 1);
+  const int digit = symbol >> r.bits;
+  const int a = (low & 1) != 0 ? 0x1FF : 0;
+  const int b = low >> 1 & 1;
+  const int c = low >> 2 & 1;
+  const int d = low >> 3 & 1;
+  const int e = low >> 4 & 1;
+  const int f = low >> 5 & 1;
+
+  int offset = 0;
+  int scale = 0;
+  if (r.trits != 0)
+  {
+    switch (r.bits)
+    {
+    case 1:
+      scale = 204;
+      break;
+    case 2:
+      offset = b << 8 | b << 4 | b << 2 | b << 1;
+      scale = 93;
+      break;
+    case 3:
+      offset = c << 8 | b << 7 | c << 3 | b << 2 | c << 1 | b;
+      scale = 44;
+      break;
+    case 4:
+      offset = d << 8 | c << 7 | b << 6 | d << 2 | c << 1 | b;
+      scale = 22;
+      break;
+    case 5:
+      offset = e << 8 | d << 7 | c << 6 | b << 5 | e << 1 | d;
+      scale = 11;
+      break;
+    case 6:
+      offset = f << 8 | e << 7 | d << 6 | c << 5 | b << 4 | f;
+      scale = 5;
+      break;
+    }
+  }
+  else
+  {
+    switch (r.bits)
+    {
+    case 1:
+      scale = 113;
+      break;
+    case 2:
+      offset = b << 8 | b << 3 | b << 2;
+      scale = 54;
+      break;
+    case 3:
+      offset = c << 8 | b << 7 | c << 2 | b << 1 | c;
+      scale = 26;
+      break;
+    case 4:
+      offset = d << 8 | c << 7 | b << 6 | d << 1 | c;
+      scale = 13;
+      break;
+    case 5:
+      offset = e << 8 | d << 7 | c << 6 | b << 5 | e;
+      scale = 6;
+      break;
+    }
+  }
+  const int t = (digit * scale + offset) ^ a;
+  return (a & 0x80) | t >> 2;
+}
+
+// Weight value 0..64 of an encoded symbol.
+int UnquantizeWeight(int range, int symbol)
+{
+  const auto& r = kRanges[range];
+  int         value;
+  if (r.trits == 0 && r.quints == 0)
+  {
+    value = ReplicateBits(symbol, r.bits, 6);
+  }
+  else if (r.bits == 0)
+  {
+    constexpr int kTrits[3] = {0, 32, 63};
+    constexpr int kQuints[5] = {0, 16, 32, 47, 63};
+    value = r.trits != 0 ? kTrits[symbol] : kQuints[symbol];
+  }
+  else
+  {
+    const int low = symbol & ((1 << r.bits) - 1);
+    const int digit = symbol >> r.bits;
+    const int a = (low & 1) != 0 ? 0x7F : 0;
+    const int b = low >> 1 & 1;
+    const int c = low >> 2 & 1;
+
+    int offset = 0;
+    int scale = 0;
+    if (r.trits != 0)
+    {
+      offset = r.bits == 2 ? b << 6 | b << 2 | b : r.bits == 3 ? c << 6 | b << 5 | c << 1 | b : 0;
+      scale = r.bits == 1 ? 50 : r.bits == 2 ? 23 : 11;
+    }
+    else
+    {
+      offset = r.bits == 2 ? b << 6 | b << 1 : 0;
+      scale = r.bits == 1 ? 28 : 13;
+    }
+    const int t = (digit * scale + offset) ^ a;
+    value = (a & 0x20) | t >> 2;
+  }
+  return value > 32 ? value + 1 : value;
+}
+
+struct Tables
+{
+  std::array<std::uint8_t, 243> trit_codes;
+  std::array<std::uint8_t, 125> quint_codes;
+  // value of every symbol, and the symbol nearest to every value
+  std::array<std::array<std::uint8_t, 256>, kRangeCount>       color_values;
+  std::array<std::array<std::uint8_t, 256>, kRangeCount>       color_symbols;
+  std::array<std::array<std::uint8_t, 32>, kWeightRangeCount>  weight_values;
+  std::array<std::array<std::uint8_t, 65>, kWeightRangeCount>  weight_symbols;
+};
+
+template <std::size_t N>
+void FillNearest(const std::uint8_t* values, int levels, std::array<std::uint8_t, N>& symbols)
+{
+  for (std::size_t value = 0; value < N; ++value)
+  {
+    int best = 0;
+    for (int symbol = 1; symbol < levels; ++symbol)
+    {
+      if (std::abs(values[symbol] - static_cast<int>(value)) <
+          std::abs(values[best] - static_cast<int>(value)))
+      {
+        best = symbol;
+      }
+    }
+    symbols[value] = static_cast<std::uint8_t>(best);
+  }
+}
+
+Tables BuildTables()
+{
+  Tables tables{};
+  // the lowest code of a tuple, so a partial last group leaves its missing high bits zero
+  for (int code = 255; code >= 0; --code)
+  {
+    const auto t = DecodeTrits(code);
+    tables.trit_codes[t[0] + 3 * t[1] + 9 * t[2] + 27 * t[3] + 81 * t[4]] =
+        static_cast<std::uint8_t>(code);
+  }
+  for (int code = 127; code >= 0; --code)
+  {
+    const auto q = DecodeQuints(code);
+    tables.quint_codes[q[0] + 5 * q[1] + 25 * q[2]] = static_cast<std::uint8_t>(code);
+  }
+
+  for (int range = kMinColorRange; range < kRangeCount; ++range)
+  {
+    const int levels = RangeLevels(range);
+    for (int symbol = 0; symbol < levels; ++symbol)
+    {
+      tables.color_values[range][symbol] =
+          static_cast<std::uint8_t>(UnquantizeColor(range, symbol));
+    }
+    FillNearest(tables.color_values[range].data(), levels, tables.color_symbols[range]);
+  }
+  for (int range = 0; range < kWeightRangeCount; ++range)
+  {
+    const int levels = RangeLevels(range);
+    for (int symbol = 0; symbol < levels; ++symbol)
+    {
+      tables.weight_values[range][symbol] =
+          static_cast<std::uint8_t>(UnquantizeWeight(range, symbol));
+    }
+    FillNearest(tables.weight_values[range].data(), levels, tables.weight_symbols[range]);
+  }
+  return tables;
+}
+
+const Tables& GetTables()
+{
+  static const Tables tables = BuildTables();
+  return tables;
+}
+
+// Bilinear weight infill of one grid size: each texel blends four grid weights, in 1/16ths.
+struct Infill
+{
+  int                                          grid_width;
+  int                                          grid_height;
+  std::array<std::array<std::uint8_t, 4>, kMaxTexels> points;
+  std::array<std::array<std::uint8_t, 4>, kMaxTexels> factors;
+};
+
+Infill MakeInfill(int block_width, int block_height, int grid_width, int grid_height)
+{
+  Infill    infill{grid_width, grid_height, {}, {}};
+  const int scale_s = (1024 + block_width / 2) / (block_width - 1);
+  const int scale_t = (1024 + block_height / 2) / (block_height - 1);
+  for (int t = 0; t < block_height; ++t)
+  {
+    for (int s = 0; s < block_width; ++s)
+    {
+      const int gs = (scale_s * s * (grid_width - 1) + 32) >> 6;
+      const int gt = (scale_t * t * (grid_height - 1) + 32) >> 6;
+      const int js = gs >> 4;
+      const int fs = gs & 15;
+      const int jt = gt >> 4;
+      const int ft = gt & 15;
+      const int w11 = (fs * ft + 8) >> 4;
+
+      const int texel = t * block_width + s;
+      const int point = jt * grid_width + js;
+      // the neighbours past the last row or column always get a zero factor
+      const int right = js + 1 < grid_width ? 1 : 0;
+      const int below = jt + 1 < grid_height ? grid_width : 0;
+      infill.points[texel] = {static_cast<std::uint8_t>(point),
+                              static_cast<std::uint8_t>(point + right),
+                              static_cast<std::uint8_t>(point + below),
+                              static_cast<std::uint8_t>(point + below + right)};
+      infill.factors[texel] = {static_cast<std::uint8_t>(16 - fs - ft + w11),
+                               static_cast<std::uint8_t>(fs - w11),
+                               static_cast<std::uint8_t>(ft - w11),
+                               static_cast<std::uint8_t>(w11)};
+    }
+  }
+  return infill;
+}
+
+// A single plane block mode that fits the block, with the endpoint range its weights leave to
+// RGB and to RGBA endpoints of one and of two partitions, -1 when they do not fit.
+struct BlockMode
+{
+  int mode;
+  int infill;
+  int weight_range;
+  int weight_bits;
+  int color_ranges[2][2];
+};
+
+struct BlockLayout
+{
+  int                        width;
+  int                        height;
+  std::vector<Infill>        infills;
+  std::vector<BlockMode>     modes;
+  // texels of the second partition of each distinct two partition seed
+  std::vector<std::uint64_t> partition_masks;
+  std::vector<int>           partition_seeds;
+};
+
+// Grid size and weight range of a 2D block mode, as the decoder reads it.
+bool DecodeBlockMode(int mode, int& grid_width, int& grid_height, int& weight_range)
+{
+  int       range = mode >> 4 & 1;
+  int       high_precision = mode >> 9 & 1;
+  int       dual_plane = mode >> 10 & 1;
+  const int a = mode >> 5 & 3;
+  if ((mode & 3) != 0)
+  {
+    range |= (mode & 3) << 1;
+    int b = mode >> 7 & 3;
+    switch (mode >> 2 & 3)
+    {
+    case 0:
+      grid_width = b + 4;
+      grid_height = a + 2;
+      break;
+    case 1:
+      grid_width = b + 8;
+      grid_height = a + 2;
+      break;
+    case 2:
+      grid_width = a + 2;
+      grid_height = b + 8;
+      break;
+    default:
+      b &= 1;
+      grid_width = (mode & 0x100) != 0 ? b + 2 : a + 2;
+      grid_height = (mode & 0x100) != 0 ? a + 2 : b + 6;
+      break;
+    }
+  }
+  else
+  {
+    range |= (mode >> 2 & 3) << 1;
+    if ((mode >> 2 & 3) == 0)
+    {
+      return false;
+    }
+    const int b = mode >> 9 & 3;
+    switch (mode >> 7 & 3)
+    {
+    case 0:
+      grid_width = 12;
+      grid_height = a + 2;
+      break;
+    case 1:
+      grid_width = a + 2;
+      grid_height = 12;
+      break;
+    case 2:
+      grid_width = a + 6;
+      grid_height = b + 6;
+      dual_plane = 0;
+      high_precision = 0;
+      break;
+    default:
+      if (a > 1)
+      {
+        return false;
+      }
+      grid_width = a == 0 ? 6 : 10;
+      grid_height = a == 0 ? 10 : 6;
+      break;
+    }
+  }
+  weight_range = range - 2 + 6 * high_precision;
+  return dual_plane == 0;
+}
+
+std::uint32_t HashPartitionSeed(std::uint32_t seed)
+{
+  seed ^= seed >> 15;
+  seed -= seed << 17;
+  seed += seed << 7;
+  seed += seed << 4;
+  seed ^= seed >> 5;
+  seed += seed << 16;
+  seed ^= seed >> 7;
+  seed ^= seed >> 3;
+  seed ^= seed << 6;
+  seed ^= seed >> 17;
+  return seed;
+}
+
+// Partition of a texel under a two partition seed, as the decoder computes it.
+int SelectPartition(int seed, int x, int y, bool small_block)
+{
+  if (small_block)
+  {
+    x <<= 1;
+    y <<= 1;
+  }
+  seed += 1024;
+  const std::uint32_t random = HashPartitionSeed(static_cast<std::uint32_t>(seed));
+
+  int factors[8];
+  for (int k = 0; k < 8; ++k)
+  {
+    factors[k] = static_cast<int>(random >> (4 * k) & 15);
+    factors[k] *= factors[k];
+  }
+  const int shift1 = (seed & 1) != 0 ? ((seed & 2) != 0 ? 4 : 5) : 5;
+  const int shift2 = (seed & 1) != 0 ? 5 : ((seed & 2) != 0 ? 4 : 5);
+  for (int k = 0; k < 8; ++k)
+  {
+    factors[k] >>= k % 2 == 0 ? shift1 : shift2;
+  }
+
+  const int a = (factors[0] * x + factors[1] * y + static_cast<int>(random >> 14)) & 0x3F;
+  const int b = (factors[2] * x + factors[3] * y + static_cast<int>(random >> 10)) & 0x3F;
+  return a >= b ? 0 : 1;
+}
+
+BlockLayout MakeBlockLayout(int width, int height)
+{
+  BlockLayout layout{width, height, {}, {}, {}, {}};
+  for (int mode = 0; mode < 2048; ++mode)
+  {
+    int grid_width = 0;
+    int grid_height = 0;
+    int weight_range = 0;
+    if (!DecodeBlockMode(mode, grid_width, grid_height, weight_range) || grid_width > width ||
+        grid_height > height)
+    {
+      continue;
+    }
+    const int weight_bits = IseBitCount(weight_range, grid_width * grid_height);
+    if (weight_bits < 24 || weight_bits > 96)
+    {
+      continue;
+    }
+
+    BlockMode block_mode{mode, -1, weight_range, weight_bits, {{-1, -1}, {-1, -1}}};
+    for (int partitions = 1; partitions <= 2; ++partitions)
+    {
+      // block mode and partition count, then the endpoint mode, or the partition seed and
+      // a shared endpoint mode
+      const int header_bits = partitions == 1 ? 17 : 29;
+      const int color_bits = 128 - header_bits - weight_bits;
+      for (int channels = 3; channels <= 4; ++channels)
+      {
+        for (int range = kRangeCount - 1; range >= kMinColorRange; --range)
+        {
+          if (IseBitCount(range, 2 * channels * partitions) <= color_bits)
+          {
+            block_mode.color_ranges[partitions - 1][channels - 3] = range;
+            break;
+          }
+        }
+      }
+    }
+    if (block_mode.color_ranges[0][0] < 0)
+    {
+      continue;
+    }
+
+    for (std::size_t i = 0; i < layout.infills.size(); ++i)
+    {
+      if (layout.infills[i].grid_width == grid_width &&
+          layout.infills[i].grid_height == grid_height)
+      {
+        block_mode.infill = static_cast<int>(i);
+      }
+    }
+    if (block_mode.infill < 0)
+    {
+      block_mode.infill = static_cast<int>(layout.infills.size());
+      layout.infills.push_back(MakeInfill(width, height, grid_width, grid_height));
+    }
+    layout.modes.push_back(block_mode);
+  }
+
+  const int           texel_count = width * height;
+  const std::uint64_t all = texel_count == 64 ? ~std::uint64_t{0}
+                                              : (std::uint64_t{1} << texel_count) - 1;
+  for (int seed = 0; seed < 1024; ++seed)
+  {
+    std::uint64_t mask = 0;
+    for (int i = 0; i < texel_count; ++i)
+    {
+      if (SelectPartition(seed, i % width, i / width, texel_count < 31) == 1)
+      {
+        mask |= std::uint64_t{1} << i;
+      }
+    }
+    // seeds that leave a partition empty, or repeat another one, are of no use
+    if (mask == 0 || mask == all ||
+        std::find(layout.partition_masks.begin(), layout.partition_masks.end(), mask) !=
+            layout.partition_masks.end())
+    {
+      continue;
+    }
+    layout.partition_masks.push_back(mask);
+    layout.partition_seeds.push_back(seed);
+  }
+  return layout;
+}
+
+const BlockLayout& GetBlockLayout(int width, int height)
+{
+  static const std::vector<BlockLayout> layouts = []
+  {
+    std::vector<BlockLayout> all;
+    for (const auto& [w, h] : {std::pair{4, 4},
+                               std::pair{5, 4},
+                               std::pair{5, 5},
+                               std::pair{6, 5},
+                               std::pair{6, 6},
+                               std::pair{8, 5},
+                               std::pair{8, 6},
+                               std::pair{8, 8}})
+    {
+      all.push_back(MakeBlockLayout(w, h));
+    }
+    return all;
+  }();
+  for (const auto& layout : layouts)
+  {
+    if (layout.width == width && layout.height == height)
+    {
+      return layout;
+    }
+  }
+  throw std::runtime_error("unsupported ASTC block size");
+}
+
+using Rgba = std::array<float, 4>;
+
+struct Texels
+{
+  int                           count;
+  int                           channels;
+  std::array<Rgba, kMaxTexels>  colors;
+  // colors of texels whose color does not count replaced by the mean, for the line fit
+  std::array<Rgba, kMaxTexels>  fit_colors;
+  std::array<float, kMaxTexels> color_weights;
+  std::array<float, kMaxTexels> alpha_weights;
+};
+
+// Texels of the second partition, none for a single partition block.
+struct Partitioning
+{
+  int           count{1};
+  int           seed{0};
+  std::uint64_t mask{0};
+
+  [[nodiscard]]
+  int Of(int texel) const
+  {
+    return static_cast<int>(mask >> texel & 1);
+  }
+};
+
+struct Endpoints
+{
+  Rgba low;
+  Rgba high;
+};
+
+// Extent of the partition's texels along their dominant direction, found by power iteration on
+// their weighted covariance.
+Endpoints FitLine(const Texels& texels, const Partitioning& partitioning, int partition)
+{
+  const int channels = texels.channels;
+  Rgba      mean{};
+  float     total = 0.0f;
+  for (int i = 0; i < texels.count; ++i)
+  {
+    if (partitioning.Of(i) != partition)
+    {
+      continue;
+    }
+    for (int c = 0; c < channels; ++c)
+    {
+      mean[c] += texels.alpha_weights[i] * texels.fit_colors[i][c];
+    }
+    total += texels.alpha_weights[i];
+  }
+  if (total <= 0.0f)
+  {
+    return {{0.0f, 0.0f, 0.0f, 255.0f}, {0.0f, 0.0f, 0.0f, 255.0f}};
+  }
+  for (int c = 0; c < channels; ++c)
+  {
+    mean[c] /= total;
+  }
+
+  float covariance[4][4] = {};
+  for (int i = 0; i < texels.count; ++i)
+  {
+    if (partitioning.Of(i) != partition)
+    {
+      continue;
+    }
+    Rgba delta{};
+    for (int c = 0; c < channels; ++c)
+    {
+      delta[c] = texels.fit_colors[i][c] - mean[c];
+    }
+    for (int a = 0; a < channels; ++a)
+    {
+      for (int b = 0; b < channels; ++b)
+      {
+        covariance[a][b] += texels.alpha_weights[i] * delta[a] * delta[b];
+      }
+    }
+  }
+
+  int start = 0;
+  for (int c = 1; c < channels; ++c)
+  {
+    if (covariance[c][c] > covariance[start][start])
+    {
+      start = c;
+    }
+  }
+  Rgba axis{};
+  for (int c = 0; c < channels; ++c)
+  {
+    axis[c] = covariance[start][c];
+  }
+  for (int iteration = 0; iteration < 8; ++iteration)
+  {
+    Rgba  next{};
+    float largest = 0.0f;
+    for (int a = 0; a < channels; ++a)
+    {
+      for (int b = 0; b < channels; ++b)
+      {
+        next[a] += covariance[a][b] * axis[b];
+      }
+      largest = std::max(largest, std::abs(next[a]));
+    }
+    if (largest <= 0.0f)
+    {
+      break;
+    }
+    for (int c = 0; c < channels; ++c)
+    {
+      axis[c] = next[c] / largest;
+    }
+  }
+  float length = 0.0f;
+  for (int c = 0; c < channels; ++c)
+  {
+    length += axis[c] * axis[c];
+  }
+  length = std::sqrt(length);
+
+  float t_min = 0.0f;
+  float t_max = 0.0f;
+  if (length > 0.0f)
+  {
+    for (int c = 0; c < channels; ++c)
+    {
+      axis[c] /= length;
+    }
+    for (int i = 0; i < texels.count; ++i)
+    {
+      if (partitioning.Of(i) != partition || texels.alpha_weights[i] <= 0.0f)
+      {
+        continue;
+      }
+      float t = 0.0f;
+      for (int c = 0; c < channels; ++c)
+      {
+        t += (texels.fit_colors[i][c] - mean[c]) * axis[c];
+      }
+      t_min = std::min(t_min, t);
+      t_max = std::max(t_max, t);
+    }
+  }
+
+  Endpoints endpoints{};
+  for (int c = 0; c < channels; ++c)
+  {
+    endpoints.low[c] = std::clamp(mean[c] + t_min * axis[c], 0.0f, 255.0f);
+    endpoints.high[c] = std::clamp(mean[c] + t_max * axis[c], 0.0f, 255.0f);
+  }
+  endpoints.low[3] = channels == 4 ? endpoints.low[3] : 255.0f;
+  endpoints.high[3] = channels == 4 ? endpoints.high[3] : 255.0f;
+  return endpoints;
+}
+
+// A decoder reads endpoints whose second color is the darker one as blue contracted, so the
+// brighter one goes second.
+void OrientEndpoints(Endpoints& endpoints)
+{
+  if (endpoints.high[0] + endpoints.high[1] + endpoints.high[2] <
+      endpoints.low[0] + endpoints.low[1] + endpoints.low[2])
+  {
+    std::swap(endpoints.low, endpoints.high);
+  }
+}
+
+// Texel weights 0..64 that place each texel nearest to it on the segment between the endpoints
+// of its partition.
+void ProjectTexels(const Texels& texels, const Partitioning& partitioning,
+                   const Endpoints* endpoints, float* ideal)
+{
+  Rgba  directions[2] = {};
+  float lengths[2] = {};
+  for (int p = 0; p < partitioning.count; ++p)
+  {
+    for (int c = 0; c < texels.channels; ++c)
+    {
+      directions[p][c] = endpoints[p].high[c] - endpoints[p].low[c];
+      lengths[p] += directions[p][c] * directions[p][c];
+    }
+  }
+  for (int i = 0; i < texels.count; ++i)
+  {
+    const int p = partitioning.Of(i);
+    float     t = 0.0f;
+    if (lengths[p] > 0.0f)
+    {
+      for (int c = 0; c < texels.channels; ++c)
+      {
+        t += (texels.fit_colors[i][c] - endpoints[p].low[c]) * directions[p][c];
+      }
+      t /= lengths[p];
+    }
+    ideal[i] = std::clamp(t, 0.0f, 1.0f) * 64.0f;
+  }
+}
+
+// Grid weights whose bilinear infill best matches the ideal texel weights: a weighted average
+// of the texels each grid point reaches, then corrected by the remaining infill error.
+void DecimateWeights(const Texels& texels, const Infill& infill, const float* ideal,
+                     int iterations, float* grid)
+{
+  const int grid_count = infill.grid_width * infill.grid_height;
+  float     sums[kMaxTexels] = {};
+  float     totals[kMaxTexels] = {};
+  for (int i = 0; i < texels.count; ++i)
+  {
+    // texels that do not count still steer points that reach nothing else
+    const float weight = std::max(texels.alpha_weights[i], 1e-3f);
+    for (int k = 0; k < 4; ++k)
+    {
+      const float factor = weight * infill.factors[i][k];
+      sums[infill.points[i][k]] += factor * ideal[i];
+      totals[infill.points[i][k]] += factor;
+    }
+  }
+  for (int j = 0; j < grid_count; ++j)
+  {
+    grid[j] = totals[j] > 0.0f ? sums[j] / totals[j] : 32.0f;
+  }
+
+  for (int iteration = 0; iteration < iterations; ++iteration)
+  {
+    std::fill(sums, sums + grid_count, 0.0f);
+    for (int i = 0; i < texels.count; ++i)
+    {
+      float value = 0.0f;
+      for (int k = 0; k < 4; ++k)
+      {
+        value += infill.factors[i][k] * grid[infill.points[i][k]];
+      }
+      const float residual = ideal[i] - value / 16.0f;
+      const float weight = std::max(texels.alpha_weights[i], 1e-3f);
+      for (int k = 0; k < 4; ++k)
+      {
+        sums[infill.points[i][k]] += weight * infill.factors[i][k] * residual;
+      }
+    }
+    for (int j = 0; j < grid_count; ++j)
+    {
+      if (totals[j] > 0.0f)
+      {
+        grid[j] = std::clamp(grid[j] + sums[j] / totals[j], 0.0f, 64.0f);
+      }
+    }
+  }
+}
+
+void InfillWeights(const Infill& infill, const int* grid_values, int texel_count, int* weights)
+{
+  for (int i = 0; i < texel_count; ++i)
+  {
+    int sum = 8;
+    for (int k = 0; k < 4; ++k)
+    {
+      sum += infill.factors[i][k] * grid_values[infill.points[i][k]];
+    }
+    weights[i] = sum >> 4;
+  }
+}
+
+// Endpoints of a partition minimizing the squared error for the given texel weights, channel
+// by channel.
+void RefineEndpoints(const Texels& texels, const Partitioning& partitioning, int partition,
+                     const int* weights, Endpoints& endpoints)
+{
+  for (int c = 0; c < texels.channels; ++c)
+  {
+    double aa = 0.0;
+    double ab = 0.0;
+    double bb = 0.0;
+    double ap = 0.0;
+    double bp = 0.0;
+    for (int i = 0; i < texels.count; ++i)
+    {
+      if (partitioning.Of(i) != partition)
+      {
+        continue;
+      }
+      const double weight = c == 3 ? texels.alpha_weights[i] : texels.color_weights[i];
+      const double u = weights[i] / 64.0;
+      aa += weight * (1.0 - u) * (1.0 - u);
+      ab += weight * (1.0 - u) * u;
+      bb += weight * u * u;
+      ap += weight * (1.0 - u) * texels.colors[i][c];
+      bp += weight * u * texels.colors[i][c];
+    }
+    const double determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6)
+    {
+      continue;
+    }
+    endpoints.low[c] =
+        static_cast<float>(std::clamp((ap * bb - bp * ab) / determinant, 0.0, 255.0));
+    endpoints.high[c] =
+        static_cast<float>(std::clamp((bp * aa - ap * ab) / determinant, 0.0, 255.0));
+  }
+}
+
+struct Trial
+{
+  float                       error{kInfinity};
+  const BlockMode*            mode{nullptr};
+  Partitioning                partitioning;
+  int                         color_range{0};
+  std::array<int, 16>         color_symbols{};
+  std::array<int, kMaxTexels> weight_symbols{};
+};
+
+// Interpolation happens on endpoints widened to 16 bits, the result is rounded back to 8.
+int DecodeTexel(int low, int high, int weight)
+{
+  const int value = (low * 257 * (64 - weight) + high * 257 * weight + 32) >> 6;
+  return (value * 255 + 32767) / 65535;
+}
+
+// Quantizes grid weights and endpoints for one block mode and partitioning, refining the
+// endpoints against the weights they end up with.
+Trial EvaluateMode(const Texels& texels, const BlockLayout& layout, const BlockMode& mode,
+                   const Partitioning& partitioning, const Endpoints* fitted, int passes)
+{
+  const auto& tables = GetTables();
+  const auto& infill = layout.infills[mode.infill];
+  const int   grid_count = infill.grid_width * infill.grid_height;
+  const int   color_range = mode.color_ranges[partitioning.count - 1][texels.channels - 3];
+  const auto& color_values = tables.color_values[color_range];
+  const auto& color_symbols = tables.color_symbols[color_range];
+  const auto& weight_values = tables.weight_values[mode.weight_range];
+  const auto& weight_symbols = tables.weight_symbols[mode.weight_range];
+
+  Trial     best;
+  Endpoints endpoints[2] = {fitted[0], fitted[1]};
+  // a pass whose quantized endpoints come out in the wrong order turns them around and repeats
+  for (int pass = 0, attempt = 0; pass < passes && attempt < passes + 2; ++attempt)
+  {
+    float ideal[kMaxTexels];
+    float grid[kMaxTexels];
+    ProjectTexels(texels, partitioning, endpoints, ideal);
+    DecimateWeights(texels, infill, ideal, pass == 0 ? 1 : 2, grid);
+
+    Trial trial;
+    trial.mode = &mode;
+    trial.partitioning = partitioning;
+    trial.color_range = color_range;
+    int grid_values[kMaxTexels];
+    for (int j = 0; j < grid_count; ++j)
+    {
+      trial.weight_symbols[j] = weight_symbols[static_cast<int>(grid[j] + 0.5f)];
+      grid_values[j] = weight_values[trial.weight_symbols[j]];
+    }
+    int weights[kMaxTexels];
+    InfillWeights(infill, grid_values, texels.count, weights);
+
+    int  low[2][4];
+    int  high[2][4];
+    bool ordered = true;
+    for (int p = 0; p < partitioning.count; ++p)
+    {
+      RefineEndpoints(texels, partitioning, p, weights, endpoints[p]);
+      int low_sum = 0;
+      int high_sum = 0;
+      for (int c = 0; c < 4; ++c)
+      {
+        low[p][c] = 255;
+        high[p][c] = 255;
+        if (c >= texels.channels)
+        {
+          continue;
+        }
+        int* symbols = &trial.color_symbols[2 * (p * texels.channels + c)];
+        symbols[0] = color_symbols[static_cast<int>(endpoints[p].low[c] + 0.5f)];
+        symbols[1] = color_symbols[static_cast<int>(endpoints[p].high[c] + 0.5f)];
+        low[p][c] = color_values[symbols[0]];
+        high[p][c] = color_values[symbols[1]];
+        low_sum += c < 3 ? low[p][c] : 0;
+        high_sum += c < 3 ? high[p][c] : 0;
+      }
+      if (high_sum < low_sum)
+      {
+        std::swap(endpoints[p].low, endpoints[p].high);
+        ordered = false;
+      }
+    }
+    if (!ordered)
+    {
+      continue;
+    }
+    ++pass;
+
+    trial.error = 0.0f;
+    for (int i = 0; i < texels.count; ++i)
+    {
+      const int p = partitioning.Of(i);
+      for (int c = 0; c < 4; ++c)
+      {
+        const float weight = c == 3 ? texels.alpha_weights[i] : texels.color_weights[i];
+        const float delta = static_cast<float>(DecodeTexel(low[p][c], high[p][c], weights[i])) -
+                            texels.colors[i][c];
+        trial.error += weight * delta * delta;
+      }
+    }
+    if (trial.error < best.error)
+    {
+      best = trial;
+    }
+  }
+  return best;
+}
+
+// Tries the block modes the partitioning is expected to do best with. The error quantizing
+// weights and endpoints, and spreading fewer weights over the block, would add ranks them.
+Trial SearchModes(const Texels& texels, const BlockLayout& layout,
+                  const Partitioning& partitioning, int mode_count, int passes)
+{
+  Endpoints endpoints[2] = {};
+  float     spread = 0.0f;
+  for (int p = 0; p < partitioning.count; ++p)
+  {
+    endpoints[p] = FitLine(texels, partitioning, p);
+    OrientEndpoints(endpoints[p]);
+    float partition_spread = 0.0f;
+    for (int c = 0; c < texels.channels; ++c)
+    {
+      const float extent = endpoints[p].high[c] - endpoints[p].low[c];
+      partition_spread += extent * extent;
+    }
+    spread = std::max(spread, partition_spread);
+  }
+
+  std::vector<std::pair<float, const BlockMode*>> ranking;
+  ranking.reserve(layout.modes.size());
+  for (const auto& mode : layout.modes)
+  {
+    const int color_range = mode.color_ranges[partitioning.count - 1][texels.channels - 3];
+    if (color_range < 0)
+    {
+      continue;
+    }
+    const auto& infill = layout.infills[mode.infill];
+    const float coverage = static_cast<float>(infill.grid_width * infill.grid_height) /
+                           static_cast<float>(texels.count);
+    const float weight_step = 1.0f / static_cast<float>(RangeLevels(mode.weight_range) - 1);
+    const float color_step = 255.0f / static_cast<float>(RangeLevels(color_range) - 1);
+    ranking.emplace_back(spread * (weight_step * weight_step / 12.0f +
+                                   kGridPenalty * (1.0f - coverage)) +
+                             texels.channels * color_step * color_step / 12.0f,
+                         &mode);
+  }
+  const auto tried = std::min(ranking.size(), static_cast<std::size_t>(mode_count));
+  std::partial_sort(ranking.begin(),
+                    ranking.begin() + static_cast<std::ptrdiff_t>(tried),
+                    ranking.end(),
+                    [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  Trial best;
+  for (std::size_t i = 0; i < tried; ++i)
+  {
+    const auto trial =
+        EvaluateMode(texels, layout, *ranking[i].second, partitioning, endpoints, passes);
+    if (trial.error < best.error)
+    {
+      best = trial;
+    }
+  }
+  return best;
+}
+
+int CountBits(std::uint64_t bits)
+{
+  int count = 0;
+  for (; bits != 0; bits &= bits - 1)
+  {
+    ++count;
+  }
+  return count;
+}
+
+// Two partition seeds whose split comes closest to two clusters of the texel colors.
+std::vector<Partitioning> RankPartitionings(const Texels& texels, const BlockLayout& layout,
+                                            int count)
+{
+  const Partitioning whole;
+  const auto         line = FitLine(texels, whole, 0);
+
+  // 2-means, starting from the ends of the dominant direction
+  Rgba          centers[2] = {line.low, line.high};
+  std::uint64_t clusters = 0;
+  std::uint64_t visible = 0;
+  for (int iteration = 0; iteration < 3; ++iteration)
+  {
+    clusters = 0;
+    for (int i = 0; i < texels.count; ++i)
+    {
+      float distances[2] = {};
+      for (int k = 0; k < 2; ++k)
+      {
+        for (int c = 0; c < texels.channels; ++c)
+        {
+          const float delta = texels.fit_colors[i][c] - centers[k][c];
+          distances[k] += delta * delta;
+        }
+      }
+      clusters |= distances[1] < distances[0] ? std::uint64_t{1} << i : 0;
+    }
+
+    Rgba  sums[2] = {};
+    float totals[2] = {};
+    for (int i = 0; i < texels.count; ++i)
+    {
+      const int k = static_cast<int>(clusters >> i & 1);
+      for (int c = 0; c < texels.channels; ++c)
+      {
+        sums[k][c] += texels.alpha_weights[i] * texels.fit_colors[i][c];
+      }
+      totals[k] += texels.alpha_weights[i];
+    }
+    for (int k = 0; k < 2; ++k)
+    {
+      for (int c = 0; c < texels.channels && totals[k] > 0.0f; ++c)
+      {
+        centers[k][c] = sums[k][c] / totals[k];
+      }
+    }
+  }
+  for (int i = 0; i < texels.count; ++i)
+  {
+    visible |= texels.alpha_weights[i] > 0.0f ? std::uint64_t{1} << i : 0;
+  }
+
+  std::vector<std::pair<int, std::size_t>> ranking;
+  ranking.reserve(layout.partition_masks.size());
+  const int visible_count = CountBits(visible);
+  for (std::size_t s = 0; s < layout.partition_masks.size(); ++s)
+  {
+    const int mismatches = CountBits((layout.partition_masks[s] ^ clusters) & visible);
+    ranking.emplace_back(std::min(mismatches, visible_count - mismatches), s);
+  }
+  const auto ranked = std::min(ranking.size(), static_cast<std::size_t>(count));
+  std::partial_sort(ranking.begin(),
+                    ranking.begin() + static_cast<std::ptrdiff_t>(ranked),
+                    ranking.end());
+
+  std::vector<Partitioning> partitionings;
+  for (std::size_t r = 0; r < ranked; ++r)
+  {
+    const auto s = ranking[r].second;
+    partitionings.push_back({2, layout.partition_seeds[s], layout.partition_masks[s]});
+  }
+  return partitionings;
+}
+
+void SetBits(std::uint8_t* bytes, int position, unsigned int value, int count)
+{
+  for (int i = 0; i < count; ++i, ++position)
+  {
+    if ((value >> i & 1) != 0)
+    {
+      bytes[position >> 3] |= static_cast<std::uint8_t>(1 << (position & 7));
+    }
+  }
+}
+
+// Integer sequence encoding of the symbols: bits of every value interleaved with the packed
+// trits or quints of each group of 5 or 3 values.
+std::array<std::uint8_t, 32> EncodeIse(int range, const int* symbols, int count)
+{
+  const auto&                  r = kRanges[range];
+  const auto&                  tables = GetTables();
+  const unsigned int           mask = (1u << r.bits) - 1;
+  std::array<std::uint8_t, 32> stream{};
+  int                          position = 0;
+  const auto                   put = [&](unsigned int value, int bits)
+  {
+    SetBits(stream.data(), position, value, bits);
+    position += bits;
+  };
+
+  if (r.trits != 0)
+  {
+    for (int first = 0; first < count; first += 5)
+    {
+      int digits[5] = {};
+      int low[5] = {};
+      for (int k = 0; k < 5 && first + k < count; ++k)
+      {
+        digits[k] = symbols[first + k] >> r.bits;
+        low[k] = symbols[first + k] & static_cast<int>(mask);
+      }
+      const unsigned int code =
+          tables.trit_codes[digits[0] + 3 * digits[1] + 9 * digits[2] + 27 * digits[3] +
+                            81 * digits[4]];
+      put(low[0], r.bits);
+      put(code & 3, 2);
+      put(low[1], r.bits);
+      put(code >> 2 & 3, 2);
+      put(low[2], r.bits);
+      put(code >> 4 & 1, 1);
+      put(low[3], r.bits);
+      put(code >> 5 & 3, 2);
+      put(low[4], r.bits);
+      put(code >> 7 & 1, 1);
+    }
+  }
+  else if (r.quints != 0)
+  {
+    for (int first = 0; first < count; first += 3)
+    {
+      int digits[3] = {};
+      int low[3] = {};
+      for (int k = 0; k < 3 && first + k < count; ++k)
+      {
+        digits[k] = symbols[first + k] >> r.bits;
+        low[k] = symbols[first + k] & static_cast<int>(mask);
+      }
+      const unsigned int code = tables.quint_codes[digits[0] + 5 * digits[1] + 25 * digits[2]];
+      put(low[0], r.bits);
+      put(code & 7, 3);
+      put(low[1], r.bits);
+      put(code >> 3 & 3, 2);
+      put(low[2], r.bits);
+      put(code >> 5 & 3, 2);
+    }
+  }
+  else
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      put(static_cast<unsigned int>(symbols[i]), r.bits);
+    }
+  }
+  return stream;
+}
+
+bool GetBit(const std::uint8_t* bytes, int position)
+{
+  return (bytes[position >> 3] >> (position & 7) & 1) != 0;
+}
+
+// Block mode and partitions, then the endpoints upwards and the weights down from bit 127.
+void WriteBlock(const Trial& trial, int channels, int weight_count, std::uint8_t* out)
+{
+  const auto& partitioning = trial.partitioning;
+  const int   endpoint_mode = channels == 4 ? kEndpointModeRgba : kEndpointModeRgb;
+  std::memset(out, 0, 16);
+  SetBits(out, 0, static_cast<unsigned int>(trial.mode->mode), 11);
+  SetBits(out, 11, static_cast<unsigned int>(partitioning.count - 1), 2);
+  int position = 13;
+  if (partitioning.count == 1)
+  {
+    SetBits(out, position, endpoint_mode, 4);
+    position += 4;
+  }
+  else
+  {
+    // seed, then zero bits that mark one endpoint mode shared by the partitions
+    SetBits(out, position, static_cast<unsigned int>(partitioning.seed), 10);
+    SetBits(out, position + 12, endpoint_mode, 4);
+    position += 16;
+  }
+
+  const int  color_count = 2 * channels * partitioning.count;
+  const auto colors = EncodeIse(trial.color_range, trial.color_symbols.data(), color_count);
+  for (int i = 0; i < IseBitCount(trial.color_range, color_count); ++i)
+  {
+    SetBits(out, position + i, GetBit(colors.data(), i) ? 1 : 0, 1);
+  }
+
+  const auto weights =
+      EncodeIse(trial.mode->weight_range, trial.weight_symbols.data(), weight_count);
+  for (int i = 0; i < trial.mode->weight_bits; ++i)
+  {
+    SetBits(out, 127 - i, GetBit(weights.data(), i) ? 1 : 0, 1);
+  }
+}
+
+// Constant color block: a void extent that covers the whole texture, with UNORM16 channels.
+void WriteConstantBlock(const Channel* color, std::uint8_t* out)
+{
+  constexpr std::uint8_t kHeader[8] = {0xFC, 0xFD, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  std::memcpy(out, kHeader, sizeof(kHeader));
+  for (int c = 0; c < 4; ++c)
+  {
+    out[8 + 2 * c] = color[c];
+    out[9 + 2 * c] = color[c];
+  }
+}
+} // namespace
+
+void encode_astc_block(const Channel* pixels, int block_width, int block_height,
+                       std::uint64_t visible, CompressionQuality quality, std::uint8_t* out)
+{
+  const auto& layout = GetBlockLayout(block_width, block_height);
+
+  Texels texels{};
+  texels.count = block_width * block_height;
+  float alpha_total = 0.0f;
+  float color_total = 0.0f;
+  for (int i = 0; i < texels.count; ++i)
+  {
+    for (int c = 0; c < 4; ++c)
+    {
+      texels.colors[i][c] = pixels[i * 4 + c];
+    }
+    texels.alpha_weights[i] = static_cast<float>(visible >> i & 1);
+    texels.color_weights[i] = pixels[i * 4 + 3] > 0 ? texels.alpha_weights[i] : 0.0f;
+    alpha_total += texels.alpha_weights[i];
+    color_total += texels.color_weights[i];
+  }
+  if (alpha_total == 0.0f)
+  {
+    texels.alpha_weights.fill(1.0f);
+  }
+  // fully transparent: keep whatever color the page holds there
+  if (color_total == 0.0f)
+  {
+    texels.color_weights = texels.alpha_weights;
+  }
+
+  // texels whose alpha, and whose color, the others are compared with
+  int  alpha_reference = -1;
+  int  color_reference = -1;
+  bool constant = true;
+  bool opaque = true;
+  for (int i = 0; i < texels.count; ++i)
+  {
+    const Channel* pixel = pixels + i * 4;
+    if (texels.alpha_weights[i] > 0.0f)
+    {
+      opaque = opaque && pixel[3] == 255;
+      alpha_reference = alpha_reference < 0 ? i : alpha_reference;
+      constant = constant && pixel[3] == pixels[alpha_reference * 4 + 3];
+    }
+    if (texels.color_weights[i] > 0.0f)
+    {
+      color_reference = color_reference < 0 ? i : color_reference;
+      constant = constant && std::memcmp(pixel, pixels + color_reference * 4, 3) == 0;
+    }
+  }
+  if (constant)
+  {
+    const Channel* color = pixels + color_reference * 4;
+    const Channel  rgba[4] = {color[0], color[1], color[2], pixels[alpha_reference * 4 + 3]};
+    WriteConstantBlock(rgba, out);
+    return;
+  }
+
+  texels.channels = opaque ? 3 : 4;
+  Rgba  mean{};
+  float total = 0.0f;
+  for (int i = 0; i < texels.count; ++i)
+  {
+    for (int c = 0; c < 3; ++c)
+    {
+      mean[c] += texels.color_weights[i] * texels.colors[i][c];
+    }
+    total += texels.color_weights[i];
+  }
+  for (int i = 0; i < texels.count; ++i)
+  {
+    texels.fit_colors[i] = texels.colors[i];
+    if (texels.color_weights[i] == 0.0f)
+    {
+      for (int c = 0; c < 3; ++c)
+      {
+        texels.fit_colors[i][c] = mean[c] / total;
+      }
+    }
+  }
+
+  const auto effort = GetSearchEffort(quality);
+  auto       best = SearchModes(texels, layout, Partitioning{}, effort.modes, effort.passes);
+  if (effort.partitionings > 0 && best.error > kPartitionThreshold * alpha_total)
+  {
+    for (const auto& partitioning : RankPartitionings(texels, layout, effort.partitionings))
+    {
+      const auto trial =
+          SearchModes(texels, layout, partitioning, effort.partition_modes, effort.passes);
+      if (trial.error < best.error)
+      {
+        best = trial;
+      }
+    }
+  }
+  const auto& infill = layout.infills[best.mode->infill];
+  WriteBlock(best, texels.channels, infill.grid_width * infill.grid_height, out);
+}
+} // namespace TexturePacker
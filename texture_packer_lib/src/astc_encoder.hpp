@@ -0,0 +1,16 @@
+#pragma once
+
+#include <texture_packer/abstract_image.hpp>
+#include <texture_packer/pack_settings.hpp>
+
+#include <cstdint>
+
+namespace TexturePacker
+{
+// Encodes block_width x block_height RGBA32 pixels (up to 8x8) in row major order into one 16 byte
+// ASTC LDR block. Only the pixels set in `visible` (bit y * block_width + x) are fitted. Blocks
+// use one or two partitions with RGB endpoints, or RGBA ones when some pixel is translucent, on
+// the weight grid that fits them best; a single color becomes a constant color block.
+void encode_astc_block(const Channel* pixels, int block_width, int block_height,
+                       std::uint64_t visible, CompressionQuality quality, std::uint8_t* out);
+} // namespace TexturePacker
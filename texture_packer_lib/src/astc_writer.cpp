@@ -0,0 +1,46 @@
+#include "astc_writer.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#include "texture_encoder.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+void PutLittleEndian24(std::uint8_t* out, int value)
+{
+  out[0] = static_cast<std::uint8_t>(value);
+  out[1] = static_cast<std::uint8_t>(value >> 8);
+  out[2] = static_cast<std::uint8_t>(value >> 16);
+}
+} // namespace
+
+void write_astc(const std::string& file_path, int width, int height,
+                TextureCompression compression, const std::vector<std::uint8_t>& payload)
+{
+  const auto format = get_block_format(compression);
+
+  // magic 0x5CA1AB13, block size in texels, then image size with 24 bits per dimension
+  std::uint8_t header[16] = {0x13,
+                             0xAB,
+                             0xA1,
+                             0x5C,
+                             static_cast<std::uint8_t>(format.block_width),
+                             static_cast<std::uint8_t>(format.block_height),
+                             1};
+  PutLittleEndian24(header + 7, width);
+  PutLittleEndian24(header + 10, height);
+  PutLittleEndian24(header + 13, 1);
+
+  std::ofstream fs(file_path, std::ios::binary);
+  fs.write(reinterpret_cast<const char*>(header), sizeof(header));
+  fs.write(reinterpret_cast<const char*>(payload.data()),
+           static_cast<std::streamsize>(payload.size()));
+  if (!fs)
+  {
+    throw std::runtime_error("can not write " + file_path);
+  }
+}
+} // namespace TexturePacker
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <texture_packer/pack_settings.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace TexturePacker
+{
+// Writes a .astc file: the 16 byte header of the ARM tools followed by the blocks, payload as
+// laid out by encode_texture.
+void write_astc(const std::string& file_path, int width, int height,
+                TextureCompression compression, const std::vector<std::uint8_t>& payload);
+} // namespace TexturePacker
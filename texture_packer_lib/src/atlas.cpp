@@ -1,18 +1,29 @@
 #include <texture_packer/atlas.hpp>
 
+#include <algorithm>
 #include <cassert>
 
 namespace TexturePacker
 {
+namespace
+{
+int AlignUp(int value, int alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
 CAtlas::CAtlas(int _max_width, int _max_height, bool _force_square, bool _force_pot,
                int _border_padding, int _shape_padding, ExpandStrategy _expand_strategy,
-               RankStrategy _rank_strategy)
+               RankStrategy _rank_strategy, int _alignment_x, int _alignment_y)
     : m_width(0)
     , m_height(0)
     , m_max_width(_max_width)
     , m_max_height(_max_height)
     , m_border_padding(_border_padding)
     , m_shape_padding(_shape_padding)
+    , m_alignment_x(std::max(1, _alignment_x))
+    , m_alignment_y(std::max(1, _alignment_y))
     , m_force_square(_force_square)
     , m_force_pot(_force_pot)
     , m_expand_strategy(_expand_strategy)
@@ -65,6 +76,23 @@ void CAtlas::PruneFreeRects()
   m_free_rects = new_free_rects;
 }
 
+std::pair<int, int> CAtlas::GetPlacement(const CRect& free_rect) const
+{
+  const int sp_x = free_rect.x == m_border_padding ? 0 : m_shape_padding;
+  const int sp_y = free_rect.y == m_border_padding ? 0 : m_shape_padding;
+  return {AlignUp(free_rect.x + sp_x, m_alignment_x),
+          AlignUp(free_rect.y + sp_y, m_alignment_y)};
+}
+
+CRect CAtlas::GetFootprint(const CRect& free_rect, int x, int y, const CRect& image_rect) const
+{
+  // cells cut off by the edge of the free rect only count as far as it reaches
+  const int right = std::min(AlignUp(x + image_rect.width, m_alignment_x), free_rect.get_right());
+  const int bottom =
+      std::min(AlignUp(y + image_rect.height, m_alignment_y), free_rect.get_bottom());
+  return {x, y, right - x, bottom - y};
+}
+
 bool CAtlas::IsInMaxSize(int new_width, int new_height) const
 {
   return new_width <= m_max_width && new_height <= m_max_height;
@@ -81,6 +109,10 @@ void CAtlas::Shrink()
   }
   m_width = max_x + m_border_padding;
   m_height = max_y + m_border_padding;
+  // keep every level of an aligned page exactly half of the previous one, and its edge blocks
+  // whole
+  m_width = std::min(AlignUp(m_width, m_alignment_x), m_max_width);
+  m_height = std::min(AlignUp(m_height, m_alignment_y), m_max_height);
   // TODO fit free rects
   m_free_rects.clear();
 }
@@ -144,47 +176,45 @@ std::tuple<unsigned int, unsigned int, bool> CAtlas::FindBestRankWithoutRotate(
 unsigned int CAtlas::Rank(CRect free_rect, const CImageRect& image_rect,
                           RankStrategy rank_strategy) const
 {
-  unsigned int r = MAX_RANK;
+  const auto [x, y] = GetPlacement(free_rect);
+  if (x + image_rect.width > free_rect.get_right() ||
+      y + image_rect.height > free_rect.get_bottom())
+  {
+    return MAX_RANK;
+  }
+
+  // ranked by what the image really takes once snapped to the grid
+  const auto footprint = GetFootprint(free_rect, x, y, image_rect);
+  int        r = 0;
   switch (rank_strategy)
   {
   case RankStrategy::RankBSSF:
-    r = image_rect.width >= image_rect.height ? free_rect.width - image_rect.width
-                                              : free_rect.height - image_rect.height;
+    r = footprint.width >= footprint.height ? free_rect.width - footprint.width
+                                            : free_rect.height - footprint.height;
     break;
   case RankStrategy::RankBLSF:
-    r = image_rect.width <= image_rect.height ? free_rect.width - image_rect.width
-                                              : free_rect.height - image_rect.height;
+    r = footprint.width <= footprint.height ? free_rect.width - footprint.width
+                                            : free_rect.height - footprint.height;
     break;
   case RankStrategy::RankBAF:
-    r = free_rect.get_area() - image_rect.get_area();
+    r = free_rect.get_area() - footprint.get_area();
     break;
   }
 
-  const int sp_x = free_rect.x == m_border_padding ? 0 : m_shape_padding;
-  const int sp_y = free_rect.y == m_border_padding ? 0 : m_shape_padding;
-
-  if (r < 0 || free_rect.width - image_rect.width < sp_x ||
-      free_rect.height - image_rect.height < sp_y)
-  {
-    return MAX_RANK;
-  }
-
-  return r;
+  return r < 0 ? MAX_RANK : static_cast<unsigned int>(r);
 }
 
 void CAtlas::PlaceImageRectInFreeRect(unsigned int free_rect_idx, CImageRect& image_rect)
 {
   auto free_rect = m_free_rects[free_rect_idx];
 
-  const int sp_x = free_rect.x == m_border_padding ? 0 : m_shape_padding;
-  const int sp_y = free_rect.y == m_border_padding ? 0 : m_shape_padding;
-
-  image_rect.x = free_rect.x + sp_x;
-  image_rect.y = free_rect.y + sp_y;
+  std::tie(image_rect.x, image_rect.y) = GetPlacement(free_rect);
 
-  CImageRect tmp_rect = image_rect;
-  tmp_rect.enlarge_left_to(image_rect.get_left() - sp_x);
-  tmp_rect.enlarge_top_to(image_rect.get_top() - sp_y);
+  // the used area also covers the padding and alignment gap in front of the image, and the rest
+  // of the grid cells it ends in
+  CRect tmp_rect = GetFootprint(free_rect, image_rect.x, image_rect.y, image_rect);
+  tmp_rect.enlarge_left_to(free_rect.x);
+  tmp_rect.enlarge_top_to(free_rect.y);
 
   std::vector<CRect> non_overlapped_free_rects;
   std::vector<CRect> new_free_rects;
@@ -320,4 +350,26 @@ const std::vector<CImageRect>& CAtlas::GetPlacedImageRect() const
 {
   return m_image_rects;
 }
+
+CAtlas CAtlas::Scaled(int factor) const
+{
+  CAtlas atlas(*this);
+  atlas.m_width *= factor;
+  atlas.m_height *= factor;
+  atlas.m_max_width *= factor;
+  atlas.m_max_height *= factor;
+  atlas.m_border_padding *= factor;
+  atlas.m_shape_padding *= factor;
+  atlas.m_alignment_x *= factor;
+  atlas.m_alignment_y *= factor;
+  atlas.m_free_rects.clear();
+  for (auto& image_rect : atlas.m_image_rects)
+  {
+    image_rect.x *= factor;
+    image_rect.y *= factor;
+    image_rect.width *= factor;
+    image_rect.height *= factor;
+  }
+  return atlas;
+}
 } // namespace TexturePacker
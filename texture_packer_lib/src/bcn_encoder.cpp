@@ -0,0 +1,1096 @@
+#include "bcn_encoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr int   kPixels = 16;
+constexpr float kInfinity = std::numeric_limits<float>::max();
+
+using Color = std::array<float, 4>;
+
+// Segment in color space that a block palette is spread along.
+struct Line
+{
+  Color low;
+  Color high;
+};
+
+struct Statistics
+{
+  Color mean;
+  float covariance[4][4];
+};
+
+int RefineIterations(CompressionQuality quality)
+{
+  switch (quality)
+  {
+  case CompressionQuality::Fast:
+    return 1;
+  case CompressionQuality::Normal:
+    return 2;
+  case CompressionQuality::Thorough:
+    return 6;
+  }
+  return 1;
+}
+
+std::array<Color, kPixels> LoadColors(const Channel* pixels)
+{
+  std::array<Color, kPixels> colors{};
+  for (int i = 0; i < kPixels; ++i)
+  {
+    for (int c = 0; c < 4; ++c)
+    {
+      colors[i][c] = pixels[i * 4 + c];
+    }
+  }
+  return colors;
+}
+
+Statistics ComputeStatistics(const Color* colors, const int* members, int count, int channels)
+{
+  Statistics stats{};
+  for (int i = 0; i < count; ++i)
+  {
+    for (int c = 0; c < channels; ++c)
+    {
+      stats.mean[c] += colors[members[i]][c];
+    }
+  }
+  for (int c = 0; c < channels; ++c)
+  {
+    stats.mean[c] /= static_cast<float>(count);
+  }
+  for (int i = 0; i < count; ++i)
+  {
+    Color delta{};
+    for (int c = 0; c < channels; ++c)
+    {
+      delta[c] = colors[members[i]][c] - stats.mean[c];
+    }
+    for (int a = 0; a < channels; ++a)
+    {
+      for (int b = 0; b < channels; ++b)
+      {
+        stats.covariance[a][b] += delta[a] * delta[b];
+      }
+    }
+  }
+  return stats;
+}
+
+// Unit length dominant eigenvector of the covariance by power iteration, zero for a set of
+// identical colors.
+Color PrincipalAxis(const Statistics& stats, int channels, int iterations = 8)
+{
+  int start = 0;
+  for (int c = 1; c < channels; ++c)
+  {
+    if (stats.covariance[c][c] > stats.covariance[start][start])
+    {
+      start = c;
+    }
+  }
+
+  Color axis{};
+  for (int c = 0; c < channels; ++c)
+  {
+    axis[c] = stats.covariance[start][c];
+  }
+  for (int iteration = 0; iteration < iterations; ++iteration)
+  {
+    Color next{};
+    float largest = 0.0f;
+    for (int a = 0; a < channels; ++a)
+    {
+      for (int b = 0; b < channels; ++b)
+      {
+        next[a] += stats.covariance[a][b] * axis[b];
+      }
+      largest = std::max(largest, std::abs(next[a]));
+    }
+    if (largest <= 0.0f)
+    {
+      return {};
+    }
+    for (int c = 0; c < channels; ++c)
+    {
+      axis[c] = next[c] / largest;
+    }
+  }
+
+  float length = 0.0f;
+  for (int c = 0; c < channels; ++c)
+  {
+    length += axis[c] * axis[c];
+  }
+  length = std::sqrt(length);
+  for (int c = 0; c < channels; ++c)
+  {
+    axis[c] /= length;
+  }
+  return axis;
+}
+
+// Extent of the members along their principal axis.
+Line FitLine(const Color* colors, const int* members, int count, int channels)
+{
+  const auto stats = ComputeStatistics(colors, members, count, channels);
+  const auto axis = PrincipalAxis(stats, channels);
+
+  float t_min = 0.0f;
+  float t_max = 0.0f;
+  for (int i = 0; i < count; ++i)
+  {
+    float t = 0.0f;
+    for (int c = 0; c < channels; ++c)
+    {
+      t += (colors[members[i]][c] - stats.mean[c]) * axis[c];
+    }
+    t_min = std::min(t_min, t);
+    t_max = std::max(t_max, t);
+  }
+
+  Line line{};
+  for (int c = 0; c < channels; ++c)
+  {
+    line.low[c] = std::clamp(stats.mean[c] + t_min * axis[c], 0.0f, 255.0f);
+    line.high[c] = std::clamp(stats.mean[c] + t_max * axis[c], 0.0f, 255.0f);
+  }
+  return line;
+}
+
+// Color sums and sums of pairwise products of a set of pixels, from which the covariance of
+// any subset follows without revisiting its pixels.
+struct Moments
+{
+  float count;
+  Color sum;
+  float products[4][4];
+};
+
+Moments SumMoments(const Color* colors, unsigned int mask)
+{
+  Moments moments{};
+  for (int i = 0; i < kPixels; ++i)
+  {
+    if ((mask >> i & 1) == 0)
+    {
+      continue;
+    }
+    moments.count += 1.0f;
+    for (int a = 0; a < 4; ++a)
+    {
+      moments.sum[a] += colors[i][a];
+      for (int b = a; b < 4; ++b)
+      {
+        moments.products[a][b] += colors[i][a] * colors[i][b];
+      }
+    }
+  }
+  return moments;
+}
+
+Moments SubtractMoments(Moments moments, const Moments& subset)
+{
+  moments.count -= subset.count;
+  for (int a = 0; a < 4; ++a)
+  {
+    moments.sum[a] -= subset.sum[a];
+    for (int b = a; b < 4; ++b)
+    {
+      moments.products[a][b] -= subset.products[a][b];
+    }
+  }
+  return moments;
+}
+
+// Squared distance of a set from its principal axis, which ranks partitions. An estimate of the
+// axis is enough for that.
+float LineError(const Moments& moments, int channels)
+{
+  if (moments.count <= 0.0f)
+  {
+    return 0.0f;
+  }
+  Statistics stats{};
+  for (int a = 0; a < channels; ++a)
+  {
+    stats.mean[a] = moments.sum[a] / moments.count;
+    for (int b = a; b < channels; ++b)
+    {
+      stats.covariance[a][b] =
+          moments.products[a][b] - moments.sum[a] * moments.sum[b] / moments.count;
+      stats.covariance[b][a] = stats.covariance[a][b];
+    }
+  }
+  const auto axis = PrincipalAxis(stats, channels, 3);
+
+  float total = 0.0f;
+  float along = 0.0f;
+  for (int a = 0; a < channels; ++a)
+  {
+    total += stats.covariance[a][a];
+    for (int b = 0; b < channels; ++b)
+    {
+      along += axis[a] * stats.covariance[a][b] * axis[b];
+    }
+  }
+  return std::max(0.0f, total - along);
+}
+
+// Least squares endpoints for members that are interpolated at t (0 at low, 1 at high).
+bool RefineLine(const Color* colors, const int* members, int count, int channels, const float* t,
+                Line& line)
+{
+  float a = 0.0f;
+  float b = 0.0f;
+  float c = 0.0f;
+  Color x{};
+  Color y{};
+  for (int i = 0; i < count; ++i)
+  {
+    const float high_weight = t[i];
+    const float low_weight = 1.0f - high_weight;
+    a += low_weight * low_weight;
+    b += low_weight * high_weight;
+    c += high_weight * high_weight;
+    for (int ch = 0; ch < channels; ++ch)
+    {
+      x[ch] += low_weight * colors[members[i]][ch];
+      y[ch] += high_weight * colors[members[i]][ch];
+    }
+  }
+
+  const float determinant = a * c - b * b;
+  if (std::abs(determinant) < 1e-6f)
+  {
+    return false;
+  }
+  for (int ch = 0; ch < channels; ++ch)
+  {
+    line.low[ch] = std::clamp((c * x[ch] - b * y[ch]) / determinant, 0.0f, 255.0f);
+    line.high[ch] = std::clamp((a * y[ch] - b * x[ch]) / determinant, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+template <int N>
+float SquaredDistance(const int (&decoded)[N], const Color& color)
+{
+  float distance = 0.0f;
+  for (int c = 0; c < N; ++c)
+  {
+    const float delta = static_cast<float>(decoded[c]) - color[c];
+    distance += delta * delta;
+  }
+  return distance;
+}
+
+void WriteLittleEndian(std::uint64_t value, int bytes, std::uint8_t* out)
+{
+  for (int i = 0; i < bytes; ++i)
+  {
+    out[i] = static_cast<std::uint8_t>(value >> (8 * i));
+  }
+}
+
+struct Bc1Block
+{
+  std::uint16_t c0;
+  std::uint16_t c1;
+  std::uint32_t indices;
+  float         error;
+};
+
+std::uint16_t Pack565(const Color& color)
+{
+  const auto quantize = [](float value, int max)
+  { return static_cast<unsigned int>(std::lround(value * static_cast<float>(max) / 255.0f)); };
+  return static_cast<std::uint16_t>(quantize(color[0], 31) << 11 | quantize(color[1], 63) << 5 |
+                                    quantize(color[2], 31));
+}
+
+void Unpack565(std::uint16_t packed, int (&rgb)[3])
+{
+  const int r = packed >> 11 & 31;
+  const int g = packed >> 5 & 63;
+  const int b = packed & 31;
+  rgb[0] = r << 3 | r >> 2;
+  rgb[1] = g << 2 | g >> 4;
+  rgb[2] = b << 3 | b >> 2;
+}
+
+// Colors of the block as the decoder sees them: four colors when c0 > c1 and always in BC3,
+// otherwise three colors and transparent black at index 3.
+int Bc1Palette(std::uint16_t c0, std::uint16_t c1, bool four_colors, int (&palette)[4][3])
+{
+  Unpack565(c0, palette[0]);
+  Unpack565(c1, palette[1]);
+  for (int c = 0; c < 3; ++c)
+  {
+    if (four_colors)
+    {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    else
+    {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  return four_colors ? 4 : 3;
+}
+
+Bc1Block EvaluateBc1(const Color* colors, const bool* transparent, std::uint16_t c0,
+                     std::uint16_t c1, bool four_colors)
+{
+  int       palette[4][3];
+  const int palette_size = Bc1Palette(c0, c1, four_colors, palette);
+
+  Bc1Block block{c0, c1, 0, 0.0f};
+  for (int i = 0; i < kPixels; ++i)
+  {
+    if (transparent[i])
+    {
+      block.indices |= 3u << (2 * i);
+      continue;
+    }
+    unsigned int best = 0;
+    float        best_error = kInfinity;
+    for (int k = 0; k < palette_size; ++k)
+    {
+      const float error = SquaredDistance(palette[k], colors[i]);
+      if (error < best_error)
+      {
+        best = static_cast<unsigned int>(k);
+        best_error = error;
+      }
+    }
+    block.indices |= best << (2 * i);
+    block.error += best_error;
+  }
+  return block;
+}
+
+// Color half of a BC1 or BC3 block. Only BC1 has the three color mode, which it needs for
+// pixels with alpha below 128 and otherwise tries when the quality is not Fast. The colors of
+// pixels that end up invisible do not take part in the fit.
+Bc1Block EncodeBc1Colors(const Channel* pixels, CompressionQuality quality, bool bc3)
+{
+  const auto colors = LoadColors(pixels);
+  bool       transparent[kPixels]{};
+  bool       any_transparent = false;
+  int        members[kPixels];
+  int        count = 0;
+  for (int i = 0; i < kPixels; ++i)
+  {
+    if (pixels[i * 4 + 3] < (bc3 ? 1 : 128))
+    {
+      transparent[i] = true;
+      any_transparent = true;
+    }
+    else
+    {
+      members[count++] = i;
+    }
+  }
+  if (count == 0)
+  {
+    return {0, 0, 0xFFFFFFFFu, 0.0f};
+  }
+
+  Bc1Block   best{0, 0, 0, kInfinity};
+  const auto consider = [&](const Bc1Block& block)
+  {
+    if (block.error < best.error)
+    {
+      best = block;
+    }
+  };
+  const auto try_line = [&](const Line& line)
+  {
+    const auto a = Pack565(line.low);
+    const auto b = Pack565(line.high);
+    const auto larger = std::max(a, b);
+    const auto smaller = std::min(a, b);
+    if (bc3)
+    {
+      consider(EvaluateBc1(colors.data(), transparent, larger, smaller, true));
+      return;
+    }
+    if (!any_transparent && a != b)
+    {
+      consider(EvaluateBc1(colors.data(), transparent, larger, smaller, true));
+    }
+    if (any_transparent || a == b || quality != CompressionQuality::Fast)
+    {
+      consider(EvaluateBc1(colors.data(), transparent, smaller, larger, false));
+    }
+  };
+
+  Line line = FitLine(colors.data(), members, count, 3);
+  try_line(line);
+  for (int iteration = 0; iteration < RefineIterations(quality) && best.error > 0.0f; ++iteration)
+  {
+    constexpr float kFourColorT[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+    constexpr float kThreeColorT[4] = {0.0f, 1.0f, 0.5f, 0.0f};
+    const float*    position = bc3 || best.c0 > best.c1 ? kFourColorT : kThreeColorT;
+
+    float t[kPixels];
+    for (int i = 0; i < count; ++i)
+    {
+      t[i] = position[best.indices >> (2 * members[i]) & 3];
+    }
+    if (!RefineLine(colors.data(), members, count, 3, t, line))
+    {
+      break;
+    }
+    try_line(line);
+  }
+  return best;
+}
+
+void WriteBc1(const Bc1Block& block, std::uint8_t* out)
+{
+  WriteLittleEndian(block.c0, 2, out);
+  WriteLittleEndian(block.c1, 2, out + 2);
+  WriteLittleEndian(block.indices, 4, out + 4);
+}
+
+struct Bc4Block
+{
+  int           a0;
+  int           a1;
+  std::uint64_t indices;
+  int           error;
+};
+
+Bc4Block EvaluateBc4(const Channel* pixels, int a0, int a1)
+{
+  int palette[8] = {a0, a1};
+  if (a0 > a1)
+  {
+    for (int k = 1; k <= 6; ++k)
+    {
+      palette[k + 1] = ((7 - k) * a0 + k * a1 + 3) / 7;
+    }
+  }
+  else
+  {
+    for (int k = 1; k <= 4; ++k)
+    {
+      palette[k + 1] = ((5 - k) * a0 + k * a1 + 2) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+
+  Bc4Block block{a0, a1, 0, 0};
+  for (int i = 0; i < kPixels; ++i)
+  {
+    const int     alpha = pixels[i * 4 + 3];
+    std::uint64_t best = 0;
+    int           best_error = 256 * 256;
+    for (int k = 0; k < 8; ++k)
+    {
+      const int error = (palette[k] - alpha) * (palette[k] - alpha);
+      if (error < best_error)
+      {
+        best = static_cast<std::uint64_t>(k);
+        best_error = error;
+      }
+    }
+    block.indices |= best << (3 * i);
+    block.error += best_error;
+  }
+  return block;
+}
+
+// Eight interpolated values between the extremes, or six between the extremes other than 0 and
+// 255 plus both of those exactly.
+Bc4Block EncodeBc4(const Channel* pixels, CompressionQuality quality)
+{
+  int low = 255;
+  int high = 0;
+  int inner_low = 255;
+  int inner_high = 0;
+  for (int i = 0; i < kPixels; ++i)
+  {
+    const int alpha = pixels[i * 4 + 3];
+    low = std::min(low, alpha);
+    high = std::max(high, alpha);
+    if (alpha != 0 && alpha != 255)
+    {
+      inner_low = std::min(inner_low, alpha);
+      inner_high = std::max(inner_high, alpha);
+    }
+  }
+
+  auto       best = EvaluateBc4(pixels, high, low);
+  const auto consider = [&](const Bc4Block& block)
+  {
+    if (block.error < best.error)
+    {
+      best = block;
+    }
+  };
+  if (best.error == 0 || quality == CompressionQuality::Fast)
+  {
+    return best;
+  }
+
+  consider(inner_low <= inner_high ? EvaluateBc4(pixels, inner_low, inner_high)
+                                   : EvaluateBc4(pixels, 0, 0));
+  if (quality == CompressionQuality::Thorough)
+  {
+    for (int shrink_high = 0; shrink_high < 4; ++shrink_high)
+    {
+      for (int shrink_low = 0; shrink_low < 4; ++shrink_low)
+      {
+        if (high - shrink_high > low + shrink_low)
+        {
+          consider(EvaluateBc4(pixels, high - shrink_high, low + shrink_low));
+        }
+      }
+    }
+  }
+  return best;
+}
+
+// Pixel i is in the second subset when bit i is set.
+constexpr std::uint16_t kPartitions2[64] = {
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80,
+    0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000, 0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310,
+    0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C, 0xAAAA,
+    0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A, 0x73CE, 0x13C8, 0x324C, 0x3BDC,
+    0x6996, 0xC33C, 0x9966, 0x0660, 0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6,
+    0x639C, 0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+};
+
+// Anchor pixel of the second subset, whose index is stored without its top bit.
+constexpr std::uint8_t kAnchors2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 2,  8,  2,  2,  8,
+    8,  15, 2,  8,  2,  2,  8,  8,  2,  2,  15, 15, 6,  8,  2,  8,  15, 15, 2,  8,  2,  2,
+    2,  15, 15, 6,  6,  2,  6,  8,  15, 15, 2,  2,  15, 15, 15, 15, 15, 2,  2,  15,
+};
+
+constexpr int kWeights2[4] = {0, 21, 43, 64};
+constexpr int kWeights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+constexpr int kWeights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+enum class PBits
+{
+  None,
+  Unique,
+  Shared,
+};
+
+struct Bc7Mode
+{
+  int   number;
+  int   subsets;
+  int   color_bits;
+  int   alpha_bits; // 0 when alpha is not stored and decodes as 255
+  int   index_bits;
+  PBits pbits;
+};
+
+constexpr Bc7Mode kMode1{1, 2, 6, 0, 3, PBits::Shared};
+constexpr Bc7Mode kMode6{6, 1, 7, 7, 4, PBits::Unique};
+constexpr Bc7Mode kMode7{7, 2, 5, 5, 2, PBits::Unique};
+
+// Mode 5 indexes color and alpha separately. Its alpha is fitted as a single channel stored in
+// the red slot, the other channels are zero.
+constexpr Bc7Mode kMode5Color{5, 1, 7, 0, 2, PBits::None};
+constexpr Bc7Mode kMode5Alpha{5, 1, 8, 0, 2, PBits::None};
+
+struct Endpoint
+{
+  int value[4];
+  int pbit;
+};
+
+struct SubsetFit
+{
+  Endpoint endpoints[2];
+  int      indices[kPixels]; // by pixel, only the members of the subset are set
+  float    error;
+};
+
+struct Bc7Candidate
+{
+  const Bc7Mode* mode;
+  int            partition;
+  SubsetFit      subsets[2];
+  float          error;
+};
+
+const int* Weights(int index_bits)
+{
+  switch (index_bits)
+  {
+  case 2:
+    return kWeights2;
+  case 3:
+    return kWeights3;
+  default:
+    return kWeights4;
+  }
+}
+
+int SubsetOf(int partition, int pixel)
+{
+  return partition < 0 ? 0 : kPartitions2[partition] >> pixel & 1;
+}
+
+// Replicates the top bits of a `bits` wide value into the low bits of a byte.
+int Expand(int value, int bits)
+{
+  value <<= 8 - bits;
+  return value | value >> bits;
+}
+
+int DecodeChannel(int value, int bits, int pbit, const Bc7Mode& mode)
+{
+  return mode.pbits == PBits::None ? Expand(value, bits) : Expand(value << 1 | pbit, bits + 1);
+}
+
+void DecodeEndpoint(const Endpoint& endpoint, const Bc7Mode& mode, int (&out)[4])
+{
+  for (int c = 0; c < 3; ++c)
+  {
+    out[c] = DecodeChannel(endpoint.value[c], mode.color_bits, endpoint.pbit, mode);
+  }
+  out[3] = mode.alpha_bits > 0
+               ? DecodeChannel(endpoint.value[3], mode.alpha_bits, endpoint.pbit, mode)
+               : 255;
+}
+
+Endpoint QuantizeEndpoint(const Color& color, const Bc7Mode& mode, int pbit)
+{
+  Endpoint endpoint{{}, pbit};
+  for (int c = 0; c < 4; ++c)
+  {
+    const int bits = c < 3 ? mode.color_bits : mode.alpha_bits;
+    if (bits == 0)
+    {
+      continue;
+    }
+    long value = 0;
+    if (mode.pbits == PBits::None)
+    {
+      value = std::lround(color[c] * static_cast<float>((1 << bits) - 1) / 255.0f);
+    }
+    else
+    {
+      const auto max = static_cast<float>((1 << (bits + 1)) - 1);
+      value = std::lround((color[c] * max / 255.0f - static_cast<float>(pbit)) / 2.0f);
+    }
+    endpoint.value[c] = std::clamp(static_cast<int>(value), 0, (1 << bits) - 1);
+  }
+  return endpoint;
+}
+
+float EndpointError(const Endpoint& endpoint, const Color& color, const Bc7Mode& mode)
+{
+  int decoded[4];
+  DecodeEndpoint(endpoint, mode, decoded);
+  return SquaredDistance(decoded, color);
+}
+
+// Alpha 255 only decodes back from p-bit 1 and alpha 0 from p-bit 0, so opaque and fully
+// transparent endpoints keep their exact alpha.
+bool PBitAllowed(const Color& color, const Bc7Mode& mode, int pbit)
+{
+  if (mode.alpha_bits == 0)
+  {
+    return true;
+  }
+  if (color[3] >= 254.5f)
+  {
+    return pbit == 1;
+  }
+  if (color[3] <= 0.5f)
+  {
+    return pbit == 0;
+  }
+  return true;
+}
+
+void QuantizeLine(const Line& line, const Bc7Mode& mode, Endpoint (&endpoints)[2])
+{
+  if (mode.pbits == PBits::None)
+  {
+    endpoints[0] = QuantizeEndpoint(line.low, mode, 0);
+    endpoints[1] = QuantizeEndpoint(line.high, mode, 0);
+    return;
+  }
+  if (mode.pbits == PBits::Unique)
+  {
+    for (int e = 0; e < 2; ++e)
+    {
+      const Color& color = e == 0 ? line.low : line.high;
+      float        best_error = kInfinity;
+      for (int pbit = 0; pbit < 2; ++pbit)
+      {
+        if (!PBitAllowed(color, mode, pbit))
+        {
+          continue;
+        }
+        const auto  endpoint = QuantizeEndpoint(color, mode, pbit);
+        const float error = EndpointError(endpoint, color, mode);
+        if (error < best_error)
+        {
+          endpoints[e] = endpoint;
+          best_error = error;
+        }
+      }
+    }
+    return;
+  }
+
+  float best_error = kInfinity;
+  for (int pbit = 0; pbit < 2; ++pbit)
+  {
+    const auto  low = QuantizeEndpoint(line.low, mode, pbit);
+    const auto  high = QuantizeEndpoint(line.high, mode, pbit);
+    const float error = EndpointError(low, line.low, mode) + EndpointError(high, line.high, mode);
+    if (error < best_error)
+    {
+      endpoints[0] = low;
+      endpoints[1] = high;
+      best_error = error;
+    }
+  }
+}
+
+float AssignIndices(const Color* colors, const int* members, int count, const Bc7Mode& mode,
+                    const Endpoint (&endpoints)[2], int* indices)
+{
+  int low[4];
+  int high[4];
+  DecodeEndpoint(endpoints[0], mode, low);
+  DecodeEndpoint(endpoints[1], mode, high);
+
+  const int* weights = Weights(mode.index_bits);
+  const int  levels = 1 << mode.index_bits;
+  int        palette[16][4];
+  for (int k = 0; k < levels; ++k)
+  {
+    for (int c = 0; c < 4; ++c)
+    {
+      palette[k][c] = ((64 - weights[k]) * low[c] + weights[k] * high[c] + 32) >> 6;
+    }
+  }
+
+  float error = 0.0f;
+  for (int i = 0; i < count; ++i)
+  {
+    const Color& color = colors[members[i]];
+    int          best = 0;
+    float        best_error = kInfinity;
+    for (int k = 0; k < levels; ++k)
+    {
+      const float distance = SquaredDistance(palette[k], color);
+      if (distance < best_error)
+      {
+        best = k;
+        best_error = distance;
+      }
+    }
+    indices[members[i]] = best;
+    error += best_error;
+  }
+  return error;
+}
+
+SubsetFit FitSubset(const Color* colors, const int* members, int count, const Bc7Mode& mode,
+                    int iterations)
+{
+  const int channels = mode.alpha_bits > 0 ? 4 : 3;
+  Line      line = FitLine(colors, members, count, channels);
+  if (channels == 3)
+  {
+    line.low[3] = 255.0f;
+    line.high[3] = 255.0f;
+  }
+
+  SubsetFit best{};
+  best.error = kInfinity;
+  const auto try_line = [&](const Line& candidate)
+  {
+    SubsetFit fit{};
+    QuantizeLine(candidate, mode, fit.endpoints);
+    fit.error = AssignIndices(colors, members, count, mode, fit.endpoints, fit.indices);
+    if (fit.error < best.error)
+    {
+      best = fit;
+    }
+  };
+  try_line(line);
+
+  const int* weights = Weights(mode.index_bits);
+  for (int iteration = 0; iteration < iterations && best.error > 0.0f; ++iteration)
+  {
+    float t[kPixels];
+    for (int i = 0; i < count; ++i)
+    {
+      t[i] = static_cast<float>(weights[best.indices[members[i]]]) / 64.0f;
+    }
+    if (!RefineLine(colors, members, count, channels, t, line))
+    {
+      break;
+    }
+    try_line(line);
+  }
+  return best;
+}
+
+Bc7Candidate FitPartition(const Color* colors, const Bc7Mode& mode, int partition, int iterations)
+{
+  Bc7Candidate candidate{&mode, partition, {}, 0.0f};
+  for (int subset = 0; subset < mode.subsets; ++subset)
+  {
+    int members[kPixels];
+    int count = 0;
+    for (int i = 0; i < kPixels; ++i)
+    {
+      if (SubsetOf(partition, i) == subset)
+      {
+        members[count++] = i;
+      }
+    }
+    candidate.subsets[subset] = FitSubset(colors, members, count, mode, iterations);
+    candidate.error += candidate.subsets[subset].error;
+  }
+  return candidate;
+}
+
+// Color and alpha of mode 5, fitted apart with their own indices.
+Bc7Candidate FitMode5(const Color* colors, int iterations)
+{
+  std::array<Color, kPixels> opaque{};
+  std::array<Color, kPixels> alpha{};
+  int                        members[kPixels];
+  for (int i = 0; i < kPixels; ++i)
+  {
+    opaque[i] = {colors[i][0], colors[i][1], colors[i][2], 255.0f};
+    alpha[i] = {colors[i][3], 0.0f, 0.0f, 255.0f};
+    members[i] = i;
+  }
+
+  Bc7Candidate candidate{&kMode5Color, -1, {}, 0.0f};
+  candidate.subsets[0] = FitSubset(opaque.data(), members, kPixels, kMode5Color, iterations);
+  candidate.subsets[1] = FitSubset(alpha.data(), members, kPixels, kMode5Alpha, iterations);
+  candidate.error = candidate.subsets[0].error + candidate.subsets[1].error;
+  return candidate;
+}
+
+class CBitWriter
+{
+public:
+  explicit CBitWriter(std::uint8_t* out)
+      : m_out(out)
+  {
+    std::memset(m_out, 0, 16);
+  }
+
+  void Write(unsigned int value, int bits)
+  {
+    for (int bit = 0; bit < bits; ++bit, ++m_position)
+    {
+      if ((value >> bit & 1) != 0)
+      {
+        m_out[m_position >> 3] |= static_cast<std::uint8_t>(1 << (m_position & 7));
+      }
+    }
+  }
+
+private:
+  std::uint8_t* m_out;
+  int           m_position{0};
+};
+
+void WriteBc7Mode5(Bc7Candidate candidate, std::uint8_t* out)
+{
+  for (auto& fit : candidate.subsets)
+  {
+    if (fit.indices[0] > 1)
+    {
+      std::swap(fit.endpoints[0], fit.endpoints[1]);
+      for (int& index : fit.indices)
+      {
+        index = 3 - index;
+      }
+    }
+  }
+
+  CBitWriter writer(out);
+  writer.Write(1u << 5, 6);
+  writer.Write(0, 2); // no channel rotation
+  for (int c = 0; c < 3; ++c)
+  {
+    for (const auto& endpoint : candidate.subsets[0].endpoints)
+    {
+      writer.Write(static_cast<unsigned int>(endpoint.value[c]), 7);
+    }
+  }
+  for (const auto& endpoint : candidate.subsets[1].endpoints)
+  {
+    writer.Write(static_cast<unsigned int>(endpoint.value[0]), 8);
+  }
+  for (const auto& fit : candidate.subsets)
+  {
+    for (int i = 0; i < kPixels; ++i)
+    {
+      writer.Write(static_cast<unsigned int>(fit.indices[i]), i == 0 ? 1 : 2);
+    }
+  }
+}
+
+void WriteBc7(Bc7Candidate candidate, std::uint8_t* out)
+{
+  if (candidate.mode->number == 5)
+  {
+    WriteBc7Mode5(candidate, out);
+    return;
+  }
+
+  const Bc7Mode& mode = *candidate.mode;
+  const int      max_index = (1 << mode.index_bits) - 1;
+  const int      anchors[2] = {0, candidate.partition < 0 ? 0 : kAnchors2[candidate.partition]};
+
+  // the top bit of each anchor index is implied zero, flip the subsets where it is not
+  for (int subset = 0; subset < mode.subsets; ++subset)
+  {
+    auto& fit = candidate.subsets[subset];
+    if (fit.indices[anchors[subset]] <= max_index / 2)
+    {
+      continue;
+    }
+    std::swap(fit.endpoints[0], fit.endpoints[1]);
+    for (int i = 0; i < kPixels; ++i)
+    {
+      if (SubsetOf(candidate.partition, i) == subset)
+      {
+        fit.indices[i] = max_index - fit.indices[i];
+      }
+    }
+  }
+
+  CBitWriter writer(out);
+  writer.Write(1u << mode.number, mode.number + 1);
+  if (mode.subsets > 1)
+  {
+    writer.Write(static_cast<unsigned int>(candidate.partition), 6);
+  }
+  for (int c = 0; c < 4; ++c)
+  {
+    const int bits = c < 3 ? mode.color_bits : mode.alpha_bits;
+    for (int subset = 0; subset < mode.subsets && bits > 0; ++subset)
+    {
+      for (const auto& endpoint : candidate.subsets[subset].endpoints)
+      {
+        writer.Write(static_cast<unsigned int>(endpoint.value[c]), bits);
+      }
+    }
+  }
+  for (int subset = 0; subset < mode.subsets; ++subset)
+  {
+    const auto& endpoints = candidate.subsets[subset].endpoints;
+    writer.Write(static_cast<unsigned int>(endpoints[0].pbit), 1);
+    if (mode.pbits == PBits::Unique)
+    {
+      writer.Write(static_cast<unsigned int>(endpoints[1].pbit), 1);
+    }
+  }
+  for (int i = 0; i < kPixels; ++i)
+  {
+    const int  subset = SubsetOf(candidate.partition, i);
+    const bool anchor = i == anchors[subset];
+    writer.Write(static_cast<unsigned int>(candidate.subsets[subset].indices[i]),
+                 mode.index_bits - (anchor ? 1 : 0));
+  }
+}
+} // namespace
+
+void encode_bc1_block(const Channel* pixels, CompressionQuality quality, std::uint8_t* out)
+{
+  WriteBc1(EncodeBc1Colors(pixels, quality, false), out);
+}
+
+void encode_bc3_block(const Channel* pixels, CompressionQuality quality, std::uint8_t* out)
+{
+  const auto alpha = EncodeBc4(pixels, quality);
+  out[0] = static_cast<std::uint8_t>(alpha.a0);
+  out[1] = static_cast<std::uint8_t>(alpha.a1);
+  WriteLittleEndian(alpha.indices, 6, out + 2);
+  WriteBc1(EncodeBc1Colors(pixels, quality, true), out + 8);
+}
+
+void encode_bc7_block(const Channel* pixels, CompressionQuality quality, std::uint8_t* out)
+{
+  const auto colors = LoadColors(pixels);
+  const int  iterations = RefineIterations(quality);
+  const auto consider = [](Bc7Candidate& best, const Bc7Candidate& candidate)
+  {
+    if (candidate.error < best.error)
+    {
+      best = candidate;
+    }
+  };
+
+  bool opaque = true;
+  for (int i = 0; i < kPixels; ++i)
+  {
+    opaque = opaque && pixels[i * 4 + 3] == 255;
+  }
+
+  auto best = FitPartition(colors.data(), kMode6, -1, iterations);
+  if (!opaque && best.error > 0.0f)
+  {
+    consider(best, FitMode5(colors.data(), iterations));
+  }
+
+  // two subsets only pay off where one line leaves a visible error
+  constexpr float kSubsetThreshold = kPixels * 2.0f;
+  const bool      search_partitions =
+      quality == CompressionQuality::Thorough ||
+      (quality == CompressionQuality::Normal && best.error > kSubsetThreshold);
+  if (!search_partitions || best.error == 0.0f)
+  {
+    WriteBc7(best, out);
+    return;
+  }
+
+  const Bc7Mode& mode = opaque ? kMode1 : kMode7;
+  const int      channels = opaque ? 3 : 4;
+
+  // rank partitions by how well each subset fits a line, then encode the best few
+  const auto                            block_moments = SumMoments(colors.data(), 0xFFFF);
+  std::array<std::pair<float, int>, 64> ranking;
+  for (int partition = 0; partition < 64; ++partition)
+  {
+    const auto second = SumMoments(colors.data(), kPartitions2[partition]);
+    const auto first = SubtractMoments(block_moments, second);
+    ranking[partition] = {LineError(first, channels) + LineError(second, channels), partition};
+  }
+  const int tries = quality == CompressionQuality::Thorough ? 16 : 4;
+  std::partial_sort(ranking.begin(), ranking.begin() + tries, ranking.end());
+  for (int i = 0; i < tries; ++i)
+  {
+    consider(best, FitPartition(colors.data(), mode, ranking[i].second, iterations));
+  }
+  WriteBc7(best, out);
+}
+} // namespace TexturePacker
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <texture_packer/abstract_image.hpp>
+#include <texture_packer/pack_settings.hpp>
+
+#include <cstdint>
+
+namespace TexturePacker
+{
+// Block encoders of 4x4 RGBA32 pixels, 64 bytes in row major order. Each writes one block of
+// the D3D format to out, 8 bytes for BC1 and 16 bytes for BC3 and BC7.
+
+// Pixels with alpha below 128 become transparent black, the rest are stored opaque.
+void encode_bc1_block(const Channel* pixels, CompressionQuality quality, std::uint8_t* out);
+
+void encode_bc3_block(const Channel* pixels, CompressionQuality quality, std::uint8_t* out);
+
+// Uses mode 6, and mode 5 for translucent blocks. Unless the quality is Fast, blocks that one
+// line fits poorly also try mode 1 (opaque) or 7 (translucent) on the most promising two subset
+// partitions.
+void encode_bc7_block(const Channel* pixels, CompressionQuality quality, std::uint8_t* out);
+} // namespace TexturePacker
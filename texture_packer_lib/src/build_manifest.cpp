@@ -0,0 +1,140 @@
+#include "build_manifest.hpp"
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr int kVersion = 3;
+
+std::string HashToString(std::uint64_t hash)
+{
+  return fmt::format("{:016x}", hash);
+}
+
+std::uint64_t HashFromString(const std::string& value)
+{
+  return std::stoull(value, nullptr, 16);
+}
+} // namespace
+
+CBuildManifest CBuildManifest::Load(const std::string& file_path)
+{
+  std::ifstream fs(file_path);
+  if (!fs)
+  {
+    return {};
+  }
+
+  try
+  {
+    const auto root_json = nlohmann::json::parse(fs);
+    if (root_json.at("version").get<int>() != kVersion)
+    {
+      return {};
+    }
+
+    CBuildManifest manifest;
+    manifest.settings_hash = HashFromString(root_json.at("settingsHash").get<std::string>());
+    for (const auto& [input_path, hash] : root_json.at("inputs").items())
+    {
+      manifest.input_hashes[input_path] = HashFromString(hash.get<std::string>());
+    }
+    for (const auto& page_json : root_json.at("pages"))
+    {
+      CManifestPage page;
+      page.image_file_name = page_json.at("image").get<std::string>();
+      page.json_file_name = page_json.at("json").get<std::string>();
+      page.signature = HashFromString(page_json.at("signature").get<std::string>());
+      page.image_hash = HashFromString(page_json.at("imageHash").get<std::string>());
+      page.json_hash = HashFromString(page_json.at("jsonHash").get<std::string>());
+      for (const auto& mipmap_json : page_json.at("mipmaps"))
+      {
+        page.mipmaps.push_back({mipmap_json.at("image").get<std::string>(),
+                                HashFromString(mipmap_json.at("imageHash").get<std::string>())});
+      }
+      manifest.pages.push_back(std::move(page));
+    }
+    return manifest;
+  }
+  catch (const std::exception&)
+  {
+    return {};
+  }
+}
+
+void CBuildManifest::Save(const std::string& file_path) const
+{
+  nlohmann::json root_json;
+  root_json["version"] = kVersion;
+  root_json["settingsHash"] = HashToString(settings_hash);
+
+  nlohmann::json inputs_json = nlohmann::json::object();
+  for (const auto& [input_path, hash] : input_hashes)
+  {
+    inputs_json[input_path] = HashToString(hash);
+  }
+  root_json["inputs"] = inputs_json;
+
+  nlohmann::json pages_json = nlohmann::json::array();
+  for (const auto& page : pages)
+  {
+    nlohmann::json page_json;
+    page_json["image"] = page.image_file_name;
+    page_json["json"] = page.json_file_name;
+    page_json["signature"] = HashToString(page.signature);
+    page_json["imageHash"] = HashToString(page.image_hash);
+    page_json["jsonHash"] = HashToString(page.json_hash);
+    page_json["mipmaps"] = nlohmann::json::array();
+    for (const auto& mipmap : page.mipmaps)
+    {
+      page_json["mipmaps"].push_back(
+          {{"image", mipmap.file_name}, {"imageHash", HashToString(mipmap.hash)}});
+    }
+    pages_json.push_back(page_json);
+  }
+  root_json["pages"] = pages_json;
+
+  const auto content = root_json.dump(4);
+  {
+    std::ifstream     fs(file_path, std::ios::binary);
+    const std::string previous_content{std::istreambuf_iterator<char>(fs),
+                                       std::istreambuf_iterator<char>()};
+    if (fs && previous_content == content)
+    {
+      return;
+    }
+  }
+
+  std::ofstream fs(file_path, std::ios::binary);
+  fs << content;
+}
+
+std::vector<std::string> CManifestPage::GetFileNames() const
+{
+  std::vector<std::string> file_names{image_file_name, json_file_name};
+  for (const auto& mipmap : mipmaps)
+  {
+    file_names.push_back(mipmap.file_name);
+  }
+  return file_names;
+}
+
+const CManifestPage* CBuildManifest::FindPage(const std::string& image_file_name) const
+{
+  for (const auto& page : pages)
+  {
+    if (page.image_file_name == image_file_name)
+    {
+      return &page;
+    }
+  }
+  return nullptr;
+}
+} // namespace TexturePacker
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace TexturePacker
+{
+struct CManifestFile
+{
+  std::string   file_name;
+  std::uint64_t hash{0};
+};
+
+struct CManifestPage
+{
+  // Every file written for the page.
+  [[nodiscard]]
+  std::vector<std::string> GetFileNames() const;
+
+  std::string                image_file_name;
+  std::string                json_file_name;
+  std::uint64_t              signature{0};
+  std::uint64_t              image_hash{0};
+  std::uint64_t              json_hash{0};
+  std::vector<CManifestFile> mipmaps;
+};
+
+// Record of a previous Pack into the same output dir. A page whose signature (settings, layout and
+// sprite contents) and output hashes still match is left untouched on the next build.
+struct CBuildManifest
+{
+  static constexpr const char* kFileName = "texture_packer.manifest.json";
+
+  // An empty manifest when the file is missing or unreadable, so everything is rebuilt.
+  [[nodiscard]]
+  static CBuildManifest Load(const std::string& file_path);
+
+  // Leaves the file untouched when its content would not change.
+  void Save(const std::string& file_path) const;
+
+  [[nodiscard]]
+  const CManifestPage* FindPage(const std::string& image_file_name) const;
+
+  std::uint64_t                        settings_hash{0};
+  std::map<std::string, std::uint64_t> input_hashes;
+  std::vector<CManifestPage>           pages;
+};
+} // namespace TexturePacker
@@ -0,0 +1,128 @@
+#include "composite.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+namespace TexturePacker
+{
+namespace
+{
+// (src * alpha + dst * (255 - alpha)) / 255 with the rounding of SDL's ALPHA_BLEND_CHANNEL.
+Channel BlendChannel(unsigned int src, unsigned int dst, unsigned int alpha)
+{
+  unsigned int value = src * alpha + dst * (255 - alpha) + 1;
+  value += value >> 8;
+  return static_cast<Channel>(value >> 8);
+}
+
+// color * alpha / 255, rounded to nearest.
+Channel PremultiplyChannel(unsigned int color, unsigned int alpha)
+{
+  unsigned int value = color * alpha + 128;
+  value += value >> 8;
+  return static_cast<Channel>(value >> 8);
+}
+} // namespace
+
+void copy_rows(Channel* dst, int dst_pitch, const Channel* src, int src_pitch, int width,
+               int rows, int channels)
+{
+  const auto row_size = static_cast<std::size_t>(width) * channels;
+  if (dst_pitch == src_pitch && static_cast<std::size_t>(dst_pitch) == row_size)
+  {
+    std::memcpy(dst, src, row_size * static_cast<std::size_t>(rows));
+    return;
+  }
+  for (int y = 0; y < rows; ++y)
+  {
+    std::memcpy(dst + static_cast<std::ptrdiff_t>(y) * dst_pitch,
+                src + static_cast<std::ptrdiff_t>(y) * src_pitch,
+                row_size);
+  }
+}
+
+void expand_rows(Channel* dst, int dst_pitch, const Channel* src, int src_pitch, int src_channels,
+                 int width, int rows)
+{
+  const int green = src_channels >= 3 ? 1 : 0;
+  const int blue = src_channels >= 3 ? 2 : 0;
+  for (int y = 0; y < rows; ++y)
+  {
+    Channel*       d = dst + static_cast<std::ptrdiff_t>(y) * dst_pitch;
+    const Channel* s = src + static_cast<std::ptrdiff_t>(y) * src_pitch;
+    for (int x = 0; x < width; ++x, d += 4, s += src_channels)
+    {
+      d[0] = s[0];
+      d[1] = s[green];
+      d[2] = s[blue];
+      d[3] = 255;
+    }
+  }
+}
+
+void blend_rows(Channel* dst, int dst_pitch, const Channel* src, int src_pitch, int width,
+                int rows)
+{
+  for (int y = 0; y < rows; ++y)
+  {
+    Channel*       d = dst + static_cast<std::ptrdiff_t>(y) * dst_pitch;
+    const Channel* s = src + static_cast<std::ptrdiff_t>(y) * src_pitch;
+    for (int x = 0; x < width; ++x, d += 4, s += 4)
+    {
+      const unsigned int src_a = s[3];
+      if (src_a == 0)
+      {
+        continue;
+      }
+      d[0] = BlendChannel(s[0], d[0], src_a);
+      d[1] = BlendChannel(s[1], d[1], src_a);
+      d[2] = BlendChannel(s[2], d[2], src_a);
+      d[3] = BlendChannel(255, d[3], src_a);
+    }
+  }
+}
+
+void premultiply_rows(Channel* dst, int dst_pitch, const Channel* src, int src_pitch, int width,
+                      int rows)
+{
+  for (int y = 0; y < rows; ++y)
+  {
+    Channel*       d = dst + static_cast<std::ptrdiff_t>(y) * dst_pitch;
+    const Channel* s = src + static_cast<std::ptrdiff_t>(y) * src_pitch;
+    for (int x = 0; x < width; ++x, d += 4, s += 4)
+    {
+      const unsigned int alpha = s[3];
+      d[0] = PremultiplyChannel(s[0], alpha);
+      d[1] = PremultiplyChannel(s[1], alpha);
+      d[2] = PremultiplyChannel(s[2], alpha);
+      d[3] = s[3];
+    }
+  }
+}
+
+void composite_rows(CompositeMode mode, bool premultiply, Channel* dst, int dst_pitch,
+                    const Channel* src, int src_pitch, int width, int rows, int src_channels)
+{
+  if (src_channels != 4)
+  {
+    expand_rows(dst, dst_pitch, src, src_pitch, src_channels, width, rows);
+    return;
+  }
+  switch (mode)
+  {
+  case CompositeMode::Copy:
+    if (premultiply)
+    {
+      premultiply_rows(dst, dst_pitch, src, src_pitch, width, rows);
+    }
+    else
+    {
+      copy_rows(dst, dst_pitch, src, src_pitch, width, rows);
+    }
+    break;
+  case CompositeMode::Blend:
+    blend_rows(dst, dst_pitch, src, src_pitch, width, rows);
+    break;
+  }
+}
+} // namespace TexturePacker
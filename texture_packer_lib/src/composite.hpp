@@ -0,0 +1,33 @@
+#pragma once
+
+#include <texture_packer/abstract_image.hpp>
+#include <texture_packer/pack_settings.hpp>
+
+namespace TexturePacker
+{
+// Row kernels on raw RGBA32 buffers. They touch only the given rows, so disjoint row ranges of
+// one destination can run on separate threads.
+
+// Copies `rows` rows of `width` pixels of `channels` bytes, replacing the destination.
+void copy_rows(Channel* dst, int dst_pitch, const Channel* src, int src_pitch, int width,
+               int rows, int channels = 4);
+
+// Widens `rows` rows of `width` gray (1 channel) or RGB24 (3) pixels to opaque RGBA32.
+void expand_rows(Channel* dst, int dst_pitch, const Channel* src, int src_pitch, int src_channels,
+                 int width, int rows);
+
+// Blends `rows` rows of `width` RGBA32 pixels from src over dst, with the same arithmetic as
+// SDL's blended blit.
+void blend_rows(Channel* dst, int dst_pitch, const Channel* src, int src_pitch, int width,
+                int rows);
+
+// Copies `rows` rows of `width` RGBA32 pixels, multiplying color by alpha on the way.
+void premultiply_rows(Channel* dst, int dst_pitch, const Channel* src, int src_pitch, int width,
+                      int rows);
+
+// With `premultiply` the destination holds premultiplied color. Blending needs no separate pass
+// then: src * alpha + dst * (255 - alpha) is already "over" for a premultiplied destination.
+// Sources without alpha are opaque, every mode reduces to widening them to RGBA32.
+void composite_rows(CompositeMode mode, bool premultiply, Channel* dst, int dst_pitch,
+                    const Channel* src, int src_pitch, int width, int rows, int src_channels = 4);
+} // namespace TexturePacker
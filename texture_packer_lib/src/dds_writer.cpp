@@ -0,0 +1,121 @@
+#include "dds_writer.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#include "texture_encoder.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr std::uint32_t kMagic = 0x20534444; // "DDS "
+constexpr std::uint32_t kFourCCDX10 = 0x30315844;
+
+constexpr std::uint32_t kFlagsCaps = 0x1;
+constexpr std::uint32_t kFlagsHeight = 0x2;
+constexpr std::uint32_t kFlagsWidth = 0x4;
+constexpr std::uint32_t kFlagsPitch = 0x8;
+constexpr std::uint32_t kFlagsPixelFormat = 0x1000;
+constexpr std::uint32_t kFlagsLinearSize = 0x80000;
+constexpr std::uint32_t kPixelFormatFourCC = 0x4;
+constexpr std::uint32_t kCapsTexture = 0x1000;
+constexpr std::uint32_t kDimensionTexture2D = 3;
+
+struct DdsPixelFormat
+{
+  std::uint32_t size;
+  std::uint32_t flags;
+  std::uint32_t four_cc;
+  std::uint32_t rgb_bit_count;
+  std::uint32_t bit_masks[4];
+};
+
+struct Header
+{
+  std::uint32_t  magic;
+  std::uint32_t  size;
+  std::uint32_t  flags;
+  std::uint32_t  height;
+  std::uint32_t  width;
+  std::uint32_t  pitch_or_linear_size;
+  std::uint32_t  depth;
+  std::uint32_t  mip_map_count;
+  std::uint32_t  reserved1[11];
+  DdsPixelFormat pixel_format;
+  std::uint32_t  caps[4];
+  std::uint32_t  reserved2;
+  std::uint32_t  dxgi_format;
+  std::uint32_t  resource_dimension;
+  std::uint32_t  misc_flag;
+  std::uint32_t  array_size;
+  std::uint32_t  misc_flags2;
+};
+
+static_assert(sizeof(Header) == 4 + 124 + 20, "magic, DDS_HEADER and DDS_HEADER_DXT10");
+
+std::uint32_t DxgiFormat(TextureCompression compression)
+{
+  switch (compression)
+  {
+  case TextureCompression::None:
+    return 28; // DXGI_FORMAT_R8G8B8A8_UNORM
+  case TextureCompression::BC1:
+    return 71; // DXGI_FORMAT_BC1_UNORM
+  case TextureCompression::BC3:
+    return 77; // DXGI_FORMAT_BC3_UNORM
+  case TextureCompression::BC7:
+    return 98; // DXGI_FORMAT_BC7_UNORM
+  case TextureCompression::ETC2_RGBA:
+  case TextureCompression::ASTC_4x4:
+  case TextureCompression::ASTC_5x4:
+  case TextureCompression::ASTC_5x5:
+  case TextureCompression::ASTC_6x5:
+  case TextureCompression::ASTC_6x6:
+  case TextureCompression::ASTC_8x5:
+  case TextureCompression::ASTC_8x6:
+  case TextureCompression::ASTC_8x8:
+    break;
+  }
+  return 0;
+}
+} // namespace
+
+void write_dds(const std::string& file_path, int width, int height,
+               TextureCompression compression, const std::vector<std::uint8_t>& payload)
+{
+  const auto format = get_block_format(compression);
+  const bool compressed = compression != TextureCompression::None;
+  const auto blocks_x = static_cast<std::uint32_t>(
+      (width + format.block_width - 1) / format.block_width);
+  const auto blocks_y = static_cast<std::uint32_t>(
+      (height + format.block_height - 1) / format.block_height);
+  const auto row_bytes = blocks_x * static_cast<std::uint32_t>(format.block_bytes);
+
+  Header header{};
+  header.magic = kMagic;
+  header.size = 124;
+  header.flags = kFlagsCaps | kFlagsHeight | kFlagsWidth | kFlagsPixelFormat |
+                 (compressed ? kFlagsLinearSize : kFlagsPitch);
+  header.height = static_cast<std::uint32_t>(height);
+  header.width = static_cast<std::uint32_t>(width);
+  header.pitch_or_linear_size = compressed ? row_bytes * blocks_y : row_bytes;
+  header.mip_map_count = 1;
+  header.pixel_format.size = sizeof(DdsPixelFormat);
+  header.pixel_format.flags = kPixelFormatFourCC;
+  header.pixel_format.four_cc = kFourCCDX10;
+  header.caps[0] = kCapsTexture;
+  header.dxgi_format = DxgiFormat(compression);
+  header.resource_dimension = kDimensionTexture2D;
+  header.array_size = 1;
+
+  std::ofstream fs(file_path, std::ios::binary);
+  fs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  fs.write(reinterpret_cast<const char*>(payload.data()),
+           static_cast<std::streamsize>(payload.size()));
+  if (!fs)
+  {
+    throw std::runtime_error("can not write " + file_path);
+  }
+}
+} // namespace TexturePacker
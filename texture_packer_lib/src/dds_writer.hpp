@@ -0,0 +1,14 @@
+#pragma once
+
+#include <texture_packer/pack_settings.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace TexturePacker
+{
+// Writes a single level 2D DDS file with a DX10 header, payload as laid out by encode_texture.
+void write_dds(const std::string& file_path, int width, int height,
+               TextureCompression compression, const std::vector<std::uint8_t>& payload);
+} // namespace TexturePacker
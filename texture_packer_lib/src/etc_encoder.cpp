@@ -0,0 +1,685 @@
+#include "etc_encoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr int       kPixels = 16;
+constexpr long long kWorst = std::numeric_limits<long long>::max();
+
+// ETC1 intensity modifiers {a, b}: selector 0 adds a, 1 adds b, 2 subtracts a, 3 subtracts b.
+constexpr int kModifiers[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}};
+
+constexpr int kAlphaModifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14},
+    {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12},
+    {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11},
+    {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10},
+    {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},
+    {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},
+    {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},
+    {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},
+    {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+// Alpha table 13 holds a zero modifier at selector 4, which stores a constant alpha exactly.
+constexpr int kExactAlphaTable = 13;
+constexpr int kExactAlphaSelector = 4;
+
+// Pixels of the two subblocks, indexed y * 4 + x: side by side without flip, stacked with it.
+constexpr int kSubblocks[2][2][8] = {
+    {{0, 1, 4, 5, 8, 9, 12, 13}, {2, 3, 6, 7, 10, 11, 14, 15}},
+    {{0, 1, 2, 3, 4, 5, 6, 7}, {8, 9, 10, 11, 12, 13, 14, 15}},
+};
+
+using Rgb = std::array<int, 3>;
+using Selectors = std::array<int, kPixels>;
+
+struct Block
+{
+  std::array<Rgb, kPixels> colors;
+  std::array<int, kPixels> alphas;
+  // 1 where the color, or the alpha, of a pixel is fitted
+  std::array<int, kPixels> color_weights;
+  std::array<int, kPixels> alpha_weights;
+};
+
+struct Encoding
+{
+  std::uint64_t bits{0};
+  long long     error{kWorst};
+};
+
+int Clamp255(int value)
+{
+  return std::clamp(value, 0, 255);
+}
+
+int Expand4(int value)
+{
+  return value * 17;
+}
+
+int Expand5(int value)
+{
+  return (value << 3) | (value >> 2);
+}
+
+int Expand6(int value)
+{
+  return (value << 2) | (value >> 4);
+}
+
+int Expand7(int value)
+{
+  return (value << 1) | (value >> 6);
+}
+
+int SquaredError(const Rgb& a, const Rgb& b)
+{
+  const int r = a[0] - b[0];
+  const int g = a[1] - b[1];
+  const int bl = a[2] - b[2];
+  return r * r + g * g + bl * bl;
+}
+
+// Selector bits are stored column major, most significant halves above the least significant.
+std::uint64_t PackSelectors(const Selectors& selectors)
+{
+  std::uint64_t bits = 0;
+  for (int i = 0; i < kPixels; ++i)
+  {
+    const int position = (i % 4) * 4 + i / 4;
+    bits |= static_cast<std::uint64_t>(selectors[i] >> 1) << (16 + position);
+    bits |= static_cast<std::uint64_t>(selectors[i] & 1) << position;
+  }
+  return bits;
+}
+
+void StoreBigEndian(std::uint64_t bits, std::uint8_t* out)
+{
+  for (int i = 0; i < 8; ++i)
+  {
+    out[i] = static_cast<std::uint8_t>(bits >> (56 - 8 * i));
+  }
+}
+
+Block LoadBlock(const Channel* pixels, std::uint64_t visible)
+{
+  Block block{};
+  int   colored = 0;
+  for (int i = 0; i < kPixels; ++i)
+  {
+    block.colors[i] = {pixels[i * 4], pixels[i * 4 + 1], pixels[i * 4 + 2]};
+    block.alphas[i] = pixels[i * 4 + 3];
+    block.alpha_weights[i] = static_cast<int>(visible >> i & 1);
+    block.color_weights[i] = block.alphas[i] > 0 ? block.alpha_weights[i] : 0;
+    colored += block.color_weights[i];
+  }
+  // fully transparent: keep whatever color the page holds there
+  if (colored == 0)
+  {
+    block.color_weights = block.alpha_weights;
+  }
+  return block;
+}
+
+struct SubblockFit
+{
+  long long error{kWorst};
+  int       table{0};
+  Selectors selectors{};
+};
+
+// Best modifier table of a subblock around an 8 bit base color.
+SubblockFit FitTables(const Block& block, const int* members, const Rgb& base)
+{
+  SubblockFit best;
+  for (int table = 0; table < 8; ++table)
+  {
+    SubblockFit fit;
+    fit.table = table;
+    fit.error = 0;
+    for (int m = 0; m < 8 && fit.error < best.error; ++m)
+    {
+      const int i = members[m];
+      int       best_error = std::numeric_limits<int>::max();
+      for (int selector = 0; selector < 4; ++selector)
+      {
+        const int modifier =
+            selector < 2 ? kModifiers[table][selector] : -kModifiers[table][selector - 2];
+        const Rgb color{Clamp255(base[0] + modifier),
+                        Clamp255(base[1] + modifier),
+                        Clamp255(base[2] + modifier)};
+        const int error = SquaredError(color, block.colors[i]);
+        if (error < best_error)
+        {
+          best_error = error;
+          fit.selectors[i] = selector;
+        }
+      }
+      fit.error += static_cast<long long>(best_error) * block.color_weights[i];
+    }
+    if (fit.error < best.error)
+    {
+      best = fit;
+    }
+  }
+  return best;
+}
+
+struct BaseCandidate
+{
+  Rgb         quantized;
+  SubblockFit fit;
+};
+
+// Quantized base colors around the subblock mean, each with its best table. Fast only takes the
+// rounded mean, Normal both roundings of every channel and Thorough one step further out.
+int FitBases(const Block& block, const int* members, int bits, CompressionQuality quality,
+             BaseCandidate* candidates)
+{
+  double sum[3] = {};
+  int    weight = 0;
+  for (int m = 0; m < 8; ++m)
+  {
+    const int i = members[m];
+    for (int c = 0; c < 3; ++c)
+    {
+      sum[c] += block.colors[i][c] * block.color_weights[i];
+    }
+    weight += block.color_weights[i];
+  }
+
+  const int max_value = (1 << bits) - 1;
+  int       options[3][3];
+  int       option_count[3];
+  for (int c = 0; c < 3; ++c)
+  {
+    const double scaled = weight > 0 ? sum[c] / weight * max_value / 255.0 : 0.0;
+    const int    low = static_cast<int>(std::floor(scaled));
+    const int    nearest = static_cast<int>(std::lround(scaled));
+    int          count = 0;
+    switch (quality)
+    {
+    case CompressionQuality::Fast:
+      options[c][count++] = nearest;
+      break;
+    case CompressionQuality::Normal:
+      options[c][count++] = low;
+      options[c][count++] = low + 1;
+      break;
+    case CompressionQuality::Thorough:
+      options[c][count++] = nearest - 1;
+      options[c][count++] = nearest;
+      options[c][count++] = nearest + 1;
+      break;
+    }
+    // out of range options collapse onto their neighbours
+    for (int k = 0; k < count; ++k)
+    {
+      options[c][k] = std::clamp(options[c][k], 0, max_value);
+    }
+    option_count[c] = static_cast<int>(std::unique(options[c], options[c] + count) - options[c]);
+  }
+
+  int candidate_count = 0;
+  for (int r = 0; r < option_count[0]; ++r)
+  {
+    for (int g = 0; g < option_count[1]; ++g)
+    {
+      for (int b = 0; b < option_count[2]; ++b)
+      {
+        auto& candidate = candidates[candidate_count++];
+        candidate.quantized = {options[0][r], options[1][g], options[2][b]};
+        const auto expand = bits == 4 ? Expand4 : Expand5;
+        candidate.fit = FitTables(block,
+                                  members,
+                                  {expand(candidate.quantized[0]),
+                                   expand(candidate.quantized[1]),
+                                   expand(candidate.quantized[2])});
+      }
+    }
+  }
+  return candidate_count;
+}
+
+std::uint64_t PackSubblocks(std::uint64_t colors, int flip, const SubblockFit& first,
+                            const SubblockFit& second)
+{
+  Selectors selectors{};
+  for (int m = 0; m < 8; ++m)
+  {
+    selectors[kSubblocks[flip][0][m]] = first.selectors[kSubblocks[flip][0][m]];
+    selectors[kSubblocks[flip][1][m]] = second.selectors[kSubblocks[flip][1][m]];
+  }
+  return colors | static_cast<std::uint64_t>(first.table) << 37 |
+         static_cast<std::uint64_t>(second.table) << 34 | static_cast<std::uint64_t>(flip) << 32 |
+         PackSelectors(selectors);
+}
+
+Encoding EncodeIndividual(const Block& block, int flip, CompressionQuality quality)
+{
+  BaseCandidate candidates[2][27];
+  Encoding      encoding;
+  encoding.error = 0;
+  std::uint64_t colors = 0;
+  const BaseCandidate* best[2] = {};
+  for (int s = 0; s < 2; ++s)
+  {
+    const int count = FitBases(block, kSubblocks[flip][s], 4, quality, candidates[s]);
+    best[s] = &candidates[s][0];
+    for (int k = 1; k < count; ++k)
+    {
+      if (candidates[s][k].fit.error < best[s]->fit.error)
+      {
+        best[s] = &candidates[s][k];
+      }
+    }
+    encoding.error += best[s]->fit.error;
+    for (int c = 0; c < 3; ++c)
+    {
+      colors |= static_cast<std::uint64_t>(best[s]->quantized[c]) << (60 - 8 * c - 4 * s);
+    }
+  }
+  encoding.bits = PackSubblocks(colors, flip, best[0]->fit, best[1]->fit);
+  return encoding;
+}
+
+bool IsDeltaInRange(const Rgb& first, const Rgb& second)
+{
+  for (int c = 0; c < 3; ++c)
+  {
+    const int delta = second[c] - first[c];
+    if (delta < -4 || delta > 3)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Second subblock color moved within reach of the first one.
+BaseCandidate FitClampedBase(const Block& block, const int* members, const Rgb& first,
+                             const Rgb& wanted)
+{
+  BaseCandidate candidate;
+  for (int c = 0; c < 3; ++c)
+  {
+    candidate.quantized[c] = std::clamp(wanted[c], std::max(first[c] - 4, 0),
+                                        std::min(first[c] + 3, 31));
+  }
+  candidate.fit = FitTables(block,
+                            members,
+                            {Expand5(candidate.quantized[0]),
+                             Expand5(candidate.quantized[1]),
+                             Expand5(candidate.quantized[2])});
+  return candidate;
+}
+
+// The second color is stored as a 3 bit delta of the first; deltas out of range would switch
+// an ETC2 decoder to the T, H or planar mode.
+Encoding EncodeDifferential(const Block& block, int flip, CompressionQuality quality)
+{
+  BaseCandidate candidates[2][27];
+  int           counts[2];
+  for (int s = 0; s < 2; ++s)
+  {
+    counts[s] = FitBases(block, kSubblocks[flip][s], 5, quality, candidates[s]);
+  }
+
+  BaseCandidate first;
+  BaseCandidate second;
+  long long     best_error = kWorst;
+  for (int a = 0; a < counts[0]; ++a)
+  {
+    for (int b = 0; b < counts[1]; ++b)
+    {
+      const long long error = candidates[0][a].fit.error + candidates[1][b].fit.error;
+      if (error < best_error &&
+          IsDeltaInRange(candidates[0][a].quantized, candidates[1][b].quantized))
+      {
+        best_error = error;
+        first = candidates[0][a];
+        second = candidates[1][b];
+      }
+    }
+  }
+  if (best_error == kWorst)
+  {
+    // the subblocks differ too much, pull one towards the other
+    const auto by_error = [](const BaseCandidate& a, const BaseCandidate& b)
+    { return a.fit.error < b.fit.error; };
+    const auto& best_first = *std::min_element(candidates[0], candidates[0] + counts[0], by_error);
+    const auto& best_second = *std::min_element(candidates[1], candidates[1] + counts[1], by_error);
+
+    const auto pulled_second =
+        FitClampedBase(block, kSubblocks[flip][1], best_first.quantized, best_second.quantized);
+    const auto pulled_first =
+        FitClampedBase(block, kSubblocks[flip][0], best_second.quantized, best_first.quantized);
+    if (best_first.fit.error + pulled_second.fit.error <=
+        pulled_first.fit.error + best_second.fit.error)
+    {
+      first = best_first;
+      second = pulled_second;
+    }
+    else
+    {
+      first = pulled_first;
+      second = best_second;
+    }
+    best_error = first.fit.error + second.fit.error;
+  }
+
+  std::uint64_t colors = std::uint64_t{1} << 33;
+  for (int c = 0; c < 3; ++c)
+  {
+    const int delta = second.quantized[c] - first.quantized[c];
+    colors |= static_cast<std::uint64_t>(first.quantized[c]) << (59 - 8 * c);
+    colors |= static_cast<std::uint64_t>(delta & 7) << (56 - 8 * c);
+  }
+  return {PackSubblocks(colors, flip, first.fit, second.fit), best_error};
+}
+
+// Planar colors O, H and V as {r, g, b} triples; red and blue have 6 bits, green 7.
+using PlanarColors = std::array<Rgb, 3>;
+
+constexpr int kPlanarBits[3] = {6, 7, 6};
+
+int PlanarValue(int origin, int horizontal, int vertical, int x, int y)
+{
+  return Clamp255((x * (horizontal - origin) + y * (vertical - origin) + 4 * origin + 2) >> 2);
+}
+
+long long PlanarError(const Block& block, const PlanarColors& quantized)
+{
+  PlanarColors expanded;
+  for (int k = 0; k < 3; ++k)
+  {
+    for (int c = 0; c < 3; ++c)
+    {
+      expanded[k][c] = c == 1 ? Expand7(quantized[k][c]) : Expand6(quantized[k][c]);
+    }
+  }
+  long long error = 0;
+  for (int i = 0; i < kPixels; ++i)
+  {
+    if (block.color_weights[i] == 0)
+    {
+      continue;
+    }
+    const int x = i % 4;
+    const int y = i / 4;
+    Rgb       color;
+    for (int c = 0; c < 3; ++c)
+    {
+      color[c] = PlanarValue(expanded[0][c], expanded[1][c], expanded[2][c], x, y);
+    }
+    error += SquaredError(color, block.colors[i]);
+  }
+  return error;
+}
+
+// Bits 63, 55, 47..45 and 42 are free in planar mode. Red and green read as a differential
+// color must stay in range and blue must overflow, which is what selects planar mode.
+std::uint64_t PackPlanar(const PlanarColors& colors)
+{
+  const auto value = [](int v) { return static_cast<std::uint64_t>(v); };
+  const auto [ro, go, bo] = colors[0];
+  const auto [rh, gh, bh] = colors[1];
+  const auto [rv, gv, bv] = colors[2];
+
+  std::uint64_t bits = value(ro) << 57 | value(go >> 6) << 56 | value(go & 63) << 49 |
+                       value(bo >> 5) << 48 | value((bo >> 3) & 3) << 43 | value(bo & 7) << 39 |
+                       value(rh >> 1) << 34 | std::uint64_t{1} << 33 | value(rh & 1) << 32 |
+                       value(gh) << 25 | value(bh) << 19 | value(rv) << 13 | value(gv) << 6 |
+                       value(bv);
+
+  const auto differential_sum = [&](int shift)
+  {
+    const int base = static_cast<int>(bits >> (shift + 3) & 31);
+    const int delta = static_cast<int>(bits >> shift & 7);
+    return base + (delta >= 4 ? delta - 8 : delta);
+  };
+  if (differential_sum(56) < 0)
+  {
+    bits |= std::uint64_t{1} << 63;
+  }
+  if (differential_sum(48) < 0)
+  {
+    bits |= std::uint64_t{1} << 55;
+  }
+  const int low_bits = static_cast<int>((bits >> 43 & 3) + (bits >> 40 & 3));
+  if (low_bits >= 4)
+  {
+    bits |= std::uint64_t{7} << 45;
+  }
+  else
+  {
+    bits |= std::uint64_t{1} << 42;
+  }
+  return bits;
+}
+
+// Least squares plane through the pixels, then quantized. Normal and Thorough nudge the
+// quantized values one step at a time while that lowers the error.
+Encoding EncodePlanar(const Block& block, CompressionQuality quality)
+{
+  // pixels that do not count still get a tiny weight, which keeps the system solvable
+  constexpr double kMinWeight = 1e-3;
+
+  double matrix[3][3] = {};
+  double rhs[3][3] = {};
+  for (int i = 0; i < kPixels; ++i)
+  {
+    const double x = (i % 4) / 4.0;
+    const double y = (i / 4) / 4.0;
+    const double basis[3] = {1.0 - x - y, x, y};
+    const double weight = std::max<double>(block.color_weights[i], kMinWeight);
+    for (int a = 0; a < 3; ++a)
+    {
+      for (int b = 0; b < 3; ++b)
+      {
+        matrix[a][b] += weight * basis[a] * basis[b];
+      }
+      for (int c = 0; c < 3; ++c)
+      {
+        rhs[c][a] += weight * basis[a] * block.colors[i][c];
+      }
+    }
+  }
+
+  const auto determinant = [](const double m[3][3])
+  {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+           m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  };
+  const double divisor = determinant(matrix);
+
+  PlanarColors quantized{};
+  for (int c = 0; c < 3; ++c)
+  {
+    const int max_value = (1 << kPlanarBits[c]) - 1;
+    for (int k = 0; k < 3; ++k)
+    {
+      // Cramer's rule
+      double replaced[3][3];
+      for (int a = 0; a < 3; ++a)
+      {
+        for (int b = 0; b < 3; ++b)
+        {
+          replaced[a][b] = b == k ? rhs[c][a] : matrix[a][b];
+        }
+      }
+      const double solution = determinant(replaced) / divisor;
+      quantized[k][c] = std::clamp(
+          static_cast<int>(std::lround(solution * max_value / 255.0)), 0, max_value);
+    }
+  }
+
+  long long error = PlanarError(block, quantized);
+  const int passes = quality == CompressionQuality::Thorough ? 3
+                     : quality == CompressionQuality::Normal ? 1
+                                                             : 0;
+  for (int pass = 0; pass < passes; ++pass)
+  {
+    bool improved = false;
+    for (int k = 0; k < 3; ++k)
+    {
+      for (int c = 0; c < 3; ++c)
+      {
+        const int max_value = (1 << kPlanarBits[c]) - 1;
+        for (const int step : {-1, 1})
+        {
+          auto trial = quantized;
+          trial[k][c] = std::clamp(trial[k][c] + step, 0, max_value);
+          const long long trial_error = PlanarError(block, trial);
+          if (trial_error < error)
+          {
+            error = trial_error;
+            quantized = trial;
+            improved = true;
+          }
+        }
+      }
+    }
+    if (!improved)
+    {
+      break;
+    }
+  }
+  return {PackPlanar(quantized), error};
+}
+
+std::uint64_t EncodeColor(const Block& block, CompressionQuality quality)
+{
+  Encoding best = EncodePlanar(block, quality);
+  for (int flip = 0; flip < 2 && best.error > 0; ++flip)
+  {
+    for (const auto& encoding :
+         {EncodeDifferential(block, flip, quality), EncodeIndividual(block, flip, quality)})
+    {
+      if (encoding.error < best.error)
+      {
+        best = encoding;
+      }
+    }
+  }
+  return best.bits;
+}
+
+struct AlphaFit
+{
+  long long error{kWorst};
+  int       base{0};
+  int       multiplier{1};
+  int       table{kExactAlphaTable};
+  Selectors selectors{};
+};
+
+AlphaFit FitAlpha(const Block& block, int base, int multiplier, int table, long long limit)
+{
+  AlphaFit fit{0, base, multiplier, table, {}};
+  for (int i = 0; i < kPixels && fit.error < limit; ++i)
+  {
+    int best_error = std::numeric_limits<int>::max();
+    for (int selector = 0; selector < 8; ++selector)
+    {
+      const int value = Clamp255(base + kAlphaModifiers[table][selector] * multiplier);
+      const int error = (value - block.alphas[i]) * (value - block.alphas[i]);
+      if (error < best_error)
+      {
+        best_error = error;
+        fit.selectors[i] = selector;
+      }
+    }
+    fit.error += static_cast<long long>(best_error) * block.alpha_weights[i];
+  }
+  return fit;
+}
+
+// EAC: an 8 bit base, a multiplier and one of 16 tables of 8 modifiers. Every table is tried
+// with the base and multiplier that span the alpha range; Normal and Thorough search around them.
+std::uint64_t EncodeAlpha(const Block& block, CompressionQuality quality)
+{
+  int low = 255;
+  int high = 0;
+  for (int i = 0; i < kPixels; ++i)
+  {
+    if (block.alpha_weights[i] != 0)
+    {
+      low = std::min(low, block.alphas[i]);
+      high = std::max(high, block.alphas[i]);
+    }
+  }
+
+  AlphaFit best;
+  if (low >= high)
+  {
+    best = FitAlpha(block, low > high ? 255 : low, 1, kExactAlphaTable, kWorst);
+  }
+  else
+  {
+    const int multiplier_radius = quality == CompressionQuality::Fast ? 0 : 1;
+    const int base_radius = quality == CompressionQuality::Thorough ? 4
+                            : quality == CompressionQuality::Normal ? 1
+                                                                    : 0;
+    for (int table = 0; table < 16 && best.error > 0; ++table)
+    {
+      const int* modifiers = kAlphaModifiers[table];
+      const int  span = modifiers[7] - modifiers[3];
+      const int  multiplier =
+          std::clamp(static_cast<int>(std::lround(double(high - low) / span)), 1, 15);
+      for (int m = std::max(1, multiplier - multiplier_radius);
+           m <= std::min(15, multiplier + multiplier_radius);
+           ++m)
+      {
+        // center the table on the alpha range
+        const int base = static_cast<int>(
+            std::lround((low + high) / 2.0 - (modifiers[7] + modifiers[3]) * m / 2.0));
+        for (int b = base - base_radius; b <= base + base_radius; ++b)
+        {
+          const auto fit = FitAlpha(block, Clamp255(b), m, table, best.error);
+          if (fit.error < best.error)
+          {
+            best = fit;
+          }
+        }
+      }
+    }
+  }
+
+  std::uint64_t bits = static_cast<std::uint64_t>(best.base) << 56 |
+                       static_cast<std::uint64_t>(best.multiplier) << 52 |
+                       static_cast<std::uint64_t>(best.table) << 48;
+  for (int i = 0; i < kPixels; ++i)
+  {
+    const int position = (i % 4) * 4 + i / 4;
+    bits |= static_cast<std::uint64_t>(best.selectors[i]) << (45 - 3 * position);
+  }
+  return bits;
+}
+} // namespace
+
+void encode_etc2_rgba_block(const Channel* pixels, std::uint64_t visible,
+                            CompressionQuality quality, std::uint8_t* out)
+{
+  const auto block = LoadBlock(pixels, visible);
+  StoreBigEndian(EncodeAlpha(block, quality), out);
+  StoreBigEndian(EncodeColor(block, quality), out + 8);
+}
+} // namespace TexturePacker
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <texture_packer/abstract_image.hpp>
+#include <texture_packer/pack_settings.hpp>
+
+#include <cstdint>
+
+namespace TexturePacker
+{
+// Encodes 4x4 RGBA32 pixels, 64 bytes in row major order, into one 16 byte ETC2 RGBA8 block: EAC
+// alpha followed by ETC2 color in individual, differential or planar mode. Only the pixels set in
+// `visible` (bit y * 4 + x) are fitted; the others just take their nearest palette entry.
+void encode_etc2_rgba_block(const Channel* pixels, std::uint64_t visible,
+                            CompressionQuality quality, std::uint8_t* out);
+} // namespace TexturePacker
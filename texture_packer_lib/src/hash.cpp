@@ -0,0 +1,174 @@
+#include "hash.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+std::uint64_t RotL(std::uint64_t value, int bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+std::uint64_t Read64(const unsigned char* p)
+{
+  std::uint64_t value = 0;
+  for (int i = 7; i >= 0; --i)
+  {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+std::uint64_t Read32(const unsigned char* p)
+{
+  return std::uint64_t{p[0]} | (std::uint64_t{p[1]} << 8) | (std::uint64_t{p[2]} << 16) |
+         (std::uint64_t{p[3]} << 24);
+}
+
+std::uint64_t Round(std::uint64_t acc, std::uint64_t input)
+{
+  acc += input * kPrime2;
+  acc = RotL(acc, 31);
+  return acc * kPrime1;
+}
+
+std::uint64_t MergeRound(std::uint64_t acc, std::uint64_t value)
+{
+  acc ^= Round(0, value);
+  return acc * kPrime1 + kPrime4;
+}
+} // namespace
+
+CHasher::CHasher(std::uint64_t seed)
+    : m_acc{seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1}
+    , m_seed(seed)
+{
+}
+
+CHasher& CHasher::Update(const void* data, std::size_t size)
+{
+  const auto* p = static_cast<const unsigned char*>(data);
+  m_total_size += size;
+
+  if (m_buffered + size < m_buffer.size())
+  {
+    std::memcpy(m_buffer.data() + m_buffered, p, size);
+    m_buffered += size;
+    return *this;
+  }
+
+  auto consume_stripe = [this](const unsigned char* stripe)
+  {
+    for (std::size_t lane = 0; lane < m_acc.size(); ++lane)
+    {
+      m_acc[lane] = Round(m_acc[lane], Read64(stripe + lane * 8));
+    }
+  };
+
+  if (m_buffered > 0)
+  {
+    const auto fill = m_buffer.size() - m_buffered;
+    std::memcpy(m_buffer.data() + m_buffered, p, fill);
+    consume_stripe(m_buffer.data());
+    p += fill;
+    size -= fill;
+    m_buffered = 0;
+  }
+
+  for (; size >= m_buffer.size(); p += m_buffer.size(), size -= m_buffer.size())
+  {
+    consume_stripe(p);
+  }
+
+  std::memcpy(m_buffer.data(), p, size);
+  m_buffered = size;
+  return *this;
+}
+
+CHasher& CHasher::UpdateString(const std::string& value)
+{
+  UpdateValue(static_cast<std::uint64_t>(value.size()));
+  return Update(value.data(), value.size());
+}
+
+std::uint64_t CHasher::Digest() const
+{
+  std::uint64_t hash = 0;
+  if (m_total_size >= m_buffer.size())
+  {
+    hash = RotL(m_acc[0], 1) + RotL(m_acc[1], 7) + RotL(m_acc[2], 12) + RotL(m_acc[3], 18);
+    for (const auto acc : m_acc)
+    {
+      hash = MergeRound(hash, acc);
+    }
+  }
+  else
+  {
+    hash = m_seed + kPrime5;
+  }
+  hash += m_total_size;
+
+  const unsigned char* p = m_buffer.data();
+  const unsigned char* end = p + m_buffered;
+  for (; p + 8 <= end; p += 8)
+  {
+    hash ^= Round(0, Read64(p));
+    hash = RotL(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (p + 4 <= end)
+  {
+    hash ^= Read32(p) * kPrime1;
+    hash = RotL(hash, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+  {
+    hash ^= *p * kPrime5;
+    hash = RotL(hash, 11) * kPrime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t seed)
+{
+  return CHasher(seed).Update(data, size).Digest();
+}
+
+std::optional<std::uint64_t> hash_file(const std::string& file_path)
+{
+  std::ifstream fs(file_path, std::ios::binary);
+  if (!fs)
+  {
+    return std::nullopt;
+  }
+
+  CHasher           hasher;
+  std::vector<char> buffer(1 << 16);
+  while (fs)
+  {
+    fs.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    hasher.Update(buffer.data(), static_cast<std::size_t>(fs.gcount()));
+  }
+  if (!fs.eof())
+  {
+    return std::nullopt;
+  }
+  return hasher.Digest();
+}
+} // namespace TexturePacker
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace TexturePacker
+{
+// Streaming XXH64, used for content addressing of inputs and outputs.
+class CHasher
+{
+public:
+  explicit CHasher(std::uint64_t seed = 0);
+
+  CHasher& Update(const void* data, std::size_t size);
+
+  template <class T>
+  CHasher& UpdateValue(const T& value)
+  {
+    return Update(&value, sizeof(value));
+  }
+
+  CHasher& UpdateString(const std::string& value);
+
+  [[nodiscard]]
+  std::uint64_t Digest() const;
+
+private:
+  std::array<std::uint64_t, 4> m_acc{};
+  std::array<unsigned char, 32> m_buffer{};
+  std::size_t                   m_buffered{0};
+  std::uint64_t                 m_total_size{0};
+  std::uint64_t                 m_seed{0};
+};
+
+std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t seed = 0);
+
+// Hash of the file content, std::nullopt when the file can not be read.
+std::optional<std::uint64_t> hash_file(const std::string& file_path);
+} // namespace TexturePacker
@@ -1,8 +1,13 @@
 #include <texture_packer/image.hpp>
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <memory>
+#include <utility>
 
+#include "composite.hpp"
+#include "resampler.hpp"
 // #include "magic_image.hpp"
 #include "sdl_image.hpp"
 
@@ -14,27 +19,20 @@ CImage::CImage(const std::string& path)
   // m_impl = std::make_unique<MagicImage>(path);
 }
 
-CImage::CImage(int w, int h)
+CImage::CImage(int w, int h, int channels)
 {
-  m_impl = std::make_unique<SdlImage>(w, h);
+  m_impl = std::make_unique<SdlImage>(w, h, channels);
   // m_impl = std::make_unique<MagicImage>(w, h);
 }
 
-CImage::CImage(const CImage& other)
-    : m_impl(other.m_impl->Clone())
-{
-}
+CImage::CImage(const CImage& other) = default;
 
 CImage::CImage(CImage&& other) noexcept
     : m_impl(std::move(other.m_impl))
 {
 }
 
-CImage& CImage::operator=(const CImage& other)
-{
-  m_impl = other.m_impl->Clone();
-  return *this;
-}
+CImage& CImage::operator=(const CImage& other) = default;
 
 CImage& CImage::operator=(CImage&& other) noexcept
 {
@@ -44,6 +42,14 @@ CImage& CImage::operator=(CImage&& other) noexcept
 
 CImage::~CImage() = default;
 
+void CImage::Detach()
+{
+  if (m_impl.use_count() > 1)
+  {
+    m_impl = m_impl->Clone();
+  }
+}
+
 [[nodiscard]]
 int CImage::Width() const
 {
@@ -62,6 +68,27 @@ int CImage::Channels() const
   return m_impl->Channels();
 }
 
+bool CImage::HasAlpha() const
+{
+  return Channels() == 4;
+}
+
+int CImage::Pitch() const
+{
+  return m_impl->Pitch();
+}
+
+const Channel* CImage::Pixels() const
+{
+  return std::as_const(*m_impl).Pixels();
+}
+
+Channel* CImage::MutablePixels()
+{
+  Detach();
+  return m_impl->Pixels();
+}
+
 void CImage::SaveAsJPEG(const std::string& path) const
 {
   m_impl->SaveAsJPEG(path);
@@ -74,16 +101,20 @@ void CImage::SaveAsPNG(const std::string& path) const
 
 void CImage::Crop(int left, int top, int right, int bottom)
 {
+  Detach();
   m_impl->Crop(left, top, right, bottom);
 }
 
-void CImage::Scale(double scale)
+void CImage::Scale(double scale, ResampleFilter filter, int threads)
 {
-  m_impl->Scale(scale);
+  const int new_w = std::max(1, static_cast<int>(std::round(Width() * scale)));
+  const int new_h = std::max(1, static_cast<int>(std::round(Height() * scale)));
+  *this = resample_image(*this, new_w, new_h, filter, threads);
 }
 
 void CImage::Composite(const CImage& src, int xOffset, int yOffset)
 {
+  Detach();
   m_impl->Composite(*src.m_impl, xOffset, yOffset);
 }
 
@@ -94,13 +125,21 @@ Color CImage::GetColor(int x, int y) const
 
 void CImage::SetColor(int x, int y, Color value)
 {
+  Detach();
   m_impl->SetColor(x, y, value);
 }
 
 void CImage::EnlargeBorder(int size, bool repeat_border)
 {
-  CImage new_image(Width() + size * 2, Height() + size * 2);
-  new_image.Composite(*this, size, size);
+  CImage   new_image(Width() + size * 2, Height() + size * 2, Channels());
+  Channel* dst = new_image.MutablePixels();
+  copy_rows(dst + static_cast<std::ptrdiff_t>(size) * new_image.Pitch() + size * Channels(),
+            new_image.Pitch(),
+            Pixels(),
+            Pitch(),
+            Width(),
+            Height(),
+            Channels());
 
   std::swap(*this, new_image);
 
@@ -135,6 +174,10 @@ CRect CImage::GetBoundingBox() const
 {
   const int width = Width();
   const int height = Height();
+  if (!HasAlpha())
+  {
+    return CRect{0, 0, width, height};
+  }
   int       l = width;
   int       t = height;
   int       r = 0;
@@ -179,6 +222,10 @@ CRect CImage::GetBoundingBox() const
 
 void CImage::CleanPixelAlphaBelow(const Channel alpha)
 {
+  if (!HasAlpha())
+  {
+    return;
+  }
   const auto width = Width();
   const auto height = Height();
   for (int w = 0; w < width; ++w)
@@ -193,6 +240,28 @@ void CImage::CleanPixelAlphaBelow(const Channel alpha)
   }
 }
 
+bool CImage::IsSingleChannel() const
+{
+  if (Channels() == 1)
+  {
+    return true;
+  }
+  bool gray = true;
+  bool white = HasAlpha();
+  for (int y = 0; y < Height() && (gray || white); ++y)
+  {
+    const Channel* pixel = Pixels() + static_cast<std::ptrdiff_t>(y) * Pitch();
+    for (int x = 0; x < Width(); ++x, pixel += Channels())
+    {
+      const bool    uniform = pixel[0] == pixel[1] && pixel[0] == pixel[2];
+      const Channel alpha = HasAlpha() ? pixel[3] : Channel{255};
+      gray = gray && uniform && alpha == 255;
+      white = white && (alpha == 0 || (uniform && pixel[0] == 255));
+    }
+  }
+  return gray || white;
+}
+
 bool CImage::IsBorderPixel(int x, int y) const
 {
   const auto width = Width();
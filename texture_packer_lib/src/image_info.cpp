@@ -1,37 +1,58 @@
 #include <texture_packer/image_info.hpp>
 #include <texture_packer/utils.hpp>
 
+#include <algorithm>
+#include <cmath>
+
 namespace TexturePacker
 {
+namespace
+{
+// Must match the rounding of CImage::Scale, deferred infos size their rects with it.
+Size ScaledSize(Size size, double scale)
+{
+  return {std::max(1, static_cast<int>(std::round(size.w * scale))),
+          std::max(1, static_cast<int>(std::round(size.h * scale)))};
+}
 
-struct CExKeyGenerator
+void CropToBbox(CImage& image, const CRect& bbox)
 {
-  static std::uint32_t NextExKey()
-  {
-    static std::uint32_t ex_key_counter = 0;
-    return ex_key_counter++;
-  }
-};
+  image.Crop(bbox.get_left(),
+             bbox.get_top(),
+             image.Width() - bbox.get_right(),
+             image.Height() - bbox.get_bottom());
+}
+} // namespace
 
 CImageInfo::CImageInfo(CImage _image, std::string _image_path)
     : m_image(std::move(_image))
     , m_image_path(std::move(_image_path))
-    , m_source_rect({0, 0, m_image.Width(), m_image.Height()})
-    , m_source_bbox({0, 0, m_image.Width(), m_image.Height()})
-    , m_source_size{m_image.Width(), m_image.Height()}
-    , m_ex_key(CExKeyGenerator::NextExKey())
+    , m_image_size{m_image->Width(), m_image->Height()}
+    , m_source_rect({0, 0, m_image_size.w, m_image_size.h})
+    , m_source_bbox({0, 0, m_image_size.w, m_image_size.h})
+    , m_source_size{m_image_size}
+{
+}
+
+CImageInfo::CImageInfo(std::string _image_path, Size _image_size)
+    : m_image_path(std::move(_image_path))
+    , m_image_size{_image_size}
+    , m_source_rect({0, 0, m_image_size.w, m_image_size.h})
+    , m_source_bbox({0, 0, m_image_size.w, m_image_size.h})
+    , m_source_size{m_image_size}
 {
 }
 
-CImageInfo::CImageInfo(const CImageInfo& image_info)
-    : m_image(image_info.m_image)
-    , m_image_path(image_info.m_image_path)
-    , m_source_rect(image_info.m_source_rect)
-    , m_source_bbox(image_info.m_source_bbox)
-    , m_source_size(image_info.m_source_size)
-    , m_trimmed(image_info.m_trimmed)
-    , m_extruded(image_info.m_extruded)
-    , m_ex_key(CExKeyGenerator::NextExKey())
+CImageInfo::CImageInfo(CImage _image, std::string _image_path, CRect _source_rect,
+                       CRect _source_bbox, Size _source_size, bool _trimmed, int _extruded)
+    : m_image(std::move(_image))
+    , m_image_path(std::move(_image_path))
+    , m_image_size{m_image->Width(), m_image->Height()}
+    , m_source_rect(_source_rect)
+    , m_source_bbox(_source_bbox)
+    , m_source_size(_source_size)
+    , m_trimmed(_trimmed)
+    , m_extruded(_extruded)
 {
 }
 
@@ -55,14 +76,46 @@ CRect CImageInfo::GetSourceRect() const
   return m_source_rect;
 }
 
-std::uint32_t CImageInfo::GetExKey() const
+bool CImageInfo::IsDeferred() const
+{
+  return !m_image.has_value();
+}
+
+CImage CImageInfo::DecodeScaledImage() const
+{
+  return read_image_from_file(m_image_path, m_scale, m_scale_filter);
+}
+
+CImage CImageInfo::GetImage() const
 {
-  return m_ex_key;
+  if (m_image.has_value())
+  {
+    return *m_image;
+  }
+
+  auto image = DecodeScaledImage();
+  if (m_trimmed)
+  {
+    // m_source_bbox is already shifted by the extrusion applied after the trim
+    auto bbox = m_source_bbox;
+    bbox.x -= m_extruded;
+    bbox.y -= m_extruded;
+    image.CleanPixelAlphaBelow(m_trim_alpha_threshold);
+    CropToBbox(image, bbox);
+  }
+  if (m_extruded)
+  {
+    image.EnlargeBorder(m_extruded, true);
+  }
+  return image;
 }
 
-const CImage& CImageInfo::GetImage() const
+void CImageInfo::Decode()
 {
-  return m_image;
+  if (!m_image.has_value())
+  {
+    m_image = GetImage();
+  }
 }
 
 CImageRect CImageInfo::GetImageRect() const
@@ -70,9 +123,8 @@ CImageRect CImageInfo::GetImageRect() const
   CImageRect image_rect;
   image_rect.x = 0;
   image_rect.y = 0;
-  image_rect.width = m_image.Width();
-  image_rect.height = m_image.Height();
-  image_rect.m_ex_key = m_ex_key;
+  image_rect.width = m_image_size.w;
+  image_rect.height = m_image_size.h;
   return image_rect;
 }
 
@@ -89,7 +141,12 @@ void CImageInfo::Extrude(int size)
   }
 
   m_extruded = size;
-  m_image.EnlargeBorder(m_extruded, true);
+  if (m_image.has_value())
+  {
+    m_image->EnlargeBorder(m_extruded, true);
+  }
+  m_image_size.w += 2 * m_extruded;
+  m_image_size.h += 2 * m_extruded;
 
   m_source_rect.x += m_extruded;
   m_source_rect.y += m_extruded;
@@ -103,21 +160,40 @@ bool CImageInfo::IsTrimmed() const
   return m_trimmed;
 }
 
-void CImageInfo::Scale(double scale)
+void CImageInfo::Scale(double scale, ResampleFilter filter)
 {
-  m_image.Scale(scale);
-  m_source_rect = {0, 0, m_image.Width(), m_image.Height()};
-  m_source_bbox = {0, 0, m_image.Width(), m_image.Height()};
+  m_scale_filter = filter;
+  if (m_image.has_value())
+  {
+    m_image->Scale(scale, filter);
+    m_image_size = {m_image->Width(), m_image->Height()};
+  }
+  else
+  {
+    m_scale *= scale;
+    m_image_size = ScaledSize(m_source_size, m_scale);
+  }
+  m_source_rect = {0, 0, m_image_size.w, m_image_size.h};
+  m_source_bbox = {0, 0, m_image_size.w, m_image_size.h};
 }
 
 void CImageInfo::Trim(unsigned char alpha_threshold)
 {
   m_trimmed = true;
-  m_image.CleanPixelAlphaBelow(alpha_threshold);
-  m_source_bbox = m_image.GetBoundingBox();
-  m_image.Crop(m_source_bbox.get_left(),
-               m_source_bbox.get_top(),
-               m_source_bbox.get_right(),
-               m_source_bbox.get_bottom());
+  m_trim_alpha_threshold = alpha_threshold;
+
+  // A deferred info needs the pixels once to find the bounding box, they are dropped again
+  // and decoded a second time at composition.
+  const bool deferred = IsDeferred();
+  auto       image = deferred ? DecodeScaledImage() : std::move(*m_image);
+  image.CleanPixelAlphaBelow(alpha_threshold);
+  m_source_bbox = image.GetBoundingBox();
+  CropToBbox(image, m_source_bbox);
+  m_image_size = {image.Width(), image.Height()};
+
+  if (!deferred)
+  {
+    m_image = std::move(image);
+  }
 }
 } // namespace TexturePacker
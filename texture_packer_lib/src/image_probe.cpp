@@ -0,0 +1,218 @@
+#include <texture_packer/utils.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+namespace TexturePacker
+{
+namespace
+{
+using Bytes = std::array<unsigned char, 32>;
+
+std::uint32_t ReadBE16(const unsigned char* p)
+{
+  return (std::uint32_t{p[0]} << 8) | p[1];
+}
+
+std::uint32_t ReadBE32(const unsigned char* p)
+{
+  return (ReadBE16(p) << 16) | ReadBE16(p + 2);
+}
+
+std::uint32_t ReadLE16(const unsigned char* p)
+{
+  return (std::uint32_t{p[1]} << 8) | p[0];
+}
+
+std::uint32_t ReadLE24(const unsigned char* p)
+{
+  return (std::uint32_t{p[2]} << 16) | ReadLE16(p);
+}
+
+std::uint32_t ReadLE32(const unsigned char* p)
+{
+  return (std::uint32_t{p[3]} << 24) | ReadLE24(p);
+}
+
+std::optional<Size> ProbePNG(const Bytes& header)
+{
+  static constexpr unsigned char kSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  if (std::memcmp(header.data(), kSignature, sizeof(kSignature)) != 0 ||
+      std::memcmp(header.data() + 12, "IHDR", 4) != 0)
+  {
+    return std::nullopt;
+  }
+  return Size{static_cast<int>(ReadBE32(header.data() + 16)),
+              static_cast<int>(ReadBE32(header.data() + 20))};
+}
+
+std::optional<Size> ProbeQOI(const Bytes& header)
+{
+  if (std::memcmp(header.data(), "qoif", 4) != 0)
+  {
+    return std::nullopt;
+  }
+  return Size{static_cast<int>(ReadBE32(header.data() + 4)),
+              static_cast<int>(ReadBE32(header.data() + 8))};
+}
+
+std::optional<Size> ProbeRawz(const Bytes& header)
+{
+  if (std::memcmp(header.data(), "RAWZ", 4) != 0)
+  {
+    return std::nullopt;
+  }
+  return Size{static_cast<int>(ReadLE32(header.data() + 4)),
+              static_cast<int>(ReadLE32(header.data() + 8))};
+}
+
+std::optional<Size> ProbeWebP(const Bytes& header)
+{
+  if (std::memcmp(header.data(), "RIFF", 4) != 0 || std::memcmp(header.data() + 8, "WEBP", 4) != 0)
+  {
+    return std::nullopt;
+  }
+
+  const unsigned char* chunk = header.data() + 12;
+  const unsigned char* data = chunk + 8;
+  if (std::memcmp(chunk, "VP8 ", 4) == 0)
+  {
+    // frame tag (3 bytes) and start code (3 bytes) precede the 14 bit dimensions
+    return Size{static_cast<int>(ReadLE16(data + 6) & 0x3FFF),
+                static_cast<int>(ReadLE16(data + 8) & 0x3FFF)};
+  }
+  if (std::memcmp(chunk, "VP8L", 4) == 0)
+  {
+    const std::uint32_t bits = ReadLE32(data + 1);
+    return Size{static_cast<int>((bits & 0x3FFF) + 1),
+                static_cast<int>(((bits >> 14) & 0x3FFF) + 1)};
+  }
+  if (std::memcmp(chunk, "VP8X", 4) == 0)
+  {
+    return Size{static_cast<int>(ReadLE24(data + 4) + 1),
+                static_cast<int>(ReadLE24(data + 7) + 1)};
+  }
+  return std::nullopt;
+}
+
+std::optional<Size> ProbeBMP(const Bytes& header)
+{
+  if (header[0] != 'B' || header[1] != 'M')
+  {
+    return std::nullopt;
+  }
+
+  if (ReadLE32(header.data() + 14) == 12)
+  {
+    return Size{static_cast<int>(ReadLE16(header.data() + 18)),
+                static_cast<int>(ReadLE16(header.data() + 20))};
+  }
+  // negative height marks a top-down bitmap
+  const auto height = static_cast<std::int32_t>(ReadLE32(header.data() + 22));
+  return Size{static_cast<int>(ReadLE32(header.data() + 18)), height < 0 ? -height : height};
+}
+
+std::optional<Size> ProbeJPEG(std::ifstream& fs)
+{
+  fs.clear();
+  fs.seekg(2);
+
+  for (;;)
+  {
+    int marker = fs.get();
+    if (marker != 0xFF)
+    {
+      return std::nullopt;
+    }
+    while (marker == 0xFF)
+    {
+      marker = fs.get();
+    }
+    if (marker == EOF)
+    {
+      return std::nullopt;
+    }
+
+    // standalone markers carry no length field
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8))
+    {
+      continue;
+    }
+
+    std::array<unsigned char, 7> segment{};
+    if (!fs.read(reinterpret_cast<char*>(segment.data()), 2))
+    {
+      return std::nullopt;
+    }
+    const auto length = ReadBE16(segment.data());
+    if (length < 2)
+    {
+      return std::nullopt;
+    }
+
+    // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+    const bool is_sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 &&
+                        marker != 0xCC;
+    if (is_sof)
+    {
+      if (!fs.read(reinterpret_cast<char*>(segment.data() + 2), 5))
+      {
+        return std::nullopt;
+      }
+      return Size{static_cast<int>(ReadBE16(segment.data() + 5)),
+                  static_cast<int>(ReadBE16(segment.data() + 3))};
+    }
+
+    if (marker == 0xDA || marker == 0xD9)
+    {
+      return std::nullopt;
+    }
+    fs.seekg(length - 2, std::ios::cur);
+  }
+}
+} // namespace
+
+std::optional<Size> read_image_size_from_file(const std::string& file_path)
+{
+  std::ifstream fs(file_path, std::ios::binary);
+  Bytes         header{};
+  if (!fs.read(reinterpret_cast<char*>(header.data()), header.size()) && fs.gcount() < 4)
+  {
+    return std::nullopt;
+  }
+
+  std::optional<Size> size;
+  if (header[0] == 0xFF && header[1] == 0xD8)
+  {
+    size = ProbeJPEG(fs);
+  }
+  else
+  {
+    size = ProbePNG(header);
+    if (!size)
+    {
+      size = ProbeWebP(header);
+    }
+    if (!size)
+    {
+      size = ProbeBMP(header);
+    }
+    if (!size)
+    {
+      size = ProbeQOI(header);
+    }
+    if (!size)
+    {
+      size = ProbeRawz(header);
+    }
+  }
+
+  if (size && (size->w <= 0 || size->h <= 0))
+  {
+    return std::nullopt;
+  }
+  return size;
+}
+} // namespace TexturePacker
@@ -0,0 +1,308 @@
+#include "ktx2_writer.hpp"
+
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "pixel_format.hpp"
+#include "texture_encoder.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr std::uint8_t kIdentifier[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A}; // «KTX 20»\r\n\x1A\n
+
+constexpr std::uint32_t kSupercompressionNone = 0;
+constexpr std::uint32_t kSupercompressionZstd = 2;
+
+constexpr std::uint8_t kColorModelRgbsda = 1;
+constexpr std::uint8_t kColorModelBc1a = 128;
+constexpr std::uint8_t kColorModelBc3 = 130;
+constexpr std::uint8_t kColorModelBc7 = 134;
+constexpr std::uint8_t kColorModelEtc2 = 161;
+constexpr std::uint8_t kColorModelAstc = 162;
+constexpr std::uint8_t kColorPrimariesBt709 = 1;
+constexpr std::uint8_t kTransferLinear = 1;
+constexpr std::uint8_t kFlagAlphaPremultiplied = 1;
+constexpr std::uint8_t kChannelAlpha = 15;
+
+constexpr char kSwizzleKey[] = "KTXswizzle";
+constexpr char kWriterKey[] = "KTXwriter";
+constexpr char kWriterValue[] = "texture_packer";
+
+// One channel of the data format descriptor: which bits of a texel or block it occupies.
+struct Sample
+{
+  std::uint16_t bit_offset;
+  std::uint8_t  bit_length;
+  std::uint8_t  channel;
+  std::uint32_t upper;
+};
+
+struct Format
+{
+  std::uint32_t       vk_format;
+  std::uint8_t        color_model;
+  std::vector<Sample> samples;
+  // how the channels map to RGBA when the format has fewer of them, empty for the identity
+  const char* swizzle{""};
+  // size of the words a texel is made of, 2 for the packed 16 bit formats
+  std::uint32_t type_size{1};
+};
+
+// VK_FORMAT_*_UNORM and VK_FORMAT_*_UNORM_PACK16 of the uncompressed pixel formats
+Format GetPixelFormat(PixelFormat pixel_format)
+{
+  switch (pixel_format)
+  {
+  case PixelFormat::RGBA8:
+    return {37,
+            kColorModelRgbsda,
+            {{0, 8, 0, 255}, {8, 8, 1, 255}, {16, 8, 2, 255}, {24, 8, kChannelAlpha, 255}}};
+  case PixelFormat::RGB8:
+    return {23, kColorModelRgbsda, {{0, 8, 0, 255}, {8, 8, 1, 255}, {16, 8, 2, 255}}};
+  case PixelFormat::LA8:
+    return {16, kColorModelRgbsda, {{0, 8, 0, 255}, {8, 8, 1, 255}}, "rrrg"};
+  case PixelFormat::L8:
+    return {9, kColorModelRgbsda, {{0, 8, 0, 255}}, "rrr1"};
+  case PixelFormat::A8:
+    return {9, kColorModelRgbsda, {{0, 8, 0, 255}}, "111r"};
+  case PixelFormat::RGBA4444:
+    return {2,
+            kColorModelRgbsda,
+            {{0, 4, kChannelAlpha, 15}, {4, 4, 2, 15}, {8, 4, 1, 15}, {12, 4, 0, 15}},
+            "",
+            2};
+  case PixelFormat::RGB565:
+    return {4, kColorModelRgbsda, {{0, 5, 2, 31}, {5, 6, 1, 63}, {11, 5, 0, 31}}, "", 2};
+  }
+  throw std::runtime_error("unsupported pixel format");
+}
+
+Format GetFormat(TextureCompression compression, PixelFormat pixel_format)
+{
+  // VK_FORMAT_*_UNORM_BLOCK for the compressed ones
+  switch (compression)
+  {
+  case TextureCompression::None:
+    return GetPixelFormat(pixel_format);
+  case TextureCompression::BC1:
+    return {133, kColorModelBc1a, {{0, 64, 1, 0xFFFFFFFF}}};
+  case TextureCompression::BC3:
+    return {137, kColorModelBc3, {{0, 64, kChannelAlpha, 0xFFFFFFFF}, {64, 64, 0, 0xFFFFFFFF}}};
+  case TextureCompression::BC7:
+    return {145, kColorModelBc7, {{0, 128, 0, 0xFFFFFFFF}}};
+  case TextureCompression::ETC2_RGBA:
+    return {151, kColorModelEtc2, {{0, 64, kChannelAlpha, 0xFFFFFFFF}, {64, 64, 2, 0xFFFFFFFF}}};
+  case TextureCompression::ASTC_4x4:
+    return {157, kColorModelAstc, {{0, 128, 0, 0xFFFFFFFF}}};
+  case TextureCompression::ASTC_5x4:
+    return {159, kColorModelAstc, {{0, 128, 0, 0xFFFFFFFF}}};
+  case TextureCompression::ASTC_5x5:
+    return {161, kColorModelAstc, {{0, 128, 0, 0xFFFFFFFF}}};
+  case TextureCompression::ASTC_6x5:
+    return {163, kColorModelAstc, {{0, 128, 0, 0xFFFFFFFF}}};
+  case TextureCompression::ASTC_6x6:
+    return {165, kColorModelAstc, {{0, 128, 0, 0xFFFFFFFF}}};
+  case TextureCompression::ASTC_8x5:
+    return {167, kColorModelAstc, {{0, 128, 0, 0xFFFFFFFF}}};
+  case TextureCompression::ASTC_8x6:
+    return {169, kColorModelAstc, {{0, 128, 0, 0xFFFFFFFF}}};
+  case TextureCompression::ASTC_8x8:
+    return {171, kColorModelAstc, {{0, 128, 0, 0xFFFFFFFF}}};
+  }
+  throw std::runtime_error("unsupported texture compression");
+}
+
+void Put32(std::vector<std::uint8_t>& out, std::uint32_t value)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    out.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+  }
+}
+
+void Put64(std::vector<std::uint8_t>& out, std::uint64_t value)
+{
+  Put32(out, static_cast<std::uint32_t>(value));
+  Put32(out, static_cast<std::uint32_t>(value >> 32));
+}
+
+// Bytes of one block, or of one texel of an uncompressed format.
+int GetBlockBytes(TextureCompression compression, PixelFormat pixel_format)
+{
+  return compression == TextureCompression::None ? pixel_format_bytes(pixel_format)
+                                                 : get_block_format(compression).block_bytes;
+}
+
+// Basic data format descriptor block, preceded by the total descriptor size.
+std::vector<std::uint8_t> MakeDataFormatDescriptor(TextureCompression compression,
+                                                   PixelFormat pixel_format, bool supercompressed,
+                                                   bool premultiplied)
+{
+  const auto format = GetFormat(compression, pixel_format);
+  const auto block = get_block_format(compression);
+  const auto block_size = static_cast<std::uint32_t>(24 + 16 * format.samples.size());
+
+  std::vector<std::uint8_t> dfd;
+  Put32(dfd, 4 + block_size);
+  Put32(dfd, 0); // Khronos vendor, basic descriptor type
+  Put32(dfd, 2 | block_size << 16);
+  dfd.push_back(format.color_model);
+  dfd.push_back(kColorPrimariesBt709);
+  dfd.push_back(kTransferLinear);
+  dfd.push_back(premultiplied ? kFlagAlphaPremultiplied : 0);
+  dfd.push_back(static_cast<std::uint8_t>(block.block_width - 1));
+  dfd.push_back(static_cast<std::uint8_t>(block.block_height - 1));
+  dfd.push_back(0);
+  dfd.push_back(0);
+  // bytes per block of the only plane, left unsized once the levels are supercompressed
+  dfd.push_back(supercompressed
+                    ? 0
+                    : static_cast<std::uint8_t>(GetBlockBytes(compression, pixel_format)));
+  dfd.insert(dfd.end(), 7, 0);
+  for (const auto& sample : format.samples)
+  {
+    Put32(dfd,
+          sample.bit_offset | static_cast<std::uint32_t>(sample.bit_length - 1) << 16 |
+              static_cast<std::uint32_t>(sample.channel) << 24);
+    Put32(dfd, 0); // sample position
+    Put32(dfd, 0); // lower
+    Put32(dfd, sample.upper);
+  }
+  return dfd;
+}
+
+void PutKeyValue(std::vector<std::uint8_t>& kvd, const std::string& key, const std::string& value)
+{
+  // both null terminated, each entry padded to 4 bytes
+  Put32(kvd, static_cast<std::uint32_t>(key.size() + value.size() + 2));
+  kvd.insert(kvd.end(), key.c_str(), key.c_str() + key.size() + 1);
+  kvd.insert(kvd.end(), value.c_str(), value.c_str() + value.size() + 1);
+  kvd.resize((kvd.size() + 3) / 4 * 4, 0);
+}
+
+// Keys go in byte order.
+std::vector<std::uint8_t> MakeKeyValueData(const Format& format)
+{
+  std::vector<std::uint8_t> kvd;
+  if (*format.swizzle != '\0')
+  {
+    PutKeyValue(kvd, kSwizzleKey, format.swizzle);
+  }
+  PutKeyValue(kvd, kWriterKey, kWriterValue);
+  return kvd;
+}
+
+std::vector<std::uint8_t> Supercompress(const std::vector<std::uint8_t>& level, int zstd_level)
+{
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+  std::vector<std::uint8_t> compressed(ZSTD_compressBound(level.size()));
+  const auto size =
+      ZSTD_compress(compressed.data(), compressed.size(), level.data(), level.size(), zstd_level);
+  if (ZSTD_isError(size))
+  {
+    throw std::runtime_error(std::string("zstd supercompression failed: ") +
+                             ZSTD_getErrorName(size));
+  }
+  compressed.resize(size);
+  return compressed;
+#else
+  (void)level;
+  (void)zstd_level;
+  throw std::runtime_error("zstd supercompression is not available in this build");
+#endif
+}
+} // namespace
+
+void write_ktx2(const std::string& file_path, int width, int height,
+                TextureCompression                            compression,
+                const std::vector<std::vector<std::uint8_t>>& levels,
+                int zstd_level, bool premultiplied, PixelFormat pixel_format)
+{
+  const bool supercompressed = zstd_level > 0;
+  const auto format = GetFormat(compression, pixel_format);
+  const auto dfd =
+      MakeDataFormatDescriptor(compression, pixel_format, supercompressed, premultiplied);
+  const auto kvd = MakeKeyValueData(format);
+
+  std::vector<std::vector<std::uint8_t>> compressed_levels;
+  if (supercompressed)
+  {
+    for (const auto& level : levels)
+    {
+      compressed_levels.push_back(Supercompress(level, zstd_level));
+    }
+  }
+  const auto& stored_levels = supercompressed ? compressed_levels : levels;
+
+  // identifier, header, index and level index, then the descriptor and key/value data
+  const std::size_t dfd_offset = sizeof(kIdentifier) + 9 * 4 + 4 * 4 + 2 * 8 + levels.size() * 24;
+  const std::size_t kvd_offset = dfd_offset + dfd.size();
+
+  // Levels go smallest first. Unless supercompressed, each starts at a multiple of both the block
+  // size and 4.
+  const auto alignment =
+      supercompressed
+          ? std::size_t{1}
+          : std::lcm(static_cast<std::size_t>(GetBlockBytes(compression, pixel_format)),
+                     std::size_t{4});
+  std::vector<std::size_t> level_offsets(levels.size());
+  std::size_t              offset = kvd_offset + kvd.size();
+  for (std::size_t i = levels.size(); i-- > 0;)
+  {
+    offset = (offset + alignment - 1) / alignment * alignment;
+    level_offsets[i] = offset;
+    offset += stored_levels[i].size();
+  }
+
+  std::vector<std::uint8_t> header(kIdentifier, kIdentifier + sizeof(kIdentifier));
+  Put32(header, format.vk_format);
+  Put32(header, format.type_size);
+  Put32(header, static_cast<std::uint32_t>(width));
+  Put32(header, static_cast<std::uint32_t>(height));
+  Put32(header, 0); // depth
+  Put32(header, 0); // layers
+  Put32(header, 1); // faces
+  Put32(header, static_cast<std::uint32_t>(levels.size()));
+  Put32(header, supercompressed ? kSupercompressionZstd : kSupercompressionNone);
+  Put32(header, static_cast<std::uint32_t>(dfd_offset));
+  Put32(header, static_cast<std::uint32_t>(dfd.size()));
+  Put32(header, static_cast<std::uint32_t>(kvd_offset));
+  Put32(header, static_cast<std::uint32_t>(kvd.size()));
+  Put64(header, 0); // no supercompression global data
+  Put64(header, 0);
+  for (std::size_t i = 0; i < levels.size(); ++i)
+  {
+    Put64(header, level_offsets[i]);
+    Put64(header, stored_levels[i].size());
+    Put64(header, levels[i].size());
+  }
+  header.insert(header.end(), dfd.begin(), dfd.end());
+  header.insert(header.end(), kvd.begin(), kvd.end());
+
+  std::ofstream fs(file_path, std::ios::binary);
+  fs.write(reinterpret_cast<const char*>(header.data()),
+           static_cast<std::streamsize>(header.size()));
+  std::size_t position = header.size();
+  for (std::size_t i = levels.size(); i-- > 0;)
+  {
+    const char padding[16] = {};
+    fs.write(padding, static_cast<std::streamsize>(level_offsets[i] - position));
+    fs.write(reinterpret_cast<const char*>(stored_levels[i].data()),
+             static_cast<std::streamsize>(stored_levels[i].size()));
+    position = level_offsets[i] + stored_levels[i].size();
+  }
+  if (!fs)
+  {
+    throw std::runtime_error("can not write " + file_path);
+  }
+}
+} // namespace TexturePacker
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <texture_packer/pack_settings.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace TexturePacker
+{
+// Writes a 2D KTX2 file. levels[0] is the width x height image and each following one half the
+// size of the previous, payloads as laid out by encode_texture, or by pack_pixels in pixel_format
+// when uncompressed. With a zstd_level above 0 every level is zstd supercompressed, which throws
+// a std::runtime_error in builds without zstd.
+void write_ktx2(const std::string& file_path, int width, int height,
+                TextureCompression                            compression,
+                const std::vector<std::vector<std::uint8_t>>& levels,
+                int zstd_level = 0, bool premultiplied = false,
+                PixelFormat pixel_format = PixelFormat::RGBA8);
+} // namespace TexturePacker
@@ -0,0 +1,314 @@
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+#include "thread_pool.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr int    kChannels = 4;
+constexpr int    kBandRows = 32;
+constexpr double kPi = 3.14159265358979323846;
+
+// How the channels of a texel weigh each other. Alpha weighs color by alpha, Premultiplied
+// filters color already multiplied by alpha as is; both keep color within what alpha allows.
+// Independent filters every channel on its own, for pages whose channels hold separate planes.
+enum class Weighting
+{
+  Alpha,
+  Premultiplied,
+  Independent,
+};
+
+// Weights of a 2:1 reduction. Destination texel o covers source texels 2o and 2o + 1, tap j
+// reads source texel 2o + first_offset + j.
+struct Taps
+{
+  int                first_offset;
+  std::vector<float> weights;
+};
+
+double BesselI0(double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; ++k)
+  {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+Taps MakeTaps(MipmapFilter filter)
+{
+  if (filter == MipmapFilter::Box)
+  {
+    return {0, {0.5f, 0.5f}};
+  }
+
+  // sinc cut off at the new Nyquist frequency, Kaiser window with alpha 4 over 3 source texels
+  constexpr double kAlpha = 4.0;
+  constexpr double kRadius = 3.0;
+
+  std::vector<double> weights;
+  double              sum = 0.0;
+  for (int j = -2; j <= 3; ++j)
+  {
+    const double distance = j - 0.5;
+    const double x = kPi * distance / 2;
+    const double t = distance / kRadius;
+    const double weight =
+        std::sin(x) / x * BesselI0(kAlpha * std::sqrt(1.0 - t * t)) / BesselI0(kAlpha);
+    weights.push_back(weight);
+    sum += weight;
+  }
+
+  Taps taps{-2, {}};
+  for (const double weight : weights)
+  {
+    taps.weights.push_back(static_cast<float>(weight / sum));
+  }
+  return taps;
+}
+
+// Filters dst_rect of the destination level from the source level, reading only source texels
+// inside clamp_rect. Rows are filtered horizontally into premultiplied floats first, then
+// columns. A premultiplied source is filtered as is and stays premultiplied.
+void DownsampleRect(const Channel* src, int src_pitch, const CRect& clamp_rect, Channel* dst,
+                    int dst_pitch, const CRect& dst_rect, const Taps& taps, Weighting weighting)
+{
+  const int  tap_count = static_cast<int>(taps.weights.size());
+  const auto clamp_x = [&](int x)
+  { return std::clamp(x, clamp_rect.get_left(), clamp_rect.get_right() - 1); };
+  const auto clamp_y = [&](int y)
+  { return std::clamp(y, clamp_rect.get_top(), clamp_rect.get_bottom() - 1); };
+
+  const int first_row = clamp_y(2 * dst_rect.get_top() + taps.first_offset);
+  const int last_row =
+      clamp_y(2 * (dst_rect.get_bottom() - 1) + taps.first_offset + tap_count - 1);
+  const int row_size = dst_rect.width * kChannels;
+
+  std::vector<float> rows(static_cast<std::size_t>(last_row - first_row + 1) * row_size);
+  for (int y = first_row; y <= last_row; ++y)
+  {
+    const Channel* src_row = src + static_cast<std::ptrdiff_t>(y) * src_pitch;
+    float*         out = &rows[static_cast<std::size_t>(y - first_row) * row_size];
+    for (int x = 0; x < dst_rect.width; ++x, out += kChannels)
+    {
+      const int base = 2 * (dst_rect.x + x) + taps.first_offset;
+      float     sum[kChannels] = {};
+      for (int j = 0; j < tap_count; ++j)
+      {
+        const Channel* pixel = src_row + clamp_x(base + j) * kChannels;
+        const float    weight = taps.weights[j] * pixel[3];
+        const float    color_weight = weighting == Weighting::Alpha ? weight : taps.weights[j];
+        sum[0] += color_weight * pixel[0];
+        sum[1] += color_weight * pixel[1];
+        sum[2] += color_weight * pixel[2];
+        sum[3] += weight;
+      }
+      std::copy(sum, sum + kChannels, out);
+    }
+  }
+
+  for (int y = 0; y < dst_rect.height; ++y)
+  {
+    const int base = 2 * (dst_rect.y + y) + taps.first_offset;
+    Channel*  out = dst + static_cast<std::ptrdiff_t>(dst_rect.y + y) * dst_pitch +
+                   static_cast<std::ptrdiff_t>(dst_rect.x) * kChannels;
+    for (int x = 0; x < dst_rect.width; ++x, out += kChannels)
+    {
+      float sum[kChannels] = {};
+      for (int j = 0; j < tap_count; ++j)
+      {
+        const auto   row = static_cast<std::size_t>(clamp_y(base + j) - first_row);
+        const float* in = &rows[row * row_size + static_cast<std::size_t>(x) * kChannels];
+        for (int c = 0; c < kChannels; ++c)
+        {
+          sum[c] += taps.weights[j] * in[c];
+        }
+      }
+
+      if (weighting == Weighting::Independent)
+      {
+        for (int c = 0; c < kChannels; ++c)
+        {
+          out[c] = static_cast<Channel>(std::clamp(sum[c] + 0.5f, 0.0f, 255.0f));
+        }
+        continue;
+      }
+
+      const float alpha = sum[3];
+      if (alpha < 0.5f)
+      {
+        std::fill(out, out + kChannels, Channel{0});
+        continue;
+      }
+      out[3] = static_cast<Channel>(std::min(alpha + 0.5f, 255.0f));
+      // premultiplied color can not exceed its alpha
+      const bool  premultiplied = weighting == Weighting::Premultiplied;
+      const float limit = premultiplied ? out[3] : 255.0f;
+      for (int c = 0; c < 3; ++c)
+      {
+        const float value = premultiplied ? sum[c] : sum[c] / alpha;
+        out[c] = static_cast<Channel>(std::clamp(value + 0.5f, 0.0f, limit));
+      }
+    }
+  }
+}
+
+std::vector<CImage> BuildMipmaps(const CImage& page, const std::vector<CRect>& regions,
+                                 int levels, MipmapFilter filter, Weighting weighting, int threads)
+{
+  const auto taps = MakeTaps(filter);
+
+  std::vector<CRect> src_regions;
+  for (const auto& region : regions)
+  {
+    const int left = std::max(region.get_left(), 0);
+    const int top = std::max(region.get_top(), 0);
+    const int right = std::min(region.get_right(), page.Width());
+    const int bottom = std::min(region.get_bottom(), page.Height());
+    if (right > left && bottom > top)
+    {
+      src_regions.push_back({left, top, right - left, bottom - top});
+    }
+  }
+
+  CThreadPool         thread_pool(threads);
+  std::vector<CImage> mipmaps;
+  CImage              src = page;
+  const int           level_count = mipmap_level_count(page.Width(), page.Height(), levels);
+  for (int level = 1; level <= level_count; ++level)
+  {
+    CImage         dst(std::max(1, src.Width() / 2), std::max(1, src.Height() / 2));
+    const Channel* src_pixels = src.Pixels();
+    Channel*       dst_pixels = dst.MutablePixels();
+    const CRect    src_rect{0, 0, src.Width(), src.Height()};
+
+    // gutters and free space, filtered as one image
+    const auto band_count =
+        static_cast<std::size_t>((dst.Height() + kBandRows - 1) / kBandRows);
+    thread_pool.ParallelFor(band_count,
+                            [&](std::size_t band)
+                            {
+                              const int top = static_cast<int>(band) * kBandRows;
+                              const CRect band_rect{
+                                  0, top, dst.Width(), std::min(kBandRows, dst.Height() - top)};
+                              DownsampleRect(src_pixels,
+                                             src.Pitch(),
+                                             src_rect,
+                                             dst_pixels,
+                                             dst.Pitch(),
+                                             band_rect,
+                                             taps,
+                                             weighting);
+                            });
+
+    std::vector<std::pair<CRect, CRect>> region_pairs;
+    for (const auto& region : src_regions)
+    {
+      const auto dst_region = halve_mipmap_region(region, dst.Width(), dst.Height());
+      if (dst_region.width > 0 && dst_region.height > 0)
+      {
+        region_pairs.emplace_back(region, dst_region);
+      }
+    }
+    thread_pool.ParallelFor(region_pairs.size(),
+                            [&](std::size_t index)
+                            {
+                              const auto& [src_region, dst_region] = region_pairs[index];
+                              DownsampleRect(src_pixels,
+                                             src.Pitch(),
+                                             src_region,
+                                             dst_pixels,
+                                             dst.Pitch(),
+                                             dst_region,
+                                             taps,
+                                             weighting);
+                            });
+
+    src_regions.clear();
+    for (const auto& region_pair : region_pairs)
+    {
+      src_regions.push_back(region_pair.second);
+    }
+    mipmaps.push_back(dst);
+    src = std::move(dst);
+  }
+  return mipmaps;
+}
+
+} // namespace
+
+CRect halve_mipmap_region(const CRect& region, int width, int height)
+{
+  const int left = std::min((region.get_left() + 1) / 2, width);
+  const int top = std::min((region.get_top() + 1) / 2, height);
+  const int right = std::min((region.get_right() + 1) / 2, width);
+  const int bottom = std::min((region.get_bottom() + 1) / 2, height);
+  return {left, top, right - left, bottom - top};
+}
+
+int mipmap_level_count(int width, int height, int levels)
+{
+  int full_chain = 0;
+  for (int size = std::max(width, height); size > 1; size /= 2)
+  {
+    ++full_chain;
+  }
+  return levels <= 0 ? full_chain : std::min(levels, full_chain);
+}
+
+std::vector<CImage> build_mipmaps(const CImage& page, const std::vector<CRect>& regions,
+                                  int levels, MipmapFilter filter, bool premultiplied,
+                                  int threads)
+{
+  return BuildMipmaps(page,
+                      regions,
+                      levels,
+                      filter,
+                      premultiplied ? Weighting::Premultiplied : Weighting::Alpha,
+                      threads);
+}
+
+std::vector<CImage> build_channel_mipmaps(const CImage&                          page,
+                                          const std::vector<std::vector<CRect>>& channel_regions,
+                                          int levels, MipmapFilter filter, int threads)
+{
+  std::vector<CImage> mipmaps;
+  for (std::size_t channel = 0; channel < channel_regions.size(); ++channel)
+  {
+    // the channels are independent planes, none of them weights or masks the others
+    const auto channel_mipmaps = BuildMipmaps(
+        page, channel_regions[channel], levels, filter, Weighting::Independent, threads);
+    if (mipmaps.empty())
+    {
+      mipmaps = channel_mipmaps;
+      continue;
+    }
+    for (std::size_t level = 0; level < mipmaps.size(); ++level)
+    {
+      const auto& src = channel_mipmaps[level];
+      auto&       dst = mipmaps[level];
+      Channel*    dst_pixels = dst.MutablePixels();
+      for (int y = 0; y < dst.Height(); ++y)
+      {
+        const Channel* src_row = src.Pixels() + static_cast<std::ptrdiff_t>(y) * src.Pitch();
+        Channel*       dst_row = dst_pixels + static_cast<std::ptrdiff_t>(y) * dst.Pitch();
+        for (int x = 0; x < dst.Width(); ++x)
+        {
+          dst_row[x * 4 + channel] = src_row[x * 4 + channel];
+        }
+      }
+    }
+  }
+  return mipmaps;
+}
+} // namespace TexturePacker
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+#include <texture_packer/pack_settings.hpp>
+#include <texture_packer/rect.hpp>
+
+#include <vector>
+
+namespace TexturePacker
+{
+// Number of levels below a width x height page: `levels` capped at the chain down to 1x1, or the
+// whole chain when levels <= 0.
+int mipmap_level_count(int width, int height, int levels);
+
+// Region of the next, width x height, level that a region of a level maps to. Regions that were
+// disjoint stay disjoint, and on a 2^k aligned layout the mapping is exact.
+CRect halve_mipmap_region(const CRect& region, int width, int height);
+
+// Builds mip levels 1..levels of an RGBA32 page (levels <= 0 continues down to 1x1), each half
+// the size of the previous one. Pixels inside one of the regions (the sprite slots) only sample
+// that region, clamped at its edges, so sprites never bleed into each other across the gutters;
+// the rest of the page is filtered as a whole. Colors are weighted by alpha, unless the page is
+// `premultiplied` already. The rows, and then the regions, of each level are split across
+// `threads` workers (0 = hardware concurrency).
+std::vector<CImage> build_mipmaps(const CImage& page, const std::vector<CRect>& regions,
+                                  int levels, MipmapFilter filter, bool premultiplied = false,
+                                  int threads = 1);
+
+// Same as build_mipmaps for a page whose channels hold separate layouts, channel_regions[c]
+// being the sprite slots of channel c: each channel is filtered on its own, neither weighted nor
+// masked by alpha, within its own regions only.
+std::vector<CImage> build_channel_mipmaps(const CImage&                          page,
+                                          const std::vector<std::vector<CRect>>& channel_regions,
+                                          int levels, MipmapFilter filter, int threads = 1);
+} // namespace TexturePacker
@@ -0,0 +1,586 @@
+#include "palette.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "thread_pool.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr int         kChannels = 4;
+constexpr int         kBandRows = 64;
+constexpr int         kKMeansIterations = 4;
+constexpr std::size_t kKMeansChunk = 4096;
+// Distinct colors the histogram keeps exactly, beyond that they are grouped by their top 5 bits.
+constexpr std::size_t kMaxExactBins = 1 << 16;
+
+// Color premultiplied by alpha, and alpha: the space colors are compared in.
+using Point = std::array<float, kChannels>;
+
+std::uint32_t PackColor(const Color& color)
+{
+  return color.r | color.g << 8 | color.b << 16 | static_cast<std::uint32_t>(color.a) << 24;
+}
+
+Color PixelColor(const Channel* pixel)
+{
+  return {pixel[0], pixel[1], pixel[2], pixel[3]};
+}
+
+Color UnpackColor(std::uint32_t value)
+{
+  return {static_cast<Channel>(value),
+          static_cast<Channel>(value >> 8),
+          static_cast<Channel>(value >> 16),
+          static_cast<Channel>(value >> 24)};
+}
+
+Point ToPoint(const Color& color)
+{
+  const float scale = color.a / 255.0F;
+  return {color.r * scale, color.g * scale, color.b * scale, static_cast<float>(color.a)};
+}
+
+Color ToColor(const Point& point)
+{
+  const float alpha = std::clamp(std::round(point[3]), 0.0F, 255.0F);
+  if (alpha == 0.0F)
+  {
+    return {};
+  }
+  const auto unpremultiply = [&](float value)
+  { return static_cast<Channel>(std::clamp(std::round(value * 255.0F / alpha), 0.0F, 255.0F)); };
+  return {unpremultiply(point[0]),
+          unpremultiply(point[1]),
+          unpremultiply(point[2]),
+          static_cast<Channel>(alpha)};
+}
+
+float Distance(const Point& lhs, const Point& rhs)
+{
+  float distance = 0.0F;
+  for (int c = 0; c < kChannels; ++c)
+  {
+    const float delta = lhs[c] - rhs[c];
+    distance += delta * delta;
+  }
+  return distance;
+}
+
+std::size_t Nearest(const std::vector<Point>& points, const Point& point)
+{
+  std::size_t best = 0;
+  float       best_distance = std::numeric_limits<float>::max();
+  for (std::size_t i = 0; i < points.size(); ++i)
+  {
+    const float distance = Distance(points[i], point);
+    if (distance < best_distance)
+    {
+      best_distance = distance;
+      best = i;
+    }
+  }
+  return best;
+}
+
+// Rows are scanned in bands of a fixed height, so the result does not depend on the thread count.
+template <typename Fn>
+void ForEachBand(const CImage& image, CThreadPool& thread_pool, Fn&& fn)
+{
+  const auto band_count = static_cast<std::size_t>((image.Height() + kBandRows - 1) / kBandRows);
+  thread_pool.ParallelFor(band_count,
+                          [&](std::size_t band)
+                          {
+                            const int top = static_cast<int>(band) * kBandRows;
+                            fn(band, top, std::min(image.Height(), top + kBandRows));
+                          });
+}
+
+const Channel* Row(const CImage& image, int y)
+{
+  return image.Pixels() + static_cast<std::ptrdiff_t>(y) * image.Pitch();
+}
+
+// Distinct colors of the visible pixels, or nothing when there are more than max_colors of them.
+std::optional<std::vector<std::uint32_t>> CollectColors(const CImage& image, std::size_t max_colors,
+                                                        CThreadPool& thread_pool)
+{
+  const auto band_count = static_cast<std::size_t>((image.Height() + kBandRows - 1) / kBandRows);
+  std::vector<std::unordered_set<std::uint32_t>> band_colors(band_count);
+  std::atomic<bool>                              too_many{false};
+  ForEachBand(image,
+              thread_pool,
+              [&](std::size_t band, int top, int bottom)
+              {
+                auto& colors = band_colors[band];
+                for (int y = top; y < bottom && !too_many; ++y)
+                {
+                  const Channel* pixel = Row(image, y);
+                  for (int x = 0; x < image.Width(); ++x, pixel += kChannels)
+                  {
+                    if (pixel[3] != 0 && colors.insert(PackColor(PixelColor(pixel))).second &&
+                        colors.size() > max_colors)
+                    {
+                      too_many = true;
+                      return;
+                    }
+                  }
+                }
+              });
+  if (too_many)
+  {
+    return std::nullopt;
+  }
+
+  std::unordered_set<std::uint32_t> colors;
+  for (const auto& band : band_colors)
+  {
+    colors.insert(band.begin(), band.end());
+    if (colors.size() > max_colors)
+    {
+      return std::nullopt;
+    }
+  }
+  std::vector<std::uint32_t> sorted(colors.begin(), colors.end());
+  std::sort(sorted.begin(), sorted.end());
+  return sorted;
+}
+
+// Visible pixels grouped by the top `bits` bits of their channels. The sums are integers, so
+// merging the bands in any order gives the same means.
+struct Bin
+{
+  std::uint64_t sum[kChannels]{};
+  std::uint64_t count{0};
+};
+
+struct Sample
+{
+  Point  point;
+  double weight;
+};
+
+// Nothing when there are more than max_bins groups.
+std::optional<std::vector<Sample>> BuildHistogram(const CImage& image, int bits,
+                                                  std::size_t max_bins, CThreadPool& thread_pool)
+{
+  const auto band_count = static_cast<std::size_t>((image.Height() + kBandRows - 1) / kBandRows);
+  const int  shift = 8 - bits;
+  std::vector<std::unordered_map<std::uint32_t, Bin>> band_bins(band_count);
+  std::atomic<bool>                                   too_many{false};
+  ForEachBand(image,
+              thread_pool,
+              [&](std::size_t band, int top, int bottom)
+              {
+                auto& bins = band_bins[band];
+                for (int y = top; y < bottom && !too_many; ++y)
+                {
+                  const Channel* pixel = Row(image, y);
+                  for (int x = 0; x < image.Width(); ++x, pixel += kChannels)
+                  {
+                    const std::uint32_t alpha = pixel[3];
+                    if (alpha == 0)
+                    {
+                      continue;
+                    }
+                    const std::uint32_t key = pixel[0] >> shift | (pixel[1] >> shift) << bits |
+                                              (pixel[2] >> shift) << bits * 2 |
+                                              (alpha >> shift) << bits * 3;
+                    auto& bin = bins[key];
+                    bin.sum[0] += pixel[0] * alpha;
+                    bin.sum[1] += pixel[1] * alpha;
+                    bin.sum[2] += pixel[2] * alpha;
+                    bin.sum[3] += alpha;
+                    ++bin.count;
+                  }
+                  if (bins.size() > max_bins)
+                  {
+                    too_many = true;
+                  }
+                }
+              });
+  if (too_many)
+  {
+    return std::nullopt;
+  }
+
+  std::unordered_map<std::uint32_t, Bin> bins;
+  for (const auto& band : band_bins)
+  {
+    for (const auto& [key, band_bin] : band)
+    {
+      auto& bin = bins[key];
+      for (int c = 0; c < kChannels; ++c)
+      {
+        bin.sum[c] += band_bin.sum[c];
+      }
+      bin.count += band_bin.count;
+    }
+    if (bins.size() > max_bins)
+    {
+      return std::nullopt;
+    }
+  }
+
+  std::vector<std::pair<std::uint32_t, Bin>> sorted(bins.begin(), bins.end());
+  std::sort(sorted.begin(),
+            sorted.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+  std::vector<Sample> samples;
+  samples.reserve(sorted.size());
+  for (const auto& [key, bin] : sorted)
+  {
+    const auto count = static_cast<double>(bin.count);
+    samples.push_back({{static_cast<float>(bin.sum[0] / 255.0 / count),
+                        static_cast<float>(bin.sum[1] / 255.0 / count),
+                        static_cast<float>(bin.sum[2] / 255.0 / count),
+                        static_cast<float>(bin.sum[3] / count)},
+                       count});
+  }
+  return samples;
+}
+
+struct Box
+{
+  std::size_t begin;
+  std::size_t end;
+  Point       mean;
+  double      error;
+  int         axis;
+};
+
+Box MakeBox(const std::vector<Sample>& samples, std::size_t begin, std::size_t end)
+{
+  Box    box{begin, end, {}, 0.0, 0};
+  double weight = 0.0;
+  double sum[kChannels] = {};
+  double squares[kChannels] = {};
+  for (auto i = begin; i < end; ++i)
+  {
+    const auto& sample = samples[i];
+    weight += sample.weight;
+    for (int c = 0; c < kChannels; ++c)
+    {
+      sum[c] += sample.point[c] * sample.weight;
+      squares[c] += static_cast<double>(sample.point[c]) * sample.point[c] * sample.weight;
+    }
+  }
+  double largest = -1.0;
+  for (int c = 0; c < kChannels; ++c)
+  {
+    box.mean[c] = static_cast<float>(sum[c] / weight);
+    const double error = std::max(0.0, squares[c] - sum[c] * sum[c] / weight);
+    box.error += error;
+    if (error > largest)
+    {
+      largest = error;
+      box.axis = c;
+    }
+  }
+  if (end - begin < 2)
+  {
+    box.error = 0.0;
+  }
+  return box;
+}
+
+// Splits the box with the largest squared error at the weighted median of its widest axis, until
+// there are `colors` boxes or none can be split.
+std::vector<Point> MedianCut(std::vector<Sample>& samples, std::size_t colors)
+{
+  std::vector<Box> boxes{MakeBox(samples, 0, samples.size())};
+  while (boxes.size() < colors)
+  {
+    auto it = std::max_element(boxes.begin(),
+                               boxes.end(),
+                               [](const Box& lhs, const Box& rhs)
+                               { return lhs.error < rhs.error; });
+    if (it->error <= 0.0)
+    {
+      break;
+    }
+    const Box box = *it;
+    std::sort(samples.begin() + static_cast<std::ptrdiff_t>(box.begin),
+              samples.begin() + static_cast<std::ptrdiff_t>(box.end),
+              [&](const Sample& lhs, const Sample& rhs)
+              { return lhs.point[box.axis] < rhs.point[box.axis]; });
+    double total = 0.0;
+    for (auto i = box.begin; i < box.end; ++i)
+    {
+      total += samples[i].weight;
+    }
+    auto   split = box.begin + 1;
+    double below = samples[box.begin].weight;
+    while (split < box.end - 1 && below + samples[split].weight <= total / 2)
+    {
+      below += samples[split].weight;
+      ++split;
+    }
+    *it = MakeBox(samples, box.begin, split);
+    boxes.push_back(MakeBox(samples, split, box.end));
+  }
+
+  std::vector<Point> centroids;
+  for (const auto& box : boxes)
+  {
+    centroids.push_back(box.mean);
+  }
+  return centroids;
+}
+
+// Lloyd iterations over the histogram. Samples are summed in chunks of a fixed size, again so
+// the result does not depend on the thread count.
+void RefineCentroids(const std::vector<Sample>& samples, std::vector<Point>& centroids,
+                     CThreadPool& thread_pool)
+{
+  using Sums = std::vector<std::array<double, kChannels + 1>>;
+  const auto chunk_count = (samples.size() + kKMeansChunk - 1) / kKMeansChunk;
+  for (int iteration = 0; iteration < kKMeansIterations; ++iteration)
+  {
+    std::vector<Sums> chunk_sums(chunk_count, Sums(centroids.size()));
+    thread_pool.ParallelFor(chunk_count,
+                            [&](std::size_t chunk)
+                            {
+                              auto&      sums = chunk_sums[chunk];
+                              const auto end =
+                                  std::min(samples.size(), (chunk + 1) * kKMeansChunk);
+                              for (auto i = chunk * kKMeansChunk; i < end; ++i)
+                              {
+                                const auto& sample = samples[i];
+                                auto&       sum = sums[Nearest(centroids, sample.point)];
+                                for (int c = 0; c < kChannels; ++c)
+                                {
+                                  sum[c] += sample.point[c] * sample.weight;
+                                }
+                                sum[kChannels] += sample.weight;
+                              }
+                            });
+    for (std::size_t k = 0; k < centroids.size(); ++k)
+    {
+      std::array<double, kChannels + 1> sum{};
+      for (const auto& sums : chunk_sums)
+      {
+        for (int c = 0; c <= kChannels; ++c)
+        {
+          sum[c] += sums[k][c];
+        }
+      }
+      // a centroid nothing maps to keeps its place
+      if (sum[kChannels] > 0.0)
+      {
+        for (int c = 0; c < kChannels; ++c)
+        {
+          centroids[k][c] = static_cast<float>(sum[c] / sum[kChannels]);
+        }
+      }
+    }
+  }
+}
+
+// Translucent entries first, for a short PNG alpha table.
+void SortPalette(std::vector<Color>& palette)
+{
+  std::stable_partition(
+      palette.begin(), palette.end(), [](const Color& color) { return color.a != 255; });
+}
+
+// Palette entries, each with the squared radius within which it is the nearest entry for sure:
+// a quarter of the squared distance to the entry closest to it.
+struct SearchPalette
+{
+  std::vector<Point> points;
+  std::vector<float> radii;
+};
+
+SearchPalette MakeSearchPalette(const std::vector<Color>& palette)
+{
+  SearchPalette search;
+  for (const auto& color : palette)
+  {
+    search.points.push_back(ToPoint(color));
+  }
+  for (std::size_t i = 0; i < search.points.size(); ++i)
+  {
+    float closest = std::numeric_limits<float>::max();
+    for (std::size_t j = 0; j < search.points.size(); ++j)
+    {
+      if (i != j)
+      {
+        closest = std::min(closest, Distance(search.points[i], search.points[j]));
+      }
+    }
+    search.radii.push_back(closest / 4.0F);
+  }
+  return search;
+}
+
+// Neighbouring pixels tend to map to the same entry, so the previous result is tried first.
+std::uint8_t FindIndex(const SearchPalette& search,
+                       std::unordered_map<std::uint32_t, std::uint8_t>& cache,
+                       std::uint32_t key, const Point& point, std::uint8_t guess)
+{
+  const auto it = cache.find(key);
+  if (it != cache.end())
+  {
+    return it->second;
+  }
+  const auto index = Distance(search.points[guess], point) <= search.radii[guess]
+                         ? guess
+                         : static_cast<std::uint8_t>(Nearest(search.points, point));
+  cache.emplace(key, index);
+  return index;
+}
+
+void MapPixels(const CImage& image, CIndexedImage& result, bool dither, CThreadPool& thread_pool)
+{
+  // palette colors map to themselves, the rest to their nearest entry once looked up
+  const auto                                      search = MakeSearchPalette(result.palette);
+  std::unordered_map<std::uint32_t, std::uint8_t> palette_indices;
+  for (std::size_t i = 0; i < result.palette.size(); ++i)
+  {
+    palette_indices.emplace(PackColor(result.palette[i]), static_cast<std::uint8_t>(i));
+  }
+  // transparent pixels map to the transparent entry, which is first when there is one
+  const bool         has_transparent = !result.palette.empty() && result.palette[0].a == 0;
+  const std::uint8_t transparent = 0;
+  const int          width = image.Width();
+  ForEachBand(
+      image,
+      thread_pool,
+      [&](std::size_t, int top, int bottom)
+      {
+        auto         cache = palette_indices;
+        std::uint8_t guess = 0;
+        // error carried to the current and the next row, one pixel of margin on each side
+        std::vector<Point> error(static_cast<std::size_t>(width) + 2);
+        std::vector<Point> next_error(static_cast<std::size_t>(width) + 2);
+        for (int y = top; y < bottom; ++y)
+        {
+          const Channel* pixel = Row(image, y);
+          auto*          out = result.indices.data() + static_cast<std::ptrdiff_t>(y) * width;
+          std::fill(next_error.begin(), next_error.end(), Point{});
+          for (int x = 0; x < width; ++x, pixel += kChannels)
+          {
+            if (pixel[3] == 0 && has_transparent)
+            {
+              out[x] = transparent;
+              continue;
+            }
+            const Color color = PixelColor(pixel);
+            if (!dither)
+            {
+              guess = FindIndex(search, cache, PackColor(color), ToPoint(color), guess);
+              out[x] = guess;
+              continue;
+            }
+
+            Point target = ToPoint(color);
+            for (int c = 0; c < kChannels; ++c)
+            {
+              target[c] += error[x + 1][c];
+            }
+            target[3] = std::clamp(target[3], 0.0F, 255.0F);
+            for (int c = 0; c < 3; ++c)
+            {
+              target[c] = std::clamp(target[c], 0.0F, target[3]);
+            }
+            const auto rounded = ToColor(target);
+            const auto index =
+                FindIndex(search, cache, PackColor(rounded), ToPoint(rounded), guess);
+            out[x] = index;
+            guess = index;
+            for (int c = 0; c < kChannels; ++c)
+            {
+              const float residual = target[c] - search.points[index][c];
+              error[x + 2][c] += residual * 7.0F / 16.0F;
+              next_error[x][c] += residual * 3.0F / 16.0F;
+              next_error[x + 1][c] += residual * 5.0F / 16.0F;
+              next_error[x + 2][c] += residual * 1.0F / 16.0F;
+            }
+          }
+          std::swap(error, next_error);
+        }
+      });
+}
+} // namespace
+
+CIndexedImage quantize_image(const CImage& image, int max_colors, bool dither, int threads)
+{
+  if (image.Channels() != kChannels)
+  {
+    throw std::runtime_error("quantize_image expects RGBA32 pixels");
+  }
+  if (max_colors < 2 || max_colors > 256)
+  {
+    throw std::runtime_error("a palette holds 2 to 256 colors");
+  }
+
+  CThreadPool   thread_pool(threads);
+  CIndexedImage result;
+  result.width = image.Width();
+  result.height = image.Height();
+  result.indices.resize(static_cast<std::size_t>(result.width) * result.height);
+
+  std::atomic<bool> has_transparent{false};
+  ForEachBand(image,
+              thread_pool,
+              [&](std::size_t, int top, int bottom)
+              {
+                for (int y = top; y < bottom && !has_transparent; ++y)
+                {
+                  const Channel* pixel = Row(image, y);
+                  for (int x = 0; x < image.Width(); ++x, pixel += kChannels)
+                  {
+                    if (pixel[3] == 0)
+                    {
+                      has_transparent = true;
+                      break;
+                    }
+                  }
+                }
+              });
+  const auto visible_colors = static_cast<std::size_t>(max_colors - (has_transparent ? 1 : 0));
+
+  if (const auto colors = CollectColors(image, visible_colors, thread_pool))
+  {
+    for (const auto color : *colors)
+    {
+      result.palette.push_back(UnpackColor(color));
+    }
+    dither = false;
+  }
+  else
+  {
+    auto samples = BuildHistogram(image, 8, kMaxExactBins, thread_pool);
+    if (!samples)
+    {
+      samples = BuildHistogram(image, 5, std::numeric_limits<std::size_t>::max(), thread_pool);
+    }
+    auto centroids = MedianCut(*samples, visible_colors);
+    RefineCentroids(*samples, centroids, thread_pool);
+    for (const auto& centroid : centroids)
+    {
+      result.palette.push_back(ToColor(centroid));
+    }
+  }
+  SortPalette(result.palette);
+  if (has_transparent)
+  {
+    result.palette.insert(result.palette.begin(), Color{});
+  }
+
+  MapPixels(image, result, dither, thread_pool);
+  return result;
+}
+} // namespace TexturePacker
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace TexturePacker
+{
+// An image of 8 bit indices into a palette of at most 256 colors. Translucent entries come
+// first, so the alpha table of a PNG stops at the last of them.
+struct CIndexedImage
+{
+  int                       width{0};
+  int                       height{0};
+  std::vector<Color>        palette;
+  std::vector<std::uint8_t> indices;
+};
+
+// Palette image of an RGBA32 image with at most max_colors (2..256) colors. Fully transparent
+// pixels share one transparent entry. When the other pixels have few enough distinct colors they
+// are kept exactly, otherwise the palette is built by median cut and refined by k-means, both
+// measuring distance between colors premultiplied by alpha, so that differences in barely
+// visible pixels weigh little. `dither` diffuses the quantization error Floyd-Steinberg style
+// within bands of rows. The pixels are scanned and mapped on `threads` workers (0 = hardware
+// concurrency).
+CIndexedImage quantize_image(const CImage& image, int max_colors, bool dither = false,
+                             int threads = 1);
+} // namespace TexturePacker
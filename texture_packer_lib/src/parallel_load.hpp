@@ -0,0 +1,70 @@
+#pragma once
+
+#include <texture_packer/utils.hpp>
+
+#include <fmt/format.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace TexturePacker
+{
+// Runs load(file_path) for every path on a thread pool. Results keep the order of file_paths,
+// files whose load throws are left out and reported in errors.
+template <class LoadFn>
+std::vector<CImageInfo> load_in_parallel(const std::vector<std::string>& file_paths, int threads,
+                                         std::vector<CLoadError>& errors, LoadFn load)
+{
+  std::vector<std::optional<CImageInfo>> loaded(file_paths.size());
+  std::vector<std::string>               messages(file_paths.size());
+
+  CThreadPool thread_pool(threads);
+  thread_pool.ParallelFor(file_paths.size(),
+                          [&](std::size_t index)
+                          {
+                            try
+                            {
+                              loaded[index].emplace(load(file_paths[index]));
+                            }
+                            catch (const std::exception& ex)
+                            {
+                              messages[index] = ex.what();
+                            }
+                          });
+
+  std::vector<CImageInfo> image_infos;
+  image_infos.reserve(file_paths.size());
+  for (std::size_t index = 0; index < file_paths.size(); ++index)
+  {
+    if (loaded[index].has_value())
+    {
+      image_infos.emplace_back(std::move(*loaded[index]));
+    }
+    else
+    {
+      errors.push_back({file_paths[index], std::move(messages[index])});
+    }
+  }
+
+  return image_infos;
+}
+
+inline void throw_on_load_errors(const std::vector<CLoadError>& errors)
+{
+  if (errors.empty())
+  {
+    return;
+  }
+
+  std::string message = fmt::format("Failed to load {} image(s):", errors.size());
+  for (const auto& error : errors)
+  {
+    message += fmt::format("\n  {}: {}", error.file_path, error.message);
+  }
+  throw std::runtime_error(message);
+}
+} // namespace TexturePacker
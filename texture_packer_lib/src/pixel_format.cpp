@@ -0,0 +1,287 @@
+#include "pixel_format.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr int kChannels = 4;
+
+// 4x4 Bayer matrix of the ordered dither
+constexpr std::array<std::array<int, 4>, 4> kBayer = {{
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+}};
+
+int Reduce(int value, int bits)
+{
+  const int levels = (1 << bits) - 1;
+  return (value * levels + 127) / 255;
+}
+
+int Expand(int reduced, int bits)
+{
+  const int levels = (1 << bits) - 1;
+  return (reduced * 255 + levels / 2) / levels;
+}
+
+bool Fits(int value, int bits)
+{
+  return Expand(Reduce(value, bits), bits) == value;
+}
+
+// Rounds value to bits, or with a threshold in (0, 1) from the dither matrix rounds up as often
+// as the dropped fraction says. Values the depth holds exactly are kept either way.
+Channel Quantize(int value, int bits, float threshold)
+{
+  if (Fits(value, bits))
+  {
+    return static_cast<Channel>(value);
+  }
+  const int levels = (1 << bits) - 1;
+  const int reduced = std::min(levels, static_cast<int>(value * levels / 255.0F + threshold));
+  return static_cast<Channel>(Expand(reduced, bits));
+}
+
+template <typename Fn>
+void ForEachPixel(const CImage& image, const std::vector<CRect>& regions, Fn&& fn)
+{
+  const CRect whole{0, 0, image.Width(), image.Height()};
+  for (const auto& region : regions.empty() ? std::vector<CRect>{whole} : regions)
+  {
+    const int left = std::max(region.x, 0);
+    const int top = std::max(region.y, 0);
+    const int right = std::min(region.x + region.width, image.Width());
+    const int bottom = std::min(region.y + region.height, image.Height());
+    for (int y = top; y < bottom; ++y)
+    {
+      const Channel* row = image.Pixels() + static_cast<std::ptrdiff_t>(y) * image.Pitch();
+      for (int x = left; x < right; ++x)
+      {
+        if (!fn(row + x * image.Channels()))
+        {
+          return;
+        }
+      }
+    }
+  }
+}
+} // namespace
+
+CPixelUsage& CPixelUsage::Merge(const CPixelUsage& other)
+{
+  translucent = translucent || other.translucent;
+  colored = colored || other.colored;
+  shaded = shaded || other.shaded;
+  deep = deep || other.deep;
+  deep_565 = deep_565 || other.deep_565;
+  return *this;
+}
+
+CPixelUsage analyze_pixels(const CImage& image, const std::vector<CRect>& regions)
+{
+  const int channels = image.Channels();
+  if (channels != 1 && channels != 3 && channels != kChannels)
+  {
+    throw std::runtime_error("analyze_pixels expects gray, RGB24 or RGBA32 pixels");
+  }
+
+  // gray pixels repeat their level, pixels without alpha are opaque
+  const int   green = channels == 1 ? 0 : 1;
+  const int   blue = channels == 1 ? 0 : 2;
+  CPixelUsage usage;
+  ForEachPixel(image,
+               regions,
+               [&](const Channel* pixel)
+               {
+                 const int r = pixel[0];
+                 const int g = pixel[green];
+                 const int b = pixel[blue];
+                 const int a = channels == kChannels ? pixel[3] : 255;
+                 usage.translucent = usage.translucent || a != 255;
+                 usage.deep = usage.deep || !Fits(a, 4);
+                 if (a != 0)
+                 {
+                   usage.colored = usage.colored || r != g || r != b;
+                   usage.shaded = usage.shaded || r != 255 || g != 255 || b != 255;
+                   usage.deep = usage.deep || !Fits(r, 4) || !Fits(g, 4) || !Fits(b, 4);
+                   usage.deep_565 = usage.deep_565 || !Fits(r, 5) || !Fits(g, 6) || !Fits(b, 5);
+                 }
+                 // nothing left to find out
+                 return !(usage.translucent && usage.colored && usage.shaded && usage.deep &&
+                          usage.deep_565);
+               });
+  return usage;
+}
+
+PixelFormat select_pixel_format(const CPixelUsage& usage, bool reduce_depth)
+{
+  if (!usage.translucent)
+  {
+    if (!usage.colored)
+    {
+      return PixelFormat::L8;
+    }
+    return reduce_depth || !usage.deep_565 ? PixelFormat::RGB565 : PixelFormat::RGB8;
+  }
+  if (!usage.colored)
+  {
+    return usage.shaded ? PixelFormat::LA8 : PixelFormat::A8;
+  }
+  return reduce_depth || !usage.deep ? PixelFormat::RGBA4444 : PixelFormat::RGBA8;
+}
+
+int pixel_format_bytes(PixelFormat format)
+{
+  switch (format)
+  {
+  case PixelFormat::RGBA8:
+    return 4;
+  case PixelFormat::RGB8:
+    return 3;
+  case PixelFormat::LA8:
+  case PixelFormat::RGBA4444:
+  case PixelFormat::RGB565:
+    return 2;
+  case PixelFormat::L8:
+  case PixelFormat::A8:
+    return 1;
+  }
+  throw std::runtime_error("unsupported pixel format");
+}
+
+const char* pixel_format_name(PixelFormat format)
+{
+  switch (format)
+  {
+  case PixelFormat::RGBA8:
+    return "RGBA8";
+  case PixelFormat::RGB8:
+    return "RGB8";
+  case PixelFormat::LA8:
+    return "LA8";
+  case PixelFormat::L8:
+    return "L8";
+  case PixelFormat::A8:
+    return "A8";
+  case PixelFormat::RGBA4444:
+    return "RGBA4444";
+  case PixelFormat::RGB565:
+    return "RGB565";
+  }
+  throw std::runtime_error("unsupported pixel format");
+}
+
+CImage to_pixel_format(const CImage& image, PixelFormat format, bool dither)
+{
+  if (image.Channels() != kChannels)
+  {
+    throw std::runtime_error("to_pixel_format expects RGBA32 pixels");
+  }
+  if (format == PixelFormat::RGBA8)
+  {
+    return image;
+  }
+
+  CImage   result = image;
+  Channel* pixels = result.MutablePixels();
+  for (int y = 0; y < result.Height(); ++y)
+  {
+    Channel* pixel = pixels + static_cast<std::ptrdiff_t>(y) * result.Pitch();
+    for (int x = 0; x < result.Width(); ++x, pixel += kChannels)
+    {
+      const float threshold = dither ? (kBayer[y & 3][x & 3] + 0.5F) / 16.0F : 0.5F;
+      switch (format)
+      {
+      case PixelFormat::RGBA8:
+        break;
+      case PixelFormat::RGB8:
+        pixel[3] = 255;
+        break;
+      case PixelFormat::LA8:
+        pixel[1] = pixel[0];
+        pixel[2] = pixel[0];
+        break;
+      case PixelFormat::L8:
+        pixel[1] = pixel[0];
+        pixel[2] = pixel[0];
+        pixel[3] = 255;
+        break;
+      case PixelFormat::A8:
+        std::fill(pixel, pixel + 3, Channel{255});
+        break;
+      case PixelFormat::RGBA4444:
+        for (int c = 0; c < kChannels; ++c)
+        {
+          pixel[c] = Quantize(pixel[c], 4, threshold);
+        }
+        break;
+      case PixelFormat::RGB565:
+        pixel[0] = Quantize(pixel[0], 5, threshold);
+        pixel[1] = Quantize(pixel[1], 6, threshold);
+        pixel[2] = Quantize(pixel[2], 5, threshold);
+        pixel[3] = 255;
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+std::vector<std::uint8_t> pack_pixels(const CImage& image, PixelFormat format)
+{
+  if (image.Channels() != kChannels)
+  {
+    throw std::runtime_error("pack_pixels expects RGBA32 pixels");
+  }
+
+  std::vector<std::uint8_t> packed;
+  packed.reserve(static_cast<std::size_t>(image.Width()) * image.Height() *
+                 pixel_format_bytes(format));
+  const auto put16 = [&](int value)
+  {
+    packed.push_back(static_cast<std::uint8_t>(value));
+    packed.push_back(static_cast<std::uint8_t>(value >> 8));
+  };
+  for (int y = 0; y < image.Height(); ++y)
+  {
+    const Channel* pixel = image.Pixels() + static_cast<std::ptrdiff_t>(y) * image.Pitch();
+    for (int x = 0; x < image.Width(); ++x, pixel += kChannels)
+    {
+      switch (format)
+      {
+      case PixelFormat::RGBA8:
+        packed.insert(packed.end(), pixel, pixel + 4);
+        break;
+      case PixelFormat::RGB8:
+        packed.insert(packed.end(), pixel, pixel + 3);
+        break;
+      case PixelFormat::LA8:
+        packed.push_back(pixel[0]);
+        packed.push_back(pixel[3]);
+        break;
+      case PixelFormat::L8:
+        packed.push_back(pixel[0]);
+        break;
+      case PixelFormat::A8:
+        packed.push_back(pixel[3]);
+        break;
+      case PixelFormat::RGBA4444:
+        put16(Reduce(pixel[0], 4) << 12 | Reduce(pixel[1], 4) << 8 | Reduce(pixel[2], 4) << 4 |
+              Reduce(pixel[3], 4));
+        break;
+      case PixelFormat::RGB565:
+        put16(Reduce(pixel[0], 5) << 11 | Reduce(pixel[1], 6) << 5 | Reduce(pixel[2], 5));
+        break;
+      }
+    }
+  }
+  return packed;
+}
+} // namespace TexturePacker
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+#include <texture_packer/pack_settings.hpp>
+#include <texture_packer/rect.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace TexturePacker
+{
+// What the pixels of an image make use of, which decides the pixel formats that hold it exactly.
+// Color only counts where alpha is above 0.
+struct CPixelUsage
+{
+  bool translucent{false}; // some alpha below 255
+  bool colored{false};     // some pixel is not gray
+  bool shaded{false};      // some pixel is not white
+  bool deep{false};        // some channel does not fit 4 bits exactly
+  bool deep_565{false};    // some color channel does not fit 5, 6 and 5 bits exactly
+
+  CPixelUsage& Merge(const CPixelUsage& other);
+};
+
+// Usage of the pixels of a gray, RGB24 or RGBA32 image inside `regions`, or of all of them when
+// there are none.
+CPixelUsage analyze_pixels(const CImage& image, const std::vector<CRect>& regions = {});
+
+// Smallest format that holds pixels of that usage exactly. With reduce_depth, RGB565 and
+// RGBA4444 take the place of RGB8 and RGBA8 even when they lose precision.
+PixelFormat select_pixel_format(const CPixelUsage& usage, bool reduce_depth);
+
+int pixel_format_bytes(PixelFormat format);
+
+const char* pixel_format_name(PixelFormat format);
+
+// Copy of an RGBA32 image with the values it reads back as once stored in format: missing color
+// channels repeat gray or turn white, a missing alpha is opaque and reduced channels are rounded,
+// or ordered dithered, to their bit depth.
+CImage to_pixel_format(const CImage& image, PixelFormat format, bool dither = false);
+
+// Texels of an RGBA32 image in format, tightly packed row after row. The 16 bit formats are
+// little endian words with red in the high bits, like VK_FORMAT_R4G4B4A4_UNORM_PACK16 and
+// VK_FORMAT_R5G6B5_UNORM_PACK16.
+std::vector<std::uint8_t> pack_pixels(const CImage& image, PixelFormat format);
+} // namespace TexturePacker
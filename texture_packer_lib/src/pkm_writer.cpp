@@ -0,0 +1,39 @@
+#include "pkm_writer.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr std::uint16_t kFormatEtc2Rgba = 3;
+
+void PutBigEndian16(std::uint8_t* out, int value)
+{
+  out[0] = static_cast<std::uint8_t>(value >> 8);
+  out[1] = static_cast<std::uint8_t>(value);
+}
+} // namespace
+
+void write_pkm(const std::string& file_path, int width, int height,
+               const std::vector<std::uint8_t>& payload)
+{
+  // magic and version, then format, size padded to whole blocks and actual size, big endian
+  std::uint8_t header[16] = {'P', 'K', 'M', ' ', '2', '0'};
+  PutBigEndian16(header + 6, kFormatEtc2Rgba);
+  PutBigEndian16(header + 8, (width + 3) / 4 * 4);
+  PutBigEndian16(header + 10, (height + 3) / 4 * 4);
+  PutBigEndian16(header + 12, width);
+  PutBigEndian16(header + 14, height);
+
+  std::ofstream fs(file_path, std::ios::binary);
+  fs.write(reinterpret_cast<const char*>(header), sizeof(header));
+  fs.write(reinterpret_cast<const char*>(payload.data()),
+           static_cast<std::streamsize>(payload.size()));
+  if (!fs)
+  {
+    throw std::runtime_error("can not write " + file_path);
+  }
+}
+} // namespace TexturePacker
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace TexturePacker
+{
+// Writes a PKM 2.0 file of ETC2 RGBA8 blocks, payload as laid out by encode_texture.
+void write_pkm(const std::string& file_path, int width, int height,
+               const std::vector<std::uint8_t>& payload);
+} // namespace TexturePacker
@@ -0,0 +1,439 @@
+#include "png_writer.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "pixel_format.hpp"
+#include "thread_pool.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr std::size_t kMinChunkSize = 256 * 1024;
+constexpr std::size_t kMaxIdatSize = 1024 * 1024;
+
+using Bytes = std::vector<unsigned char>;
+
+void AppendBE32(Bytes& out, std::uint32_t value)
+{
+  out.push_back(static_cast<unsigned char>(value >> 24));
+  out.push_back(static_cast<unsigned char>(value >> 16));
+  out.push_back(static_cast<unsigned char>(value >> 8));
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+void WriteChunk(std::ofstream& fs, const char* type, const unsigned char* data, std::size_t size)
+{
+  Bytes header;
+  AppendBE32(header, static_cast<std::uint32_t>(size));
+  header.insert(header.end(), type, type + 4);
+
+  uLong crc = crc32(0, header.data() + 4, 4);
+  if (size > 0)
+  {
+    crc = crc32(crc, data, static_cast<uInt>(size));
+  }
+
+  Bytes footer;
+  AppendBE32(footer, static_cast<std::uint32_t>(crc));
+
+  fs.write(reinterpret_cast<const char*>(header.data()), 8);
+  fs.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+  fs.write(reinterpret_cast<const char*>(footer.data()), 4);
+}
+
+// Branch free, so the filter loops below vectorize. p - a equals b - c and so on.
+int Paeth(int a, int b, int c)
+{
+  const int pa = std::abs(b - c);
+  const int pb = std::abs(a - c);
+  const int pc = std::abs(a + b - 2 * c);
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// PNG color type of the pixel format, and the 8 bit layout its rows are stored in. A8 is stored
+// as gray, the reduced formats in 8 bits per channel.
+struct PngLayout
+{
+  unsigned char color_type;
+  PixelFormat   row_format;
+};
+
+PngLayout GetPngLayout(PixelFormat format)
+{
+  switch (format)
+  {
+  case PixelFormat::RGB8:
+  case PixelFormat::RGB565:
+    return {2, PixelFormat::RGB8};
+  case PixelFormat::LA8:
+    return {4, PixelFormat::LA8};
+  case PixelFormat::L8:
+    return {0, PixelFormat::L8};
+  case PixelFormat::A8:
+    return {0, PixelFormat::A8};
+  case PixelFormat::RGBA8:
+  case PixelFormat::RGBA4444:
+    break;
+  }
+  return {6, PixelFormat::RGBA8};
+}
+
+// Filters row with predict(left, up, up_left) into out and returns the sum of the absolute
+// values of the output bytes read as signed, the cost the adaptive filter minimizes. Bytes of the
+// first pixel have no left neighbours, which read as zero. Both loops are free of branches, so
+// compilers vectorize them.
+template <class Predictor>
+std::uint32_t ApplyFilter(const unsigned char* row, const unsigned char* prev_row,
+                          std::size_t row_size, std::size_t bpp, unsigned char* out,
+                          Predictor predict)
+{
+  std::uint32_t cost = 0;
+  const auto    head = std::min(bpp, row_size);
+  for (std::size_t i = 0; i < head; ++i)
+  {
+    out[i] = static_cast<unsigned char>(row[i] - predict(0, prev_row[i], 0));
+    cost += std::abs(static_cast<signed char>(out[i]));
+  }
+  for (std::size_t i = head; i < row_size; ++i)
+  {
+    out[i] = static_cast<unsigned char>(
+        row[i] - predict(row[i - bpp], prev_row[i], prev_row[i - bpp]));
+    cost += std::abs(static_cast<signed char>(out[i]));
+  }
+  return cost;
+}
+
+std::uint32_t ApplyFilter(PngFilter filter, const unsigned char* row,
+                          const unsigned char* prev_row, std::size_t row_size, std::size_t bpp,
+                          unsigned char* out)
+{
+  switch (filter)
+  {
+  case PngFilter::Sub:
+    return ApplyFilter(row, prev_row, row_size, bpp, out, [](int a, int, int) { return a; });
+  case PngFilter::Up:
+    return ApplyFilter(row, prev_row, row_size, bpp, out, [](int, int b, int) { return b; });
+  case PngFilter::Average:
+    return ApplyFilter(
+        row, prev_row, row_size, bpp, out, [](int a, int b, int) { return (a + b) >> 1; });
+  case PngFilter::Paeth:
+    return ApplyFilter(row, prev_row, row_size, bpp, out, Paeth);
+  case PngFilter::None:
+  case PngFilter::Adaptive:
+    break;
+  }
+  return ApplyFilter(row, prev_row, row_size, bpp, out, [](int, int, int) { return 0; });
+}
+
+// Writes the filter type byte and the filtered row to out; prev_row is all zeros for the first
+// row. None to Paeth are numbered like the PNG filter types. Adaptive tries every filter and
+// keeps the cheapest, the first one on ties.
+void FilterRow(const unsigned char* row, const unsigned char* prev_row, std::size_t row_size,
+               std::size_t bpp, PngFilter filter, Bytes& candidate, unsigned char* out)
+{
+  if (filter != PngFilter::Adaptive)
+  {
+    out[0] = static_cast<unsigned char>(filter);
+    ApplyFilter(filter, row, prev_row, row_size, bpp, out + 1);
+    return;
+  }
+
+  // the best filter so far stays in out, the others are tried in candidate
+  candidate.resize(row_size);
+  out[0] = static_cast<unsigned char>(PngFilter::None);
+  auto best_cost = ApplyFilter(PngFilter::None, row, prev_row, row_size, bpp, out + 1);
+  for (const auto next : {PngFilter::Sub, PngFilter::Up, PngFilter::Average, PngFilter::Paeth})
+  {
+    const auto cost = ApplyFilter(next, row, prev_row, row_size, bpp, candidate.data());
+    if (cost < best_cost)
+    {
+      best_cost = cost;
+      out[0] = static_cast<unsigned char>(next);
+      std::copy(candidate.begin(), candidate.end(), out + 1);
+    }
+  }
+}
+
+int GetZlibStrategy(PngStrategy strategy)
+{
+  switch (strategy)
+  {
+  case PngStrategy::Filtered:
+    return Z_FILTERED;
+  case PngStrategy::HuffmanOnly:
+    return Z_HUFFMAN_ONLY;
+  case PngStrategy::Rle:
+    return Z_RLE;
+  case PngStrategy::Default:
+  case PngStrategy::Best:
+    break;
+  }
+  return Z_DEFAULT_STRATEGY;
+}
+
+constexpr std::size_t kWindowSize = 32 * 1024;
+
+struct Chunk
+{
+  Bytes deflated;
+  uLong adler{1};
+  uLong raw_size{0};
+};
+
+// Deflates data[begin, end) as raw deflate data, primed with the preceding window so the chunk
+// compresses as if it continued the previous one. Every chunk but the last ends with a sync
+// flush, which byte-aligns the output without setting the final block bit, so the chunks
+// concatenate into a single valid deflate stream.
+Chunk DeflateChunk(const Bytes& data, std::size_t begin, std::size_t end, int level, int strategy)
+{
+  const bool last = end == data.size();
+
+  Chunk chunk;
+  chunk.raw_size = static_cast<uLong>(end - begin);
+  chunk.adler = adler32(chunk.adler, data.data() + begin, static_cast<uInt>(chunk.raw_size));
+
+  z_stream stream{};
+  if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, strategy) != Z_OK)
+  {
+    throw std::runtime_error("deflateInit2 failed");
+  }
+  if (begin > 0)
+  {
+    const auto window = std::min(begin, kWindowSize);
+    deflateSetDictionary(&stream, data.data() + begin - window, static_cast<uInt>(window));
+  }
+
+  chunk.deflated.resize(deflateBound(&stream, chunk.raw_size) + 16);
+  stream.next_in = const_cast<Bytef*>(data.data() + begin);
+  stream.avail_in = static_cast<uInt>(chunk.raw_size);
+  stream.next_out = chunk.deflated.data();
+  stream.avail_out = static_cast<uInt>(chunk.deflated.size());
+  const int  result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+  const bool ok = last ? result == Z_STREAM_END : result == Z_OK && stream.avail_in == 0;
+  chunk.deflated.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (!ok)
+  {
+    throw std::runtime_error("deflate failed");
+  }
+  return chunk;
+}
+
+// Chunks end byte aligned and do not depend on how the previous ones were deflated, so under
+// PngStrategy::Best each of them keeps whichever strategy deflates it smallest.
+Chunk DeflateChunk(const Bytes& data, std::size_t begin, std::size_t end,
+                   const CPngOptions& options)
+{
+  if (options.strategy != PngStrategy::Best)
+  {
+    return DeflateChunk(data, begin, end, options.level, GetZlibStrategy(options.strategy));
+  }
+  Chunk best = DeflateChunk(data, begin, end, options.level, Z_DEFAULT_STRATEGY);
+  for (const int strategy : {Z_FILTERED, Z_RLE})
+  {
+    auto chunk = DeflateChunk(data, begin, end, options.level, strategy);
+    if (chunk.deflated.size() < best.deflated.size())
+    {
+      best = std::move(chunk);
+    }
+  }
+  return best;
+}
+
+// Rows of a PNG image and how they are stored.
+struct PngRows
+{
+  int                  width;
+  int                  height;
+  const unsigned char* pixels;
+  std::size_t          pitch;
+  std::size_t          bpp;
+  unsigned char        color_type;
+};
+
+// Chunks written between IHDR and IDAT, such as the palette.
+using Ancillary = std::vector<std::pair<const char*, Bytes>>;
+
+void WritePng(const std::string& file_path, const PngRows& rows, const Ancillary& ancillary,
+              int threads, const CPngOptions& options)
+{
+  if (options.level < 0 || options.level > 9)
+  {
+    throw std::runtime_error("png compression level needs to be between 0 and 9");
+  }
+
+  const auto  bpp = rows.bpp;
+  const int   height = rows.height;
+  const auto  row_size = static_cast<std::size_t>(rows.width) * bpp;
+  const auto* pixels = rows.pixels;
+  const auto  pitch = rows.pitch;
+
+  CThreadPool thread_pool(threads);
+  const auto  max_chunks = static_cast<std::size_t>(thread_pool.GetThreadCount()) * 4;
+  const auto  rows_per_chunk = std::max<std::size_t>(
+      {1, (kMinChunkSize + row_size) / (row_size + 1), (height + max_chunks - 1) / max_chunks});
+  const auto chunk_count = (height + rows_per_chunk - 1) / rows_per_chunk;
+  auto       chunk_rows = [&](std::size_t index)
+  {
+    return std::pair(index * rows_per_chunk,
+                     std::min<std::size_t>(height, (index + 1) * rows_per_chunk));
+  };
+
+  // Filtering only looks one row back, so every chunk of rows is filtered independently.
+  Bytes       filtered((row_size + 1) * static_cast<std::size_t>(height));
+  const Bytes zero_row(row_size);
+  thread_pool.ParallelFor(chunk_count,
+                          [&](std::size_t index)
+                          {
+                            Bytes candidate;
+                            const auto [row_begin, row_end] = chunk_rows(index);
+                            for (auto y = row_begin; y < row_end; ++y)
+                            {
+                              const unsigned char* row = pixels + y * pitch;
+                              const unsigned char* prev_row =
+                                  y > 0 ? row - pitch : zero_row.data();
+                              FilterRow(row,
+                                        prev_row,
+                                        row_size,
+                                        bpp,
+                                        options.filter,
+                                        candidate,
+                                        filtered.data() + (row_size + 1) * y);
+                            }
+                          });
+
+  std::vector<Chunk> chunks(chunk_count);
+  thread_pool.ParallelFor(chunk_count,
+                          [&](std::size_t index)
+                          {
+                            const auto [row_begin, row_end] = chunk_rows(index);
+                            chunks[index] = DeflateChunk(filtered,
+                                                         (row_size + 1) * row_begin,
+                                                         (row_size + 1) * row_end,
+                                                         options);
+                          });
+
+  // zlib header for deflate with a 32K window, then the chunks, then the combined Adler-32
+  Bytes zlib_stream{0x78, 0x9C};
+  uLong adler = 1;
+  for (const auto& chunk : chunks)
+  {
+    zlib_stream.insert(zlib_stream.end(), chunk.deflated.begin(), chunk.deflated.end());
+    adler = adler32_combine(adler, chunk.adler, static_cast<z_off_t>(chunk.raw_size));
+  }
+  AppendBE32(zlib_stream, static_cast<std::uint32_t>(adler));
+
+  std::ofstream fs(file_path, std::ios::binary);
+  if (!fs)
+  {
+    throw std::runtime_error("can not open " + file_path);
+  }
+
+  static constexpr unsigned char kSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  fs.write(reinterpret_cast<const char*>(kSignature), sizeof(kSignature));
+
+  Bytes ihdr;
+  AppendBE32(ihdr, static_cast<std::uint32_t>(rows.width));
+  AppendBE32(ihdr, static_cast<std::uint32_t>(height));
+  // 8 bit, deflate, adaptive filters, no interlace
+  ihdr.insert(ihdr.end(), {8, rows.color_type, 0, 0, 0});
+  WriteChunk(fs, "IHDR", ihdr.data(), ihdr.size());
+  for (const auto& [type, data] : ancillary)
+  {
+    WriteChunk(fs, type, data.data(), data.size());
+  }
+
+  for (std::size_t offset = 0; offset < zlib_stream.size(); offset += kMaxIdatSize)
+  {
+    WriteChunk(fs,
+               "IDAT",
+               zlib_stream.data() + offset,
+               std::min(kMaxIdatSize, zlib_stream.size() - offset));
+  }
+  WriteChunk(fs, "IEND", nullptr, 0);
+
+  if (!fs)
+  {
+    throw std::runtime_error("can not write " + file_path);
+  }
+}
+} // namespace
+
+void write_png(const std::string& file_path, const CImage& image, int threads, PixelFormat format,
+               const CPngOptions& options)
+{
+  if (image.Channels() != 4)
+  {
+    throw std::runtime_error("write_png expects RGBA32 pixels");
+  }
+
+  // RGBA rows are filtered straight from the image, other layouts from a packed copy
+  const auto layout = GetPngLayout(format);
+  const auto packed = layout.row_format == PixelFormat::RGBA8
+                          ? std::vector<std::uint8_t>{}
+                          : pack_pixels(image, layout.row_format);
+  const auto bpp = static_cast<std::size_t>(pixel_format_bytes(layout.row_format));
+  WritePng(file_path,
+           {image.Width(),
+            image.Height(),
+            packed.empty() ? image.Pixels() : packed.data(),
+            packed.empty() ? static_cast<std::size_t>(image.Pitch()) : image.Width() * bpp,
+            bpp,
+            layout.color_type},
+           {},
+           threads,
+           options);
+}
+
+void write_indexed_png(const std::string& file_path, const CIndexedImage& image, int threads,
+                       CPngOptions options)
+{
+  if (image.palette.empty() || image.palette.size() > 256)
+  {
+    throw std::runtime_error("write_indexed_png expects 1 to 256 palette entries");
+  }
+
+  Bytes palette;
+  Bytes alphas;
+  for (const auto& color : image.palette)
+  {
+    palette.insert(palette.end(), {color.r, color.g, color.b});
+    alphas.push_back(color.a);
+  }
+  // entries past the last translucent one are opaque without being listed
+  while (!alphas.empty() && alphas.back() == 255)
+  {
+    alphas.pop_back();
+  }
+  Ancillary ancillary{{"PLTE", palette}};
+  if (!alphas.empty())
+  {
+    ancillary.emplace_back("tRNS", alphas);
+  }
+  // indexed rows are written unfiltered unless asked otherwise, as the PNG spec recommends
+  if (options.filter == PngFilter::Adaptive)
+  {
+    options.filter = PngFilter::None;
+  }
+  WritePng(file_path,
+           {image.width,
+            image.height,
+            image.indices.data(),
+            static_cast<std::size_t>(image.width),
+            1,
+            3},
+           ancillary,
+           threads,
+           options);
+}
+} // namespace TexturePacker
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+#include <texture_packer/pack_settings.hpp>
+
+#include <string>
+
+#include "palette.hpp"
+
+namespace TexturePacker
+{
+// Writes an RGBA32 image as an 8 bit PNG with the channels of format: gray for L8 and A8 (which
+// stores alpha), gray and alpha for LA8, RGB for RGB8 and RGB565, RGBA otherwise. With more than
+// one thread the rows are filtered and deflated as independent chunks on a thread pool and
+// stitched into one zlib stream, so a single large page still uses every core. The rows are
+// filtered and deflated as `options` say; a level outside 0..9 throws a std::runtime_error.
+void write_png(const std::string& file_path, const CImage& image, int threads,
+               PixelFormat format = PixelFormat::RGBA8, const CPngOptions& options = {});
+
+// Writes an indexed image as an 8 bit palette PNG, with an alpha table when the palette has
+// translucent entries. Rows are deflated in parallel like in write_png, unfiltered when
+// options.filter is Adaptive.
+void write_indexed_png(const std::string& file_path, const CIndexedImage& image, int threads,
+                       CPngOptions options = {});
+} // namespace TexturePacker
@@ -0,0 +1,275 @@
+#include "qoi_codec.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr std::uint8_t kOpIndex = 0x00;
+constexpr std::uint8_t kOpDiff = 0x40;
+constexpr std::uint8_t kOpLuma = 0x80;
+constexpr std::uint8_t kOpRun = 0xC0;
+constexpr std::uint8_t kOpRgb = 0xFE;
+constexpr std::uint8_t kOpRgba = 0xFF;
+constexpr std::uint8_t kMask = 0xC0;
+constexpr int          kMaxRun = 62;
+constexpr std::size_t  kHeaderSize = 14;
+
+constexpr std::array<std::uint8_t, 8> kEndMarker = {0, 0, 0, 0, 0, 0, 0, 1};
+
+struct Pixel
+{
+  std::uint8_t r{0};
+  std::uint8_t g{0};
+  std::uint8_t b{0};
+  std::uint8_t a{255};
+
+  bool operator==(const Pixel& other) const
+  {
+    return r == other.r && g == other.g && b == other.b && a == other.a;
+  }
+};
+
+Pixel LoadPixel(const Channel* src, int channels)
+{
+  switch (channels)
+  {
+  case 1:
+    return {src[0], src[0], src[0], 255};
+  case 3:
+    return {src[0], src[1], src[2], 255};
+  default:
+    return {src[0], src[1], src[2], src[3]};
+  }
+}
+
+int Hash(const Pixel& pixel)
+{
+  return (pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + pixel.a * 11) % 64;
+}
+
+void PutBE32(std::uint8_t* out, std::uint32_t value)
+{
+  out[0] = static_cast<std::uint8_t>(value >> 24);
+  out[1] = static_cast<std::uint8_t>(value >> 16);
+  out[2] = static_cast<std::uint8_t>(value >> 8);
+  out[3] = static_cast<std::uint8_t>(value);
+}
+
+std::uint32_t GetBE32(const std::uint8_t* in)
+{
+  return std::uint32_t{in[0]} << 24 | std::uint32_t{in[1]} << 16 | std::uint32_t{in[2]} << 8 |
+         in[3];
+}
+} // namespace
+
+void write_qoi(const std::string& file_path, const CImage& image)
+{
+  // QOI has no gray layout, gray pixels are stored as RGB
+  const int channels = image.Channels();
+
+  std::ofstream fs(file_path, std::ios::binary);
+  if (!fs)
+  {
+    throw std::runtime_error("can not open " + file_path);
+  }
+
+  // magic, size, channels and sRGB color space with linear alpha
+  std::uint8_t header[kHeaderSize] = {'q', 'o', 'i', 'f'};
+  PutBE32(header + 4, static_cast<std::uint32_t>(image.Width()));
+  PutBE32(header + 8, static_cast<std::uint32_t>(image.Height()));
+  header[12] = static_cast<std::uint8_t>(channels == 4 ? 4 : 3);
+  header[13] = 0;
+  fs.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+  // a pixel takes at most 5 bytes, as QOI_OP_RGBA
+  std::vector<std::uint8_t> buffer(static_cast<std::size_t>(image.Width()) * 5 + 1);
+  std::array<Pixel, 64>     index{};
+  std::fill(index.begin(), index.end(), Pixel{0, 0, 0, 0});
+  Pixel     previous;
+  int       run = 0;
+  const int height = image.Height();
+  for (int y = 0; y < height; ++y)
+  {
+    const Channel* src = image.Pixels() + static_cast<std::ptrdiff_t>(y) * image.Pitch();
+    std::uint8_t*  out = buffer.data();
+    for (int x = 0; x < image.Width(); ++x, src += channels)
+    {
+      const Pixel pixel = LoadPixel(src, channels);
+      if (pixel == previous)
+      {
+        if (++run == kMaxRun)
+        {
+          *out++ = static_cast<std::uint8_t>(kOpRun | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0)
+      {
+        *out++ = static_cast<std::uint8_t>(kOpRun | (run - 1));
+        run = 0;
+      }
+
+      const int hash = Hash(pixel);
+      if (index[hash] == pixel)
+      {
+        *out++ = static_cast<std::uint8_t>(kOpIndex | hash);
+      }
+      else if (pixel.a == previous.a)
+      {
+        index[hash] = pixel;
+        // differences wrap around, like the uint8 arithmetic of the decoder
+        const auto dr = static_cast<std::int8_t>(pixel.r - previous.r);
+        const auto dg = static_cast<std::int8_t>(pixel.g - previous.g);
+        const auto db = static_cast<std::int8_t>(pixel.b - previous.b);
+        const int  dr_dg = dr - dg;
+        const int  db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+        {
+          *out++ = static_cast<std::uint8_t>(kOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+        }
+        else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+        {
+          *out++ = static_cast<std::uint8_t>(kOpLuma | (dg + 32));
+          *out++ = static_cast<std::uint8_t>((dr_dg + 8) << 4 | (db_dg + 8));
+        }
+        else
+        {
+          *out++ = kOpRgb;
+          *out++ = pixel.r;
+          *out++ = pixel.g;
+          *out++ = pixel.b;
+        }
+      }
+      else
+      {
+        index[hash] = pixel;
+        *out++ = kOpRgba;
+        *out++ = pixel.r;
+        *out++ = pixel.g;
+        *out++ = pixel.b;
+        *out++ = pixel.a;
+      }
+      previous = pixel;
+    }
+    // a run may span rows, it ends with the image
+    if (y == height - 1 && run > 0)
+    {
+      *out++ = static_cast<std::uint8_t>(kOpRun | (run - 1));
+    }
+    fs.write(reinterpret_cast<const char*>(buffer.data()), out - buffer.data());
+  }
+  fs.write(reinterpret_cast<const char*>(kEndMarker.data()), kEndMarker.size());
+
+  if (!fs)
+  {
+    throw std::runtime_error("can not write " + file_path);
+  }
+}
+
+CImage read_qoi(const std::string& file_path)
+{
+  std::ifstream fs(file_path, std::ios::binary);
+  if (!fs)
+  {
+    throw std::runtime_error("can not open " + file_path);
+  }
+  const std::vector<std::uint8_t> data((std::istreambuf_iterator<char>(fs)),
+                                       std::istreambuf_iterator<char>());
+  if (data.size() < kHeaderSize + kEndMarker.size() || std::memcmp(data.data(), "qoif", 4) != 0)
+  {
+    throw std::runtime_error(file_path + " is not a QOI file");
+  }
+  const auto width = static_cast<int>(GetBE32(data.data() + 4));
+  const auto height = static_cast<int>(GetBE32(data.data() + 8));
+  const int  channels = data[12];
+  if (width <= 0 || height <= 0 || (channels != 3 && channels != 4))
+  {
+    throw std::runtime_error(file_path + " has an unsupported QOI header");
+  }
+
+  CImage                image(width, height, channels);
+  Channel*              pixels = image.MutablePixels();
+  std::array<Pixel, 64> index{};
+  std::fill(index.begin(), index.end(), Pixel{0, 0, 0, 0});
+  Pixel       pixel;
+  int         run = 0;
+  std::size_t pos = kHeaderSize;
+  const auto  end = data.size() - kEndMarker.size();
+  for (int y = 0; y < height; ++y)
+  {
+    Channel* dst = pixels + static_cast<std::ptrdiff_t>(y) * image.Pitch();
+    for (int x = 0; x < width; ++x, dst += channels)
+    {
+      if (run > 0)
+      {
+        --run;
+      }
+      else if (pos < end)
+      {
+        const std::uint8_t op = data[pos++];
+        if (op == kOpRgb)
+        {
+          pixel.r = data[pos];
+          pixel.g = data[pos + 1];
+          pixel.b = data[pos + 2];
+          pos += 3;
+        }
+        else if (op == kOpRgba)
+        {
+          pixel.r = data[pos];
+          pixel.g = data[pos + 1];
+          pixel.b = data[pos + 2];
+          pixel.a = data[pos + 3];
+          pos += 4;
+        }
+        else if ((op & kMask) == kOpIndex)
+        {
+          pixel = index[op];
+        }
+        else if ((op & kMask) == kOpDiff)
+        {
+          pixel.r = static_cast<std::uint8_t>(pixel.r + ((op >> 4) & 3) - 2);
+          pixel.g = static_cast<std::uint8_t>(pixel.g + ((op >> 2) & 3) - 2);
+          pixel.b = static_cast<std::uint8_t>(pixel.b + (op & 3) - 2);
+        }
+        else if ((op & kMask) == kOpLuma)
+        {
+          const int dg = (op & 0x3F) - 32;
+          const int next = data[pos++];
+          pixel.r = static_cast<std::uint8_t>(pixel.r + dg - 8 + ((next >> 4) & 0x0F));
+          pixel.g = static_cast<std::uint8_t>(pixel.g + dg);
+          pixel.b = static_cast<std::uint8_t>(pixel.b + dg - 8 + (next & 0x0F));
+        }
+        else
+        {
+          run = op & 0x3F;
+        }
+        index[Hash(pixel)] = pixel;
+      }
+      dst[0] = pixel.r;
+      dst[1] = pixel.g;
+      dst[2] = pixel.b;
+      if (channels == 4)
+      {
+        dst[3] = pixel.a;
+      }
+    }
+  }
+  if (pos > end)
+  {
+    throw std::runtime_error(file_path + " is a truncated QOI file");
+  }
+  return image;
+}
+} // namespace TexturePacker
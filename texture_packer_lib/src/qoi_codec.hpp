@@ -0,0 +1,16 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+
+#include <string>
+
+namespace TexturePacker
+{
+// Writes a gray, RGB24 or RGBA32 image as a QOI file, gray pixels as RGB. Rows are encoded one at
+// a time into a small buffer and streamed to the file, so no second copy of the image is held.
+void write_qoi(const std::string& file_path, const CImage& image);
+
+// Decodes a QOI file into an RGB24 or RGBA32 image, as its header says. Throws a
+// std::runtime_error on malformed files.
+CImage read_qoi(const std::string& file_path);
+} // namespace TexturePacker
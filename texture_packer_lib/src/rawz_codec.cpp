@@ -0,0 +1,154 @@
+#include "rawz_codec.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace TexturePacker
+{
+namespace
+{
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+constexpr std::size_t kHeaderSize = 16;
+constexpr int         kZstdLevel = 1;
+
+void PutLE32(std::uint8_t* out, std::uint32_t value)
+{
+  out[0] = static_cast<std::uint8_t>(value);
+  out[1] = static_cast<std::uint8_t>(value >> 8);
+  out[2] = static_cast<std::uint8_t>(value >> 16);
+  out[3] = static_cast<std::uint8_t>(value >> 24);
+}
+
+std::uint32_t GetLE32(const std::uint8_t* in)
+{
+  return in[0] | std::uint32_t{in[1]} << 8 | std::uint32_t{in[2]} << 16 |
+         std::uint32_t{in[3]} << 24;
+}
+
+void ThrowOnError(std::size_t result, const std::string& file_path)
+{
+  if (ZSTD_isError(result))
+  {
+    throw std::runtime_error(file_path + ": " + ZSTD_getErrorName(result));
+  }
+}
+#endif
+} // namespace
+
+void write_rawz(const std::string& file_path, const CImage& image)
+{
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+  const int channels = image.Channels();
+  std::uint8_t header[kHeaderSize] = {'R', 'A', 'W', 'Z'};
+  PutLE32(header + 4, static_cast<std::uint32_t>(image.Width()));
+  PutLE32(header + 8, static_cast<std::uint32_t>(image.Height()));
+  header[12] = static_cast<std::uint8_t>(channels);
+
+  std::ofstream fs(file_path, std::ios::binary);
+  if (!fs)
+  {
+    throw std::runtime_error("can not open " + file_path);
+  }
+  fs.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+  const std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context(ZSTD_createCCtx(),
+                                                                      ZSTD_freeCCtx);
+  const auto row_size = static_cast<std::size_t>(image.Width()) * channels;
+  ThrowOnError(ZSTD_CCtx_setParameter(context.get(), ZSTD_c_compressionLevel, kZstdLevel),
+               file_path);
+  // the frame header records the content size, so readers can check it up front
+  ThrowOnError(ZSTD_CCtx_setPledgedSrcSize(context.get(), row_size * image.Height()), file_path);
+
+  std::vector<char> buffer(ZSTD_CStreamOutSize());
+  const auto        compress = [&](const Channel* data, std::size_t size, ZSTD_EndDirective mode)
+  {
+    ZSTD_inBuffer input{data, size, 0};
+    std::size_t   remaining = 0;
+    do
+    {
+      ZSTD_outBuffer output{buffer.data(), buffer.size(), 0};
+      remaining = ZSTD_compressStream2(context.get(), &output, &input, mode);
+      ThrowOnError(remaining, file_path);
+      fs.write(buffer.data(), static_cast<std::streamsize>(output.pos));
+    } while (mode == ZSTD_e_end ? remaining != 0 : input.pos < input.size);
+  };
+  for (int y = 0; y < image.Height(); ++y)
+  {
+    compress(
+        image.Pixels() + static_cast<std::ptrdiff_t>(y) * image.Pitch(), row_size, ZSTD_e_continue);
+  }
+  compress(nullptr, 0, ZSTD_e_end);
+
+  if (!fs)
+  {
+    throw std::runtime_error("can not write " + file_path);
+  }
+#else
+  (void)image;
+  throw std::runtime_error("can not write " + file_path + ", zstd is not available in this build");
+#endif
+}
+
+CImage read_rawz(const std::string& file_path)
+{
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+  std::ifstream fs(file_path, std::ios::binary);
+  if (!fs)
+  {
+    throw std::runtime_error("can not open " + file_path);
+  }
+  std::uint8_t header[kHeaderSize] = {};
+  if (!fs.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+      std::memcmp(header, "RAWZ", 4) != 0)
+  {
+    throw std::runtime_error(file_path + " is not a rawz file");
+  }
+  const auto width = static_cast<int>(GetLE32(header + 4));
+  const auto height = static_cast<int>(GetLE32(header + 8));
+  const int  channels = header[12];
+  if (width <= 0 || height <= 0 || (channels != 1 && channels != 3 && channels != 4))
+  {
+    throw std::runtime_error(file_path + " has an unsupported rawz header");
+  }
+
+  CImage     image(width, height, channels);
+  Channel*   pixels = image.MutablePixels();
+  const auto row_size = static_cast<std::size_t>(width) * channels;
+
+  // rows are decompressed one at a time, as the pitch of the image may pad them
+  const std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(),
+                                                                      ZSTD_freeDCtx);
+  std::vector<char> buffer(ZSTD_DStreamInSize());
+  ZSTD_inBuffer     input{buffer.data(), 0, 0};
+  for (int y = 0; y < height; ++y)
+  {
+    ZSTD_outBuffer output{pixels + static_cast<std::ptrdiff_t>(y) * image.Pitch(), row_size, 0};
+    while (output.pos < output.size)
+    {
+      if (input.pos == input.size)
+      {
+        fs.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        input = {buffer.data(), static_cast<std::size_t>(fs.gcount()), 0};
+        if (input.size == 0)
+        {
+          throw std::runtime_error(file_path + " is a truncated rawz file");
+        }
+      }
+      ThrowOnError(ZSTD_decompressStream(context.get(), &output, &input), file_path);
+    }
+  }
+  return image;
+#else
+  throw std::runtime_error("can not read " + file_path + ", zstd is not available in this build");
+#endif
+}
+} // namespace TexturePacker
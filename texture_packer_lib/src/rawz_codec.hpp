@@ -0,0 +1,19 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+
+#include <string>
+
+namespace TexturePacker
+{
+// The rawz container: "RAWZ", little endian 32 bit width and height, a channel count byte and
+// three reserved bytes, then one zstd frame of the tightly packed rows. It costs little more
+// than a memcpy to write, which suits iteration builds. Both functions throw a
+// std::runtime_error when zstd is not available in this build.
+
+// Writes a gray, RGB24 or RGBA32 image, streaming its rows through a zstd level 1 compressor.
+void write_rawz(const std::string& file_path, const CImage& image);
+
+// Reads a rawz file back into an image of the stored channel count.
+CImage read_rawz(const std::string& file_path);
+} // namespace TexturePacker
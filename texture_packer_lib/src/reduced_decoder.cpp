@@ -0,0 +1,646 @@
+#include "reduced_decoder.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#ifdef TEXTURE_PACKER_WITH_JPEG
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+#endif
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr int kChannels = 4;
+
+std::uint32_t ReadBE32(const unsigned char* p)
+{
+  return (std::uint32_t{p[0]} << 24) | (std::uint32_t{p[1]} << 16) | (std::uint32_t{p[2]} << 8) |
+         p[3];
+}
+
+// Averages reduction x reduction blocks of source rows as they arrive, weighting colors by
+// alpha so transparent pixels do not darken the edges of visible ones. The result keeps the
+// first channels of each averaged RGBA pixel, so gray and opaque sources stay 1 and 3 channel.
+class CBoxReducer
+{
+public:
+  CBoxReducer(Size source_size, int reduction, int channels)
+      : m_source_size(source_size)
+      , m_reduction(reduction)
+      , m_image((source_size.w + reduction - 1) / reduction,
+                (source_size.h + reduction - 1) / reduction, channels)
+      , m_sums(static_cast<std::size_t>(m_image.Width()) * kChannels)
+  {
+  }
+
+  // rgba holds one source row of RGBA32 pixels.
+  void AddRow(const Channel* rgba)
+  {
+    for (int x = 0; x < m_source_size.w; ++x, rgba += kChannels)
+    {
+      std::uint32_t*      sum = &m_sums[static_cast<std::size_t>(x / m_reduction) * kChannels];
+      const std::uint32_t alpha = rgba[3];
+      sum[0] += rgba[0] * alpha;
+      sum[1] += rgba[1] * alpha;
+      sum[2] += rgba[2] * alpha;
+      sum[3] += alpha;
+    }
+
+    ++m_band_rows;
+    ++m_source_row;
+    if (m_band_rows == m_reduction || m_source_row == m_source_size.h)
+    {
+      EmitRow();
+    }
+  }
+
+  [[nodiscard]]
+  CImage Release()
+  {
+    return std::move(m_image);
+  }
+
+private:
+  void EmitRow()
+  {
+    Channel* dst = m_image.MutablePixels() + static_cast<std::ptrdiff_t>(m_output_row) *
+                                                 m_image.Pitch();
+    const int channels = m_image.Channels();
+    for (int x = 0; x < m_image.Width(); ++x, dst += channels)
+    {
+      const std::uint32_t* sum = &m_sums[static_cast<std::size_t>(x) * kChannels];
+      const auto           block_width =
+          static_cast<std::uint32_t>(std::min(m_reduction, m_source_size.w - x * m_reduction));
+      const auto count = block_width * static_cast<std::uint32_t>(m_band_rows);
+      const auto alpha = sum[3];
+      Channel    rgba[kChannels];
+      for (int c = 0; c < 3; ++c)
+      {
+        rgba[c] = static_cast<Channel>(alpha > 0 ? (sum[c] + alpha / 2) / alpha : 0);
+      }
+      rgba[3] = static_cast<Channel>((alpha + count / 2) / count);
+      std::copy_n(rgba, channels, dst);
+    }
+
+    std::fill(m_sums.begin(), m_sums.end(), 0);
+    m_band_rows = 0;
+    ++m_output_row;
+  }
+
+private:
+  Size                       m_source_size;
+  int                        m_reduction;
+  CImage                     m_image;
+  std::vector<std::uint32_t> m_sums;
+  int                        m_band_rows{0};
+  int                        m_source_row{0};
+  int                        m_output_row{0};
+};
+
+struct PngHeader
+{
+  int width;
+  int height;
+  int bit_depth;
+  int color_type;
+  int channels;
+};
+
+struct PngPalette
+{
+  std::array<Color, 256>       colors;
+  std::size_t                  color_count{0};
+  std::array<std::uint32_t, 3> color_key{};
+  bool                         has_color_key{false};
+};
+
+int GetPngChannels(int color_type, int bit_depth)
+{
+  switch (color_type)
+  {
+  case 0: // gray
+    return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 ||
+                   bit_depth == 16
+               ? 1
+               : 0;
+  case 3: // palette
+    return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 ? 1 : 0;
+  case 2: // RGB
+    return bit_depth == 8 || bit_depth == 16 ? 3 : 0;
+  case 4: // gray and alpha
+    return bit_depth == 8 || bit_depth == 16 ? 2 : 0;
+  case 6: // RGBA
+    return bit_depth == 8 || bit_depth == 16 ? 4 : 0;
+  default:
+    return 0;
+  }
+}
+
+// Channel count SdlImage::ConvertToNative leaves the full decode with: gray stays gray, RGB
+// stays RGB, anything with a palette or transparency becomes RGBA. A palette holding exactly
+// the 256 entry gray ramp is kept as gray like SDL's indexed surfaces.
+int GetNativeChannels(const PngHeader& header, const PngPalette& palette)
+{
+  switch (header.color_type)
+  {
+  case 0:
+    return palette.has_color_key ? 4 : 1;
+  case 2:
+    return palette.has_color_key ? 4 : 3;
+  case 3:
+  {
+    if (palette.color_count != palette.colors.size())
+    {
+      return 4;
+    }
+    for (std::size_t i = 0; i < palette.colors.size(); ++i)
+    {
+      const auto& color = palette.colors[i];
+      if (color.r != i || color.g != i || color.b != i || color.a != 255)
+      {
+        return 4;
+      }
+    }
+    return 1;
+  }
+  default:
+    return 4;
+  }
+}
+
+unsigned char Paeth(int a, int b, int c)
+{
+  const int p = a + b - c;
+  const int pa = std::abs(p - a);
+  const int pb = std::abs(p - b);
+  const int pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc)
+  {
+    return static_cast<unsigned char>(a);
+  }
+  return static_cast<unsigned char>(pb <= pc ? b : c);
+}
+
+bool UnfilterRow(unsigned char filter, unsigned char* row, const unsigned char* previous,
+                 std::size_t size, std::size_t bpp)
+{
+  switch (filter)
+  {
+  case 0:
+    return true;
+  case 1:
+    for (std::size_t i = bpp; i < size; ++i)
+    {
+      row[i] = static_cast<unsigned char>(row[i] + row[i - bpp]);
+    }
+    return true;
+  case 2:
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      row[i] = static_cast<unsigned char>(row[i] + previous[i]);
+    }
+    return true;
+  case 3:
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      const int left = i >= bpp ? row[i - bpp] : 0;
+      row[i] = static_cast<unsigned char>(row[i] + ((left + previous[i]) >> 1));
+    }
+    return true;
+  case 4:
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      const int left = i >= bpp ? row[i - bpp] : 0;
+      const int upper_left = i >= bpp ? previous[i - bpp] : 0;
+      row[i] = static_cast<unsigned char>(row[i] + Paeth(left, previous[i], upper_left));
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Expands one unfiltered row to RGBA32; 16 bit samples keep their high byte.
+void ConvertPngRow(const PngHeader& header, const PngPalette& palette, const unsigned char* row,
+                   Channel* rgba)
+{
+  const int depth = header.bit_depth;
+  const auto max_value = (1u << std::min(depth, 8)) - 1;
+  auto       sample = [&](int index) -> std::uint32_t
+  {
+    if (depth == 8)
+    {
+      return row[index];
+    }
+    if (depth == 16)
+    {
+      return (std::uint32_t{row[2 * index]} << 8) | row[2 * index + 1];
+    }
+    const int bit = index * depth;
+    return (row[bit / 8] >> (8 - depth - bit % 8)) & max_value;
+  };
+  auto to_channel = [&](std::uint32_t value)
+  { return static_cast<Channel>(depth == 16 ? value >> 8 : value * 255 / max_value); };
+
+  for (int x = 0; x < header.width; ++x, rgba += kChannels)
+  {
+    switch (header.color_type)
+    {
+    case 0:
+    {
+      const auto gray = sample(x);
+      rgba[0] = rgba[1] = rgba[2] = to_channel(gray);
+      rgba[3] = palette.has_color_key && gray == palette.color_key[0] ? 0 : 255;
+      break;
+    }
+    case 2:
+    {
+      const std::uint32_t rgb[] = {sample(3 * x), sample(3 * x + 1), sample(3 * x + 2)};
+      rgba[0] = to_channel(rgb[0]);
+      rgba[1] = to_channel(rgb[1]);
+      rgba[2] = to_channel(rgb[2]);
+      rgba[3] = palette.has_color_key && rgb[0] == palette.color_key[0] &&
+                        rgb[1] == palette.color_key[1] && rgb[2] == palette.color_key[2]
+                    ? 0
+                    : 255;
+      break;
+    }
+    case 3:
+    {
+      const auto& color = palette.colors[sample(x)];
+      rgba[0] = color.r;
+      rgba[1] = color.g;
+      rgba[2] = color.b;
+      rgba[3] = color.a;
+      break;
+    }
+    case 4:
+      rgba[0] = rgba[1] = rgba[2] = to_channel(sample(2 * x));
+      rgba[3] = to_channel(sample(2 * x + 1));
+      break;
+    default:
+      for (int c = 0; c < kChannels; ++c)
+      {
+        rgba[c] = to_channel(sample(kChannels * x + c));
+      }
+      break;
+    }
+  }
+}
+
+class CInflateStream
+{
+public:
+  CInflateStream()
+  {
+    m_ok = inflateInit(&m_stream) == Z_OK;
+  }
+
+  ~CInflateStream()
+  {
+    if (m_ok)
+    {
+      inflateEnd(&m_stream);
+    }
+  }
+
+  CInflateStream(const CInflateStream&) = delete;
+  CInflateStream& operator=(const CInflateStream&) = delete;
+
+  [[nodiscard]]
+  bool IsOk() const
+  {
+    return m_ok;
+  }
+
+  z_stream* operator->()
+  {
+    return &m_stream;
+  }
+
+  z_stream* Get()
+  {
+    return &m_stream;
+  }
+
+private:
+  z_stream m_stream{};
+  bool     m_ok{false};
+};
+
+std::optional<CReducedImage> DecodePngReduced(std::ifstream& fs, int reduction)
+{
+  PngHeader  header{};
+  PngPalette palette{};
+  palette.colors.fill({0, 0, 0, 255});
+
+  std::optional<CBoxReducer> reducer;
+  CInflateStream             stream;
+  std::vector<unsigned char> row;
+  std::vector<unsigned char> previous;
+  std::vector<Channel>       rgba;
+  std::size_t                row_fill = 0;
+  std::size_t                bpp = 1;
+  int                        rows_read = 0;
+  std::vector<unsigned char> data;
+
+  if (!stream.IsOk())
+  {
+    return std::nullopt;
+  }
+
+  const auto chunks_begin = fs.tellg();
+  fs.seekg(0, std::ios::end);
+  const auto file_end = fs.tellg();
+  fs.seekg(chunks_begin);
+  if (chunks_begin < 0 || file_end < 0 || !fs)
+  {
+    return std::nullopt;
+  }
+
+  for (bool first = true;; first = false)
+  {
+    unsigned char chunk_header[8];
+    if (!fs.read(reinterpret_cast<char*>(chunk_header), sizeof(chunk_header)))
+    {
+      return std::nullopt;
+    }
+    const auto length = ReadBE32(chunk_header);
+    const auto type = std::string(reinterpret_cast<const char*>(chunk_header + 4), 4);
+    // the chunk data is followed by a 4 byte CRC
+    const std::streamoff remaining = file_end - fs.tellg();
+    if (length > 0x7FFFFFFF || std::streamoff{length} + 4 > remaining ||
+        (first && type != "IHDR"))
+    {
+      return std::nullopt;
+    }
+    data.resize(length);
+    if (!fs.read(reinterpret_cast<char*>(data.data()), length) || !fs.ignore(4))
+    {
+      return std::nullopt;
+    }
+
+    if (type == "IHDR")
+    {
+      if (length < 13)
+      {
+        return std::nullopt;
+      }
+      header.width = static_cast<int>(ReadBE32(data.data()));
+      header.height = static_cast<int>(ReadBE32(data.data() + 4));
+      header.bit_depth = data[8];
+      header.color_type = data[9];
+      header.channels = GetPngChannels(header.color_type, header.bit_depth);
+      // Adam7 interlaced images are left to the full decoder
+      if (header.width <= 0 || header.height <= 0 || header.channels == 0 || data[12] != 0)
+      {
+        return std::nullopt;
+      }
+
+      const auto row_bits =
+          static_cast<std::size_t>(header.width) * header.channels * header.bit_depth;
+      bpp = std::max<std::size_t>(1, header.channels * header.bit_depth / 8);
+      row.resize(1 + (row_bits + 7) / 8);
+      previous.assign(row.size(), 0);
+      rgba.resize(static_cast<std::size_t>(header.width) * kChannels);
+    }
+    else if (type == "PLTE")
+    {
+      palette.color_count = std::min<std::size_t>(length / 3, 256);
+      for (std::size_t i = 0; i < palette.color_count; ++i)
+      {
+        palette.colors[i] = {data[3 * i], data[3 * i + 1], data[3 * i + 2], 255};
+      }
+    }
+    else if (type == "tRNS")
+    {
+      if (header.color_type == 3)
+      {
+        for (std::size_t i = 0; i < std::min<std::size_t>(length, 256); ++i)
+        {
+          palette.colors[i].a = data[i];
+        }
+      }
+      else if (length >= 2 * static_cast<std::size_t>(header.channels))
+      {
+        palette.has_color_key = true;
+        for (int c = 0; c < header.channels; ++c)
+        {
+          palette.color_key[c] = (std::uint32_t{data[2 * c]} << 8) | data[2 * c + 1];
+        }
+      }
+    }
+    else if (type == "IDAT")
+    {
+      // tRNS may follow IHDR, so the channel count is only known once the pixels start
+      if (!reducer)
+      {
+        reducer.emplace(Size{header.width, header.height}, reduction,
+                        GetNativeChannels(header, palette));
+      }
+      stream->next_in = data.data();
+      stream->avail_in = length;
+      while (stream->avail_in > 0 && rows_read < header.height)
+      {
+        stream->next_out = row.data() + row_fill;
+        stream->avail_out = static_cast<uInt>(row.size() - row_fill);
+        const int result = inflate(stream.Get(), Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END)
+        {
+          return std::nullopt;
+        }
+        row_fill = row.size() - stream->avail_out;
+        if (row_fill < row.size())
+        {
+          if (result == Z_STREAM_END)
+          {
+            return std::nullopt;
+          }
+          continue;
+        }
+
+        if (!UnfilterRow(row[0], row.data() + 1, previous.data() + 1, row.size() - 1, bpp))
+        {
+          return std::nullopt;
+        }
+        ConvertPngRow(header, palette, row.data() + 1, rgba.data());
+        reducer->AddRow(rgba.data());
+        std::swap(row, previous);
+        row_fill = 0;
+        ++rows_read;
+      }
+    }
+    else if (type == "IEND")
+    {
+      break;
+    }
+  }
+
+  if (!reducer || rows_read != header.height)
+  {
+    return std::nullopt;
+  }
+  return CReducedImage{reducer->Release(), Size{header.width, header.height}};
+}
+
+#ifdef TEXTURE_PACKER_WITH_JPEG
+struct JpegErrorManager
+{
+  jpeg_error_mgr base;
+  std::jmp_buf   jump;
+};
+
+// Owns the libjpeg state. Each member that calls into libjpeg sets the jump target itself and
+// keeps only trivial locals, so the longjmp of a decode error never skips a destructor.
+class CJpegDecoder
+{
+public:
+  explicit CJpegDecoder(std::FILE* file)
+      : m_file(file)
+  {
+    m_info.err = jpeg_std_error(&m_error.base);
+    m_error.base.error_exit = [](j_common_ptr info)
+    { std::longjmp(reinterpret_cast<JpegErrorManager*>(info->err)->jump, 1); };
+    m_error.base.output_message = [](j_common_ptr) {};
+  }
+
+  ~CJpegDecoder()
+  {
+    if (m_created)
+    {
+      jpeg_destroy_decompress(&m_info);
+    }
+    std::fclose(m_file);
+  }
+
+  CJpegDecoder(const CJpegDecoder&) = delete;
+  CJpegDecoder& operator=(const CJpegDecoder&) = delete;
+
+  // Reads the header and starts RGB output scaled by 1 / reduction.
+  bool Start(int reduction)
+  {
+    if (setjmp(m_error.jump) != 0)
+    {
+      return false;
+    }
+    jpeg_create_decompress(&m_info);
+    m_created = true;
+    jpeg_stdio_src(&m_info, m_file);
+    jpeg_read_header(&m_info, TRUE);
+    if (m_info.jpeg_color_space == JCS_CMYK || m_info.jpeg_color_space == JCS_YCCK)
+    {
+      return false;
+    }
+    m_info.out_color_space = JCS_RGB;
+    m_info.scale_num = 1;
+    m_info.scale_denom = static_cast<unsigned int>(reduction);
+    jpeg_start_decompress(&m_info);
+    return m_info.output_components == 3;
+  }
+
+  // Decodes every scanline into an RGB24 buffer of OutputSize().
+  bool ReadRows(Channel* pixels, int pitch)
+  {
+    if (setjmp(m_error.jump) != 0)
+    {
+      return false;
+    }
+    while (m_info.output_scanline < m_info.output_height)
+    {
+      JSAMPROW row = pixels + static_cast<std::ptrdiff_t>(m_info.output_scanline) * pitch;
+      jpeg_read_scanlines(&m_info, &row, 1);
+    }
+    jpeg_finish_decompress(&m_info);
+    return true;
+  }
+
+  [[nodiscard]]
+  Size SourceSize() const
+  {
+    return {static_cast<int>(m_info.image_width), static_cast<int>(m_info.image_height)};
+  }
+
+  [[nodiscard]]
+  Size OutputSize() const
+  {
+    return {static_cast<int>(m_info.output_width), static_cast<int>(m_info.output_height)};
+  }
+
+private:
+  std::FILE*             m_file;
+  jpeg_decompress_struct m_info{};
+  JpegErrorManager       m_error{};
+  bool                   m_created{false};
+};
+
+std::optional<CReducedImage> DecodeJpegReduced(const std::string& file_path, int reduction)
+{
+  std::FILE* file = std::fopen(file_path.c_str(), "rb");
+  if (file == nullptr)
+  {
+    return std::nullopt;
+  }
+
+  CJpegDecoder decoder(file);
+  if (!decoder.Start(reduction))
+  {
+    return std::nullopt;
+  }
+  const auto output_size = decoder.OutputSize();
+  CImage     image(output_size.w, output_size.h, 3);
+  if (!decoder.ReadRows(image.MutablePixels(), image.Pitch()))
+  {
+    return std::nullopt;
+  }
+  return CReducedImage{std::move(image), decoder.SourceSize()};
+}
+#endif
+} // namespace
+
+int decode_reduction_for_scale(double scale, ResampleFilter filter)
+{
+  const double limit = (filter == ResampleFilter::Box ? 1.0 : 0.5) / scale + 1e-9;
+  int          reduction = 1;
+  while (reduction < 8 && reduction * 2 <= limit)
+  {
+    reduction *= 2;
+  }
+  return reduction;
+}
+
+std::optional<CReducedImage> decode_image_reduced(const std::string& file_path, int reduction)
+{
+  std::ifstream fs(file_path, std::ios::binary);
+  unsigned char signature[8] = {};
+  if (!fs.read(reinterpret_cast<char*>(signature), sizeof(signature)))
+  {
+    return std::nullopt;
+  }
+
+  static constexpr unsigned char kPngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  if (std::memcmp(signature, kPngSignature, sizeof(kPngSignature)) == 0)
+  {
+    return DecodePngReduced(fs, reduction);
+  }
+#ifdef TEXTURE_PACKER_WITH_JPEG
+  if (signature[0] == 0xFF && signature[1] == 0xD8)
+  {
+    fs.close();
+    return DecodeJpegReduced(file_path, reduction);
+  }
+#endif
+  return std::nullopt;
+}
+} // namespace TexturePacker
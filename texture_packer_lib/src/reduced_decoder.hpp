@@ -0,0 +1,27 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+#include <texture_packer/resample_filter.hpp>
+
+#include <optional>
+#include <string>
+
+namespace TexturePacker
+{
+struct CReducedImage
+{
+  CImage image;
+  Size   source_size;
+};
+
+// Power of two (1, 2, 4 or 8) the decoder may shrink by before the resampler scales the rest of
+// the way. Leaves at least a 2x reduction to the resampler unless it is a box filter anyway, so
+// the chosen filter still shapes the result.
+int decode_reduction_for_scale(double scale, ResampleFilter filter);
+
+// Decodes the file at ceil(size / reduction) without holding the full size image in memory.
+// Non interlaced PNG rows are box filtered, premultiplied by alpha, as they are inflated; JPEG
+// uses the DCT scaling of libjpeg when built with it. The result has the channel count the full
+// decoder would give. std::nullopt for anything else, the caller then decodes in full.
+std::optional<CReducedImage> decode_image_reduced(const std::string& file_path, int reduction);
+} // namespace TexturePacker
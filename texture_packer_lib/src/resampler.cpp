@@ -0,0 +1,275 @@
+#include "resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr double kPi = 3.14159265358979323846;
+
+struct Kernel
+{
+  double radius;
+  double (*weight)(double x);
+};
+
+double BoxWeight(double x)
+{
+  return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+}
+
+double TriangleWeight(double x)
+{
+  x = std::abs(x);
+  return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+// Mitchell-Netravali with B = C = 1/3
+double MitchellWeight(double x)
+{
+  constexpr double b = 1.0 / 3.0;
+  constexpr double c = 1.0 / 3.0;
+
+  x = std::abs(x);
+  if (x < 1.0)
+  {
+    return ((12 - 9 * b - 6 * c) * x * x * x + (-18 + 12 * b + 6 * c) * x * x + (6 - 2 * b)) / 6;
+  }
+  if (x < 2.0)
+  {
+    return ((-b - 6 * c) * x * x * x + (6 * b + 30 * c) * x * x + (-12 * b - 48 * c) * x +
+            (8 * b + 24 * c)) /
+           6;
+  }
+  return 0.0;
+}
+
+double Sinc(double x)
+{
+  if (x == 0.0)
+  {
+    return 1.0;
+  }
+  x *= kPi;
+  return std::sin(x) / x;
+}
+
+double Lanczos3Weight(double x)
+{
+  return std::abs(x) < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+}
+
+Kernel GetKernel(ResampleFilter filter)
+{
+  switch (filter)
+  {
+  case ResampleFilter::Box:
+    return {0.5, BoxWeight};
+  case ResampleFilter::Bilinear:
+    return {1.0, TriangleWeight};
+  case ResampleFilter::Mitchell:
+    return {2.0, MitchellWeight};
+  case ResampleFilter::Lanczos:
+    return {3.0, Lanczos3Weight};
+  }
+  throw std::invalid_argument("unknown resample filter");
+}
+
+// Normalized weights of the source samples [first, first + weights.size()) for one output
+// sample. Taps outside the source are clamped onto the edge samples.
+struct Contributors
+{
+  int                first{0};
+  std::vector<float> weights;
+};
+
+std::vector<Contributors> ComputeContributors(int src_size, int dst_size, const Kernel& kernel)
+{
+  const double ratio = static_cast<double>(src_size) / dst_size;
+  // widen the kernel when minifying so it covers every source sample
+  const double filter_scale = std::max(1.0, ratio);
+  const double support = kernel.radius * filter_scale;
+
+  std::vector<Contributors> contributors(dst_size);
+  std::vector<double>       weights;
+  for (int i = 0; i < dst_size; ++i)
+  {
+    const double center = (i + 0.5) * ratio;
+    const int    left = static_cast<int>(std::floor(center - support));
+    const int    right = static_cast<int>(std::ceil(center + support));
+    const int    first = std::clamp(left, 0, src_size - 1);
+    const int    last = std::clamp(right, 0, src_size - 1);
+
+    weights.assign(last - first + 1, 0.0);
+    double total = 0.0;
+    for (int j = left; j <= right; ++j)
+    {
+      const double weight = kernel.weight((j + 0.5 - center) / filter_scale);
+      weights[std::clamp(j, first, last) - first] += weight;
+      total += weight;
+    }
+
+    auto& contributor = contributors[i];
+    contributor.first = first;
+    contributor.weights.reserve(weights.size());
+    for (const double weight : weights)
+    {
+      contributor.weights.push_back(static_cast<float>(total != 0.0 ? weight / total : 0.0));
+    }
+  }
+  return contributors;
+}
+
+// Horizontal pass for one row. Each pixel is Channels floats, 4 of which compilers vectorize
+// into one SIMD lane group.
+template <int Channels>
+void FilterRow(const float* src, const std::vector<Contributors>& contributors, float* dst)
+{
+  for (const auto& contributor : contributors)
+  {
+    float        accum[Channels] = {};
+    const float* sample = src + static_cast<std::ptrdiff_t>(contributor.first) * Channels;
+    for (const float weight : contributor.weights)
+    {
+      for (int c = 0; c < Channels; ++c)
+      {
+        accum[c] += sample[c] * weight;
+      }
+      sample += Channels;
+    }
+    for (int c = 0; c < Channels; ++c)
+    {
+      dst[c] = accum[c];
+    }
+    dst += Channels;
+  }
+}
+
+void FilterRow(int channels, const float* src, const std::vector<Contributors>& contributors,
+               float* dst)
+{
+  switch (channels)
+  {
+  case 1:
+    FilterRow<1>(src, contributors, dst);
+    break;
+  case 3:
+    FilterRow<3>(src, contributors, dst);
+    break;
+  default:
+    FilterRow<4>(src, contributors, dst);
+    break;
+  }
+}
+
+// Vertical pass for one output row, accumulated a whole source row at a time so the inner loop
+// runs over contiguous floats.
+void FilterColumn(const float* src, std::size_t row_floats, const Contributors& contributor,
+                  float* dst)
+{
+  std::fill(dst, dst + row_floats, 0.0f);
+  const float* row = src + contributor.first * row_floats;
+  for (const float weight : contributor.weights)
+  {
+    for (std::size_t i = 0; i < row_floats; ++i)
+    {
+      dst[i] += row[i] * weight;
+    }
+    row += row_floats;
+  }
+}
+
+unsigned char ToChannel(float value)
+{
+  return static_cast<unsigned char>(std::clamp(std::lround(value), 0L, 255L));
+}
+} // namespace
+
+CImage resample_image(const CImage& image, int width, int height, ResampleFilter filter,
+                      int threads)
+{
+  const int channels = image.Channels();
+  if (channels != 1 && channels != 3 && channels != 4)
+  {
+    throw std::runtime_error("resample_image expects gray, RGB24 or RGBA32 pixels");
+  }
+  const bool has_alpha = channels == 4;
+
+  const int  src_width = image.Width();
+  const int  src_height = image.Height();
+  const auto kernel = GetKernel(filter);
+  const auto horizontal = ComputeContributors(src_width, width, kernel);
+  const auto vertical = ComputeContributors(src_height, height, kernel);
+
+  CThreadPool thread_pool(threads);
+
+  // premultiply and widen to float, one row per task; opaque images are only widened
+  const auto         src_row_floats = static_cast<std::size_t>(src_width) * channels;
+  std::vector<float> premultiplied(src_row_floats * src_height);
+  thread_pool.ParallelFor(src_height,
+                          [&](std::size_t y)
+                          {
+                            const Channel* src = image.Pixels() + y * image.Pitch();
+                            float*         dst = premultiplied.data() + y * src_row_floats;
+                            if (!has_alpha)
+                            {
+                              std::copy(src, src + src_row_floats, dst);
+                              return;
+                            }
+                            for (int x = 0; x < src_width; ++x, src += 4, dst += 4)
+                            {
+                              const float alpha = src[3] / 255.0f;
+                              dst[0] = src[0] * alpha;
+                              dst[1] = src[1] * alpha;
+                              dst[2] = src[2] * alpha;
+                              dst[3] = src[3];
+                            }
+                          });
+
+  const auto         row_floats = static_cast<std::size_t>(width) * channels;
+  std::vector<float> rows(row_floats * src_height);
+  thread_pool.ParallelFor(src_height,
+                          [&](std::size_t y)
+                          {
+                            FilterRow(channels,
+                                      premultiplied.data() + y * src_row_floats,
+                                      horizontal,
+                                      rows.data() + y * row_floats);
+                          });
+
+  CImage    result(width, height, channels);
+  Channel*  result_pixels = result.MutablePixels();
+  const int result_pitch = result.Pitch();
+  thread_pool.ParallelFor(height,
+                          [&](std::size_t y)
+                          {
+                            std::vector<float> pixels(row_floats);
+                            FilterColumn(rows.data(), row_floats, vertical[y], pixels.data());
+
+                            Channel* dst = result_pixels + y * result_pitch;
+                            if (!has_alpha)
+                            {
+                              std::transform(pixels.begin(), pixels.end(), dst, ToChannel);
+                              return;
+                            }
+                            for (std::size_t i = 0; i < row_floats; i += 4, dst += 4)
+                            {
+                              const float* pixel = pixels.data() + i;
+                              const float  alpha = std::clamp(pixel[3], 0.0f, 255.0f);
+                              const float  unpremultiply = alpha > 0.0f ? 255.0f / alpha : 0.0f;
+                              dst[0] = ToChannel(pixel[0] * unpremultiply);
+                              dst[1] = ToChannel(pixel[1] * unpremultiply);
+                              dst[2] = ToChannel(pixel[2] * unpremultiply);
+                              dst[3] = ToChannel(alpha);
+                            }
+                          });
+  return result;
+}
+} // namespace TexturePacker
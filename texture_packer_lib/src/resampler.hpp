@@ -0,0 +1,14 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+#include <texture_packer/resample_filter.hpp>
+
+namespace TexturePacker
+{
+// Resamples a gray, RGB24 or RGBA32 image to width x height with two separable passes, keeping
+// its channels. Colors are filtered premultiplied by alpha, so transparent pixels do not bleed
+// their color into visible ones.
+// Rows of each pass are split across `threads` workers (0 = hardware concurrency).
+CImage resample_image(const CImage& image, int width, int height, ResampleFilter filter,
+                      int threads = 1);
+} // namespace TexturePacker
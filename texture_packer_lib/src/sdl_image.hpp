@@ -2,7 +2,7 @@
 
 #include <texture_packer/abstract_image.hpp>
 
-#include <cmath>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -41,23 +41,31 @@ public:
     {
       throw std::runtime_error(SDL_GetError());
     }
-    ConvertToRGBA();
+    ConvertToNative();
   }
 
-  SdlImage(int w, int h)
-      : m_surface(SDL_CreateSurface(w, h, SDL_PIXELFORMAT_RGBA32))
+  SdlImage(int w, int h, int channels = 4)
+      : m_surface(CreateSurface(w, h, FormatOfChannels(channels)))
   {
   }
 
   SdlImage(const SdlImage& other)
-      : m_surface(SDL_CreateSurface(other.m_surface->w, other.m_surface->w,
-                                    other.m_surface->format->format))
+      : m_surface(
+            CreateSurface(other.m_surface->w, other.m_surface->h, other.m_surface->format->format))
   {
-
-    if (SDL_BlitSurface(other.m_surface, nullptr, m_surface, nullptr) < 0)
+    if (m_surface == nullptr)
     {
       throw std::runtime_error(SDL_GetError());
     }
+
+    const auto row_size =
+        static_cast<std::size_t>(m_surface->w) * m_surface->format->bytes_per_pixel;
+    for (int y = 0; y < m_surface->h; ++y)
+    {
+      std::memcpy(static_cast<Uint8*>(m_surface->pixels) + y * m_surface->pitch,
+                  static_cast<const Uint8*>(other.m_surface->pixels) + y * other.m_surface->pitch,
+                  row_size);
+    }
   }
 
   ~SdlImage() override
@@ -83,6 +91,24 @@ public:
     return m_surface->format->bytes_per_pixel;
   }
 
+  [[nodiscard]]
+  int Pitch() const override
+  {
+    return m_surface->pitch;
+  }
+
+  [[nodiscard]]
+  const Channel* Pixels() const override
+  {
+    return static_cast<const Channel*>(m_surface->pixels);
+  }
+
+  [[nodiscard]]
+  Channel* Pixels() override
+  {
+    return static_cast<Channel*>(m_surface->pixels);
+  }
+
   void SaveAsJPEG(const std::string& path) const override
   {
     constexpr int quality = 100;
@@ -105,44 +131,52 @@ public:
     auto      old_sfc = m_surface;
     const int new_w = m_surface->w - right - left;
     const int new_h = m_surface->h - top - bottom;
-    m_surface = SDL_CreateSurface(new_w, new_h, m_surface->format->format);
-    SDL_Rect src_rect;
-    src_rect.x = left;
-    src_rect.y = top;
-    src_rect.w = new_w;
-    src_rect.h = new_h;
-    SDL_BlitSurface(old_sfc, &src_rect, m_surface, nullptr);
-    SDL_DestroySurface(old_sfc);
-  }
+    m_surface = CreateSurface(new_w, new_h, m_surface->format->format);
 
-  void Scale(double scale) override
-  {
-    const int new_w = std::max(1, static_cast<int>(std::round(Width() * scale)));
-    const int new_h = std::max(1, static_cast<int>(std::round(Height() * scale)));
-    auto      old_sfc = m_surface;
-    m_surface = SDL_CreateSurface(new_w, new_h, m_surface->format->format);
-    SDL_BlitSurface(old_sfc, nullptr, m_surface, nullptr);
+    // a blit would blend the pixels onto the empty surface, so copy the rows as they are
+    const int  bytes_per_pixel = m_surface->format->bytes_per_pixel;
+    const auto row_size = static_cast<std::size_t>(new_w) * bytes_per_pixel;
+    for (int y = 0; y < new_h; ++y)
+    {
+      std::memcpy(static_cast<Uint8*>(m_surface->pixels) + y * m_surface->pitch,
+                  static_cast<const Uint8*>(old_sfc->pixels) + (y + top) * old_sfc->pitch +
+                      left * bytes_per_pixel,
+                  row_size);
+    }
     SDL_DestroySurface(old_sfc);
   }
 
+  // Gray images hold the level itself, the other formats are bytes in RGB(A) order.
   [[nodiscard]]
   Color GetColor(int x, int y) const override
   {
-    Color color;
-    // NOLINTNEXTLINE
-    auto pixel = (Uint32*)((Uint8*)m_surface->pixels + y * m_surface->pitch +
-                           x * m_surface->format->bytes_per_pixel);
-
-    SDL_GetRGBA(*pixel, m_surface->format, &color.r, &color.g, &color.b, &color.a);
-    return color;
+    const int      channels = Channels();
+    const Channel* pixel = Pixels() + y * m_surface->pitch + x * channels;
+    switch (channels)
+    {
+    case 1:
+      return {pixel[0], pixel[0], pixel[0], 255};
+    case 3:
+      return {pixel[0], pixel[1], pixel[2], 255};
+    default:
+      return {pixel[0], pixel[1], pixel[2], pixel[3]};
+    }
   }
 
   void SetColor(int x, int y, Color color) override
   {
-    // NOLINTNEXTLINE
-    auto pixel = (Uint32*)((Uint8*)m_surface->pixels + y * m_surface->pitch +
-                           x * m_surface->format->bytes_per_pixel);
-    *pixel = SDL_MapRGBA(m_surface->format, color.r, color.g, color.b, color.a);
+    const int channels = Channels();
+    Channel*  pixel = Pixels() + y * m_surface->pitch + x * channels;
+    pixel[0] = color.r;
+    if (channels >= 3)
+    {
+      pixel[1] = color.g;
+      pixel[2] = color.b;
+    }
+    if (channels == 4)
+    {
+      pixel[3] = color.a;
+    }
   }
 
   void Composite(const CAbstractImage& src, int xOffset, int yOffset) override
@@ -177,14 +211,71 @@ public:
   }
 
 private:
-  void ConvertToRGBA()
+  static Uint32 FormatOfChannels(int channels)
+  {
+    switch (channels)
+    {
+    case 1:
+      return SDL_PIXELFORMAT_INDEX8;
+    case 3:
+      return SDL_PIXELFORMAT_RGB24;
+    default:
+      return SDL_PIXELFORMAT_RGBA32;
+    }
+  }
+
+  // Gray images are INDEX8 surfaces whose palette maps every index to that gray level.
+  static bool IsGrayPalette(const SDL_Palette* palette)
+  {
+    if (palette == nullptr || palette->ncolors != 256)
+    {
+      return false;
+    }
+    for (int i = 0; i < palette->ncolors; ++i)
+    {
+      const auto& color = palette->colors[i];
+      if (color.r != i || color.g != i || color.b != i || color.a != 255)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static SDL_Surface* CreateSurface(int w, int h, Uint32 format)
+  {
+    SDL_Surface* surface = SDL_CreateSurface(w, h, format);
+    if (surface != nullptr && format == SDL_PIXELFORMAT_INDEX8)
+    {
+      SDL_Color gray[256];
+      for (int i = 0; i < 256; ++i)
+      {
+        const auto level = static_cast<Uint8>(i);
+        gray[i] = {level, level, level, 255};
+      }
+      SDL_SetPaletteColors(surface->format->palette, gray, 0, 256);
+    }
+    return surface;
+  }
+
+  // Keeps gray and RGB24 images as they are, anything with alpha, a color key or a color palette
+  // becomes RGBA32, and other opaque formats RGB24.
+  void ConvertToNative()
   {
-    if (m_surface->format->format == SDL_PIXELFORMAT_RGBA32)
+    const Uint32 format = m_surface->format->format;
+    const bool   color_key = SDL_SurfaceHasColorKey(m_surface);
+    if ((format == SDL_PIXELFORMAT_RGBA32) ||
+        (format == SDL_PIXELFORMAT_RGB24 && !color_key) ||
+        (format == SDL_PIXELFORMAT_INDEX8 && !color_key &&
+         IsGrayPalette(m_surface->format->palette)))
     {
       return;
     }
+    const bool opaque =
+        !SDL_ISPIXELFORMAT_ALPHA(format) && !SDL_ISPIXELFORMAT_INDEXED(format) && !color_key;
     auto old_sfc = m_surface;
-    m_surface = SDL_ConvertSurfaceFormat(m_surface, SDL_PIXELFORMAT_RGBA32);
+    m_surface = SDL_ConvertSurfaceFormat(m_surface,
+                                         opaque ? SDL_PIXELFORMAT_RGB24 : SDL_PIXELFORMAT_RGBA32);
     SDL_DestroySurface(old_sfc);
   }
 
@@ -0,0 +1,257 @@
+#include "sprite_cache.hpp"
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "hash.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+constexpr std::uint32_t kMagic = 0x43535054; // "TPSC"
+constexpr std::uint16_t kVersion = 3;
+
+enum class Compression : std::uint8_t
+{
+  None = 0,
+  Zstd = 1,
+};
+
+struct EntryHeader
+{
+  std::uint32_t magic;
+  std::uint16_t version;
+  std::uint8_t  compression;
+  std::uint8_t  trimmed;
+  std::uint64_t key;
+  std::uint64_t payload_size;
+  std::int32_t  width;
+  std::int32_t  height;
+  std::int32_t  source_rect[4];
+  std::int32_t  source_bbox[4];
+  std::int32_t  source_size[2];
+  std::int32_t  extruded;
+  std::uint8_t  channels;
+  std::uint8_t  reserved[51];
+};
+
+static_assert(sizeof(EntryHeader) == 128, "payload must start 64 byte aligned");
+
+void PackRect(const CRect& rect, std::int32_t (&out)[4])
+{
+  out[0] = rect.x;
+  out[1] = rect.y;
+  out[2] = rect.width;
+  out[3] = rect.height;
+}
+
+CRect UnpackRect(const std::int32_t (&in)[4])
+{
+  return {in[0], in[1], in[2], in[3]};
+}
+} // namespace
+
+CSpriteCache::CSpriteCache(std::string cache_dir, bool compress)
+    : m_cache_dir(std::move(cache_dir))
+    , m_compress(compress)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(m_cache_dir, ec);
+}
+
+std::uint64_t CSpriteCache::MakeKey(std::uint64_t content_hash, const CPackSettings& settings)
+{
+  return CHasher()
+      .UpdateValue(kVersion)
+      .UpdateValue(content_hash)
+      .UpdateValue(settings.scale)
+      .UpdateValue(settings.scale_filter)
+      .UpdateValue(settings.trim_mode)
+      .UpdateValue(settings.extrude)
+      .Digest();
+}
+
+std::string CSpriteCache::GetEntryPath(std::uint64_t key) const
+{
+  return fmt::format("{}/{:016x}.tpsc", m_cache_dir, key);
+}
+
+std::optional<CImageInfo> CSpriteCache::Load(std::uint64_t key, const std::string& image_path) const
+{
+  std::ifstream fs(GetEntryPath(key), std::ios::binary);
+  EntryHeader   header{};
+  if (!fs || !fs.read(reinterpret_cast<char*>(&header), sizeof(header)))
+  {
+    return std::nullopt;
+  }
+  if (header.magic != kMagic || header.version != kVersion || header.key != key ||
+      header.width <= 0 || header.height <= 0 ||
+      (header.channels != 1 && header.channels != 3 && header.channels != 4))
+  {
+    return std::nullopt;
+  }
+
+  const auto row_size = static_cast<std::size_t>(header.width) * header.channels;
+  const auto pixels_size = row_size * static_cast<std::size_t>(header.height);
+
+  // a corrupt entry is a miss, so check the stored size before allocating for it
+  std::uint64_t max_payload_size = 0;
+  switch (static_cast<Compression>(header.compression))
+  {
+  case Compression::None:
+    max_payload_size = pixels_size;
+    break;
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+  case Compression::Zstd:
+    max_payload_size = ZSTD_compressBound(pixels_size);
+    break;
+#endif
+  default:
+    return std::nullopt;
+  }
+  const auto payload_begin = fs.tellg();
+  fs.seekg(0, std::ios::end);
+  const auto file_end = fs.tellg();
+  fs.seekg(payload_begin);
+  if (!fs || header.payload_size > max_payload_size ||
+      header.payload_size > static_cast<std::uint64_t>(file_end - payload_begin))
+  {
+    return std::nullopt;
+  }
+
+  std::vector<char> payload(header.payload_size);
+  if (!fs.read(payload.data(), static_cast<std::streamsize>(payload.size())))
+  {
+    return std::nullopt;
+  }
+
+  std::vector<char> decompressed;
+  const char*       pixels = payload.data();
+  switch (static_cast<Compression>(header.compression))
+  {
+  case Compression::None:
+    if (payload.size() != pixels_size)
+    {
+      return std::nullopt;
+    }
+    break;
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+  case Compression::Zstd:
+    if (ZSTD_getFrameContentSize(payload.data(), payload.size()) != pixels_size)
+    {
+      return std::nullopt;
+    }
+    decompressed.resize(pixels_size);
+    if (ZSTD_decompress(decompressed.data(), decompressed.size(), payload.data(), payload.size()) !=
+        pixels_size)
+    {
+      return std::nullopt;
+    }
+    pixels = decompressed.data();
+    break;
+#endif
+  default:
+    return std::nullopt;
+  }
+
+  CImage   image(header.width, header.height, header.channels);
+  Channel* dst = image.MutablePixels();
+  for (int y = 0; y < header.height; ++y)
+  {
+    std::memcpy(
+        dst + static_cast<std::ptrdiff_t>(y) * image.Pitch(), pixels + y * row_size, row_size);
+  }
+
+  return CImageInfo(std::move(image),
+                    image_path,
+                    UnpackRect(header.source_rect),
+                    UnpackRect(header.source_bbox),
+                    Size{header.source_size[0], header.source_size[1]},
+                    header.trimmed != 0,
+                    header.extruded);
+}
+
+void CSpriteCache::Store(std::uint64_t key, const CImageInfo& image_info) const
+{
+  const auto        image = image_info.GetImage();
+  const auto        row_size = static_cast<std::size_t>(image.Width()) * image.Channels();
+  std::vector<char> pixels(row_size * static_cast<std::size_t>(image.Height()));
+  for (int y = 0; y < image.Height(); ++y)
+  {
+    std::memcpy(pixels.data() + y * row_size,
+                image.Pixels() + static_cast<std::ptrdiff_t>(y) * image.Pitch(),
+                row_size);
+  }
+
+  EntryHeader header{};
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.compression = static_cast<std::uint8_t>(Compression::None);
+  header.trimmed = image_info.IsTrimmed() ? 1 : 0;
+  header.key = key;
+  header.width = image.Width();
+  header.height = image.Height();
+  PackRect(image_info.GetSourceRect(), header.source_rect);
+  PackRect(image_info.GetSourceBbox(), header.source_bbox);
+  header.source_size[0] = image_info.GetSourceSize().w;
+  header.source_size[1] = image_info.GetSourceSize().h;
+  header.extruded = image_info.GetExtruded();
+  header.channels = static_cast<std::uint8_t>(image.Channels());
+
+#ifdef TEXTURE_PACKER_WITH_ZSTD
+  if (m_compress)
+  {
+    std::vector<char> compressed(ZSTD_compressBound(pixels.size()));
+    const auto        size =
+        ZSTD_compress(compressed.data(), compressed.size(), pixels.data(), pixels.size(), 1);
+    if (!ZSTD_isError(size))
+    {
+      compressed.resize(size);
+      pixels = std::move(compressed);
+      header.compression = static_cast<std::uint8_t>(Compression::Zstd);
+    }
+  }
+#endif
+  header.payload_size = pixels.size();
+
+  // write to a unique temporary file and rename, so concurrent builds never see partial entries
+  const auto entry_path = GetEntryPath(key);
+  const auto temp_path =
+      fmt::format("{}.{:x}.tmp",
+                  entry_path,
+                  CHasher()
+                      .UpdateValue(std::hash<std::thread::id>{}(std::this_thread::get_id()))
+                      .UpdateValue(std::chrono::steady_clock::now().time_since_epoch().count())
+                      .Digest());
+  {
+    std::ofstream fs(temp_path, std::ios::binary);
+    fs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fs.write(pixels.data(), static_cast<std::streamsize>(pixels.size()));
+    if (!fs)
+    {
+      fs.close();
+      std::error_code ec;
+      std::filesystem::remove(temp_path, ec);
+      return;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(temp_path, entry_path, ec);
+  if (ec)
+  {
+    std::filesystem::remove(temp_path, ec);
+  }
+}
+} // namespace TexturePacker
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <texture_packer/image_info.hpp>
+#include <texture_packer/pack_settings.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace TexturePacker
+{
+// On-disk cache of processed (scaled, trimmed, extruded) sprites, keyed by the content hash of
+// the source file and the settings that affect processing.
+//
+// Each entry is one file: a fixed 128 byte header followed by the RGBA rows, tightly packed and
+// 64 byte aligned, so an uncompressed entry can be memory mapped as is. With zstd available the
+// rows may instead be stored as a single zstd frame.
+class CSpriteCache
+{
+public:
+  CSpriteCache(std::string cache_dir, bool compress);
+
+  [[nodiscard]]
+  static std::uint64_t MakeKey(std::uint64_t content_hash, const CPackSettings& settings);
+
+  // std::nullopt on a miss, or when the entry is unreadable or was written by another version.
+  [[nodiscard]]
+  std::optional<CImageInfo> Load(std::uint64_t key, const std::string& image_path) const;
+
+  // Best effort: a failed write leaves the cache without the entry and is not an error.
+  void Store(std::uint64_t key, const CImageInfo& image_info) const;
+
+private:
+  [[nodiscard]]
+  std::string GetEntryPath(std::uint64_t key) const;
+
+private:
+  std::string m_cache_dir;
+  bool        m_compress{false};
+};
+} // namespace TexturePacker
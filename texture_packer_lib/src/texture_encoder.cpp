@@ -0,0 +1,200 @@
+#include "texture_encoder.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "astc_encoder.hpp"
+#include "bcn_encoder.hpp"
+#include "etc_encoder.hpp"
+#include "thread_pool.hpp"
+
+namespace TexturePacker
+{
+namespace
+{
+void EncodeBlock(TextureCompression compression, const CBlockFormat& format,
+                 const Channel* pixels, std::uint64_t visible, CompressionQuality quality,
+                 std::uint8_t* out)
+{
+  switch (compression)
+  {
+  case TextureCompression::None:
+    break;
+  case TextureCompression::BC1:
+    encode_bc1_block(pixels, quality, out);
+    break;
+  case TextureCompression::BC3:
+    encode_bc3_block(pixels, quality, out);
+    break;
+  case TextureCompression::BC7:
+    encode_bc7_block(pixels, quality, out);
+    break;
+  case TextureCompression::ETC2_RGBA:
+    encode_etc2_rgba_block(pixels, visible, quality, out);
+    break;
+  case TextureCompression::ASTC_4x4:
+  case TextureCompression::ASTC_5x4:
+  case TextureCompression::ASTC_5x5:
+  case TextureCompression::ASTC_6x5:
+  case TextureCompression::ASTC_6x6:
+  case TextureCompression::ASTC_8x5:
+  case TextureCompression::ASTC_8x6:
+  case TextureCompression::ASTC_8x8:
+    encode_astc_block(pixels, format.block_width, format.block_height, visible, quality, out);
+    break;
+  }
+}
+} // namespace
+
+CBlockFormat get_block_format(TextureCompression compression)
+{
+  switch (compression)
+  {
+  case TextureCompression::None:
+    return {1, 1, 4};
+  case TextureCompression::BC1:
+    return {4, 4, 8};
+  case TextureCompression::BC3:
+  case TextureCompression::BC7:
+  case TextureCompression::ETC2_RGBA:
+  case TextureCompression::ASTC_4x4:
+    return {4, 4, 16};
+  case TextureCompression::ASTC_5x4:
+    return {5, 4, 16};
+  case TextureCompression::ASTC_5x5:
+    return {5, 5, 16};
+  case TextureCompression::ASTC_6x5:
+    return {6, 5, 16};
+  case TextureCompression::ASTC_6x6:
+    return {6, 6, 16};
+  case TextureCompression::ASTC_8x5:
+    return {8, 5, 16};
+  case TextureCompression::ASTC_8x6:
+    return {8, 6, 16};
+  case TextureCompression::ASTC_8x8:
+    return {8, 8, 16};
+  }
+  return {1, 1, 4};
+}
+
+bool is_compression_supported(const std::string& image_format, TextureCompression compression)
+{
+  if (image_format == "ktx2")
+  {
+    return true;
+  }
+  switch (compression)
+  {
+  case TextureCompression::None:
+    return image_format != "pkm" && image_format != "astc";
+  case TextureCompression::BC1:
+  case TextureCompression::BC3:
+  case TextureCompression::BC7:
+    return image_format == "dds";
+  case TextureCompression::ETC2_RGBA:
+    return image_format == "pkm";
+  case TextureCompression::ASTC_4x4:
+  case TextureCompression::ASTC_5x4:
+  case TextureCompression::ASTC_5x5:
+  case TextureCompression::ASTC_6x5:
+  case TextureCompression::ASTC_6x6:
+  case TextureCompression::ASTC_8x5:
+  case TextureCompression::ASTC_8x6:
+  case TextureCompression::ASTC_8x8:
+    return image_format == "astc";
+  }
+  return false;
+}
+
+std::vector<std::uint8_t> encode_texture(const CImage& image, TextureCompression compression,
+                                         CompressionQuality quality, int threads,
+                                         const std::vector<CRect>& regions)
+{
+  const auto format = get_block_format(compression);
+  const int  blocks_x = (image.Width() + format.block_width - 1) / format.block_width;
+  const int  blocks_y = (image.Height() + format.block_height - 1) / format.block_height;
+  const auto row_bytes = static_cast<std::size_t>(blocks_x) * format.block_bytes;
+
+  std::vector<std::uint8_t> payload(row_bytes * static_cast<std::size_t>(blocks_y));
+  const Channel*            pixels = image.Pixels();
+  const int                 pitch = image.Pitch();
+
+  if (compression == TextureCompression::None)
+  {
+    for (int y = 0; y < image.Height(); ++y)
+    {
+      std::memcpy(&payload[static_cast<std::size_t>(y) * row_bytes],
+                  pixels + static_cast<std::ptrdiff_t>(y) * pitch,
+                  row_bytes);
+    }
+    return payload;
+  }
+
+  CThreadPool thread_pool(threads);
+  thread_pool.ParallelFor(
+      static_cast<std::size_t>(blocks_y),
+      [&](std::size_t block_y)
+      {
+        const int top = static_cast<int>(block_y) * format.block_height;
+        const int row_width = blocks_x * format.block_width;
+
+        // pixels of this row of blocks inside a region, or inside the image without regions
+        std::vector<std::uint8_t> covered(static_cast<std::size_t>(row_width) *
+                                          format.block_height);
+        const auto                cover = [&](const CRect& rect)
+        {
+          const int left = std::max(rect.get_left(), 0);
+          const int right = std::min(rect.get_right(), image.Width());
+          const int bottom =
+              std::min({rect.get_bottom(), image.Height(), top + format.block_height});
+          for (int y = std::max(rect.get_top(), top); y < bottom && left < right; ++y)
+          {
+            std::fill(&covered[static_cast<std::size_t>(y - top) * row_width + left],
+                      &covered[static_cast<std::size_t>(y - top) * row_width + right],
+                      std::uint8_t{1});
+          }
+        };
+        if (regions.empty())
+        {
+          cover({0, 0, image.Width(), image.Height()});
+        }
+        for (const auto& region : regions)
+        {
+          cover(region);
+        }
+
+        std::vector<Channel> block(static_cast<std::size_t>(format.block_width) *
+                                   format.block_height * 4);
+        std::uint8_t*        out = &payload[block_y * row_bytes];
+        for (int block_x = 0; block_x < blocks_x; ++block_x, out += format.block_bytes)
+        {
+          Channel*      dst = block.data();
+          std::uint64_t visible = 0;
+          std::uint64_t inside = 0;
+          for (int y = 0; y < format.block_height; ++y)
+          {
+            const int      src_y = std::min(top + y, image.Height() - 1);
+            const Channel* src_row = pixels + static_cast<std::ptrdiff_t>(src_y) * pitch;
+            for (int x = 0; x < format.block_width; ++x, dst += 4)
+            {
+              const int x_in_row = block_x * format.block_width + x;
+              const int src_x = std::min(x_in_row, image.Width() - 1);
+              std::memcpy(dst, src_row + src_x * 4, 4);
+
+              const auto bit = std::uint64_t{1} << (y * format.block_width + x);
+              inside |= top + y < image.Height() && x_in_row < image.Width() ? bit : 0;
+              visible |= covered[static_cast<std::size_t>(y) * row_width + x_in_row] != 0 ? bit : 0;
+            }
+          }
+          // a block of gutters only is fitted as it is
+          if (visible == 0)
+          {
+            visible = inside;
+          }
+          EncodeBlock(compression, format, block.data(), visible, quality, out);
+        }
+      });
+  return payload;
+}
+} // namespace TexturePacker
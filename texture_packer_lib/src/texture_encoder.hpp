@@ -0,0 +1,34 @@
+#pragma once
+
+#include <texture_packer/image.hpp>
+#include <texture_packer/pack_settings.hpp>
+#include <texture_packer/rect.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace TexturePacker
+{
+// Footprint of one encoded block; uncompressed RGBA8 is a 1x1 block of 4 bytes.
+struct CBlockFormat
+{
+  int block_width;
+  int block_height;
+  int block_bytes;
+};
+
+CBlockFormat get_block_format(TextureCompression compression);
+
+// Whether files of the image format ("png", "dds", ...) can hold textures of the compression.
+bool is_compression_supported(const std::string& image_format, TextureCompression compression);
+
+// Encodes an RGBA32 image row of blocks after row of blocks, left to right. Blocks that reach
+// past the right or bottom edge repeat the last column or row. When `regions` are given, the ETC2
+// and ASTC encoders fit their endpoints to the pixels inside them only, so gutters and free
+// space do not pull on the colors of the sprites sharing a block. Rows of blocks are split across
+// `threads` workers (0 = hardware concurrency).
+std::vector<std::uint8_t> encode_texture(const CImage& image, TextureCompression compression,
+                                         CompressionQuality quality, int threads,
+                                         const std::vector<CRect>& regions = {});
+} // namespace TexturePacker
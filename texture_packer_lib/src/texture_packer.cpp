@@ -1,11 +1,29 @@
 #include <texture_packer/texture_packer.hpp>
 #include <texture_packer/utils.hpp>
 
+#include <fmt/format.h>
 #include <fmt/printf.h>
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <filesystem>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <stdexcept>
+
+#include "build_manifest.hpp"
+#include "hash.hpp"
+#include "mipmap.hpp"
+#include "parallel_load.hpp"
+#include "pixel_format.hpp"
+#include "resampler.hpp"
+#include "sprite_cache.hpp"
+#include "texture_encoder.hpp"
+#include "thread_pool.hpp"
 
 namespace TexturePacker
 {
@@ -20,79 +38,976 @@ void CTexturePacker::Pack(const std::vector<std::string>& image_paths,
 }
 */
 
-void CTexturePacker::Pack(const std::vector<CImageInfo>& image_infos, const CPackSettings& settings)
+namespace
+{
+// A deferred info is decoded right after the scale, straight at the scaled size, unless the
+// pack keeps sprites deferred until composition.
+void PrepareImageInfo(CImageInfo& image_info, const CPackSettings& settings, bool keep_deferred)
+{
+  if (settings.scale != 1.0)
+  {
+    image_info.Scale(settings.scale, settings.scale_filter);
+  }
+  if (!keep_deferred)
+  {
+    image_info.Decode();
+  }
+  if (settings.trim_mode > 0)
+  {
+    image_info.Trim(settings.trim_mode);
+  }
+  if (settings.extrude > 0)
+  {
+    image_info.Extrude(settings.extrude);
+  }
+}
+
+CAtlas MakeAtlas(const CPackSettings& settings)
+{
+  int alignment = 1;
+  if (settings.align_to_mipmaps)
+  {
+    if (settings.mipmap_levels <= 0 || settings.mipmap_levels > 12)
+    {
+      throw std::runtime_error("align_to_mipmaps needs mipmap_levels between 1 and 12");
+    }
+    alignment = 1 << settings.mipmap_levels;
+  }
+
+  int block_width = settings.block_alignment_width;
+  int block_height = settings.block_alignment_height;
+  if (block_width == 0 && block_height == 0)
+  {
+    const auto format = get_block_format(settings.texture_compression);
+    block_width = format.block_width;
+    block_height = format.block_height;
+  }
+  if (block_width < 1 || block_height < 1 || block_width > 64 || block_height > 64)
+  {
+    throw std::runtime_error("block_alignment needs a width and height between 1 and 64");
+  }
+
+  return {settings.max_width,
+          settings.max_height,
+          settings.force_square,
+          settings.force_pot,
+          settings.border_padding,
+          settings.shape_padding,
+          ExpandStrategy::ExpandShortSide,
+          RankStrategy::RankBAF,
+          std::lcm(alignment, block_width),
+          std::lcm(alignment, block_height)};
+}
+
+// Settings that can change the produced files. Threads, caching and input location do not.
+std::uint64_t HashOutputSettings(const CPackSettings& settings)
+{
+  CHasher hasher;
+  hasher.UpdateValue(settings.reduce_border_artifacts)
+      .UpdateValue(settings.force_square)
+      .UpdateValue(settings.force_pot)
+      .UpdateValue(settings.trim_mode)
+      .UpdateValue(settings.extrude)
+      .UpdateValue(settings.max_width)
+      .UpdateValue(settings.max_height)
+      .UpdateValue(settings.border_padding)
+      .UpdateValue(settings.shape_padding)
+      .UpdateValue(settings.scale)
+      .UpdateValue(settings.scale_filter)
+      .UpdateValue(settings.composite_mode)
+      .UpdateValue(settings.premultiply_alpha)
+      .UpdateValue(settings.channel_pack)
+      .UpdateValue(settings.auto_pixel_format)
+      .UpdateValue(settings.reduce_pixel_depth)
+      .UpdateValue(settings.dither)
+      .UpdateValue(settings.palette_colors)
+      .UpdateValue(settings.palette_dither)
+      .UpdateValue(settings.png_options.level)
+      .UpdateValue(settings.png_options.strategy)
+      .UpdateValue(settings.png_options.filter)
+      .UpdateString(settings.atlases_pattern_name)
+      .UpdateString(settings.atlases_output_format)
+      .UpdateValue(settings.share_variant_layout)
+      .UpdateValue(settings.generate_mipmaps)
+      .UpdateValue(settings.align_to_mipmaps)
+      .UpdateValue(settings.mipmap_levels)
+      .UpdateValue(settings.block_alignment_width)
+      .UpdateValue(settings.block_alignment_height)
+      .UpdateValue(settings.mipmap_filter)
+      .UpdateValue(settings.texture_compression)
+      .UpdateValue(settings.compression_quality)
+      .UpdateValue(settings.ktx2_zstd_level);
+  for (const auto& variant : settings.variants)
+  {
+    hasher.UpdateValue(variant.scale).UpdateString(variant.atlases_pattern_name);
+  }
+  return hasher.Digest();
+}
+
+// Resident sprites are hashed by their processed pixels. Deferred ones by their source file,
+// which together with the settings hash determines the pixels they decode to.
+std::uint64_t HashSpriteContent(const CImageInfo& image_info)
+{
+  if (image_info.IsDeferred())
+  {
+    return hash_file(image_info.GetImagePath()).value_or(0);
+  }
+
+  const auto image = image_info.GetImage();
+  const auto row_size = static_cast<std::size_t>(image.Width()) * image.Channels();
+  CHasher    hasher;
+  hasher.UpdateValue(image.Width()).UpdateValue(image.Height()).UpdateValue(image.Channels());
+  for (int y = 0; y < image.Height(); ++y)
+  {
+    hasher.Update(image.Pixels() + static_cast<std::ptrdiff_t>(y) * image.Pitch(), row_size);
+  }
+  return hasher.Digest();
+}
+
+void HashPlacedImageRects(CHasher& hasher, const CAtlas& atlas,
+                          const std::vector<CImageInfo>&    image_infos,
+                          const std::vector<std::uint64_t>& content_hashes)
+{
+  for (const auto& image_rect : atlas.GetPlacedImageRect())
+  {
+    const auto& image_info = image_infos[image_rect.m_ex_key];
+    hasher.UpdateValue(content_hashes[image_rect.m_ex_key])
+        .UpdateValue(static_cast<const CRect&>(image_rect))
+        .UpdateString(image_info.GetImagePath())
+        .UpdateValue(image_info.GetSourceRect())
+        .UpdateValue(image_info.GetSourceBbox())
+        .UpdateValue(image_info.GetSourceSize())
+        .UpdateValue(image_info.GetExtruded());
+  }
+}
+
+std::uint64_t HashPage(std::uint64_t settings_hash, const std::string& image_file_name,
+                       const std::vector<const CAtlas*>& layers,
+                       const std::vector<CImageInfo>&    image_infos,
+                       const std::vector<std::uint64_t>& content_hashes)
+{
+  CHasher hasher;
+  hasher.UpdateValue(settings_hash).UpdateString(image_file_name);
+  for (const auto* atlas : layers)
+  {
+    hasher.UpdateValue(atlas != nullptr);
+    if (atlas == nullptr)
+    {
+      continue;
+    }
+    hasher.UpdateValue(atlas->GetWidth()).UpdateValue(atlas->GetHeight());
+    HashPlacedImageRects(hasher, *atlas, image_infos, content_hashes);
+  }
+  return hasher.Digest();
+}
+
+// "atlas_00.png" -> "atlas_00.tmp.png", the extension still selects the encoder.
+std::filesystem::path MakeTempPath(const std::filesystem::path& file_path)
+{
+  auto temp_path = file_path;
+  return temp_path.replace_extension(".tmp" + file_path.extension().string());
+}
+
+// Moves temp_path over file_path unless file_path already has the same content, so unchanged
+// outputs keep their modification time. Returns the content hash.
+std::uint64_t CommitOutputFile(const std::filesystem::path& temp_path,
+                               const std::filesystem::path& file_path)
+{
+  const auto hash = hash_file(temp_path.string());
+  if (!hash)
+  {
+    throw std::runtime_error("can not write " + file_path.string());
+  }
+
+  if (hash_file(file_path.string()) == hash)
+  {
+    std::filesystem::remove(temp_path);
+  }
+  else
+  {
+    std::filesystem::rename(temp_path, file_path);
+  }
+  return *hash;
+}
+
+bool IsPageUpToDate(const CManifestPage* previous_page, const CManifestPage& page,
+                    const std::filesystem::path& output_dir)
+{
+  if (previous_page == nullptr || previous_page->signature != page.signature ||
+      previous_page->json_file_name != page.json_file_name ||
+      previous_page->mipmaps.size() != page.mipmaps.size())
+  {
+    return false;
+  }
+
+  const auto is_unchanged = [&output_dir](const std::string& file_name, std::uint64_t hash)
+  { return hash_file((output_dir / file_name).string()) == hash; };
+  if (!is_unchanged(page.image_file_name, previous_page->image_hash) ||
+      !is_unchanged(page.json_file_name, previous_page->json_hash))
+  {
+    return false;
+  }
+  for (std::size_t level = 0; level < page.mipmaps.size(); ++level)
+  {
+    const auto& mipmap = previous_page->mipmaps[level];
+    if (mipmap.file_name != page.mipmaps[level].file_name ||
+        !is_unchanged(mipmap.file_name, mipmap.hash))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Integer k with scale == k * base_scale, or 0 when the ratio is not an integer.
+int IntegerRatio(double scale, double base_scale)
+{
+  const double ratio = scale / base_scale;
+  const long   rounded = std::lround(ratio);
+  return rounded >= 1 && std::abs(ratio - static_cast<double>(rounded)) < 1e-6
+             ? static_cast<int>(rounded)
+             : 0;
+}
+
+// Sprite geometry of one variant: the scaled source size and the trimmed box inside it.
+struct VariantGeometry
+{
+  Size  size;
+  CRect bbox;
+};
+
+// The box grows outwards when scaled, so no visible pixel of the high resolution box is lost.
+VariantGeometry ScaleGeometry(Size size, const CRect& bbox, double ratio)
+{
+  VariantGeometry geometry;
+  geometry.size = {std::max(1, static_cast<int>(std::round(size.w * ratio))),
+                   std::max(1, static_cast<int>(std::round(size.h * ratio)))};
+
+  const auto scaled = [ratio](int value, bool round_up)
+  {
+    const double scaled_value = value * ratio;
+    return static_cast<int>(round_up ? std::ceil(scaled_value) : std::floor(scaled_value));
+  };
+  const int left = std::clamp(scaled(bbox.get_left(), false), 0, geometry.size.w - 1);
+  const int top = std::clamp(scaled(bbox.get_top(), false), 0, geometry.size.h - 1);
+  const int right = std::clamp(scaled(bbox.get_right(), true), left + 1, geometry.size.w);
+  const int bottom = std::clamp(scaled(bbox.get_bottom(), true), top + 1, geometry.size.h);
+  geometry.bbox = {left, top, right - left, bottom - top};
+  return geometry;
+}
+
+VariantGeometry MultiplyGeometry(const VariantGeometry& geometry, int factor)
+{
+  return {{geometry.size.w * factor, geometry.size.h * factor},
+          {geometry.bbox.x * factor,
+           geometry.bbox.y * factor,
+           geometry.bbox.width * factor,
+           geometry.bbox.height * factor}};
+}
+
+// Resamples the high resolution source to the variant size, then trims and extrudes it by
+// `extrude` the same way PrepareImageInfo does.
+CImageInfo MakeVariantImageInfo(const CImageInfo& source, const CImage& high_res_image,
+                                const VariantGeometry& geometry, int extrude,
+                                const CPackSettings& settings)
+{
+  const bool trimmed = settings.trim_mode > 0;
+  const auto [size, bbox] = geometry;
+
+  CImage image = size.w == high_res_image.Width() && size.h == high_res_image.Height()
+                     ? high_res_image
+                     : resample_image(high_res_image, size.w, size.h, settings.scale_filter);
+  if (trimmed)
+  {
+    image.Crop(bbox.get_left(),
+               bbox.get_top(),
+               size.w - bbox.get_right(),
+               size.h - bbox.get_bottom());
+  }
+  if (extrude > 0)
+  {
+    image.EnlargeBorder(extrude, true);
+  }
+
+  const CRect source_rect{extrude, extrude, size.w, size.h};
+  const CRect source_bbox =
+      trimmed ? CRect{bbox.x + extrude, bbox.y + extrude, bbox.width, bbox.height} : source_rect;
+  return {std::move(image),
+          source.GetImagePath(),
+          source_rect,
+          source_bbox,
+          source.GetSourceSize(),
+          trimmed,
+          extrude};
+}
+
+// Bytes the pages take in the pixel formats auto_pixel_format picks for the sprites on them.
+std::int64_t GetPagesMemory(const std::vector<CAtlas>&      atlases,
+                            const std::vector<CPixelUsage>& usages, bool reduce_depth)
+{
+  std::int64_t bytes = 0;
+  for (const auto& atlas : atlases)
+  {
+    CPixelUsage usage;
+    for (const auto& image_rect : atlas.GetPlacedImageRect())
+    {
+      usage.Merge(usages[image_rect.m_ex_key]);
+    }
+    bytes += static_cast<std::int64_t>(atlas.GetWidth()) * atlas.GetHeight() *
+             pixel_format_bytes(select_pixel_format(usage, reduce_depth));
+  }
+  return bytes;
+}
+
+// Atlases of one output pattern, with the image infos their rect keys index. Channel pages are
+// numbered after the atlases; each stacks the layouts of its R, G, B and A channel (null when
+// unused).
+struct PageGroup
+{
+  const std::vector<CAtlas>*                     atlases;
+  const std::vector<CImageInfo>*                 image_infos;
+  std::string                                    pattern_name;
+  const std::vector<std::vector<const CAtlas*>>* channel_pages{nullptr};
+};
+
+// Composes, encodes and writes every page of the groups, skipping pages the build manifest shows
+// as up to date, then removes the pages of the previous build that are no longer produced.
+void WritePages(const std::vector<PageGroup>& groups, const CPackSettings& settings)
+{
+  if (!is_compression_supported(settings.atlases_output_format, settings.texture_compression))
+  {
+    throw std::runtime_error("texture_compression does not fit the " +
+                             settings.atlases_output_format + " output format");
+  }
+  if (settings.ktx2_zstd_level < 0 || settings.ktx2_zstd_level > 22)
+  {
+    throw std::runtime_error("ktx2_zstd_level needs to be between 0 and 22");
+  }
+  if (settings.auto_pixel_format &&
+      (settings.texture_compression != TextureCompression::None ||
+       (settings.atlases_output_format != "png" && settings.atlases_output_format != "ktx2")))
+  {
+    throw std::runtime_error("auto_pixel_format needs uncompressed png or ktx2 output");
+  }
+  if (settings.png_options.level < 0 || settings.png_options.level > 9)
+  {
+    throw std::runtime_error("png compression level needs to be between 0 and 9");
+  }
+  if (settings.palette_colors != 0)
+  {
+    if (settings.palette_colors < 2 || settings.palette_colors > 256)
+    {
+      throw std::runtime_error("palette_colors needs to be 0 or between 2 and 256");
+    }
+    if (settings.texture_compression != TextureCompression::None ||
+        settings.atlases_output_format != "png" || settings.auto_pixel_format)
+    {
+      throw std::runtime_error("palette output needs uncompressed png without auto_pixel_format");
+    }
+  }
+  // a KTX2 page holds its mip levels, other formats get a file per level
+  const bool single_file_mipmaps = settings.atlases_output_format == "ktx2";
+
+  const std::filesystem::path output_dir = settings.atlases_output_dir;
+  const auto                  manifest_path = (output_dir / CBuildManifest::kFileName).string();
+  const auto                  previous_manifest = CBuildManifest::Load(manifest_path);
+
+  CBuildManifest manifest;
+  manifest.settings_hash = HashOutputSettings(settings);
+
+  struct Page
+  {
+    const PageGroup*                  group;
+    const std::vector<std::uint64_t>* content_hashes;
+    std::size_t                       index;
+    // the atlas of the page, or the layouts of the channels of a channel page
+    std::vector<const CAtlas*> layers;
+    bool                       channel_page;
+  };
+
+  CThreadPool                             thread_pool(settings.threads);
+  std::vector<std::vector<std::uint64_t>> group_content_hashes(groups.size());
+  std::vector<Page>                       pages;
+  for (std::size_t g = 0; g < groups.size(); ++g)
+  {
+    const auto& image_infos = *groups[g].image_infos;
+    auto&       content_hashes = group_content_hashes[g];
+    content_hashes.resize(image_infos.size());
+    thread_pool.ParallelFor(image_infos.size(),
+                            [&](std::size_t index)
+                            { content_hashes[index] = HashSpriteContent(image_infos[index]); });
+    for (std::size_t i = 0; i < image_infos.size(); ++i)
+    {
+      manifest.input_hashes.emplace(image_infos[i].GetImagePath(), content_hashes[i]);
+    }
+    for (std::size_t i = 0; i < groups[g].atlases->size(); ++i)
+    {
+      pages.push_back({&groups[g], &content_hashes, i, {&(*groups[g].atlases)[i]}, false});
+    }
+    if (groups[g].channel_pages != nullptr)
+    {
+      const auto& channel_pages = *groups[g].channel_pages;
+      for (std::size_t i = 0; i < channel_pages.size(); ++i)
+      {
+        pages.push_back({&groups[g],
+                         &content_hashes,
+                         groups[g].atlases->size() + i,
+                         channel_pages[i],
+                         true});
+      }
+    }
+  }
+
+  // Each worker composes and encodes one page at a time, so at most page_threads atlas images
+  // are alive at once.
+  const auto thread_count = static_cast<int>(CThreadPool::ResolveThreadCount(settings.threads));
+  auto       page_threads = thread_count;
+  if (settings.max_pages_in_flight > 0)
+  {
+    page_threads = std::min(page_threads, settings.max_pages_in_flight);
+  }
+  page_threads = std::min(page_threads, static_cast<int>(pages.size()));
+  CThreadPool page_thread_pool(page_threads);
+
+  // Threads left over by too few pages compose and deflate within each page.
+  const int threads_per_page = std::max(1, thread_count / std::max(1, page_threads));
+
+  manifest.pages.resize(pages.size());
+  page_thread_pool.ParallelFor(
+      pages.size(),
+      [&](std::size_t i)
+      {
+        const auto&       image_infos = *pages[i].group->image_infos;
+        const auto&       layers = pages[i].layers;
+        const bool        channel_page = pages[i].channel_page;
+        const auto        page_size = get_channel_page_size(layers);
+        const std::string atlas_name = fmt::sprintf(pages[i].group->pattern_name, pages[i].index);
+        const std::string image_file_name = atlas_name + "." + settings.atlases_output_format;
+        const std::string json_file_name = atlas_name + ".json";
+        const auto        image_path = output_dir / image_file_name;
+        const auto        json_path = output_dir / json_file_name;
+
+        CManifestPage& page = manifest.pages[i];
+        page.image_file_name = image_file_name;
+        page.json_file_name = json_file_name;
+        page.signature = HashPage(manifest.settings_hash,
+                                  image_file_name,
+                                  layers,
+                                  image_infos,
+                                  *pages[i].content_hashes);
+        const int mipmap_levels =
+            settings.generate_mipmaps
+                ? mipmap_level_count(page_size.w, page_size.h, settings.mipmap_levels)
+                : 0;
+        if (!single_file_mipmaps)
+        {
+          for (int level = 1; level <= mipmap_levels; ++level)
+          {
+            page.mipmaps.push_back(
+                {fmt::format("{}_mip{}.{}", atlas_name, level, settings.atlases_output_format)});
+          }
+        }
+
+        const auto* previous_page = previous_manifest.FindPage(image_file_name);
+        if (IsPageUpToDate(previous_page, page, output_dir))
+        {
+          page = *previous_page;
+          return;
+        }
+
+        // channel pages hold values rather than colors, there is no alpha to premultiply or bleed
+        const bool premultiplied = settings.premultiply_alpha && !channel_page;
+        auto       image = channel_page ? dump_channel_atlases_to_image(
+                                        layers, image_infos, threads_per_page)
+                                        : dump_atlas_to_image(*layers[0],
+                                                              image_infos,
+                                                              threads_per_page,
+                                                              settings.composite_mode,
+                                                              premultiplied);
+        // transparent texels are black once premultiplied, so there is nothing to bleed
+        if (settings.reduce_border_artifacts && !settings.premultiply_alpha && !channel_page)
+        {
+          image.AlphaBleeding();
+        }
+        std::vector<std::vector<CRect>> channel_regions;
+        std::vector<CRect>              regions;
+        for (const auto* atlas : layers)
+        {
+          auto& layer_regions = channel_regions.emplace_back();
+          for (const auto& image_rect : atlas != nullptr ? atlas->GetPlacedImageRect()
+                                                         : std::vector<CImageRect>{})
+          {
+            layer_regions.push_back(image_rect);
+            regions.push_back(image_rect);
+          }
+        }
+        // channel pages keep all four planes
+        const auto pixel_format =
+            settings.auto_pixel_format && !channel_page
+                ? select_pixel_format(analyze_pixels(image, regions), settings.reduce_pixel_depth)
+                : PixelFormat::RGBA8;
+        const auto make_mipmaps = [&](int levels)
+        {
+          return channel_page ? build_channel_mipmaps(image,
+                                                      channel_regions,
+                                                      levels,
+                                                      settings.mipmap_filter,
+                                                      threads_per_page)
+                              : build_mipmaps(image,
+                                              regions,
+                                              levels,
+                                              settings.mipmap_filter,
+                                              premultiplied,
+                                              threads_per_page);
+        };
+        // channel pages keep their planes apart, a palette would mix them
+        const bool palette = settings.palette_colors > 0 && !channel_page;
+        const auto save_level =
+            [&](const std::filesystem::path& path, const CImage& level, const auto& level_regions)
+        {
+          if (palette)
+          {
+            save_palette_png_to_file(path.string(),
+                                     level,
+                                     settings.palette_colors,
+                                     settings.palette_dither,
+                                     threads_per_page,
+                                     settings.png_options);
+            return;
+          }
+          save_image_to_file(path.string(),
+                             to_pixel_format(level, pixel_format, settings.dither),
+                             threads_per_page,
+                             settings.texture_compression,
+                             settings.compression_quality,
+                             level_regions,
+                             pixel_format,
+                             settings.png_options);
+        };
+        const auto image_temp_path = MakeTempPath(image_path);
+        const auto json_temp_path = MakeTempPath(json_path);
+        if (single_file_mipmaps)
+        {
+          auto mipmaps = mipmap_levels > 0 ? make_mipmaps(mipmap_levels) : std::vector<CImage>{};
+          for (auto& mipmap : mipmaps)
+          {
+            mipmap = to_pixel_format(mipmap, pixel_format, settings.dither);
+          }
+          save_ktx2_to_file(image_temp_path.string(),
+                            to_pixel_format(image, pixel_format, settings.dither),
+                            mipmaps,
+                            threads_per_page,
+                            settings.texture_compression,
+                            settings.compression_quality,
+                            settings.ktx2_zstd_level,
+                            premultiplied,
+                            regions,
+                            pixel_format);
+        }
+        else
+        {
+          save_level(image_temp_path, image, regions);
+        }
+        if (channel_page)
+        {
+          dump_channel_atlases_to_json(
+              json_temp_path.string(), layers, image_infos, image_file_name);
+        }
+        else
+        {
+          dump_atlas_to_json(json_temp_path.string(),
+                             *layers[0],
+                             image_infos,
+                             image_file_name,
+                             settings.premultiply_alpha,
+                             settings.auto_pixel_format ? std::optional(pixel_format)
+                                                        : std::nullopt);
+        }
+        page.image_hash = CommitOutputFile(image_temp_path, image_path);
+        page.json_hash = CommitOutputFile(json_temp_path, json_path);
+
+        if (page.mipmaps.empty())
+        {
+          return;
+        }
+        const auto mipmaps = make_mipmaps(static_cast<int>(page.mipmaps.size()));
+        for (std::size_t level = 0; level < mipmaps.size(); ++level)
+        {
+          for (auto& region : regions)
+          {
+            region = halve_mipmap_region(region, mipmaps[level].Width(), mipmaps[level].Height());
+          }
+          const auto mipmap_path = output_dir / page.mipmaps[level].file_name;
+          const auto mipmap_temp_path = MakeTempPath(mipmap_path);
+          save_level(mipmap_temp_path, mipmaps[level], regions);
+          page.mipmaps[level].hash = CommitOutputFile(mipmap_temp_path, mipmap_path);
+        }
+      });
+
+  // Files of the previous build that this build no longer produces.
+  std::set<std::string> produced_file_names;
+  for (const auto& page : manifest.pages)
+  {
+    for (const auto& file_name : page.GetFileNames())
+    {
+      produced_file_names.insert(file_name);
+    }
+  }
+  for (const auto& previous_page : previous_manifest.pages)
+  {
+    for (const auto& file_name : previous_page.GetFileNames())
+    {
+      if (produced_file_names.count(file_name) == 0)
+      {
+        std::error_code ec;
+        std::filesystem::remove(output_dir / file_name, ec);
+      }
+    }
+  }
+
+  manifest.Save(manifest_path);
+}
+} // namespace
+
+void CTexturePacker::Pack(const std::vector<CImageInfo>& image_infos,
+                          const CPackSettings&           settings) const
 {
-  m_atlases.clear();
-  m_atlases.emplace_back(settings.max_width,
-                         settings.max_height,
-                         settings.force_square,
-                         settings.force_pot,
-                         settings.border_padding,
-                         settings.shape_padding);
+  if (!settings.variants.empty())
+  {
+    PackVariants(image_infos, settings);
+    return;
+  }
 
   auto image_infos_copy = image_infos;
 
-  if (settings.scale != 1.0)
+  CThreadPool thread_pool(settings.threads);
+  thread_pool.ParallelFor(
+      image_infos_copy.size(),
+      [&](std::size_t index)
+      { PrepareImageInfo(image_infos_copy[index], settings, settings.deferred_decode); });
+
+  PackPreparedImageInfos(image_infos_copy, settings);
+}
+
+void CTexturePacker::Pack(const CPackSettings& settings) const
+{
+  const auto file_paths = list_image_files_in_dir(settings.images_input_dir);
+  // Downscaled sources are probed and decoded while preparing, straight at their scaled size.
+  const bool downscale = settings.scale < 1.0;
+
+  // Variants resample from the decoded source, so cached single-scale sprites do not apply.
+  if (settings.sprite_cache_dir.empty() || !settings.variants.empty())
+  {
+    // variants decode every source once themselves
+    const bool probe = settings.deferred_decode || downscale || !settings.variants.empty();
+    const auto image_infos = probe ? probe_image_infos_from_paths(file_paths, settings.threads)
+                                   : load_image_infos_from_paths(file_paths, settings.threads);
+    return Pack(image_infos, settings);
+  }
+
+  // Cache hits skip the decoder and the per-pixel passes, and are always kept resident.
+  const CSpriteCache      sprite_cache(settings.sprite_cache_dir, settings.compress_sprite_cache);
+  std::vector<CLoadError> errors;
+  const auto              image_infos = load_in_parallel(
+      file_paths,
+      settings.threads,
+      errors,
+      [&](const std::string& file_path)
+      {
+        const auto content_hash = hash_file(file_path);
+        if (!content_hash)
+        {
+          throw std::runtime_error("can not read file");
+        }
+
+        const auto key = CSpriteCache::MakeKey(*content_hash, settings);
+        if (auto cached = sprite_cache.Load(key, file_path))
+        {
+          return std::move(*cached);
+        }
+
+        auto image_info = downscale ? probe_image_info_from_file(file_path)
+                                    : read_image_info_from_file(file_path);
+        PrepareImageInfo(image_info, settings, false);
+        sprite_cache.Store(key, image_info);
+        return image_info;
+      });
+  throw_on_load_errors(errors);
+
+  PackPreparedImageInfos(image_infos, settings);
+}
+
+void CTexturePacker::PackPreparedImageInfos(const std::vector<CImageInfo>& image_infos,
+                                            const CPackSettings&           settings)
+{
+  if (!settings.channel_pack)
   {
-    for (CImageInfo& image_info : image_infos_copy)
+    std::vector<std::size_t> indices(image_infos.size());
+    std::iota(indices.begin(), indices.end(), std::size_t{0});
+    const auto atlases = LayoutColorImageInfos(image_infos, indices, settings);
+    WritePages({{&atlases, &image_infos, settings.atlases_pattern_name}}, settings);
+    return;
+  }
+
+  // deferred sprites are decoded once more here and their pixels dropped again, like Trim does
+  std::vector<char> single_channel(image_infos.size(), 0);
+  CThreadPool       thread_pool(settings.threads);
+  thread_pool.ParallelFor(image_infos.size(),
+                          [&](std::size_t i)
+                          { single_channel[i] = image_infos[i].GetImage().IsSingleChannel(); });
+
+  // Single channel sprites are dealt largest first to the least filled of the four channels, so
+  // the channel layouts come out about the same size.
+  std::vector<std::size_t> color_indices;
+  std::vector<std::size_t> channel_candidates;
+  for (std::size_t i = 0; i < image_infos.size(); ++i)
+  {
+    (single_channel[i] ? channel_candidates : color_indices).push_back(i);
+  }
+  const auto area = [&](std::size_t i) { return image_infos[i].GetImageRect().get_area(); };
+  std::stable_sort(channel_candidates.begin(),
+                   channel_candidates.end(),
+                   [&](std::size_t a, std::size_t b) { return area(a) > area(b); });
+  std::array<std::vector<std::size_t>, 4> channel_indices;
+  std::array<std::int64_t, 4>             channel_areas{};
+  for (const auto i : channel_candidates)
+  {
+    const auto c = static_cast<std::size_t>(
+        std::min_element(channel_areas.begin(), channel_areas.end()) - channel_areas.begin());
+    channel_indices[c].push_back(i);
+    channel_areas[c] += area(i);
+  }
+
+  const auto atlases = color_indices.empty()
+                           ? std::vector<CAtlas>{}
+                           : LayoutColorImageInfos(image_infos, color_indices, settings);
+  std::array<std::vector<CAtlas>, 4> channel_atlases;
+  std::size_t                        channel_page_count = 0;
+  for (std::size_t c = 0; c < channel_atlases.size(); ++c)
+  {
+    if (!channel_indices[c].empty())
     {
-      image_info.Scale(settings.scale);
+      channel_atlases[c] = LayoutImageInfos(image_infos, channel_indices[c], settings);
     }
+    channel_page_count = std::max(channel_page_count, channel_atlases[c].size());
   }
-  if (settings.trim_mode > 0)
+  std::vector<std::vector<const CAtlas*>> channel_pages(channel_page_count);
+  for (std::size_t j = 0; j < channel_page_count; ++j)
   {
-    for (CImageInfo& image_info : image_infos_copy)
+    for (const auto& layouts : channel_atlases)
     {
-      image_info.Trim(settings.trim_mode);
+      channel_pages[j].push_back(j < layouts.size() ? &layouts[j] : nullptr);
     }
   }
+  WritePages({{&atlases, &image_infos, settings.atlases_pattern_name, &channel_pages}}, settings);
+}
 
-  if (settings.extrude > 0)
+std::vector<CAtlas> CTexturePacker::LayoutColorImageInfos(
+    const std::vector<CImageInfo>& image_infos, const std::vector<std::size_t>& indices,
+    const CPackSettings& settings)
+{
+  if (!settings.auto_pixel_format)
   {
-    for (CImageInfo& image_info : image_infos_copy)
+    return LayoutImageInfos(image_infos, indices, settings);
+  }
+
+  // deferred sprites are decoded once more here and their pixels dropped again, like Trim does
+  std::vector<CPixelUsage> usages(image_infos.size());
+  CThreadPool              thread_pool(settings.threads);
+  thread_pool.ParallelFor(indices.size(),
+                          [&](std::size_t i)
+                          {
+                            const auto index = indices[i];
+                            usages[index] = analyze_pixels(image_infos[index].GetImage());
+                          });
+
+  auto                     atlases = LayoutImageInfos(image_infos, indices, settings);
+  std::vector<std::size_t> opaque_indices;
+  std::vector<std::size_t> translucent_indices;
+  for (const auto i : indices)
+  {
+    (usages[i].translucent ? translucent_indices : opaque_indices).push_back(i);
+  }
+  if (opaque_indices.empty() || translucent_indices.empty())
+  {
+    return atlases;
+  }
+
+  // Opaque sprites on pages of their own drop the alpha channel, which can outweigh the extra
+  // page edges.
+  auto split_atlases = LayoutImageInfos(image_infos, opaque_indices, settings);
+  for (auto& atlas : LayoutImageInfos(image_infos, translucent_indices, settings))
+  {
+    split_atlases.push_back(std::move(atlas));
+  }
+  return GetPagesMemory(split_atlases, usages, settings.reduce_pixel_depth) <
+                 GetPagesMemory(atlases, usages, settings.reduce_pixel_depth)
+             ? split_atlases
+             : atlases;
+}
+
+void CTexturePacker::PackVariants(const std::vector<CImageInfo>& image_infos,
+                                  const CPackSettings&           settings)
+{
+  if (settings.channel_pack)
+  {
+    throw std::runtime_error("channel_pack can not be combined with variants");
+  }
+
+  const auto& variants = settings.variants;
+  for (const auto& variant : variants)
+  {
+    if (variant.scale <= 0.0)
     {
-      image_info.Extrude(settings.extrude);
+      throw std::runtime_error("variant scale must be positive");
     }
   }
+  const auto [base_variant, top_variant] = std::minmax_element(
+      variants.begin(),
+      variants.end(),
+      [](const CScaleVariant& a, const CScaleVariant& b) { return a.scale < b.scale; });
+  const double base_scale = base_variant->scale;
+  const double top_scale = top_variant->scale;
 
-  std::vector<CImageRect> image_rects;
-  for (const auto& image_info : image_infos_copy)
+  std::vector<int> factors(variants.size(), 1);
+  if (settings.share_variant_layout)
   {
-    image_rects.emplace_back(image_info.GetImageRect());
+    for (std::size_t v = 0; v < variants.size(); ++v)
+    {
+      factors[v] = IntegerRatio(variants[v].scale, base_scale);
+      if (factors[v] == 0)
+      {
+        throw std::runtime_error(
+            "share_variant_layout needs every variant scale to be an integer multiple of the "
+            "smallest one");
+      }
+    }
+    // sprites keep their extrusion in the frame offset, which holds at most 255 pixels
+    if (settings.extrude * *std::max_element(factors.begin(), factors.end()) > 255)
+    {
+      throw std::runtime_error(
+          "share_variant_layout needs extrude times the largest scale factor to be at most 255");
+    }
   }
 
-  AddImageRects(image_rects, settings);
-  for (auto& atlas : m_atlases)
+  // Each source is decoded and trimmed once at the highest scale, every variant is resampled
+  // from that image. A shared layout derives all sprite sizes from the smallest variant, so
+  // every variant is an exact integer multiple of it, extrusion included.
+  std::vector<std::vector<std::optional<CImageInfo>>> variant_slots(
+      variants.size(), std::vector<std::optional<CImageInfo>>(image_infos.size()));
+  CThreadPool thread_pool(settings.threads);
+  thread_pool.ParallelFor(
+      image_infos.size(),
+      [&](std::size_t i)
+      {
+        auto image = image_infos[i].IsDeferred()
+                         ? read_image_from_file(
+                               image_infos[i].GetImagePath(), top_scale, settings.scale_filter)
+                         : image_infos[i].GetImage();
+        if (!image_infos[i].IsDeferred() && top_scale != 1.0)
+        {
+          image.Scale(top_scale, settings.scale_filter);
+        }
+        const Size size{image.Width(), image.Height()};
+        CRect      bbox{0, 0, size.w, size.h};
+        if (settings.trim_mode > 0)
+        {
+          image.CleanPixelAlphaBelow(static_cast<Channel>(settings.trim_mode));
+          bbox = image.GetBoundingBox();
+        }
+
+        const auto base_geometry = ScaleGeometry(size, bbox, base_scale / top_scale);
+        for (std::size_t v = 0; v < variants.size(); ++v)
+        {
+          const auto geometry = settings.share_variant_layout
+                                    ? MultiplyGeometry(base_geometry, factors[v])
+                                    : ScaleGeometry(size, bbox, variants[v].scale / top_scale);
+          variant_slots[v][i].emplace(MakeVariantImageInfo(
+              image_infos[i], image, geometry, settings.extrude * factors[v], settings));
+        }
+      });
+
+  std::vector<std::vector<CImageInfo>> variant_image_infos(variants.size());
+  for (std::size_t v = 0; v < variants.size(); ++v)
   {
-    atlas.Shrink();
+    variant_image_infos[v].reserve(image_infos.size());
+    for (auto& slot : variant_slots[v])
+    {
+      variant_image_infos[v].push_back(std::move(*slot));
+    }
   }
-  auto image_info_map = make_image_info_map(image_infos_copy);
 
-  for (std::size_t i = 0; i < m_atlases.size(); ++i)
+  std::vector<std::vector<CAtlas>> variant_atlases(variants.size());
+  if (settings.share_variant_layout)
   {
-    const auto&                 atlas = m_atlases[i];
-    const std::string           atlas_name = fmt::sprintf(settings.atlases_pattern_name, i);
-    const std::string           image_file_name = atlas_name + "." + settings.atlases_output_format;
-    const std::string           json_file_name = atlas_name + ".json";
-    const std::filesystem::path image_path = settings.atlases_output_dir + "/" + image_file_name;
-    const std::filesystem::path json_path = settings.atlases_output_dir + "/" + json_file_name;
-    auto                        image = dump_atlas_to_image(atlas, image_info_map);
-    if (settings.reduce_border_artifacts)
+    // lay out the smallest variant so the largest one still fits the max atlas size
+    const int max_factor = *std::max_element(factors.begin(), factors.end());
+    auto      layout_settings = settings;
+    layout_settings.max_width /= max_factor;
+    layout_settings.max_height /= max_factor;
+
+    const auto base_index = static_cast<std::size_t>(base_variant - variants.begin());
+    const auto base_atlases = LayoutImageInfos(variant_image_infos[base_index], layout_settings);
+    for (std::size_t v = 0; v < variants.size(); ++v)
     {
-      image.AlphaBleeding();
+      for (const auto& atlas : base_atlases)
+      {
+        variant_atlases[v].push_back(atlas.Scaled(factors[v]));
+      }
     }
-    save_image_to_file(image_path.string(), image);
-    dump_atlas_to_json(json_path.string(), atlas, image_info_map, image_file_name);
   }
+  else
+  {
+    for (std::size_t v = 0; v < variants.size(); ++v)
+    {
+      variant_atlases[v] = LayoutImageInfos(variant_image_infos[v], settings);
+    }
+  }
+
+  std::vector<PageGroup> groups;
+  for (std::size_t v = 0; v < variants.size(); ++v)
+  {
+    groups.push_back(
+        {&variant_atlases[v], &variant_image_infos[v], variants[v].atlases_pattern_name});
+  }
+  WritePages(groups, settings);
+}
+
+std::vector<CAtlas> CTexturePacker::LayoutImageInfos(const std::vector<CImageInfo>& image_infos,
+                                                     const CPackSettings&           settings)
+{
+  std::vector<std::size_t> indices(image_infos.size());
+  std::iota(indices.begin(), indices.end(), std::size_t{0});
+  return LayoutImageInfos(image_infos, indices, settings);
 }
 
-void CTexturePacker::Pack(const CPackSettings& settings)
+std::vector<CAtlas> CTexturePacker::LayoutImageInfos(const std::vector<CImageInfo>& image_infos,
+                                                     const std::vector<std::size_t>& indices,
+                                                     const CPackSettings&            settings)
 {
-  auto image_infos = load_image_infos_from_dir(settings.images_input_dir);
-  return Pack(image_infos, settings);
+  std::vector<CAtlas> atlases;
+  atlases.push_back(MakeAtlas(settings));
+
+  // Rect keys are indices into image_infos, so the dump functions index it directly.
+  std::vector<CImageRect> image_rects;
+  image_rects.reserve(indices.size());
+  for (const auto i : indices)
+  {
+    auto image_rect = image_infos[i].GetImageRect();
+    image_rect.m_ex_key = static_cast<unsigned int>(i);
+    image_rects.emplace_back(image_rect);
+  }
+
+  AddImageRects(atlases, image_rects, settings);
+  for (auto& atlas : atlases)
+  {
+    atlas.Shrink();
+  }
+  return atlases;
 }
 
-void CTexturePacker::AddImageRects(std::vector<CImageRect> image_rects,
+void CTexturePacker::AddImageRects(std::vector<CAtlas>&    atlases,
+                                   std::vector<CImageRect> image_rects,
                                    const CPackSettings&    settings)
 {
   std::sort(image_rects.begin(),
@@ -102,11 +1017,12 @@ void CTexturePacker::AddImageRects(std::vector<CImageRect> image_rects,
 
   for (auto image_rect : image_rects)
   {
-    AddImageRect(image_rect, settings);
+    AddImageRect(atlases, image_rect, settings);
   }
 }
 
-void CTexturePacker::AddImageRect(CImageRect image_rect, const CPackSettings& settings)
+void CTexturePacker::AddImageRect(std::vector<CAtlas>& atlases, CImageRect image_rect,
+                                  const CPackSettings& settings)
 {
   unsigned int best_atlas_index = -1;
   unsigned int best_free_rect_index = -1;
@@ -117,9 +1033,9 @@ void CTexturePacker::AddImageRect(CImageRect image_rect, const CPackSettings& se
   unsigned int free_rect_index{};
   bool         rotated{};
 
-  for (std::size_t atlas_index = 0; atlas_index < m_atlases.size(); ++atlas_index)
+  for (std::size_t atlas_index = 0; atlas_index < atlases.size(); ++atlas_index)
   {
-    std::tie(rank, free_rect_index, rotated) = m_atlases[atlas_index].FindBestRank(image_rect);
+    std::tie(rank, free_rect_index, rotated) = atlases[atlas_index].FindBestRank(image_rect);
 
     if (rank < best_rank)
     {
@@ -132,15 +1048,15 @@ void CTexturePacker::AddImageRect(CImageRect image_rect, const CPackSettings& se
 
   if (best_rank == MAX_RANK)
   {
-    for (std::size_t atlas_index = 0; atlas_index < m_atlases.size(); ++atlas_index)
+    for (std::size_t atlas_index = 0; atlas_index < atlases.size(); ++atlas_index)
     {
       while (MAX_RANK == best_rank)
       {
-        if (m_atlases[atlas_index].TryExpand())
+        if (atlases[atlas_index].TryExpand())
         {
           best_atlas_index = atlas_index;
           std::tie(best_rank, best_free_rect_index, best_rotated) =
-              m_atlases[atlas_index].FindBestRank(image_rect);
+              atlases[atlas_index].FindBestRank(image_rect);
         }
         else
         {
@@ -156,26 +1072,21 @@ void CTexturePacker::AddImageRect(CImageRect image_rect, const CPackSettings& se
 
     if (best_rank == MAX_RANK)
     {
-      m_atlases.emplace_back(settings.max_width,
-                             settings.max_height,
-                             settings.force_square,
-                             settings.force_pot,
-                             settings.border_padding,
-                             settings.shape_padding);
+      atlases.push_back(MakeAtlas(settings));
 
-      best_atlas_index = (unsigned int)m_atlases.size() - 1;
+      best_atlas_index = (unsigned int)atlases.size() - 1;
       std::tie(best_rank, best_free_rect_index, best_rotated) =
-          m_atlases[best_atlas_index].FindBestRank(image_rect);
+          atlases[best_atlas_index].FindBestRank(image_rect);
 
       while (MAX_RANK == best_rank)
       {
-        if (!m_atlases[best_atlas_index].TryExpand())
+        if (!atlases[best_atlas_index].TryExpand())
         {
           assert(false); // can not place image in max size
         }
 
         std::tie(best_rank, best_free_rect_index, best_rotated) =
-            m_atlases[best_atlas_index].FindBestRank(image_rect);
+            atlases[best_atlas_index].FindBestRank(image_rect);
       }
     }
   }
@@ -185,6 +1096,6 @@ void CTexturePacker::AddImageRect(CImageRect image_rect, const CPackSettings& se
     image_rect.rotate();
   }
 
-  m_atlases[best_atlas_index].PlaceImageRectInFreeRect(best_free_rect_index, image_rect);
+  atlases[best_atlas_index].PlaceImageRectInFreeRect(best_free_rect_index, image_rect);
 }
 } // namespace TexturePacker
@@ -0,0 +1,72 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace TexturePacker
+{
+CThreadPool::CThreadPool(int threads)
+{
+  const auto thread_count = ResolveThreadCount(threads);
+  m_workers.reserve(thread_count - 1);
+  for (unsigned int i = 1; i < thread_count; ++i)
+  {
+    m_workers.emplace_back([this]() { WorkerLoop(); });
+  }
+}
+
+CThreadPool::~CThreadPool()
+{
+  {
+    const std::lock_guard lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+
+  for (auto& worker : m_workers)
+  {
+    worker.join();
+  }
+}
+
+unsigned int CThreadPool::GetThreadCount() const
+{
+  return static_cast<unsigned int>(m_workers.size()) + 1;
+}
+
+unsigned int CThreadPool::ResolveThreadCount(int threads)
+{
+  if (threads > 0)
+  {
+    return static_cast<unsigned int>(threads);
+  }
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
+void CThreadPool::Post(std::function<void()> task)
+{
+  {
+    const std::lock_guard lock(m_mutex);
+    m_tasks.emplace_back(std::move(task));
+  }
+  m_cv.notify_one();
+}
+
+void CThreadPool::WorkerLoop()
+{
+  for (;;)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock lock(m_mutex);
+      m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+      if (m_tasks.empty())
+      {
+        return;
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
+} // namespace TexturePacker
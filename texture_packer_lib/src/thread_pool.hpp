@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace TexturePacker
+{
+class CThreadPool
+{
+public:
+  // threads <= 0 uses the hardware concurrency. The calling thread also takes part in
+  // ParallelFor, so a pool of N threads runs N - 1 workers.
+  explicit CThreadPool(int threads);
+
+  CThreadPool(const CThreadPool&) = delete;
+
+  CThreadPool& operator=(const CThreadPool&) = delete;
+
+  ~CThreadPool();
+
+  [[nodiscard]]
+  unsigned int GetThreadCount() const;
+
+  // Calls fn(index) for every index in [0, count) and blocks until all calls have returned.
+  // The first exception thrown by fn stops handing out new indices and is rethrown here.
+  template <class Fn>
+  void ParallelFor(std::size_t count, Fn&& fn);
+
+  [[nodiscard]]
+  static unsigned int ResolveThreadCount(int threads);
+
+private:
+  void Post(std::function<void()> task);
+
+  void WorkerLoop();
+
+private:
+  std::vector<std::thread>          m_workers;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex                        m_mutex;
+  std::condition_variable           m_cv;
+  bool                              m_stop{false};
+};
+
+template <class Fn>
+void CThreadPool::ParallelFor(std::size_t count, Fn&& fn)
+{
+  if (count == 0)
+  {
+    return;
+  }
+
+  if (m_workers.empty() || count == 1)
+  {
+    for (std::size_t index = 0; index < count; ++index)
+    {
+      fn(index);
+    }
+    return;
+  }
+
+  struct SharedState
+  {
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool>        failed{false};
+    std::exception_ptr       exception;
+    std::mutex               mutex;
+    std::condition_variable  cv;
+    std::size_t              running{0};
+  };
+
+  auto state = std::make_shared<SharedState>();
+  auto run = [state, count, &fn]()
+  {
+    for (std::size_t index = state->next++; index < count && !state->failed;
+         index = state->next++)
+    {
+      try
+      {
+        fn(index);
+      }
+      catch (...)
+      {
+        const std::lock_guard lock(state->mutex);
+        if (!state->failed.exchange(true))
+        {
+          state->exception = std::current_exception();
+        }
+      }
+    }
+  };
+
+  const std::size_t helpers = std::min(m_workers.size(), count - 1);
+  state->running = helpers;
+  for (std::size_t i = 0; i < helpers; ++i)
+  {
+    Post(
+        [state, run]()
+        {
+          run();
+          const std::lock_guard lock(state->mutex);
+          if (--state->running == 0)
+          {
+            state->cv.notify_all();
+          }
+        });
+  }
+
+  run();
+
+  std::unique_lock lock(state->mutex);
+  state->cv.wait(lock, [&state]() { return state->running == 0; });
+  if (state->exception)
+  {
+    std::rethrow_exception(state->exception);
+  }
+}
+} // namespace TexturePacker
@@ -1,10 +1,31 @@
 #include <texture_packer/utils.hpp>
 
+#include <fmt/format.h>
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
+#include <stdexcept>
+
+#include "astc_writer.hpp"
+#include "composite.hpp"
+#include "dds_writer.hpp"
+#include "ktx2_writer.hpp"
+#include "mipmap.hpp"
+#include "palette.hpp"
+#include "parallel_load.hpp"
+#include "pixel_format.hpp"
+#include "pkm_writer.hpp"
+#include "png_writer.hpp"
+#include "qoi_codec.hpp"
+#include "rawz_codec.hpp"
+#include "reduced_decoder.hpp"
+#include "resampler.hpp"
+#include "texture_encoder.hpp"
+#include "thread_pool.hpp"
 
 // template <class K, class V, class dummy_compare, class A>
 // using my_workaround_fifo_map = nlohmann::fifo_map<K, V, nlohmann::fifo_map_compare<K>, A>;
@@ -12,7 +33,57 @@
 
 namespace TexturePacker
 {
-std::vector<CImageInfo> load_image_infos_from_dir(const std::string& dir_path)
+namespace
+{
+// Concurrent packs may race to create the same output directory, which is not an error.
+void create_parent_directories(const std::string& file_path)
+{
+  const auto parent_path = std::filesystem::path(file_path).parent_path();
+  if (parent_path.empty())
+  {
+    return;
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(parent_path, ec);
+  if (ec && !std::filesystem::is_directory(parent_path))
+  {
+    throw std::filesystem::filesystem_error("can not create directory", parent_path, ec);
+  }
+}
+
+nlohmann::json make_frame_json(const CImageRect& image_rect, const CImageInfo& image_info)
+{
+  const auto source_bbox = image_info.GetSourceBbox();
+  const auto source_rect = image_info.GetSourceRect();
+
+  const auto source_bbox_x = source_bbox.x - image_info.GetExtruded();
+  const auto source_bbox_y = source_bbox.y - image_info.GetExtruded();
+  // TODO
+  // const auto source_bbox_w = source_bbox.width - image_info.GetExtruded();
+  // const auto source_bbox_h = source_bbox.height - image_info.GetExtruded();
+
+  std::filesystem::path image_path = image_info.GetImagePath();
+  image_path = image_path.filename();
+
+  nlohmann::json frame_data;
+  frame_data["filename"] = image_path.string();
+  frame_data["frame"]["x"] = image_rect.x + image_info.GetExtruded();
+  frame_data["frame"]["y"] = image_rect.y + image_info.GetExtruded();
+  frame_data["frame"]["w"] = source_bbox.width;
+  frame_data["frame"]["h"] = source_bbox.height;
+  frame_data["rotated"] = false;
+  frame_data["padding"]["left"] = source_bbox_x;
+  frame_data["padding"]["top"] = source_bbox_y;
+  frame_data["padding"]["right"] = source_rect.width - source_bbox.width - source_bbox_x;
+  frame_data["padding"]["bottom"] = source_rect.height - source_bbox.height - source_bbox_y;
+  frame_data["sourceSize"]["w"] = image_info.GetSourceSize().w;
+  frame_data["sourceSize"]["h"] = image_info.GetSourceSize().h;
+  return frame_data;
+}
+} // namespace
+
+std::vector<std::string> list_image_files_in_dir(const std::string& dir_path)
 {
   std::vector<std::string> file_paths;
 
@@ -21,113 +92,289 @@ std::vector<CImageInfo> load_image_infos_from_dir(const std::string& dir_path)
     auto file_path = fe.path().string();
     auto suffix = fe.path().extension().string();
     if (suffix.compare(".bmp") == 0 || suffix.compare(".jpg") == 0 ||
-        suffix.compare(".jpeg") == 0 || suffix.compare(".webp") == 0 || suffix.compare(".png") == 0)
+        suffix.compare(".jpeg") == 0 || suffix.compare(".webp") == 0 ||
+        suffix.compare(".png") == 0 || suffix.compare(".qoi") == 0 || suffix.compare(".rawz") == 0)
     {
       file_paths.emplace_back(file_path);
     }
   }
 
-  return load_image_infos_from_paths(file_paths);
+  // directory_iterator order is unspecified, sort to get the same atlases on every run
+  std::sort(file_paths.begin(), file_paths.end());
+
+  return file_paths;
 }
 
-std::vector<CImageInfo> load_image_infos_from_paths(const std::vector<std::string>& file_paths)
+std::vector<CImageInfo> load_image_infos_from_dir(const std::string& dir_path, int threads)
 {
-  std::vector<CImageInfo> image_infos;
+  return load_image_infos_from_paths(list_image_files_in_dir(dir_path), threads);
+}
 
-  for (auto file_path : file_paths)
-  {
-    image_infos.emplace_back(read_image_from_file(file_path), file_path);
-  }
+std::vector<CImageInfo> load_image_infos_from_paths(const std::vector<std::string>& file_paths,
+                                                    int threads, std::vector<CLoadError>& errors)
+{
+  return load_in_parallel(file_paths, threads, errors, read_image_info_from_file);
+}
 
+std::vector<CImageInfo> load_image_infos_from_paths(const std::vector<std::string>& file_paths,
+                                                    int                             threads)
+{
+  std::vector<CLoadError> errors;
+  auto                    image_infos = load_image_infos_from_paths(file_paths, threads, errors);
+  throw_on_load_errors(errors);
+  return image_infos;
+}
+
+std::vector<CImageInfo> probe_image_infos_from_paths(const std::vector<std::string>& file_paths,
+                                                     int                             threads,
+                                                     std::vector<CLoadError>&        errors)
+{
+  return load_in_parallel(file_paths, threads, errors, probe_image_info_from_file);
+}
+
+std::vector<CImageInfo> probe_image_infos_from_paths(const std::vector<std::string>& file_paths,
+                                                     int                             threads)
+{
+  std::vector<CLoadError> errors;
+  auto                    image_infos = probe_image_infos_from_paths(file_paths, threads, errors);
+  throw_on_load_errors(errors);
   return image_infos;
 }
 
+void save_palette_png_to_file(const std::string& file_path, const CImage& image, int max_colors,
+                              bool dither, int threads, const CPngOptions& png_options)
+{
+  create_parent_directories(file_path);
+  write_indexed_png(
+      file_path, quantize_image(image, max_colors, dither, threads), threads, png_options);
+}
+
 CImageInfo read_image_info_from_file(const std::string& file_path)
 {
   return {read_image_from_file(file_path), file_path};
 }
 
-void save_image_to_file(const std::string& file_path, const CImage& image)
+CImageInfo probe_image_info_from_file(const std::string& file_path)
 {
-  const std::filesystem::path path(file_path);
-  if (!std::filesystem::exists(path.parent_path()))
+  if (auto size = read_image_size_from_file(file_path))
   {
-    std::filesystem::create_directories(path.parent_path());
+    return {file_path, *size};
   }
+  // unknown header layout, decode once just to learn the size
+  const auto image = read_image_from_file(file_path);
+  return {file_path, Size{image.Width(), image.Height()}};
+}
+
+void save_image_to_file(const std::string& file_path, const CImage& image, int threads,
+                        TextureCompression compression, CompressionQuality quality,
+                        const std::vector<CRect>& regions, PixelFormat pixel_format,
+                        const CPngOptions& png_options)
+{
+  create_parent_directories(file_path);
 
   auto suffix = file_path.substr(file_path.find_last_of("."));
   assert(!suffix.empty());
+  if (!is_compression_supported(suffix.substr(1), compression))
+  {
+    throw std::runtime_error("texture compression does not fit the file format of " + file_path);
+  }
+  if (suffix.compare(".dds") == 0)
+  {
+    write_dds(file_path,
+              image.Width(),
+              image.Height(),
+              compression,
+              encode_texture(image, compression, quality, threads, regions));
+    return;
+  }
+  if (suffix.compare(".pkm") == 0)
+  {
+    write_pkm(file_path,
+              image.Width(),
+              image.Height(),
+              encode_texture(image, compression, quality, threads, regions));
+    return;
+  }
+  if (suffix.compare(".astc") == 0)
+  {
+    write_astc(file_path,
+               image.Width(),
+               image.Height(),
+               compression,
+               encode_texture(image, compression, quality, threads, regions));
+    return;
+  }
+  if (suffix.compare(".ktx2") == 0)
+  {
+    save_ktx2_to_file(
+        file_path, image, {}, threads, compression, quality, 0, false, regions, pixel_format);
+    return;
+  }
   if (suffix.compare(".jpg") == 0)
   {
     image.SaveAsJPEG(file_path.c_str());
   }
   else if (suffix.compare(".png") == 0)
   {
-    image.SaveAsPNG(file_path.c_str());
+    write_png(file_path, image, threads, pixel_format, png_options);
+  }
+  else if (suffix.compare(".qoi") == 0)
+  {
+    write_qoi(file_path, image);
+  }
+  else if (suffix.compare(".rawz") == 0)
+  {
+    write_rawz(file_path, image);
+  }
+}
+
+void save_ktx2_to_file(const std::string& file_path, const CImage& image,
+                       const std::vector<CImage>& mipmaps, int threads,
+                       TextureCompression compression, CompressionQuality quality, int zstd_level,
+                       bool premultiplied, std::vector<CRect> regions, PixelFormat pixel_format)
+{
+  create_parent_directories(file_path);
+
+  const auto encode = [&](const CImage& level)
+  {
+    return compression == TextureCompression::None
+               ? pack_pixels(level, pixel_format)
+               : encode_texture(level, compression, quality, threads, regions);
+  };
+  std::vector<std::vector<std::uint8_t>> levels;
+  levels.push_back(encode(image));
+  for (const auto& mipmap : mipmaps)
+  {
+    for (auto& region : regions)
+    {
+      region = halve_mipmap_region(region, mipmap.Width(), mipmap.Height());
+    }
+    levels.push_back(encode(mipmap));
   }
+  write_ktx2(file_path,
+             image.Width(),
+             image.Height(),
+             compression,
+             levels,
+             zstd_level,
+             premultiplied,
+             pixel_format);
 }
 
 CImage read_image_from_file(const std::string& file_path)
 {
+  const auto dot = file_path.find_last_of('.');
+  const auto suffix = dot == std::string::npos ? std::string() : file_path.substr(dot);
+  if (suffix.compare(".qoi") == 0)
+  {
+    return read_qoi(file_path);
+  }
+  if (suffix.compare(".rawz") == 0)
+  {
+    return read_rawz(file_path);
+  }
   auto img = CImage(file_path.c_str());
   return img;
 }
 
+CImage read_image_from_file(const std::string& file_path, double scale, ResampleFilter filter)
+{
+  const int reduction = scale < 1.0 ? decode_reduction_for_scale(scale, filter) : 1;
+  if (reduction > 1)
+  {
+    if (auto reduced = decode_image_reduced(file_path, reduction))
+    {
+      // CImage::Scale rounds the same way, so both paths agree on the final size
+      const int width = std::max(1, static_cast<int>(std::round(reduced->source_size.w * scale)));
+      const int height = std::max(1, static_cast<int>(std::round(reduced->source_size.h * scale)));
+      if (width == reduced->image.Width() && height == reduced->image.Height())
+      {
+        return std::move(reduced->image);
+      }
+      return resample_image(reduced->image, width, height, filter);
+    }
+  }
+
+  auto image = read_image_from_file(file_path);
+  if (scale != 1.0)
+  {
+    image.Scale(scale, filter);
+  }
+  return image;
+}
+
 void draw_image_in_image(CImage& main_image, const CImage& sub_image, int start_x, int start_y)
 {
   main_image.Composite(sub_image, start_x, start_y);
 }
 
 void dump_atlas_to_json(const std::string& file_path, const CAtlas& atlas,
-                        ImageInfoMap& image_info_map, const std::string& texture_file_name)
+                        const std::vector<CImageInfo>& image_infos,
+                        const std::string&             texture_file_name,
+                        bool                           premultiply_alpha,
+                        std::optional<PixelFormat>     pixel_format)
 {
-  const std::filesystem::path path(file_path);
-  if (!std::filesystem::exists(path.parent_path()))
-  {
-    std::filesystem::create_directories(path.parent_path());
-  }
+  create_parent_directories(file_path);
 
   nlohmann::json root_json;
   nlohmann::json frames_json;
 
   for (const CImageRect& image_rect : atlas.GetPlacedImageRect())
   {
-    const auto& image_info = image_info_map.at(image_rect.m_ex_key);
+    frames_json.push_back(make_frame_json(image_rect, image_infos[image_rect.m_ex_key]));
+  }
 
-    const auto source_bbox = image_info.GetSourceBbox();
-    const auto source_rect = image_info.GetSourceRect();
+  root_json["frames"] = frames_json;
 
-    const auto source_bbox_x = source_bbox.x - image_info.GetExtruded();
-    const auto source_bbox_y = source_bbox.y - image_info.GetExtruded();
-    // TODO
-    // const auto source_bbox_w = source_bbox.width - image_info.GetExtruded();
-    // const auto source_bbox_h = source_bbox.height - image_info.GetExtruded();
+  nlohmann::json metadata;
+  metadata["textureFileName"] = std::filesystem::path(texture_file_name).filename().string();
+  metadata["size"]["w"] = atlas.GetWidth();
+  metadata["size"]["h"] = atlas.GetHeight();
+  metadata["premultiplyAlpha"] = premultiply_alpha;
+  if (pixel_format)
+  {
+    metadata["pixelFormat"] = pixel_format_name(*pixel_format);
+  }
+
+  root_json["metadata"] = metadata;
 
-    std::filesystem::path image_path = image_info.GetImagePath();
-    image_path = image_path.filename();
+  std::ofstream fs(file_path);
+  fs << root_json.dump(4);
+}
 
-    nlohmann::json frame_data;
-    frame_data["filename"] = image_path.string();
-    frame_data["frame"]["x"] = image_rect.x + image_info.GetExtruded();
-    frame_data["frame"]["y"] = image_rect.y + image_info.GetExtruded();
-    frame_data["frame"]["w"] = source_bbox.width;
-    frame_data["frame"]["h"] = source_bbox.height;
-    frame_data["rotated"] = false;
-    frame_data["padding"]["left"] = source_bbox_x;
-    frame_data["padding"]["top"] = source_bbox_y;
-    frame_data["padding"]["right"] = source_rect.width - source_bbox.width - source_bbox_x;
-    frame_data["padding"]["bottom"] = source_rect.height - source_bbox.height - source_bbox_y;
-    frame_data["sourceSize"]["w"] = image_info.GetSourceSize().w;
-    frame_data["sourceSize"]["h"] = image_info.GetSourceSize().h;
-    frames_json.push_back(frame_data);
+void dump_channel_atlases_to_json(const std::string&                 file_path,
+                                  const std::vector<const CAtlas*>& channel_atlases,
+                                  const std::vector<CImageInfo>&     image_infos,
+                                  const std::string&                 texture_file_name)
+{
+  create_parent_directories(file_path);
+
+  nlohmann::json root_json;
+  nlohmann::json frames_json = nlohmann::json::array();
+
+  const auto size = get_channel_page_size(channel_atlases);
+  for (std::size_t channel = 0; channel < channel_atlases.size(); ++channel)
+  {
+    if (channel_atlases[channel] == nullptr)
+    {
+      continue;
+    }
+    for (const CImageRect& image_rect : channel_atlases[channel]->GetPlacedImageRect())
+    {
+      auto frame_data = make_frame_json(image_rect, image_infos[image_rect.m_ex_key]);
+      frame_data["channel"] = channel;
+      frames_json.push_back(frame_data);
+    }
   }
 
   root_json["frames"] = frames_json;
 
   nlohmann::json metadata;
   metadata["textureFileName"] = std::filesystem::path(texture_file_name).filename().string();
-  metadata["size"]["w"] = atlas.GetWidth();
-  metadata["size"]["h"] = atlas.GetHeight();
+  metadata["size"]["w"] = size.w;
+  metadata["size"]["h"] = size.h;
+  metadata["premultiplyAlpha"] = false;
+  metadata["channelPacked"] = true;
 
   root_json["metadata"] = metadata;
 
@@ -135,23 +382,111 @@ void dump_atlas_to_json(const std::string& file_path, const CAtlas& atlas,
   fs << root_json.dump(4);
 }
 
-ImageInfoMap make_image_info_map(const std::vector<CImageInfo>& image_infos)
+Size get_channel_page_size(const std::vector<const CAtlas*>& channel_atlases)
 {
-  ImageInfoMap image_info_map;
-  for (const CImageInfo& image_info : image_infos)
+  Size size{1, 1};
+  for (const auto* atlas : channel_atlases)
   {
-    image_info_map.emplace(image_info.GetExKey(), image_info);
+    if (atlas != nullptr)
+    {
+      size.w = std::max(size.w, atlas->GetWidth());
+      size.h = std::max(size.h, atlas->GetHeight());
+    }
   }
-  return image_info_map;
+  return size;
 }
 
-CImage dump_atlas_to_image(const CAtlas& atlas, const ImageInfoMap& image_info_map)
+CImage dump_channel_atlases_to_image(const std::vector<const CAtlas*>& channel_atlases,
+                                     const std::vector<CImageInfo>&     image_infos,
+                                     int                                threads)
 {
-  CImage image(atlas.GetWidth(), atlas.GetHeight());
-  for (auto image_rect : atlas.GetPlacedImageRect())
+  const auto size = get_channel_page_size(channel_atlases);
+  CImage     image(size.w, size.h);
+  Channel*   pixels = image.MutablePixels();
+  std::fill(pixels, pixels + static_cast<std::ptrdiff_t>(image.Pitch()) * size.h, Channel{0});
+  for (std::size_t channel = 0; channel < channel_atlases.size(); ++channel)
   {
-    const auto& image_info = image_info_map.at(image_rect.m_ex_key);
-    draw_image_in_image(image, image_info.GetImage(), image_rect.x, image_rect.y);
+    if (channel_atlases[channel] == nullptr)
+    {
+      continue;
+    }
+    // premultiplied red is the gray level of opaque sprites and the alpha of white ones
+    const auto layer = dump_atlas_to_image(
+        *channel_atlases[channel], image_infos, threads, CompositeMode::Copy, true);
+    for (int y = 0; y < layer.Height(); ++y)
+    {
+      const Channel* src = layer.Pixels() + static_cast<std::ptrdiff_t>(y) * layer.Pitch();
+      Channel*       dst = pixels + static_cast<std::ptrdiff_t>(y) * image.Pitch() + channel;
+      for (int x = 0; x < layer.Width(); ++x)
+      {
+        dst[x * 4] = src[x * 4];
+      }
+    }
+  }
+  return image;
+}
+
+CImage dump_atlas_to_image(const CAtlas& atlas, const std::vector<CImageInfo>& image_infos,
+                           int threads, CompositeMode composite_mode, bool premultiply_alpha)
+{
+  const auto& image_rects = atlas.GetPlacedImageRect();
+  CThreadPool thread_pool(threads);
+
+  CImage     image(atlas.GetWidth(), atlas.GetHeight());
+  Channel*   pixels = image.MutablePixels();
+  const int  pitch = image.Pitch();
+  const auto band_count = std::min<std::size_t>(image.Height(), thread_pool.GetThreadCount() * 4);
+  const int  band_height = static_cast<int>((image.Height() + band_count - 1) / band_count);
+
+  // Deferred infos decode in GetImage(), so sprites are fetched once rather than per band, one
+  // window of a sprite per worker at a time: peak memory is the page plus one sprite per worker.
+  const auto window_size = static_cast<std::size_t>(thread_pool.GetThreadCount());
+  std::vector<std::optional<CImage>> sprites(window_size);
+  for (std::size_t first = 0; first < image_rects.size(); first += window_size)
+  {
+    const auto count = std::min(window_size, image_rects.size() - first);
+    thread_pool.ParallelFor(count,
+                            [&](std::size_t index)
+                            {
+                              const auto& image_rect = image_rects[first + index];
+                              sprites[index].emplace(image_infos[image_rect.m_ex_key].GetImage());
+                            });
+
+    // Every band is written by one worker, composing only the sprite rows that fall inside it.
+    thread_pool.ParallelFor(
+        band_count,
+        [&](std::size_t band)
+        {
+          const int band_top = static_cast<int>(band) * band_height;
+          const int band_bottom = std::min(image.Height(), band_top + band_height);
+          for (std::size_t i = 0; i < count; ++i)
+          {
+            const auto& image_rect = image_rects[first + i];
+            const auto& sprite = *sprites[i];
+            const int   top = std::max(band_top, image_rect.y);
+            const int   bottom = std::min(band_bottom, image_rect.y + sprite.Height());
+            const int   width = std::min(sprite.Width(), image.Width() - image_rect.x);
+            if (top >= bottom || width <= 0)
+            {
+              continue;
+            }
+            const auto sprite_row = static_cast<std::ptrdiff_t>(top - image_rect.y);
+            composite_rows(composite_mode,
+                           premultiply_alpha,
+                           pixels + static_cast<std::ptrdiff_t>(top) * pitch + image_rect.x * 4,
+                           pitch,
+                           sprite.Pixels() + sprite_row * sprite.Pitch(),
+                           sprite.Pitch(),
+                           width,
+                           bottom - top,
+                           sprite.Channels());
+          }
+        });
+
+    for (auto& sprite : sprites)
+    {
+      sprite.reset();
+    }
   }
   return image;
 }